@@ -108,11 +108,11 @@ arp_request(const struct arp_state *astate,
 
 #ifdef PRIVSEP
 	if (ifp->ctx->options & DHCPCD_PRIVSEP)
-		return ps_bpf_sendarp(ifp, tip, arp_buffer, len);
+		return ps_bpf_sendarp(ifp, arp_buffer, len);
 #endif
 	/* Note that well formed ethernet will add extra padding
 	 * to ensure that the packet is at least 60 bytes (64 including FCS). */
-	return bpf_send(astate->bpf, ETHERTYPE_ARP, arp_buffer, len);
+	return bpf_send(ARP_CSTATE(ifp)->bpf, ETHERTYPE_ARP, arp_buffer, len);
 
 eexit:
 	errno = ENOBUFS;
@@ -229,8 +229,7 @@ arp_packet(struct interface *ifp, uint8_t *data, size_t len,
 	const struct interface *ifn;
 	struct arphdr ar;
 	struct arp_msg arm;
-	const struct iarp_state *state;
-	struct arp_state *astate, *astaten;
+	struct arp_state *astate;
 	uint8_t *hw_s, *hw_t;
 
 	/* Copy the frame header source and destination out */
@@ -286,27 +285,24 @@ arp_packet(struct interface *ifp, uint8_t *data, size_t len,
 
 	/* Match the ARP probe to our states.
 	 * Ignore Unicast Poll, RFC1122. */
-	state = ARP_CSTATE(ifp);
-	if (state == NULL)
-		return;
-	TAILQ_FOREACH_SAFE(astate, &state->arp_states, next, astaten) {
-		if (IN_ARE_ADDR_EQUAL(&arm.sip, &astate->addr) ||
-		    (IN_IS_ADDR_UNSPECIFIED(&arm.sip) &&
-		    IN_ARE_ADDR_EQUAL(&arm.tip, &astate->addr) &&
-		    bpf_flags & BPF_BCAST))
-			arp_found(astate, &arm);
-	}
+	if (!IN_IS_ADDR_UNSPECIFIED(&arm.sip))
+		astate = arp_find(ifp, &arm.sip);
+	else if (bpf_flags & BPF_BCAST)
+		astate = arp_find(ifp, &arm.tip);
+	else
+		astate = NULL;
+	if (astate != NULL)
+		arp_found(astate, &arm);
 }
 
 static void
 arp_read(void *arg, unsigned short events)
 {
-	struct arp_state *astate = arg;
-	struct bpf *bpf = astate->bpf;
-	struct interface *ifp = astate->iface;
-	uint8_t buf[ARP_LEN];
+	struct interface *ifp = arg;
+	struct iarp_state *state = ARP_STATE(ifp);
+	struct bpf *bpf = state->bpf;
+	void *frame;
 	ssize_t bytes;
-	struct in_addr addr = astate->addr;
 
 	if (events != ELE_READ)
 		logerrx("%s: unexpected event 0x%04x", __func__, events);
@@ -316,17 +312,19 @@ arp_read(void *arg, unsigned short events)
 	 * so we have to process the entire buffer. */
 	bpf->bpf_flags &= ~BPF_EOF;
 	while (!(bpf->bpf_flags & BPF_EOF)) {
-		bytes = bpf_read(bpf, buf, sizeof(buf));
+		bytes = bpf_read(bpf, &frame);
 		if (bytes == -1) {
 			logerr("%s: %s", __func__, ifp->name);
-			arp_free(astate);
+			arp_drop(ifp);
 			return;
 		}
-		arp_packet(ifp, buf, (size_t)bytes, bpf->bpf_flags);
+		if (bytes == 0)
+			break;
+		arp_packet(ifp, frame, (size_t)bytes, bpf->bpf_flags);
 		/* Check we still have a state after processing. */
-		if ((astate = arp_find(ifp, &addr)) == NULL)
+		if ((state = ARP_STATE(ifp)) == NULL)
 			break;
-		if ((bpf = astate->bpf) == NULL)
+		if ((bpf = state->bpf) == NULL)
 			break;
 	}
 }
@@ -375,16 +373,80 @@ arp_probe(struct arp_state *astate)
 }
 #endif	/* ARP */
 
+static size_t
+arp_hash(const struct in_addr *addr, size_t hashlen)
+{
+	uint32_t h = ntohl(addr->s_addr);
+
+	/* Aliases tend to differ in the low bits. */
+	h ^= h >> 16;
+	h ^= h >> 8;
+	return (size_t)h & (hashlen - 1);
+}
+
+static int
+arp_hash_add(struct iarp_state *state, struct arp_state *astate)
+{
+	struct arp_state **hash, *a, *an;
+	size_t i, h, hashlen;
+
+	if (state->arp_nstates >= state->arp_hashlen) {
+		hashlen = state->arp_hashlen == 0 ? 16 : state->arp_hashlen * 2;
+		hash = calloc(hashlen, sizeof(*hash));
+		if (hash == NULL)
+			return -1;
+		for (i = 0; i < state->arp_hashlen; i++) {
+			for (a = state->arp_hash[i]; a != NULL; a = an) {
+				an = a->hnext;
+				h = arp_hash(&a->addr, hashlen);
+				a->hnext = hash[h];
+				hash[h] = a;
+			}
+		}
+		free(state->arp_hash);
+		state->arp_hash = hash;
+		state->arp_hashlen = hashlen;
+	}
+
+	h = arp_hash(&astate->addr, state->arp_hashlen);
+	astate->hnext = state->arp_hash[h];
+	state->arp_hash[h] = astate;
+	state->arp_nstates++;
+	return 0;
+}
+
+static void
+arp_hash_remove(struct iarp_state *state, struct arp_state *astate)
+{
+	struct arp_state **ap;
+	size_t h;
+
+	h = arp_hash(&astate->addr, state->arp_hashlen);
+	for (ap = &state->arp_hash[h];
+	    *ap != NULL;
+	    ap = &(*ap)->hnext)
+	{
+		if (*ap == astate) {
+			*ap = astate->hnext;
+			state->arp_nstates--;
+			return;
+		}
+	}
+}
+
 struct arp_state *
 arp_find(struct interface *ifp, const struct in_addr *addr)
 {
 	struct iarp_state *state;
 	struct arp_state *astate;
 
-	if ((state = ARP_STATE(ifp)) == NULL)
+	if ((state = ARP_STATE(ifp)) == NULL || state->arp_hashlen == 0)
 		goto out;
-	TAILQ_FOREACH(astate, &state->arp_states, next) {
-		if (astate->addr.s_addr == addr->s_addr && astate->iface == ifp)
+	for (astate = state->arp_hash[arp_hash(addr, state->arp_hashlen)];
+	    astate != NULL;
+	    astate = astate->hnext)
+	{
+		if (astate->addr.s_addr == addr->s_addr)
 			return astate;
 	}
 out:
@@ -441,9 +503,12 @@ skip_request:
 	if (ia != NULL)
 		ia->flags |= ~IPV4_AF_NEW;
 
-	eloop_timeout_add_sec(ifp->ctx->eloop, ANNOUNCE_WAIT,
-	    astate->claims < ANNOUNCE_NUM ? arp_announce1 : arp_announced,
-	    astate);
+	if (astate->claims < ANNOUNCE_NUM)
+		eloop_timeout_add_sec(ifp->ctx->eloop, ANNOUNCE_WAIT,
+		    arp_announce1, astate);
+	else
+		eloop_timeout_add_sec(ifp->ctx->eloop, ANNOUNCE_WAIT,
+		    arp_announced, astate);
 }
 
 static void
@@ -528,6 +593,57 @@ arp_announceaddr(struct dhcpcd_ctx *ctx, const struct in_addr *ia)
 	return arp_ifannounceaddr(iff, ia);
 }
 
+static void
+arp_close(struct interface *ifp)
+{
+	struct iarp_state *state = ARP_STATE(ifp);
+
+#ifdef PRIVSEP
+	if (state->ps_bpf) {
+		if (ps_bpf_closearp(ifp) == -1)
+			logerr(__func__);
+		state->ps_bpf = false;
+	}
+#endif
+	if (state->bpf == NULL)
+		return;
+	eloop_event_delete(ifp->ctx->eloop, state->bpf->bpf_fd);
+	bpf_close(state->bpf);
+	state->bpf = NULL;
+}
+
+/* Open the BPF socket for the interface,
+ * or rebuild its filter if the address set has changed. */
+static int
+arp_open(struct interface *ifp)
+{
+	struct iarp_state *state = ARP_STATE(ifp);
+
+#ifdef PRIVSEP
+	/* The privsep BPF process passes us any ARP frame not sent by us
+	 * and arp_packet() sorts it out, so there is nothing to rebuild. */
+	if (IN_PRIVSEP(ifp->ctx)) {
+		if (state->ps_bpf)
+			return 0;
+		if (ps_bpf_openarp(ifp) == -1)
+			return -1;
+		state->ps_bpf = true;
+		return 0;
+	}
+#endif
+
+	if (state->bpf != NULL)
+		return bpf_arp(state->bpf, NULL);
+
+	state->bpf = bpf_open(ifp, bpf_arp, NULL);
+	if (state->bpf == NULL)
+		return -1;
+	if (eloop_event_add(ifp->ctx->eloop, state->bpf->bpf_fd, ELE_READ,
+	    arp_read, ifp) == -1)
+		logerr("%s: eloop_event_add", __func__);
+	return 0;
+}
+
 struct arp_state *
 arp_new(struct interface *ifp, const struct in_addr *addr)
 {
@@ -535,7 +651,7 @@ arp_new(struct interface *ifp, const struct in_addr *addr)
 	struct arp_state *astate;
 
 	if ((state = ARP_STATE(ifp)) == NULL) {
-		ifp->if_data[IF_DATA_ARP] = malloc(sizeof(*state));
+		ifp->if_data[IF_DATA_ARP] = calloc(1, sizeof(*state));
 		state = ARP_STATE(ifp);
 		if (state == NULL) {
 			logerr(__func__);
@@ -549,36 +665,31 @@ arp_new(struct interface *ifp, const struct in_addr *addr)
 
 	if ((astate = calloc(1, sizeof(*astate))) == NULL) {
 		logerr(__func__);
-		return NULL;
+		goto eexit;
 	}
 	astate->iface = ifp;
 	astate->addr = *addr;
-
-#ifdef PRIVSEP
-	if (IN_PRIVSEP(ifp->ctx)) {
-		if (ps_bpf_openarp(ifp, addr) == -1) {
-			logerr(__func__);
-			free(astate);
-			return NULL;
-		}
-	} else
-#endif
-	{
-		astate->bpf = bpf_open(ifp, bpf_arp, addr);
-		if (astate->bpf == NULL) {
-			logerr(__func__);
-			free(astate);
-			return NULL;
-		}
-		if (eloop_event_add(ifp->ctx->eloop, astate->bpf->bpf_fd, ELE_READ,
-		    arp_read, astate) == -1)
-			logerr("%s: eloop_event_add", __func__);
+	if (arp_hash_add(state, astate) == -1) {
+		logerr(__func__);
+		free(astate);
+		goto eexit;
 	}
-
-
-	state = ARP_STATE(ifp);
 	TAILQ_INSERT_TAIL(&state->arp_states, astate, next);
+
+	if (arp_open(ifp) == -1) {
+		logerr(__func__);
+		arp_free(astate);
+		return NULL;
+	}
 	return astate;
+
+eexit:
+	if (TAILQ_FIRST(&state->arp_states) == NULL) {
+		free(state->arp_hash);
+		free(state);
+		ifp->if_data[IF_DATA_ARP] = NULL;
+	}
+	return NULL;
 }
 
 void
@@ -597,24 +708,18 @@ arp_free(struct arp_state *astate)
 
 	state =	ARP_STATE(ifp);
 	TAILQ_REMOVE(&state->arp_states, astate, next);
+	arp_hash_remove(state, astate);
 	if (astate->free_cb)
 		astate->free_cb(astate);
-
-#ifdef PRIVSEP
-	if (IN_PRIVSEP(ctx) && ps_bpf_closearp(ifp, &astate->addr) == -1)
-		logerr(__func__);
-#endif
-	if (astate->bpf != NULL) {
-		eloop_event_delete(ctx->eloop, astate->bpf->bpf_fd);
-		bpf_close(astate->bpf);
-	}
-
 	free(astate);
 
 	if (TAILQ_FIRST(&state->arp_states) == NULL) {
+		arp_close(ifp);
+		free(state->arp_hash);
 		free(state);
 		ifp->if_data[IF_DATA_ARP] = NULL;
-	}
+	} else if (state->bpf != NULL && arp_open(ifp) == -1)
+		logerr(__func__);
 }
 
 void
@@ -632,6 +737,9 @@ arp_drop(struct interface *ifp)
 	struct iarp_state *state;
 	struct arp_state *astate;
 
+	/* Close the socket first so the filter isn't rebuilt each time. */
+	if (ARP_STATE(ifp) != NULL)
+		arp_close(ifp);
 	while ((state = ARP_STATE(ifp)) != NULL &&
 	    (astate = TAILQ_FIRST(&state->arp_states)) != NULL)
 		arp_free(astate);
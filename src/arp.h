@@ -67,9 +67,9 @@ struct arp_msg {
 
 struct arp_state {
 	TAILQ_ENTRY(arp_state) next;
+	struct arp_state *hnext;
 	struct interface *iface;
 	struct in_addr addr;
-	struct bpf *bpf;
 
 	int probes;
 	int claims;
@@ -83,8 +83,14 @@ struct arp_state {
 };
 TAILQ_HEAD(arp_statehead, arp_state);
 
+/* All addresses on the interface share one BPF socket. */
 struct iarp_state {
+	struct bpf *bpf;
+	bool ps_bpf;		/* privsep BPF ARP process is running */
 	struct arp_statehead arp_states;
+	size_t arp_nstates;
+	struct arp_state **arp_hash;
+	size_t arp_hashlen;
 };
 
 #define ARP_STATE(ifp)							       \
@@ -234,13 +234,14 @@ eexit:
 }
 
 /* BPF requires that we read the entire buffer.
- * So we pass the buffer in the API so we can loop on >1 packet. */
+ * So we return each packet in place so we can loop on >1 packet.
+ * The packet is only valid until the next call. */
 ssize_t
-bpf_read(struct bpf *bpf, void *data, size_t len)
+bpf_read(struct bpf *bpf, void **data)
 {
 	ssize_t bytes;
 	struct bpf_hdr packet;
-	const char *payload;
+	char *payload;
 
 	bpf->bpf_flags &= ~BPF_EOF;
 	for (;;) {
@@ -261,21 +262,18 @@ bpf_read(struct bpf *bpf, void *data, size_t len)
 			bpf->bpf_pos = 0;
 		}
 		bytes = -1;
-		payload = (const char *)bpf->bpf_buffer + bpf->bpf_pos;
+		payload = (char *)bpf->bpf_buffer + bpf->bpf_pos;
 		memcpy(&packet, payload, sizeof(packet));
 		if (bpf->bpf_pos + packet.bh_caplen + packet.bh_hdrlen >
 		    bpf->bpf_len)
 			goto next; /* Packet beyond buffer, drop. */
 		payload += packet.bh_hdrlen;
-		if (packet.bh_caplen > len)
-			bytes = (ssize_t)len;
-		else
-			bytes = (ssize_t)packet.bh_caplen;
+		bytes = (ssize_t)packet.bh_caplen;
 		if (bpf_frame_bcast(bpf->bpf_ifp, payload) == 0)
 			bpf->bpf_flags |= BPF_BCAST;
 		else
 			bpf->bpf_flags &= ~BPF_BCAST;
-		memcpy(data, payload, (size_t)bytes);
+		*data = payload;
 next:
 		bpf->bpf_pos += BPF_WORDALIGN(packet.bh_hdrlen +
 		    packet.bh_caplen);
@@ -299,6 +297,18 @@ bpf_attach(int fd, void *filter, unsigned int filter_len)
 	return ioctl(fd, BIOCSETF, &pf);
 }
 
+int
+bpf_lock(const struct bpf *bpf)
+{
+
+#ifdef BIOCLOCK
+	return ioctl(bpf->bpf_fd, BIOCLOCK);
+#else
+	UNUSED(bpf);
+	return 0;
+#endif
+}
+
 #ifdef BIOCSETWF
 static int
 bpf_wattach(int fd, void *filter, unsigned int filter_len)
@@ -340,6 +350,7 @@ bpf_send(const struct bpf *bpf, uint16_t protocol,
 }
 #endif
 
+#ifndef __linux__
 void
 bpf_close(struct bpf *bpf)
 {
@@ -348,6 +359,7 @@ bpf_close(struct bpf *bpf)
 	free(bpf->bpf_buffer);
 	free(bpf);
 }
+#endif
 
 #ifdef ARP
 #define BPF_CMP_HWADDR_LEN	((((HWADDR_LEN / 4) + 2) * 2) + 1)
@@ -479,26 +491,26 @@ static const struct bpf_insn bpf_arp_filter [] = {
 #define BPF_ARP_FILTER_LEN	__arraycount(bpf_arp_filter)
 
 /* One address is two checks of two statements. */
-#define BPF_NADDRS		1
-#define BPF_ARP_ADDRS_LEN	5 + ((BPF_NADDRS * 2) * 2)
+#define BPF_ARP_ADDR_LEN	4
+#define BPF_ARP_ADDRS_LEN(n)	(5 + ((n) * BPF_ARP_ADDR_LEN))
 
-#define BPF_ARP_LEN		BPF_ARP_ETHER_LEN + BPF_ARP_FILTER_LEN + \
-				BPF_CMP_HWADDR_LEN + BPF_ARP_ADDRS_LEN
+#define BPF_ARP_LEN(n)		(BPF_ARP_ETHER_LEN + BPF_ARP_FILTER_LEN + \
+				BPF_CMP_HWADDR_LEN + BPF_ARP_ADDRS_LEN(n))
 
+/* If naddrs is zero then any address will match. */
 static int
-bpf_arp_rw(const struct bpf *bpf, const struct in_addr *ia, bool recv)
+bpf_arp_rw(const struct bpf *bpf, const struct in_addr *addrs, size_t naddrs,
+    bool recv)
 {
 	const struct interface *ifp = bpf->bpf_ifp;
-	struct bpf_insn buf[BPF_ARP_LEN + 1];
-	struct bpf_insn *bp;
+	struct bpf_insn *buf, *bp;
 	uint16_t arp_len;
+	size_t i;
+	int r;
 
-	bp = buf;
 	/* Check frame header. */
 	switch(ifp->hwtype) {
 	case ARPHRD_ETHER:
-		memcpy(bp, bpf_arp_ether, sizeof(bpf_arp_ether));
-		bp += BPF_ARP_ETHER_LEN;
 		arp_len = sizeof(struct ether_header)+sizeof(struct ether_arp);
 		break;
 	default:
@@ -506,6 +518,13 @@ bpf_arp_rw(const struct bpf *bpf, const struct in_addr *ia, bool recv)
 		return -1;
 	}
 
+	buf = malloc(sizeof(*buf) * (BPF_ARP_LEN(naddrs) + 1));
+	if (buf == NULL)
+		return -1;
+	bp = buf;
+	memcpy(bp, bpf_arp_ether, sizeof(bpf_arp_ether));
+	bp += BPF_ARP_ETHER_LEN;
+
 	/* Copy in the main filter. */
 	memcpy(bp, bpf_arp_filter, sizeof(bpf_arp_filter));
 	bp += BPF_ARP_FILTER_LEN;
@@ -514,14 +533,23 @@ bpf_arp_rw(const struct bpf *bpf, const struct in_addr *ia, bool recv)
 	bp += bpf_cmp_hwaddr(bp, BPF_CMP_HWADDR_LEN, sizeof(struct arphdr),
 	                     !recv, ifp->hwaddr, ifp->hwlen);
 
+	if (naddrs == 0) {
+		BPF_SET_STMT(bp, BPF_RET + BPF_K, arp_len);
+		bp++;
+		goto attach;
+	}
+
 	/* Match sender protocol address */
 	BPF_SET_STMT(bp, BPF_LD + BPF_W + BPF_IND,
 	    sizeof(struct arphdr) + ifp->hwlen);
 	bp++;
-	BPF_SET_JUMP(bp, BPF_JMP + BPF_JEQ + BPF_K, htonl(ia->s_addr), 0, 1);
-	bp++;
-	BPF_SET_STMT(bp, BPF_RET + BPF_K, arp_len);
-	bp++;
+	for (i = 0; i < naddrs; i++) {
+		BPF_SET_JUMP(bp, BPF_JMP + BPF_JEQ + BPF_K,
+		    htonl(addrs[i].s_addr), 0, 1);
+		bp++;
+		BPF_SET_STMT(bp, BPF_RET + BPF_K, arp_len);
+		bp++;
+	}
 
 	/* If we didn't match sender, then we're only interested in
 	 * ARP probes to us, so check the null host sender. */
@@ -534,37 +562,94 @@ bpf_arp_rw(const struct bpf *bpf, const struct in_addr *ia, bool recv)
 	BPF_SET_STMT(bp, BPF_LD + BPF_W + BPF_IND, (sizeof(struct arphdr) +
 	    (size_t)(ifp->hwlen * 2) + sizeof(in_addr_t)));
 	bp++;
-	BPF_SET_JUMP(bp, BPF_JMP + BPF_JEQ + BPF_K, htonl(ia->s_addr), 0, 1);
-	bp++;
-	BPF_SET_STMT(bp, BPF_RET + BPF_K, arp_len);
-	bp++;
+	for (i = 0; i < naddrs; i++) {
+		BPF_SET_JUMP(bp, BPF_JMP + BPF_JEQ + BPF_K,
+		    htonl(addrs[i].s_addr), 0, 1);
+		bp++;
+		BPF_SET_STMT(bp, BPF_RET + BPF_K, arp_len);
+		bp++;
+	}
 
 	/* No match, drop it */
 	BPF_SET_STMT(bp, BPF_RET + BPF_K, 0);
 	bp++;
 
+attach:
 #ifdef BIOCSETWF
 	if (!recv)
-		return bpf_wattach(bpf->bpf_fd, buf, (unsigned int)(bp - buf));
+		r = bpf_wattach(bpf->bpf_fd, buf, (unsigned int)(bp - buf));
+	else
 #endif
-
-	return bpf_attach(bpf->bpf_fd, buf, (unsigned int)(bp - buf));
+	r = bpf_attach(bpf->bpf_fd, buf, (unsigned int)(bp - buf));
+	free(buf);
+	return r;
 }
 
-int
-bpf_arp(const struct bpf *bpf, const struct in_addr *ia)
+static int
+bpf_arp_addrs(const struct bpf *bpf, const struct in_addr *addrs,
+    size_t naddrs)
 {
 
+	/* Too many addresses for the kernel, so match any
+	 * and let arp_packet() sort it out. */
+	if (BPF_ARP_LEN(naddrs) > BPF_MAXINSNS)
+		naddrs = 0;
+
 #ifdef BIOCSETWF
-	if (bpf_arp_rw(bpf, ia, true) == -1 ||
-	    bpf_arp_rw(bpf, ia, false) == -1 ||
-	    ioctl(bpf->bpf_fd, BIOCLOCK) == -1)
+	if (bpf_arp_rw(bpf, addrs, naddrs, true) == -1 ||
+	    bpf_arp_rw(bpf, addrs, naddrs, false) == -1)
 		return -1;
 	return 0;
 #else
-	return bpf_arp_rw(bpf, ia, true);
+	return bpf_arp_rw(bpf, addrs, naddrs, true);
 #endif
 }
+
+/*
+ * With an address, the filter only matches that and is locked.
+ * Without ARP state, as in the privsep BPF process, the filter matches
+ * any address and is locked.
+ * Otherwise it matches every address the interface is probing or
+ * defending. Call this again to rebuild the filter as they come and go.
+ */
+int
+bpf_arp(const struct bpf *bpf, const struct in_addr *ia)
+{
+	const struct iarp_state *state;
+	const struct arp_state *astate;
+	struct in_addr *addrs;
+	size_t naddrs;
+	int r;
+
+	if (ia != NULL) {
+		if (bpf_arp_addrs(bpf, ia, 1) == -1 ||
+		    bpf_lock(bpf) == -1)
+			return -1;
+		return 0;
+	}
+
+	state = ARP_CSTATE(bpf->bpf_ifp);
+	if (state == NULL) {
+		if (bpf_arp_addrs(bpf, NULL, 0) == -1 ||
+		    bpf_lock(bpf) == -1)
+			return -1;
+		return 0;
+	}
+	if (state->arp_nstates == 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	addrs = malloc(sizeof(*addrs) * state->arp_nstates);
+	if (addrs == NULL)
+		return -1;
+	naddrs = 0;
+	TAILQ_FOREACH(astate, &state->arp_states, next) {
+		addrs[naddrs++] = astate->addr;
+	}
+	r = bpf_arp_addrs(bpf, addrs, naddrs);
+	free(addrs);
+	return r;
+}
 #endif
 
 #ifdef ARPHRD_NONE
@@ -696,7 +781,7 @@ bpf_bootp(const struct bpf *bpf, __unused const struct in_addr *ia)
 #ifdef BIOCSETWF
 	if (bpf_bootp_rw(bpf, true) == -1 ||
 	    bpf_bootp_rw(bpf, false) == -1 ||
-	    ioctl(bpf->bpf_fd, BIOCLOCK) == -1)
+	    bpf_lock(bpf) == -1)
 		return -1;
 	return 0;
 #else
@@ -708,6 +793,9 @@ bpf_bootp(const struct bpf *bpf, __unused const struct in_addr *ia)
 #warning A compromised PF_PACKET socket can be used as a raw socket
 #endif
 #endif
-	return bpf_bootp_rw(bpf, true);
+	if (bpf_bootp_rw(bpf, true) == -1 ||
+	    bpf_lock(bpf) == -1)
+		return -1;
+	return 0;
 #endif
 }
@@ -62,6 +62,7 @@ struct bpf {
 	size_t bpf_size;
 	size_t bpf_len;
 	size_t bpf_pos;
+	struct bpf_ring *bpf_ring;	/* Linux mmap(2) receive ring */
 };
 
 extern const char *bpf_name;
@@ -74,8 +75,9 @@ struct bpf * bpf_open(const struct interface *,
     const struct in_addr *);
 void bpf_close(struct bpf *);
 int bpf_attach(int, void *, unsigned int);
+int bpf_lock(const struct bpf *);
 ssize_t bpf_send(const struct bpf *, uint16_t, const void *, size_t);
-ssize_t bpf_read(struct bpf *, void *, size_t);
+ssize_t bpf_read(struct bpf *, void **);
 int bpf_arp(const struct bpf *, const struct in_addr *);
 int bpf_bootp(const struct bpf *, const struct in_addr *);
 #endif
@@ -32,9 +32,11 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "dhcpcd.h"
@@ -137,6 +139,78 @@ writefile(const char *file, mode_t mode, const void *data, size_t len)
 	return bytes;
 }
 
+/* Write via a temporary file and rename it over the original,
+ * so a crash leaves either the old or the new contents in place.
+ * If mtime is not zero, it becomes the modification time. */
+ssize_t
+writefile_atomic(const char *file, mode_t mode, time_t mtime,
+    const void *data, size_t len)
+{
+	char tmp[PATH_MAX];
+	int fd, serrno;
+	ssize_t bytes;
+
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", file) >= sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+	if (fd == -1)
+		return -1;
+	bytes = write(fd, data, len);
+	if (bytes != -1 && (size_t)bytes != len) {
+		errno = ENOSPC;
+		bytes = -1;
+	}
+	if (bytes != -1 && mtime != 0) {
+		struct timespec ts[2] = {
+		    { .tv_sec = mtime }, { .tv_sec = mtime }
+		};
+
+		if (futimens(fd, ts) == -1)
+			bytes = -1;
+	}
+	if (bytes != -1 && fsync(fd) == -1)
+		bytes = -1;
+	serrno = errno;
+	close(fd);
+	if (bytes == -1 || rename(tmp, file) == -1) {
+		if (bytes != -1)
+			serrno = errno;
+		unlink(tmp);
+		errno = serrno;
+		return -1;
+	}
+	return bytes;
+}
+
+/* Commit a rename or unlink in the directory holding file. */
+int
+syncdir(const char *file)
+{
+	char dir[PATH_MAX], *p;
+	int fd, err;
+
+	if (strlcpy(dir, file, sizeof(dir)) >= sizeof(dir)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	p = strrchr(dir, '/');
+	if (p == NULL)
+		strlcpy(dir, ".", sizeof(dir));
+	else if (p == dir)
+		p[1] = '\0';
+	else
+		*p = '\0';
+
+	fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	err = fsync(fd);
+	close(fd);
+	return err;
+}
+
 int
 filemtime(const char *file, time_t *time)
 {
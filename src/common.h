@@ -151,6 +151,8 @@ const char *hwaddr_ntoa(const void *, size_t, char *, size_t);
 size_t hwaddr_aton(uint8_t *, const char *);
 ssize_t readfile(const char *, void *, size_t);
 ssize_t writefile(const char *, mode_t, const void *, size_t);
+ssize_t writefile_atomic(const char *, mode_t, time_t, const void *, size_t);
+int syncdir(const char *);
 int filemtime(const char *, time_t *);
 char *get_line(char ** __restrict, ssize_t * __restrict);
 int is_root_local(void);
@@ -0,0 +1,490 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - DHCP client daemon
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/resource.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "common.h"
+#include "dhcpcd.h"
+#include "control.h"
+#include "dhcp.h"
+#include "eloop.h"
+#include "if.h"
+#include "ipv4.h"
+#include "ipv6.h"
+#include "logerr.h"
+#include "route.h"
+#include "sa.h"
+#include "workers.h"
+
+/* Initial room for records, grown as needed. */
+#define	CTL_OUT_SIZE	4096
+
+struct ctl_out {
+	struct fd_buf *buf;
+	size_t size;
+	uint32_t nrecords;
+	bool error;
+};
+
+static void *
+ctl_rec(struct ctl_out *o, uint16_t type, size_t len, unsigned int ifindex)
+{
+	struct ctl_rechdr *rh;
+	size_t size;
+
+	if (o->error)
+		return NULL;
+	if (o->buf->len + len > o->size) {
+		struct fd_buf *nbuf;
+
+		for (size = o->size * 2; o->buf->len + len > size; size *= 2)
+			;
+		nbuf = realloc(o->buf, sizeof(*nbuf) + size);
+		if (nbuf == NULL) {
+			o->error = true;
+			return NULL;
+		}
+		o->buf = nbuf;
+		o->size = size;
+	}
+
+	rh = (void *)(o->buf->data + o->buf->len);
+	memset(rh, 0, len);
+	rh->rh_type = type;
+	rh->rh_len = (uint16_t)len;
+	rh->rh_ifindex = ifindex;
+	o->buf->len += len;
+	o->nrecords++;
+	return rh;
+}
+
+static void
+ctl_addr(struct ctl_out *o, const struct interface *ifp, uint8_t family,
+    const void *addr, size_t addrlen, uint8_t prefix_len, int flags,
+    uint32_t pltime, uint32_t vltime)
+{
+	struct ctl_rec_addr *ra;
+
+	ra = ctl_rec(o, CTL_REC_ADDR, sizeof(*ra), ifp->index);
+	if (ra == NULL)
+		return;
+	ra->ra_family = family;
+	ra->ra_prefix_len = prefix_len;
+	ra->ra_flags = flags;
+	ra->ra_pltime = pltime;
+	ra->ra_vltime = vltime;
+	memcpy(ra->ra_addr, addr, addrlen);
+}
+
+static void
+ctl_iface(struct ctl_out *o, const struct interface *ifp)
+{
+	struct ctl_rec_iface *ri;
+#ifdef INET
+	const struct dhcp_state *state;
+	const struct ipv4_state *istate;
+	const struct ipv4_addr *ia;
+#endif
+#ifdef INET6
+	const struct ipv6_state *i6state;
+	const struct ipv6_addr *ia6;
+#endif
+
+	ri = ctl_rec(o, CTL_REC_IFACE, sizeof(*ri), ifp->index);
+	if (ri == NULL)
+		return;
+	ri->ri_gen = ifp->ctl_gen;
+	strlcpy(ri->ri_name, ifp->name, sizeof(ri->ri_name));
+	ri->ri_flags = ifp->flags;
+	ri->ri_carrier = (int16_t)ifp->carrier;
+	ri->ri_active = (uint16_t)ifp->active;
+
+#ifdef INET
+	state = D_CSTATE(ifp);
+	if (state != NULL && state->new != NULL) {
+		struct ctl_rec_lease *rl;
+
+		rl = ctl_rec(o, CTL_REC_LEASE, sizeof(*rl), ifp->index);
+		if (rl == NULL)
+			return;
+		rl->rl_addr = state->lease.addr;
+		rl->rl_mask = state->lease.mask;
+		rl->rl_brd = state->lease.brd;
+		rl->rl_server = state->lease.server;
+		rl->rl_leasetime = state->lease.leasetime;
+		rl->rl_renewaltime = state->lease.renewaltime;
+		rl->rl_rebindtime = state->lease.rebindtime;
+	}
+
+	istate = IPV4_CSTATE(ifp);
+	if (istate != NULL) {
+		TAILQ_FOREACH(ia, &istate->addrs, next) {
+#ifdef IP_LIFETIME
+			ctl_addr(o, ifp, AF_INET, &ia->addr, sizeof(ia->addr),
+			    inet_ntocidr(ia->mask), ia->addr_flags,
+			    ia->pltime, ia->vltime);
+#else
+			ctl_addr(o, ifp, AF_INET, &ia->addr, sizeof(ia->addr),
+			    inet_ntocidr(ia->mask), ia->addr_flags,
+			    DHCP_INFINITE_LIFETIME, DHCP_INFINITE_LIFETIME);
+#endif
+		}
+	}
+#endif
+
+#ifdef INET6
+	i6state = IPV6_CSTATE(ifp);
+	if (i6state != NULL) {
+		TAILQ_FOREACH(ia6, &i6state->addrs, next) {
+			ctl_addr(o, ifp, AF_INET6, &ia6->addr,
+			    sizeof(ia6->addr), ia6->prefix_len,
+			    ia6->addr_flags,
+			    ia6->prefix_pltime, ia6->prefix_vltime);
+		}
+	}
+#endif
+}
+
+/* Routes are held by ctx rather than the interface, so one pass over
+ * them serves however many interfaces were selected. */
+static void
+ctl_routes(struct ctl_out *o, struct dhcpcd_ctx *ctx,
+    const struct interface *only, uint64_t mingen)
+{
+	struct rt *rt;
+	const struct interface *ifp;
+	struct ctl_rec_route *rr;
+	socklen_t alen;
+	int prefix;
+
+	RB_TREE_FOREACH(rt, &ctx->routes) {
+		ifp = rt->rt_ifp;
+		if (ifp == NULL)
+			continue;
+		if (only != NULL ? ifp != only : ifp->ctl_gen < mingen)
+			continue;
+		alen = sa_addrlen(&rt->rt_dest);
+		if (alen == 0 || alen > sizeof(rr->rr_dest))
+			continue;
+		rr = ctl_rec(o, CTL_REC_ROUTE, sizeof(*rr), ifp->index);
+		if (rr == NULL)
+			return;
+		rr->rr_family = (uint8_t)rt->rt_dest.sa_family;
+		prefix = sa_toprefix(&rt->rt_netmask);
+		if (prefix == -1)
+			prefix = (int)alen * NBBY;
+		rr->rr_prefix_len = (uint8_t)prefix;
+#ifdef HAVE_ROUTE_METRIC
+		rr->rr_metric = rt->rt_metric;
+#endif
+		rr->rr_mtu = rt->rt_mtu;
+		memcpy(rr->rr_dest,
+		    (const uint8_t *)&rt->rt_dest + sa_addroffset(&rt->rt_dest),
+		    alen);
+		if (rt->rt_gateway.sa_family == rt->rt_dest.sa_family)
+			memcpy(rr->rr_gateway,
+			    (const uint8_t *)&rt->rt_gateway +
+			    sa_addroffset(&rt->rt_gateway), alen);
+	}
+}
+
+static void
+ctl_state_all(struct ctl_out *o, struct dhcpcd_ctx *ctx)
+{
+	const struct interface *ifp;
+
+	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+		ctl_iface(o, ifp);
+	}
+	ctl_routes(o, ctx, NULL, 0);
+}
+
+static void
+ctl_state_delta(struct ctl_out *o, struct dhcpcd_ctx *ctx, uint64_t mingen)
+{
+	const struct ctl_gone *cg;
+	const struct interface *ifp;
+	struct ctl_rec_gone *rg;
+
+	/* Departures first, the index could since have been reused. */
+	TAILQ_FOREACH_REVERSE(cg, &ctx->ctl_gone, ctl_gone_head, next) {
+		if (cg->cg_gen < mingen)
+			break;
+		rg = ctl_rec(o, CTL_REC_GONE, sizeof(*rg), cg->cg_index);
+		if (rg == NULL)
+			return;
+		rg->ri_gen = cg->cg_gen;
+		strlcpy(rg->ri_name, cg->cg_name, sizeof(rg->ri_name));
+	}
+
+	TAILQ_FOREACH_REVERSE(ifp, &ctx->ctl_ifaces, if_head, ctl_next) {
+		if (ifp->ctl_gen < mingen)
+			break;
+		ctl_iface(o, ifp);
+	}
+	ctl_routes(o, ctx, NULL, mingen);
+}
+
+#ifdef ELOOP_STATS
+__CTASSERT(CTL_CB_BUCKETS == ELOOP_STATS_BUCKETS);
+
+static void
+ctl_callback(void *arg, const struct eloop_cbstats *cs)
+{
+	struct ctl_out *o = arg;
+	struct ctl_rec_callback *rc;
+
+	rc = ctl_rec(o, CTL_REC_CALLBACK, sizeof(*rc), 0);
+	if (rc == NULL)
+		return;
+	strlcpy(rc->rc_name, cs->name, sizeof(rc->rc_name));
+	rc->rc_kind = cs->kind;
+	rc->rc_count = cs->count;
+	rc->rc_total_ns = cs->total_ns;
+	rc->rc_max_ns = cs->max_ns;
+	memcpy(rc->rc_hist, cs->hist, sizeof(rc->rc_hist));
+}
+
+static void
+ctl_eloop(struct ctl_out *o, struct dhcpcd_ctx *ctx)
+{
+	struct ctl_rec_eloop *re;
+	struct eloop_stats es;
+	struct timespec now;
+	struct rusage ru;
+	unsigned int nsecs;
+
+	re = ctl_rec(o, CTL_REC_ELOOP, sizeof(*re), 0);
+	if (re == NULL)
+		return;
+	eloop_stats(ctx->eloop, &es, NULL, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	re->re_elapsed_ns = eloop_timespec_diff(&now, &es.since, &nsecs) *
+	    NSEC_PER_SEC + nsecs;
+	re->re_wakeups = es.wakeups;
+	re->re_poll_ns = es.poll_ns;
+	re->re_dispatch_ns = es.dispatch_ns;
+	if (getrusage(RUSAGE_SELF, &ru) == 0) {
+		re->re_utime_us = (uint64_t)ru.ru_utime.tv_sec * 1000000 +
+		    (uint64_t)ru.ru_utime.tv_usec;
+		re->re_stime_us = (uint64_t)ru.ru_stime.tv_sec * 1000000 +
+		    (uint64_t)ru.ru_stime.tv_usec;
+	}
+
+	/* Adding records can move re, so it must be filled in first. */
+	eloop_stats(ctx->eloop, NULL, ctl_callback, o);
+}
+#endif
+
+/* Microseconds of wall clock time. */
+static uint64_t
+ctl_clock(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_REALTIME, &ts) == -1)
+		return 0;
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+int
+control_state_request(struct fd_list *fd, const struct ctl_req *req)
+{
+	struct dhcpcd_ctx *ctx = fd->ctx;
+	struct ctl_out o = { .size = CTL_OUT_SIZE };
+	struct ctl_reply *cp;
+	struct interface *ifp;
+	char ifname[IF_NAMESIZE];
+	uint16_t status = 0;
+	uint32_t flags = 0;
+	int err;
+
+	o.buf = malloc(sizeof(*o.buf) + o.size);
+	if (o.buf == NULL)
+		return -1;
+	o.buf->refs = 1;
+	o.buf->len = sizeof(*cp);
+
+	/* Ensure routes are current. */
+	if (ctx->rt_dirty != 0)
+		rt_build_flush(ctx);
+
+	if (req->cr_version != CTL_VERSION) {
+		status = EPROTONOSUPPORT;
+		goto reply;
+	}
+
+	switch (req->cr_type) {
+	case CTL_REQ_STATE:
+		if (req->cr_ifname[0] == '\0') {
+			ctl_state_all(&o, ctx);
+			break;
+		}
+		memcpy(ifname, req->cr_ifname, sizeof(ifname));
+		ifname[sizeof(ifname) - 1] = '\0';
+		ifp = if_find(ctx->ifaces, ifname);
+		if (ifp == NULL) {
+			status = ENXIO;
+			break;
+		}
+		ctl_iface(&o, ifp);
+		ctl_routes(&o, ctx, ifp, 0);
+		break;
+	case CTL_REQ_DELTA:
+		if (req->cr_gen < ctx->ctl_gen_floor ||
+		    req->cr_gen > ctx->ctl_gen)
+		{
+			flags |= CTL_RESYNC;
+			ctl_state_all(&o, ctx);
+		} else
+			ctl_state_delta(&o, ctx, req->cr_gen + 1);
+		break;
+	case CTL_REQ_ELOOP:
+	case CTL_REQ_ELOOP_RESET:
+#ifdef ELOOP_STATS
+		if (req->cr_type == CTL_REQ_ELOOP_RESET &&
+		    fd->flags & FD_UNPRIV)
+		{
+			status = EPERM;
+			break;
+		}
+		ctl_eloop(&o, ctx);
+		if (req->cr_type == CTL_REQ_ELOOP_RESET && !o.error)
+			eloop_stats_reset(ctx->eloop);
+#else
+		status = ENOTSUP;
+#endif
+		break;
+	default:
+		status = EINVAL;
+		break;
+	}
+
+	if (o.error) {
+		free(o.buf);
+		return -1;
+	}
+
+reply:
+#ifdef WORKERS
+	/* Each worker moves its generation on to the clock, so the
+	 * oldest one the manager hands out is current for them all. */
+	if (IN_WORKER(ctx)) {
+		uint64_t now = ctl_clock();
+
+		if (now > ctx->ctl_gen)
+			ctx->ctl_gen = now;
+	}
+#endif
+	cp = (void *)o.buf->data;
+	memcpy(cp->cp_magic, CTL_MAGIC, sizeof(cp->cp_magic));
+	cp->cp_version = CTL_VERSION;
+	cp->cp_status = status;
+	cp->cp_gen = ctx->ctl_gen;
+	cp->cp_nrecords = status == 0 ? o.nrecords : 0;
+	cp->cp_flags = flags;
+	if (status != 0)
+		o.buf->len = sizeof(*cp);
+
+	err = control_queue_buf(fd, o.buf);
+	control_buf_unref(o.buf);
+	return err;
+}
+
+void
+control_ifchanged(struct interface *ifp)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+
+	if (ifp->ctl_gen != 0)
+		TAILQ_REMOVE(&ctx->ctl_ifaces, ifp, ctl_next);
+	ifp->ctl_gen = ++ctx->ctl_gen;
+	TAILQ_INSERT_TAIL(&ctx->ctl_ifaces, ifp, ctl_next);
+}
+
+void
+control_ifdeparted(struct interface *ifp)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct ctl_gone *cg;
+
+	if (ifp->ctl_gen != 0) {
+		TAILQ_REMOVE(&ctx->ctl_ifaces, ifp, ctl_next);
+		ifp->ctl_gen = 0;
+	}
+
+	if (ctx->ctl_ngone == CTL_GONE_MAX) {
+		cg = TAILQ_FIRST(&ctx->ctl_gone);
+		TAILQ_REMOVE(&ctx->ctl_gone, cg, next);
+		ctx->ctl_gen_floor = cg->cg_gen;
+	} else if ((cg = malloc(sizeof(*cg))) != NULL)
+		ctx->ctl_ngone++;
+	else {
+		logerr(__func__);
+		/* Pollers will have to resync. */
+		ctx->ctl_gen_floor = ++ctx->ctl_gen;
+		return;
+	}
+
+	cg->cg_gen = ++ctx->ctl_gen;
+	cg->cg_index = ifp->index;
+	strlcpy(cg->cg_name, ifp->name, sizeof(cg->cg_name));
+	TAILQ_INSERT_TAIL(&ctx->ctl_gone, cg, next);
+}
+
+void
+control_state_init(struct dhcpcd_ctx *ctx)
+{
+
+	TAILQ_INIT(&ctx->ctl_ifaces);
+	TAILQ_INIT(&ctx->ctl_gone);
+	ctx->ctl_ngone = 0;
+
+	/* Start from the time so that a generation held from before
+	 * a restart is older than any we hand out. */
+	ctx->ctl_gen = ctl_clock();
+	ctx->ctl_gen_floor = ctx->ctl_gen;
+}
+
+void
+control_state_free(struct dhcpcd_ctx *ctx)
+{
+	struct ctl_gone *cg;
+
+	while ((cg = TAILQ_FIRST(&ctx->ctl_gone)) != NULL) {
+		TAILQ_REMOVE(&ctx->ctl_gone, cg, next);
+		free(cg);
+	}
+	ctx->ctl_ngone = 0;
+}
@@ -47,6 +47,7 @@
 #include "if.h"
 #include "logerr.h"
 #include "privsep.h"
+#include "workers.h"
 
 #ifndef SUN_LEN
 #define SUN_LEN(su) \
@@ -55,6 +56,42 @@
 
 static void control_handle_data(void *, unsigned short);
 
+struct fd_buf *
+control_buf_new(const void *data, size_t len)
+{
+	struct fd_buf *buf;
+
+	buf = malloc(sizeof(*buf) + len);
+	if (buf == NULL)
+		return NULL;
+	buf->refs = 1;
+	buf->len = len;
+	memcpy(buf->data, data, len);
+	return buf;
+}
+
+void
+control_buf_unref(struct fd_buf *buf)
+{
+
+	if (--buf->refs == 0)
+		free(buf);
+}
+
+static void
+control_data_free(struct fd_list *fd, struct fd_data *fdp)
+{
+
+	control_buf_unref(fdp->buf);
+	fdp->buf = NULL;
+#ifdef CTL_FREE_LIST
+	TAILQ_INSERT_TAIL(&fd->free_queue, fdp, next);
+#else
+	UNUSED(fd);
+	free(fdp);
+#endif
+}
+
 static void
 control_queue_free(struct fd_list *fd)
 {
@@ -62,16 +99,14 @@ control_queue_free(struct fd_list *fd)
 
 	while ((fdp = TAILQ_FIRST(&fd->queue))) {
 		TAILQ_REMOVE(&fd->queue, fdp, next);
-		if (fdp->data_size != 0)
-			free(fdp->data);
+		control_buf_unref(fdp->buf);
 		free(fdp);
 	}
+	fd->queue_off = 0;
 
 #ifdef CTL_FREE_LIST
 	while ((fdp = TAILQ_FIRST(&fd->free_queue))) {
 		TAILQ_REMOVE(&fd->free_queue, fdp, next);
-		if (fdp->data_size != 0)
-			free(fdp->data);
 		free(fdp);
 	}
 #endif
@@ -85,6 +120,9 @@ control_free(struct fd_list *fd)
 	if (fd->ctx->ps_control_client == fd)
 		fd->ctx->ps_control_client = NULL;
 #endif
+#ifdef WORKERS
+	workers_ctlfree(fd);
+#endif
 
 	eloop_event_delete(fd->ctx->eloop, fd->fd);
 	close(fd->fd);
@@ -133,48 +171,86 @@ control_handle_read(struct fd_list *fd)
 	}
 #endif
 
+#ifdef WORKERS
+	if (IN_WORKERS_MANAGER(fd->ctx)) {
+		if (workers_ctlrequest(fd, buffer, (size_t)bytes) == -1) {
+			logerr(__func__);
+			control_free(fd);
+		}
+		return;
+	}
+#endif
+
 	control_recvdata(fd, buffer, (size_t)bytes);
 }
 
+static size_t
+control_data_len(const struct fd_data *data)
+{
+
+	if (data->data_flags & FD_SENDLEN)
+		return sizeof(data->buf->len) + data->buf->len;
+	return data->buf->len;
+}
+
 static void
 control_handle_write(struct fd_list *fd)
 {
-	struct iovec iov[2];
-	int iov_len;
+	struct iovec iov[CONTROL_WRITEV_MAX * 2], *iovp = iov;
+	int iov_len = 0;
 	struct fd_data *data;
-
-	data = TAILQ_FIRST(&fd->queue);
-
-	if (data->data_flags & FD_SENDLEN) {
-		iov[0].iov_base = &data->data_len;
-		iov[0].iov_len = sizeof(size_t);
-		iov[1].iov_base = data->data;
-		iov[1].iov_len = data->data_len;
-		iov_len = 2;
-	} else {
-		iov[0].iov_base = data->data;
-		iov[0].iov_len = data->data_len;
-		iov_len = 1;
+	size_t off, dlen;
+	ssize_t len;
+
+	TAILQ_FOREACH(data, &fd->queue, next) {
+		if ((size_t)iov_len + 2 > __arraycount(iov))
+			break;
+		if (data->data_flags & FD_SENDLEN) {
+			iov[iov_len].iov_base = &data->buf->len;
+			iov[iov_len].iov_len = sizeof(data->buf->len);
+			iov_len++;
+		}
+		iov[iov_len].iov_base = data->buf->data;
+		iov[iov_len].iov_len = data->buf->len;
+		iov_len++;
 	}
 
-	if (writev(fd->fd, iov, iov_len) == -1) {
+	/* Skip what a short write sent last time. */
+	for (off = fd->queue_off; off >= iovp->iov_len; iovp++, iov_len--)
+		off -= iovp->iov_len;
+	iovp->iov_base = (uint8_t *)iovp->iov_base + off;
+	iovp->iov_len -= off;
+
+	len = writev(fd->fd, iovp, iov_len);
+	if (len == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+			return;
 		logerr("%s: write", __func__);
 		control_free(fd);
 		return;
 	}
 
-	TAILQ_REMOVE(&fd->queue, data, next);
-#ifdef CTL_FREE_LIST
-	TAILQ_INSERT_TAIL(&fd->free_queue, data, next);
-#else
-	if (data->data_size != 0)
-		free(data->data);
-	free(data);
-#endif
+	fd->queue_off += (size_t)len;
+	while ((data = TAILQ_FIRST(&fd->queue)) != NULL) {
+		dlen = control_data_len(data);
+		if (fd->queue_off < dlen)
+			break;
+		fd->queue_off -= dlen;
+		TAILQ_REMOVE(&fd->queue, data, next);
+		control_data_free(fd, data);
+	}
 
-	if (TAILQ_FIRST(&fd->queue) != NULL)
+	if (data != NULL)
 		return;
 
+#ifdef WORKERS
+	/* Reply sent, so the manager can pass on the next request. */
+	if (fd == fd->ctx->wk_client) {
+		workers_ctldone(fd);
+		return;
+	}
+#endif
+
 #ifdef PRIVSEP
 	if (IN_PRIVSEP_SE(fd->ctx) && !(fd->flags & FD_LISTEN)) {
 		if (ps_ctl_sendeof(fd) == -1)
@@ -213,6 +289,27 @@ control_recvdata(struct fd_list *fd, char *data, size_t len)
 	/* Each command is \n terminated
 	 * Each argument is NULL separated */
 	while (len != 0) {
+		if (len >= CTL_MAGIC_LEN &&
+		    memcmp(p, CTL_MAGIC, CTL_MAGIC_LEN) == 0)
+		{
+			struct ctl_req req;
+
+			if (len < sizeof(req)) {
+				errno = EINVAL;
+				logerrx("%s: short state request", __func__);
+				return;
+			}
+			memcpy(&req, p, sizeof(req));
+			p += sizeof(req);
+			len -= sizeof(req);
+			if (control_state_request(fd, &req) == -1) {
+				logerr(__func__);
+				control_free(fd);
+				return;
+			}
+			continue;
+		}
+
 		argc = 0;
 		ap = argvp;
 		while (len != 0) {
@@ -271,6 +368,7 @@ control_new(struct dhcpcd_ctx *ctx, int fd, unsigned int flags)
 	l->fd = fd;
 	l->flags = flags;
 	TAILQ_INIT(&l->queue);
+	l->queue_off = 0;
 #ifdef CTL_FREE_LIST
 	TAILQ_INIT(&l->free_queue);
 #endif
@@ -558,51 +656,30 @@ control_send(struct dhcpcd_ctx *ctx, int argc, char * const *argv)
 }
 
 int
-control_queue(struct fd_list *fd, void *data, size_t data_len)
+control_queue_buf(struct fd_list *fd, struct fd_buf *buf)
 {
 	struct fd_data *d;
 	unsigned short events;
 
-	if (data_len == 0) {
+	if (buf->len == 0) {
 		errno = EINVAL;
 		return -1;
 	}
 
 #ifdef CTL_FREE_LIST
-	struct fd_data *df;
-
-	d = NULL;
-	TAILQ_FOREACH(df, &fd->free_queue, next) {
-		if (d == NULL || d->data_size < df->data_size) {
-			d = df;
-			if (d->data_size <= data_len)
-				break;
-		}
-	}
+	d = TAILQ_FIRST(&fd->free_queue);
 	if (d != NULL)
 		TAILQ_REMOVE(&fd->free_queue, d, next);
 	else
 #endif
 	{
-		d = calloc(1, sizeof(*d));
+		d = malloc(sizeof(*d));
 		if (d == NULL)
 			return -1;
 	}
 
-	if (d->data_size == 0)
-		d->data = NULL;
-	if (d->data_size < data_len) {
-		void *nbuf = realloc(d->data, data_len);
-		if (nbuf == NULL) {
-			free(d->data);
-			free(d);
-			return -1;
-		}
-		d->data = nbuf;
-		d->data_size = data_len;
-	}
-	memcpy(d->data, data, data_len);
-	d->data_len = data_len;
+	buf->refs++;
+	d->buf = buf;
 	d->data_flags = fd->flags & FD_SENDLEN;
 
 	TAILQ_INSERT_TAIL(&fd->queue, d, next);
@@ -612,3 +689,46 @@ control_queue(struct fd_list *fd, void *data, size_t data_len)
 	return eloop_event_add(fd->ctx->eloop, fd->fd, events,
 	    control_handle_data, fd);
 }
+
+int
+control_queue(struct fd_list *fd, void *data, size_t data_len)
+{
+	struct fd_buf *buf;
+	int err;
+
+	if (data_len == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((buf = control_buf_new(data, data_len)) == NULL)
+		return -1;
+	err = control_queue_buf(fd, buf);
+	control_buf_unref(buf);
+	return err;
+}
+
+/* Queue one copy of data to every listener.
+ * Returns the number of listeners queued to. */
+int
+control_broadcast(struct dhcpcd_ctx *ctx, void *data, size_t data_len)
+{
+	struct fd_list *fd;
+	struct fd_buf *buf = NULL;
+	int n = 0;
+
+	TAILQ_FOREACH(fd, &ctx->control_fds, next) {
+		if (!(fd->flags & FD_LISTEN))
+			continue;
+		if (buf == NULL &&
+		    (buf = control_buf_new(data, data_len)) == NULL)
+			return -1;
+		if (control_queue_buf(fd, buf) == -1)
+			logerr("%s: control_queue_buf", __func__);
+		else
+			n++;
+	}
+	if (buf != NULL)
+		control_buf_unref(buf);
+	return n;
+}
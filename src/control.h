@@ -29,7 +29,10 @@
 #ifndef CONTROL_H
 #define CONTROL_H
 
+#include <netinet/in.h>
+
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "dhcpcd.h"
 
@@ -42,11 +45,20 @@
 /* Limit queue size per fd */
 #define CONTROL_QUEUE_MAX	100
 
+/* Number of queued messages to send with one writev(2) */
+#define CONTROL_WRITEV_MAX	16
+
+/* Message data is never changed once made, so one copy is shared
+ * by the queues of all the listeners it is sent to. */
+struct fd_buf {
+	size_t refs;
+	size_t len;
+	uint8_t data[];
+};
+
 struct fd_data {
 	TAILQ_ENTRY(fd_data) next;
-	void *data;
-	size_t data_size;
-	size_t data_len;
+	struct fd_buf *buf;
 	unsigned int data_flags;
 };
 TAILQ_HEAD(fd_data_head, fd_data);
@@ -57,6 +69,7 @@ struct fd_list {
 	int fd;
 	unsigned int flags;
 	struct fd_data_head queue;
+	size_t queue_off;	/* bytes of the first message written */
 #ifdef CTL_FREE_LIST
 	struct fd_data_head free_queue;
 #endif
@@ -67,6 +80,152 @@ TAILQ_HEAD(fd_list_head, fd_list);
 #define	FD_UNPRIV	0x02U
 #define	FD_SENDLEN	0x04U
 
+/*
+ * Binary state protocol.
+ * A request is a struct ctl_req written to the control socket.
+ * The leading NUL cannot start an argv command, so both can share
+ * the socket.
+ * The reply is framed as any other reply, a size_t length then data.
+ * The data is a struct ctl_reply followed by cp_nrecords records,
+ * each starting with a struct ctl_rechdr and padded to 8 bytes.
+ * Everything is in host byte order as the socket is local.
+ *
+ * Each interface carries the generation of its last change, which is
+ * when a hook reason last ran for it.
+ * A delta holds the complete state of every interface changed since
+ * cr_gen, so a poller replaces what it held for that ifindex.
+ * If the generation is too old to compute a delta from, for example
+ * dhcpcd restarted or too many interfaces departed, full state is
+ * sent with CTL_RESYNC set.
+ *
+ * CTL_REQ_ELOOP returns one CTL_REC_ELOOP record for the main loop
+ * followed by a CTL_REC_CALLBACK record for each callback which has run.
+ * When interfaces are shared over workers, each worker adds its own.
+ * ENOTSUP is returned if dhcpcd was built without eloop statistics.
+ */
+#define	CTL_MAGIC		"\0DCB"
+#define	CTL_MAGIC_LEN		4
+#define	CTL_VERSION		1
+
+#define	CTL_REQ_STATE		1	/* cr_ifname, or all if empty */
+#define	CTL_REQ_DELTA		2	/* interfaces changed since cr_gen */
+#define	CTL_REQ_ELOOP		3	/* eloop statistics */
+#define	CTL_REQ_ELOOP_RESET	4	/* as above, then zero them */
+
+struct ctl_req {
+	uint8_t cr_magic[CTL_MAGIC_LEN];
+	uint16_t cr_version;
+	uint16_t cr_type;
+	uint64_t cr_gen;
+	char cr_ifname[IF_NAMESIZE];
+};
+
+#define	CTL_RESYNC		0x01U	/* reply is full state */
+
+struct ctl_reply {
+	uint8_t cp_magic[CTL_MAGIC_LEN];
+	uint16_t cp_version;
+	uint16_t cp_status;		/* 0 or an errno */
+	uint64_t cp_gen;		/* current generation */
+	uint32_t cp_nrecords;
+	uint32_t cp_flags;
+};
+
+#define	CTL_REC_IFACE		1
+#define	CTL_REC_GONE		2
+#define	CTL_REC_LEASE		3
+#define	CTL_REC_ADDR		4
+#define	CTL_REC_ROUTE		5
+#define	CTL_REC_ELOOP		6
+#define	CTL_REC_CALLBACK	7
+
+struct ctl_rechdr {
+	uint16_t rh_type;
+	uint16_t rh_len;		/* including this header */
+	uint32_t rh_ifindex;
+};
+
+struct ctl_rec_iface {
+	struct ctl_rechdr ri_hdr;
+	uint64_t ri_gen;
+	char ri_name[IF_NAMESIZE];
+	uint32_t ri_flags;		/* IFF_ flags */
+	int16_t ri_carrier;		/* LINK_ state */
+	uint16_t ri_active;
+};
+
+/* Departed interface, ri_name and ri_gen are valid. */
+#define	ctl_rec_gone	ctl_rec_iface
+
+struct ctl_rec_lease {
+	struct ctl_rechdr rl_hdr;
+	struct in_addr rl_addr;
+	struct in_addr rl_mask;
+	struct in_addr rl_brd;
+	struct in_addr rl_server;
+	uint32_t rl_leasetime;
+	uint32_t rl_renewaltime;
+	uint32_t rl_rebindtime;
+	uint32_t rl_pad;
+};
+
+struct ctl_rec_addr {
+	struct ctl_rechdr ra_hdr;
+	uint8_t ra_family;
+	uint8_t ra_prefix_len;
+	uint16_t ra_pad;
+	int32_t ra_flags;		/* kernel address flags */
+	uint32_t ra_pltime;
+	uint32_t ra_vltime;
+	uint8_t ra_addr[16];
+};
+
+struct ctl_rec_route {
+	struct ctl_rechdr rr_hdr;
+	uint8_t rr_family;
+	uint8_t rr_prefix_len;
+	uint16_t rr_pad;
+	uint32_t rr_metric;
+	uint32_t rr_mtu;
+	uint32_t rr_pad2;
+	uint8_t rr_dest[16];
+	uint8_t rr_gateway[16];
+};
+
+struct ctl_rec_eloop {
+	struct ctl_rechdr re_hdr;
+	uint64_t re_elapsed_ns;		/* since statistics were reset */
+	uint64_t re_wakeups;
+	uint64_t re_poll_ns;
+	uint64_t re_dispatch_ns;
+	uint64_t re_utime_us;		/* getrusage(2) of the process */
+	uint64_t re_stime_us;
+};
+
+#define	CTL_CB_NAMELEN		32
+#define	CTL_CB_BUCKETS		24	/* ELOOP_STATS_BUCKETS */
+
+struct ctl_rec_callback {
+	struct ctl_rechdr rc_hdr;
+	char rc_name[CTL_CB_NAMELEN];
+	uint32_t rc_kind;		/* ELOOP_STATS_EVENT, etc */
+	uint32_t rc_pad;
+	uint64_t rc_count;
+	uint64_t rc_total_ns;
+	uint64_t rc_max_ns;
+	uint64_t rc_hist[CTL_CB_BUCKETS];
+};
+
+/* Remembered so a delta can report interfaces which departed. */
+#define	CTL_GONE_MAX		256
+struct ctl_gone {
+	TAILQ_ENTRY(ctl_gone) next;
+	uint64_t cg_gen;
+	unsigned int cg_index;
+	char cg_name[IF_NAMESIZE];
+};
+TAILQ_HEAD(ctl_gone_head, ctl_gone);
+
 int control_start(struct dhcpcd_ctx *, const char *, sa_family_t);
 int control_stop(struct dhcpcd_ctx *);
 int control_open(const char *, sa_family_t, bool);
@@ -74,6 +233,17 @@ ssize_t control_send(struct dhcpcd_ctx *, int, char * const *);
 struct fd_list *control_new(struct dhcpcd_ctx *, int, unsigned int);
 void control_free(struct fd_list *);
 void control_delete(struct fd_list *);
+struct fd_buf *control_buf_new(const void *, size_t);
+void control_buf_unref(struct fd_buf *);
+int control_queue_buf(struct fd_list *, struct fd_buf *);
 int control_queue(struct fd_list *, void *, size_t);
+int control_broadcast(struct dhcpcd_ctx *, void *, size_t);
 void control_recvdata(struct fd_list *fd, char *, size_t);
+
+struct interface;
+void control_state_init(struct dhcpcd_ctx *);
+void control_state_free(struct dhcpcd_ctx *);
+void control_ifchanged(struct interface *);
+void control_ifdeparted(struct interface *);
+int control_state_request(struct fd_list *, const struct ctl_req *);
 #endif
@@ -56,6 +56,9 @@
 #ifndef LEASEFILE6
 # define LEASEFILE6		LEASEFILE "6"
 #endif
+#ifndef LEASELOG
+# define LEASELOG		DBDIR "/leases.log"
+#endif
 #ifndef PIDFILE
 # define PIDFILE		RUNDIR "/%s%s%spid"
 #endif
@@ -66,6 +69,12 @@
 # define RDM_MONOFILE		DBDIR "/rdm_monotonic"
 #endif
 
+/* Maximum number of hook scripts to run at once.
+ * Scripts for the same interface are always run in order. */
+#ifndef SCRIPT_JOBS_MAX
+# define SCRIPT_JOBS_MAX	4
+#endif
+
 #ifndef NO_SIGNALS
 #  define USE_SIGNALS
 #endif
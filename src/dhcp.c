@@ -70,10 +70,12 @@
 #include "if.h"
 #include "ipv4.h"
 #include "ipv4ll.h"
+#include "lease.h"
 #include "logerr.h"
 #include "privsep.h"
 #include "sa.h"
 #include "script.h"
+#include "workers.h"
 
 #define DAD		"Duplicate address detected"
 #define DHCP_MIN_LEASE	20
@@ -167,33 +169,44 @@ dhcp_printoptions(const struct dhcpcd_ctx *ctx,
 	}
 }
 
-static const uint8_t *
-get_option(struct dhcpcd_ctx *ctx,
-    const struct bootp *bootp, size_t bootp_len,
-    unsigned int opt, size_t *opt_len)
+/*
+ * Options are looked up many times for each message we accept,
+ * so instead of walking the options area each time we index every
+ * option in one pass and then return from the index.
+ * Options split over several areas (RFC 3396) are concatenated
+ * when the index is built.
+ * A message is indexed once when it is received or read from a lease,
+ * and that index moves with the message when it is stored in our state.
+ * The offer, new and old messages in our state each own their index
+ * and free it with the message.
+ * Only if an index could not be allocated is a message indexed into
+ * a scratch index on each lookup.
+ */
+#define	DHCP_OPTIDX_NONE	0
+#define	DHCP_OPTIDX_ONE		1	/* offset into the message */
+#define	DHCP_OPTIDX_CAT		2	/* offset into idx_cat */
+
+struct dhcp_optidx {
+	const struct bootp *idx_bootp;	/* message indexed */
+	size_t idx_len;
+	uint8_t *idx_cat;		/* concatenated split options */
+	size_t idx_catsize;
+	int idx_error;			/* errno if the message is bad */
+	uint8_t idx_type[256];
+	uint32_t idx_off[256];
+	uint32_t idx_optlen[256];
+};
+
+static int
+dhcp_optidx_walk(struct dhcp_optidx *idx,
+    const struct bootp *bootp, size_t bootp_len, bool cat)
 {
 	const uint8_t *p, *e;
-	uint8_t l, o, ol, overl, *bp;
-	const uint8_t *op;
-	size_t bl;
-
-	if (bootp == NULL || bootp_len < DHCP_MIN_LEN) {
-		errno = EINVAL;
-		return NULL;
-	}
-
-	/* Check we have the magic cookie */
-	if (!IS_DHCP(bootp)) {
-		errno = ENOTSUP;
-		return NULL;
-	}
+	uint8_t l, o, overl;
 
 	p = bootp->vend + 4; /* options after the 4 byte cookie */
 	e = (const uint8_t *)bootp + bootp_len;
-	ol = o = overl = 0;
-	bp = NULL;
-	op = NULL;
-	bl = 0;
+	overl = 0;
 	while (p < e) {
 		o = *p++;
 		switch (o) {
@@ -212,23 +225,19 @@ get_option(struct dhcpcd_ctx *ctx,
 				p = bootp->sname;
 				e = p + sizeof(bootp->sname);
 			} else
-				goto exit;
+				return 0;
 			/* No length to read */
 			continue;
 		}
 
 		/* Check we can read the length */
-		if (p == e) {
-			errno = EINVAL;
-			return NULL;
-		}
+		if (p == e)
+			return -1;
 		l = *p++;
 
 		/* Check we can read the option data, if present */
-		if (p + l > e) {
-			errno = EINVAL;
-			return NULL;
-		}
+		if (p + l > e)
+			return -1;
 
 		if (o == DHO_OPTSOVERLOADED) {
 			/* Ensure we only get this option once by setting
@@ -239,59 +248,255 @@ get_option(struct dhcpcd_ctx *ctx,
 				overl = 0x80 | p[0];
 		}
 
-		if (o == opt) {
-			if (op) {
-				/* We must concatonate the options. */
-				if (bl + l > ctx->opt_buffer_len) {
-					size_t pos;
-					uint8_t *nb;
-
-					if (bp)
-						pos = (size_t)
-						    (bp - ctx->opt_buffer);
-					else
-						pos = 0;
-					nb = realloc(ctx->opt_buffer, bl + l);
-					if (nb == NULL)
-						return NULL;
-					ctx->opt_buffer = nb;
-					ctx->opt_buffer_len = bl + l;
-					bp = ctx->opt_buffer + pos;
-				}
-				if (bp == NULL)
-					bp = ctx->opt_buffer;
-				memcpy(bp, op, ol);
-				bp += ol;
+		if (cat) {
+			if (idx->idx_type[o] == DHCP_OPTIDX_CAT) {
+				memcpy(idx->idx_cat + idx->idx_off[o] +
+				    idx->idx_optlen[o], p, l);
+				idx->idx_optlen[o] += l;
+			}
+		} else {
+			switch (idx->idx_type[o]) {
+			case DHCP_OPTIDX_NONE:
+				idx->idx_type[o] = DHCP_OPTIDX_ONE;
+				idx->idx_off[o] =
+				    (uint32_t)(p - (const uint8_t *)bootp);
+				idx->idx_optlen[o] = l;
+				break;
+			case DHCP_OPTIDX_ONE:
+				idx->idx_type[o] = DHCP_OPTIDX_CAT;
+				/* FALLTHROUGH */
+			default:
+				idx->idx_optlen[o] += l;
+				break;
 			}
-			ol = l;
-			op = p;
-			bl += ol;
 		}
 		p += l;
 	}
+	return 0;
+}
+
+static int
+dhcp_optidx_build(struct dhcp_optidx *idx,
+    const struct bootp *bootp, size_t bootp_len)
+{
+	size_t catlen;
+	unsigned int o;
+
+	idx->idx_bootp = bootp;
+	idx->idx_len = bootp_len;
+	idx->idx_error = 0;
+	memset(idx->idx_type, DHCP_OPTIDX_NONE, sizeof(idx->idx_type));
+
+	if (bootp_len < DHCP_MIN_LEN || bootp_len > UINT32_MAX) {
+		idx->idx_error = EINVAL;
+		return 0;
+	}
+	/* Check we have the magic cookie */
+	if (!IS_DHCP(bootp)) {
+		idx->idx_error = ENOTSUP;
+		return 0;
+	}
 
-exit:
-	if (opt_len)
-		*opt_len = bl;
-	if (bp) {
-		memcpy(bp, op, ol);
-		return (const uint8_t *)ctx->opt_buffer;
+	if (dhcp_optidx_walk(idx, bootp, bootp_len, false) == -1) {
+		idx->idx_error = EINVAL;
+		return 0;
+	}
+
+	/* Lay out the split options in idx_cat and fill it
+	 * from a second walk. */
+	catlen = 0;
+	for (o = 0; o < __arraycount(idx->idx_type); o++) {
+		if (idx->idx_type[o] != DHCP_OPTIDX_CAT)
+			continue;
+		idx->idx_off[o] = (uint32_t)catlen;
+		catlen += idx->idx_optlen[o];
+		idx->idx_optlen[o] = 0;
+	}
+	if (catlen == 0)
+		return 0;
+	if (catlen > idx->idx_catsize) {
+		uint8_t *nc = realloc(idx->idx_cat, catlen);
+
+		if (nc == NULL) {
+			idx->idx_bootp = NULL;
+			return -1;
+		}
+		idx->idx_cat = nc;
+		idx->idx_catsize = catlen;
+	}
+	return dhcp_optidx_walk(idx, bootp, bootp_len, true);
+}
+
+static void
+dhcp_optidx_free(struct dhcp_optidx *idx)
+{
+
+	if (idx == NULL)
+		return;
+	free(idx->idx_cat);
+	free(idx);
+}
+
+/* (Re)index a message just stored in our state, or free the index
+ * if the message has gone.
+ * If we run out of memory the message is looked up without it. */
+static void
+dhcp_optidx_set(struct dhcp_optidx **idxp,
+    const struct bootp *bootp, size_t bootp_len)
+{
+
+	if (bootp == NULL || bootp_len == 0) {
+		dhcp_optidx_free(*idxp);
+		*idxp = NULL;
+		return;
+	}
+	if (*idxp == NULL && (*idxp = calloc(1, sizeof(**idxp))) == NULL) {
+		logerr(__func__);
+		return;
+	}
+	if (dhcp_optidx_build(*idxp, bootp, bootp_len) == -1) {
+		logerr(__func__);
+		dhcp_optidx_free(*idxp);
+		*idxp = NULL;
+	}
+}
+
+/* Index the message being handled, which is pinned to the buffer
+ * it arrived in until dhcp_optidx_take() moves it into our state. */
+static void
+dhcp_optidx_recv(struct dhcpcd_ctx *ctx,
+    const struct bootp *bootp, size_t bootp_len)
+{
+
+	if (ctx->opt_recv == NULL &&
+	    (ctx->opt_recv = calloc(1, sizeof(*ctx->opt_recv))) == NULL)
+	{
+		logerr(__func__);
+		return;
+	}
+	if (dhcp_optidx_build(ctx->opt_recv, bootp, bootp_len) == -1) {
+		logerr(__func__);
+		dhcp_optidx_free(ctx->opt_recv);
+		ctx->opt_recv = NULL;
+	}
+}
+
+/* The buffer the message was in is about to be reused or freed. */
+static void
+dhcp_optidx_unpin(struct dhcpcd_ctx *ctx)
+{
+
+	if (ctx->opt_recv != NULL)
+		ctx->opt_recv->idx_bootp = NULL;
+}
+
+/* The message being handled from has been copied to bootp in our state,
+ * so move its index over rather than index the copy again. */
+static void
+dhcp_optidx_take(struct dhcpcd_ctx *ctx, struct dhcp_optidx **idxp,
+    const struct bootp *from, const struct bootp *bootp, size_t bootp_len)
+{
+	struct dhcp_optidx *idx = ctx->opt_recv;
+
+	if (idx == NULL || bootp == NULL ||
+	    idx->idx_bootp != from || idx->idx_len != bootp_len)
+	{
+		dhcp_optidx_unpin(ctx);
+		dhcp_optidx_set(idxp, bootp, bootp_len);
+		return;
 	}
-	if (op)
-		return op;
+
+	/* Offsets are from the start of the message,
+	 * so only the message has to change.
+	 * Keep the old index to build the next message in. */
+	idx->idx_bootp = bootp;
+	ctx->opt_recv = *idxp;
+	dhcp_optidx_unpin(ctx);
+	*idxp = idx;
+}
+
+static struct dhcp_optidx *
+dhcp_optidx_get(const struct interface *ifp,
+    const struct bootp *bootp, size_t bootp_len)
+{
+	const struct dhcp_state *state = D_CSTATE(ifp);
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct dhcp_optidx *idx;
+
+	/* Messages may swap places in our state, so match on
+	 * the message rather than where it is stored. */
+	if (state != NULL) {
+		idx = state->new_idx;
+		if (idx != NULL && idx->idx_bootp == bootp &&
+		    idx->idx_len == bootp_len)
+			return idx;
+		idx = state->offer_idx;
+		if (idx != NULL && idx->idx_bootp == bootp &&
+		    idx->idx_len == bootp_len)
+			return idx;
+		idx = state->old_idx;
+		if (idx != NULL && idx->idx_bootp == bootp &&
+		    idx->idx_len == bootp_len)
+			return idx;
+	}
+	idx = ctx->opt_recv;
+	if (idx != NULL && idx->idx_bootp == bootp &&
+	    idx->idx_len == bootp_len)
+		return idx;
+
+	if (ctx->opt_scratch == NULL &&
+	    (ctx->opt_scratch = calloc(1, sizeof(*idx))) == NULL)
+		return NULL;
+	if (dhcp_optidx_build(ctx->opt_scratch, bootp, bootp_len) == -1)
+		return NULL;
+	return ctx->opt_scratch;
+}
+
+static const uint8_t *
+get_option(const struct interface *ifp,
+    const struct bootp *bootp, size_t bootp_len,
+    unsigned int opt, size_t *opt_len)
+{
+	struct dhcp_optidx *idx;
+
+	if (bootp == NULL || opt > UINT8_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if ((idx = dhcp_optidx_get(ifp, bootp, bootp_len)) == NULL)
+		return NULL;
+	if (idx->idx_error != 0) {
+		errno = idx->idx_error;
+		return NULL;
+	}
+
+	switch (idx->idx_type[opt]) {
+	case DHCP_OPTIDX_ONE:
+		if (opt_len)
+			*opt_len = idx->idx_optlen[opt];
+		return (const uint8_t *)bootp + idx->idx_off[opt];
+	case DHCP_OPTIDX_CAT:
+		if (opt_len)
+			*opt_len = idx->idx_optlen[opt];
+		return idx->idx_cat + idx->idx_off[opt];
+	}
+
+	if (opt_len)
+		*opt_len = 0;
 	errno = ENOENT;
 	return NULL;
 }
 
 static int
-get_option_addr(struct dhcpcd_ctx *ctx,
+get_option_addr(const struct interface *ifp,
     struct in_addr *a, const struct bootp *bootp, size_t bootp_len,
     uint8_t option)
 {
 	const uint8_t *p;
 	size_t len;
 
-	p = get_option(ctx, bootp, bootp_len, option, &len);
+	p = get_option(ifp, bootp, bootp_len, option, &len);
 	if (!p || len < (ssize_t)sizeof(a->s_addr))
 		return -1;
 	memcpy(&a->s_addr, p, sizeof(a->s_addr));
@@ -299,14 +504,14 @@ get_option_addr(struct dhcpcd_ctx *ctx,
 }
 
 static int
-get_option_uint32(struct dhcpcd_ctx *ctx,
+get_option_uint32(const struct interface *ifp,
     uint32_t *i, const struct bootp *bootp, size_t bootp_len, uint8_t option)
 {
 	const uint8_t *p;
 	size_t len;
 	uint32_t d;
 
-	p = get_option(ctx, bootp, bootp_len, option, &len);
+	p = get_option(ifp, bootp, bootp_len, option, &len);
 	if (!p || len < (ssize_t)sizeof(d))
 		return -1;
 	memcpy(&d, p, sizeof(d));
@@ -316,14 +521,14 @@ get_option_uint32(struct dhcpcd_ctx *ctx,
 }
 
 static int
-get_option_uint16(struct dhcpcd_ctx *ctx,
+get_option_uint16(const struct interface *ifp,
     uint16_t *i, const struct bootp *bootp, size_t bootp_len, uint8_t option)
 {
 	const uint8_t *p;
 	size_t len;
 	uint16_t d;
 
-	p = get_option(ctx, bootp, bootp_len, option, &len);
+	p = get_option(ifp, bootp, bootp_len, option, &len);
 	if (!p || len < (ssize_t)sizeof(d))
 		return -1;
 	memcpy(&d, p, sizeof(d));
@@ -333,13 +538,13 @@ get_option_uint16(struct dhcpcd_ctx *ctx,
 }
 
 static int
-get_option_uint8(struct dhcpcd_ctx *ctx,
+get_option_uint8(const struct interface *ifp,
     uint8_t *i, const struct bootp *bootp, size_t bootp_len, uint8_t option)
 {
 	const uint8_t *p;
 	size_t len;
 
-	p = get_option(ctx, bootp, bootp_len, option, &len);
+	p = get_option(ifp, bootp, bootp_len, option, &len);
 	if (!p || len < (ssize_t)sizeof(*p))
 		return -1;
 	if (i)
@@ -519,14 +724,14 @@ print_rfc3361(FILE *fp, const uint8_t *data, size_t dl)
 }
 
 static char *
-get_option_string(struct dhcpcd_ctx *ctx,
+get_option_string(const struct interface *ifp,
     const struct bootp *bootp, size_t bootp_len, uint8_t option)
 {
 	size_t len;
 	const uint8_t *p;
 	char *s;
 
-	p = get_option(ctx, bootp, bootp_len, option, &len);
+	p = get_option(ifp, bootp, bootp_len, option, &len);
 	if (!p || len == 0 || *p == '\0')
 		return NULL;
 
@@ -585,12 +790,12 @@ get_option_routes(rb_tree_t *routes, struct interface *ifp,
 
 	/* If we have CSR's then we MUST use these only */
 	if (!has_option_mask(ifo->nomask, DHO_CSR))
-		p = get_option(ifp->ctx, bootp, bootp_len, DHO_CSR, &len);
+		p = get_option(ifp, bootp, bootp_len, DHO_CSR, &len);
 	else
 		p = NULL;
 	/* Check for crappy MS option */
 	if (!p && !has_option_mask(ifo->nomask, DHO_MSCSR)) {
-		p = get_option(ifp->ctx, bootp, bootp_len, DHO_MSCSR, &len);
+		p = get_option(ifp, bootp, bootp_len, DHO_MSCSR, &len);
 		if (p)
 			csr = "MS ";
 	}
@@ -611,7 +816,7 @@ get_option_routes(rb_tree_t *routes, struct interface *ifp,
 	n = 0;
 	/* OK, get our static routes first. */
 	if (!has_option_mask(ifo->nomask, DHO_STATICROUTE))
-		p = get_option(ifp->ctx, bootp, bootp_len,
+		p = get_option(ifp, bootp, bootp_len,
 		    DHO_STATICROUTE, &len);
 	else
 		p = NULL;
@@ -653,7 +858,7 @@ get_option_routes(rb_tree_t *routes, struct interface *ifp,
 
 	/* Now grab our routers */
 	if (!has_option_mask(ifo->nomask, DHO_ROUTER))
-		p = get_option(ifp->ctx, bootp, bootp_len, DHO_ROUTER, &len);
+		p = get_option(ifp, bootp, bootp_len, DHO_ROUTER, &len);
 	else
 		p = NULL;
 	if (p && len % 4 == 0) {
@@ -687,7 +892,7 @@ dhcp_get_mtu(const struct interface *ifp)
 	mtu = 0; /* bogus gcc warning */
 	if ((state = D_CSTATE(ifp)) == NULL ||
 	    has_option_mask(ifp->options->nomask, DHO_MTU) ||
-	    get_option_uint16(ifp->ctx, &mtu,
+	    get_option_uint16(ifp, &mtu,
 			      state->new, state->new_len, DHO_MTU) == -1)
 		return 0;
 	return mtu;
@@ -1166,7 +1371,7 @@ read_lease(struct interface *ifp, struct bootp **bootp)
 	} else {
 		logdebugx("%s: reading lease: %s",
 		    ifp->name, state->leasefile);
-		sbytes = dhcp_readfile(ifp->ctx, state->leasefile,
+		sbytes = lease_read(ifp->ctx, state->leasefile,
 		    buf.buf, sizeof(buf.buf));
 	}
 	if (sbytes == -1) {
@@ -1185,18 +1390,19 @@ read_lease(struct interface *ifp, struct bootp **bootp)
 		logerrx("%s: %s: truncated lease", ifp->name, __func__);
 		return 0;
 	}
+	dhcp_optidx_recv(ifp->ctx, &buf.bootp, bytes);
 
 	if (ifp->ctx->options & DHCPCD_DUMPLEASE)
 		goto out;
 
 	/* We may have found a BOOTP server */
-	if (get_option_uint8(ifp->ctx, &type, &buf.bootp, bytes,
+	if (get_option_uint8(ifp, &type, &buf.bootp, bytes,
 	    DHO_MESSAGETYPE) == -1)
 		type = 0;
 
 #ifdef AUTH
 	/* Authenticate the message */
-	auth = get_option(ifp->ctx, &buf.bootp, bytes,
+	auth = get_option(ifp, &buf.bootp, bytes,
 	    DHO_AUTHENTICATION, &auth_len);
 	if (auth) {
 		if (dhcp_auth_validate(&state->auth, &ifp->options->auth,
@@ -1225,6 +1431,10 @@ out:
 		return 0;
 	}
 	memcpy(*bootp, buf.buf, bytes);
+	/* Pin the index to the copy for the caller to take. */
+	if (ifp->ctx->opt_recv != NULL &&
+	    ifp->ctx->opt_recv->idx_bootp == &buf.bootp)
+		ifp->ctx->opt_recv->idx_bootp = *bootp;
 	return bytes;
 }
 
@@ -1293,7 +1503,7 @@ dhcp_env(FILE *fenv, const char *prefix, const struct interface *ifp,
 	uint32_t en;
 
 	ifo = ifp->options;
-	if (get_option_uint8(ifp->ctx, &overl, bootp, bootp_len,
+	if (get_option_uint8(ifp, &overl, bootp, bootp_len,
 	    DHO_OPTSOVERLOADED) == -1)
 		overl = 0;
 
@@ -1304,7 +1514,7 @@ dhcp_env(FILE *fenv, const char *prefix, const struct interface *ifp,
 		if (efprintf(fenv, "%s_ip_address=%s",
 		    prefix, inet_ntoa(addr)) == -1)
 			return -1;
-		if (get_option_addr(ifp->ctx, &net,
+		if (get_option_addr(ifp, &net,
 		    bootp, bootp_len, DHO_SUBNETMASK) == -1) {
 			net.s_addr = ipv4_getnetmask(addr.s_addr);
 			if (efprintf(fenv, "%s_subnet_mask=%s",
@@ -1314,7 +1524,7 @@ dhcp_env(FILE *fenv, const char *prefix, const struct interface *ifp,
 		if (efprintf(fenv, "%s_subnet_cidr=%d",
 		    prefix, inet_ntocidr(net))== -1)
 			return -1;
-		if (get_option_addr(ifp->ctx, &brd,
+		if (get_option_addr(ifp, &brd,
 		    bootp, bootp_len, DHO_BROADCAST) == -1)
 		{
 			brd.s_addr = addr.s_addr | ~net.s_addr;
@@ -1363,7 +1573,7 @@ dhcp_env(FILE *fenv, const char *prefix, const struct interface *ifp,
 			continue;
 		if (dhcp_getoverride(ifo, opt->option))
 			continue;
-		p = get_option(ifp->ctx, bootp, bootp_len, opt->option, &pl);
+		p = get_option(ifp, bootp, bootp_len, opt->option, &pl);
 		if (p == NULL)
 			continue;
 		dhcp_envoption(ifp->ctx, fenv, prefix, ifp->name,
@@ -1389,7 +1599,7 @@ dhcp_env(FILE *fenv, const char *prefix, const struct interface *ifp,
 	{
 		if (has_option_mask(ifo->nomask, opt->option))
 			continue;
-		p = get_option(ifp->ctx, bootp, bootp_len, opt->option, &pl);
+		p = get_option(ifp, bootp, bootp_len, opt->option, &pl);
 		if (p == NULL)
 			continue;
 		dhcp_envoption(ifp->ctx, fenv, prefix, ifp->name,
@@ -1403,14 +1613,12 @@ static void
 get_lease(struct interface *ifp,
     struct dhcp_lease *lease, const struct bootp *bootp, size_t len)
 {
-	struct dhcpcd_ctx *ctx;
 
 	assert(bootp != NULL);
 
 	memcpy(&lease->cookie, bootp->vend, sizeof(lease->cookie));
 	/* BOOTP does not set yiaddr for replies when ciaddr is set. */
 	lease->addr.s_addr = bootp->yiaddr ? bootp->yiaddr : bootp->ciaddr;
-	ctx = ifp->ctx;
 	if (ifp->options->options & (DHCPCD_STATIC | DHCPCD_INFORM)) {
 		if (ifp->options->req_addr.s_addr != INADDR_ANY) {
 			lease->mask = ifp->options->req_mask;
@@ -1428,25 +1636,25 @@ get_lease(struct interface *ifp,
 			lease->brd = ia->brd;
 		}
 	} else {
-		if (get_option_addr(ctx, &lease->mask, bootp, len,
+		if (get_option_addr(ifp, &lease->mask, bootp, len,
 		    DHO_SUBNETMASK) == -1)
 			lease->mask.s_addr =
 			    ipv4_getnetmask(lease->addr.s_addr);
-		if (get_option_addr(ctx, &lease->brd, bootp, len,
+		if (get_option_addr(ifp, &lease->brd, bootp, len,
 		    DHO_BROADCAST) == -1)
 			lease->brd.s_addr =
 			    lease->addr.s_addr | ~lease->mask.s_addr;
 	}
-	if (get_option_uint32(ctx, &lease->leasetime,
+	if (get_option_uint32(ifp, &lease->leasetime,
 	    bootp, len, DHO_LEASETIME) != 0)
 		lease->leasetime = DHCP_INFINITE_LIFETIME;
-	if (get_option_uint32(ctx, &lease->renewaltime,
+	if (get_option_uint32(ifp, &lease->renewaltime,
 	    bootp, len, DHO_RENEWALTIME) != 0)
 		lease->renewaltime = 0;
-	if (get_option_uint32(ctx, &lease->rebindtime,
+	if (get_option_uint32(ifp, &lease->rebindtime,
 	    bootp, len, DHO_REBINDTIME) != 0)
 		lease->rebindtime = 0;
-	if (get_option_addr(ctx, &lease->server, bootp, len, DHO_SERVERID) != 0)
+	if (get_option_addr(ifp, &lease->server, bootp, len, DHO_SERVERID) != 0)
 		lease->server.s_addr = INADDR_ANY;
 }
 
@@ -1931,7 +2139,7 @@ dhcp_expire(void *arg)
 	} else {
 		logerrx("%s: DHCP lease expired", ifp->name);
 		dhcp_drop(ifp, "EXPIRE");
-		dhcp_unlink(ifp->ctx, state->leasefile);
+		lease_unlink(ifp->ctx, state->leasefile);
 	}
 	state->interval = 0;
 	dhcp_discover(ifp);
@@ -2057,7 +2265,7 @@ dhcp_addr_duplicated(struct interface *ifp, struct in_addr *ia)
 
 	/* RFC 2131 3.1.5, Client-server interaction */
 	logerrx("%s: DAD detected %s", ifp->name, inet_ntoa(*ia));
-	dhcp_unlink(ifp->ctx, state->leasefile);
+	lease_unlink(ifp->ctx, state->leasefile);
 	if (!(opts & DHCPCD_STATIC) && !state->lease.frominfo)
 		dhcp_decline(ifp);
 #ifdef IN_IFF_DUPLICATED
@@ -2235,12 +2443,16 @@ dhcp_bind(struct interface *ifp)
 	 * normally when two interfaces have a lease matching IP addresses. */
 	if (state->offer) {
 		free(state->old);
+		dhcp_optidx_free(state->old_idx);
 		state->old = state->new;
 		state->old_len = state->new_len;
+		state->old_idx = state->new_idx;
 		state->new = state->offer;
 		state->new_len = state->offer_len;
+		state->new_idx = state->offer_idx;
 		state->offer = NULL;
 		state->offer_len = 0;
+		state->offer_idx = NULL;
 	}
 	get_lease(ifp, lease, state->new, state->new_len);
 	if (ifo->options & DHCPCD_STATIC) {
@@ -2305,6 +2517,9 @@ dhcp_bind(struct interface *ifp)
 		state->reason = "TEST";
 		script_runreason(ifp, state->reason);
 		eloop_exit(ctx->eloop, EXIT_SUCCESS);
+		/* Don't process any more frames from this read. */
+		if (state->bpf != NULL)
+			state->bpf->bpf_flags |= BPF_EOF;
 		return;
 	}
 	if (state->reason == NULL) {
@@ -2325,12 +2540,15 @@ dhcp_bind(struct interface *ifp)
 	if (lease->leasetime == DHCP_INFINITE_LIFETIME)
 		lease->renewaltime = lease->rebindtime = lease->leasetime;
 	else {
-		eloop_timeout_add_sec(ctx->eloop,
-		    lease->renewaltime, dhcp_startrenew, ifp);
-		eloop_timeout_add_sec(ctx->eloop,
-		    lease->rebindtime, dhcp_rebind, ifp);
-		eloop_timeout_add_sec(ctx->eloop,
-		    lease->leasetime, dhcp_expire, ifp);
+		eloop_timeout_add_sec_slack(ctx->eloop,
+		    lease->renewaltime, ELOOP_SLACK_SEC(lease->renewaltime),
+		    dhcp_startrenew, ifp);
+		eloop_timeout_add_sec_slack(ctx->eloop,
+		    lease->rebindtime, ELOOP_SLACK_SEC(lease->rebindtime),
+		    dhcp_rebind, ifp);
+		eloop_timeout_add_sec_slack(ctx->eloop,
+		    lease->leasetime, ELOOP_SLACK_SEC(lease->leasetime),
+		    dhcp_expire, ifp);
 		logdebugx("%s: renew in %"PRIu32" seconds, rebind in %"PRIu32
 		    " seconds",
 		    ifp->name, lease->renewaltime, lease->rebindtime);
@@ -2340,9 +2558,9 @@ dhcp_bind(struct interface *ifp)
 	    !(ifo->options & (DHCPCD_INFORM | DHCPCD_STATIC))) {
 		logdebugx("%s: writing lease: %s",
 		    ifp->name, state->leasefile);
-		if (dhcp_writefile(ifp->ctx, state->leasefile, 0640,
+		if (lease_write(ifp->ctx, state->leasefile, 0640,
 		    state->new, state->new_len) == -1)
-			logerr("dhcp_writefile: %s", state->leasefile);
+			logerr("lease_write: %s", state->leasefile);
 	}
 
 	old_state = state->added;
@@ -2381,8 +2599,9 @@ dhcp_bind(struct interface *ifp)
 	dhcp_closebpf(ifp);
 
 openudp:
-	/* If not in manager mode, open an address specific socket. */
-	if (ctx->options & DHCPCD_MANAGER ||
+	/* If not in manager mode, open an address specific socket.
+	 * Workers cannot share the wildcard socket, so they do too. */
+	if ((ctx->options & DHCPCD_MANAGER && !IN_WORKER(ctx)) ||
 	    ifo->options & DHCPCD_STATIC ||
 	    (state->old != NULL &&
 	     state->old->yiaddr == state->new->yiaddr &&
@@ -2555,6 +2774,7 @@ dhcp_static(struct interface *ifp)
 	state->offer_len = dhcp_message_new(&state->offer,
 	    ia ? &ia->addr : &ifo->req_addr,
 	    ia ? &ia->mask : &ifo->req_mask);
+	dhcp_optidx_set(&state->offer_idx, state->offer, state->offer_len);
 	if (state->offer_len)
 #if defined(ARP) || defined(KERNEL_RFC5227)
 		dhcp_arp_bind(ifp);
@@ -2577,6 +2797,7 @@ dhcp_inform(struct interface *ifp)
 	free(state->offer);
 	state->offer = NULL;
 	state->offer_len = 0;
+	dhcp_optidx_set(&state->offer_idx, NULL, 0);
 
 	if (ifo->req_addr.s_addr == INADDR_ANY) {
 		ia = ipv4_iffindaddr(ifp, NULL, NULL);
@@ -2604,6 +2825,8 @@ dhcp_inform(struct interface *ifp)
 				ipv4_deladdr(ia, 1);
 			state->offer_len = dhcp_message_new(&state->offer,
 			    &ifo->req_addr, &ifo->req_mask);
+			dhcp_optidx_set(&state->offer_idx,
+			    state->offer, state->offer_len);
 #ifdef ARP
 			if (dhcp_arp_address(ifp) != 1)
 				return;
@@ -2617,6 +2840,7 @@ dhcp_inform(struct interface *ifp)
 	state->addr = ia;
 	state->offer_len = dhcp_message_new(&state->offer,
 	    &ia->addr, &ia->mask);
+	dhcp_optidx_set(&state->offer_idx, state->offer, state->offer_len);
 	if (state->offer_len) {
 		dhcp_new_xid(ifp);
 		get_lease(ifp, &state->lease, state->offer, state->offer_len);
@@ -2786,7 +3010,7 @@ dhcp_drop(struct interface *ifp, const char *reason)
 			return;
 		state->state = DHS_RELEASE;
 
-		dhcp_unlink(ifp->ctx, state->leasefile);
+		lease_unlink(ifp->ctx, state->leasefile);
 		if (if_is_link_up(ifp) &&
 		    state->new != NULL &&
 		    state->lease.server.s_addr != INADDR_ANY)
@@ -2812,7 +3036,7 @@ dhcp_drop(struct interface *ifp, const char *reason)
 		 * If dhcpcd is restarted, the token is lost.
 		 * XXX persist this in another file?
 		 */
-		dhcp_unlink(ifp->ctx, state->leasefile);
+		lease_unlink(ifp->ctx, state->leasefile);
 	}
 #endif
 
@@ -2829,11 +3053,15 @@ dhcp_drop(struct interface *ifp, const char *reason)
 	free(state->offer);
 	state->offer = NULL;
 	state->offer_len = 0;
+	dhcp_optidx_set(&state->offer_idx, NULL, 0);
 	free(state->old);
+	dhcp_optidx_free(state->old_idx);
 	state->old = state->new;
 	state->old_len = state->new_len;
+	state->old_idx = state->new_idx;
 	state->new = NULL;
 	state->new_len = 0;
+	state->new_idx = NULL;
 	state->reason = reason;
 	if (ifp->options->options & DHCPCD_CONFIGURE)
 		ipv4_applyaddr(ifp);
@@ -2845,6 +3073,7 @@ dhcp_drop(struct interface *ifp, const char *reason)
 	free(state->old);
 	state->old = NULL;
 	state->old_len = 0;
+	dhcp_optidx_set(&state->old_idx, NULL, 0);
 	state->lease.addr.s_addr = 0;
 	ifp->options->options &= ~(DHCPCD_CSR_WARNED |
 	    DHCPCD_ROUTER_HOST_ROUTE_WARNED);
@@ -2889,7 +3118,7 @@ log_dhcp(int loglevel, const char *msg,
 	uint8_t overl;
 
 	if (strcmp(msg, "NAK:") == 0) {
-		a = get_option_string(ifp->ctx, bootp, bootp_len, DHO_MESSAGE);
+		a = get_option_string(ifp, bootp, bootp_len, DHO_MESSAGE);
 		if (a) {
 			char *tmp;
 			size_t al, tmpl;
@@ -2917,8 +3146,8 @@ log_dhcp(int loglevel, const char *msg,
 		a = NULL;
 
 	tfrom = "from";
-	r = get_option_addr(ifp->ctx, &addr, bootp, bootp_len, DHO_SERVERID);
-	if (get_option_uint8(ifp->ctx, &overl, bootp, bootp_len,
+	r = get_option_addr(ifp, &addr, bootp, bootp_len, DHO_SERVERID);
+	if (get_option_uint8(ifp, &overl, bootp, bootp_len,
 	    DHO_OPTSOVERLOADED) == -1)
 		overl = 0;
 	if (bootp->sname[0] && r == 0 && !(overl & 2)) {
@@ -3055,7 +3284,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 	}
 
 	/* We may have found a BOOTP server */
-	if (get_option_uint8(ifp->ctx, &type,
+	if (get_option_uint8(ifp, &type,
 	    bootp, bootp_len, DHO_MESSAGETYPE) == -1)
 		type = 0;
 	else if (ifo->options & DHCPCD_BOOTP) {
@@ -3066,7 +3295,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 
 #ifdef AUTH
 	/* Authenticate the message */
-	auth = get_option(ifp->ctx, bootp, bootp_len,
+	auth = get_option(ifp, bootp, bootp_len,
 	    DHO_AUTHENTICATION, &auth_len);
 	if (auth) {
 		if (dhcp_auth_validate(&state->auth, &ifo->auth,
@@ -3141,7 +3370,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 	/* Ensure that no reject options are present */
 	for (i = 1; i < 255; i++) {
 		if (has_option_mask(ifo->rejectmask, i) &&
-		    get_option_uint8(ifp->ctx, &tmp,
+		    get_option_uint8(ifp, &tmp,
 		    bootp, bootp_len, (uint8_t)i) == 0)
 		{
 			LOGDHCP(LOG_WARNING, "reject DHCP");
@@ -3152,7 +3381,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 	if (type == DHCP_NAK) {
 		/* For NAK, only check if we require the ServerID */
 		if (has_option_mask(ifo->requiremask, DHO_SERVERID) &&
-		    get_option_addr(ifp->ctx, &addr,
+		    get_option_addr(ifp, &addr,
 		    bootp, bootp_len, DHO_SERVERID) == -1)
 		{
 			LOGDHCP(LOG_WARNING, "reject NAK");
@@ -3161,7 +3390,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 
 		/* We should restart on a NAK */
 		LOGDHCP(LOG_WARNING, "NAK:");
-		if ((msg = get_option_string(ifp->ctx,
+		if ((msg = get_option_string(ifp,
 		    bootp, bootp_len, DHO_MESSAGE)))
 		{
 			logwarnx("%s: message: %s", ifp->name, msg);
@@ -3171,7 +3400,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 			return;
 		if (!(ifp->ctx->options & DHCPCD_TEST)) {
 			dhcp_drop(ifp, "NAK");
-			dhcp_unlink(ifp->ctx, state->leasefile);
+			lease_unlink(ifp->ctx, state->leasefile);
 		}
 
 		/* If we constantly get NAKS then we should slowly back off */
@@ -3190,7 +3419,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 	/* Ensure that all required options are present */
 	for (i = 1; i < 255; i++) {
 		if (has_option_mask(ifo->requiremask, i) &&
-		    get_option_uint8(ifp->ctx, &tmp,
+		    get_option_uint8(ifp, &tmp,
 		    bootp, bootp_len, (uint8_t)i) != 0)
 		{
 			/* If we are BOOTP, then ignore the need for serverid.
@@ -3206,7 +3435,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 	}
 
 	if (has_option_mask(ifo->requestmask, DHO_IPV6_PREFERRED_ONLY)) {
-		if (get_option_uint32(ifp->ctx, &v6only_time, bootp, bootp_len,
+		if (get_option_uint32(ifp, &v6only_time, bootp, bootp_len,
 		    DHO_IPV6_PREFERRED_ONLY) == 0 &&
 		    (state->state == DHS_DISCOVER || state->state == DHS_REBOOT))
 		{
@@ -3225,7 +3454,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 	/* DHCP Auto-Configure, RFC 2563 */
 	if (type == DHCP_OFFER && bootp->yiaddr == 0) {
 		LOGDHCP(LOG_WARNING, "no address given");
-		if ((msg = get_option_string(ifp->ctx,
+		if ((msg = get_option_string(ifp,
 		    bootp, bootp_len, DHO_MESSAGE)))
 		{
 			logwarnx("%s: message: %s", ifp->name, msg);
@@ -3233,7 +3462,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 		}
 #ifdef IPV4LL
 		if (state->state == DHS_DISCOVER &&
-		    get_option_uint8(ifp->ctx, &tmp, bootp, bootp_len,
+		    get_option_uint8(ifp, &tmp, bootp, bootp_len,
 		    DHO_AUTOCONFIGURE) == 0)
 		{
 			switch (tmp) {
@@ -3265,7 +3494,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 
 	if (use_v6only) {
 		dhcp_drop(ifp, "EXPIRE");
-		dhcp_unlink(ifp->ctx, state->leasefile);
+		lease_unlink(ifp->ctx, state->leasefile);
 		eloop_timeout_delete(ifp->ctx->eloop, NULL, ifp);
 		eloop_timeout_add_sec(ifp->ctx->eloop, v6only_time,
 		    dhcp_discover, ifp);
@@ -3302,14 +3531,14 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 		lease->addr.s_addr = bootp->yiaddr;
 		memcpy(&lease->cookie, bootp->vend, sizeof(lease->cookie));
 		if (type == 0 ||
-		    get_option_addr(ifp->ctx,
+		    get_option_addr(ifp,
 		    &lease->server, bootp, bootp_len, DHO_SERVERID) != 0)
 			lease->server.s_addr = INADDR_ANY;
 
 		/* Test for rapid commit in the OFFER */
 		if (!(ifp->ctx->options & DHCPCD_TEST) &&
 		    has_option_mask(ifo->requestmask, DHO_RAPIDCOMMIT) &&
-		    get_option(ifp->ctx, bootp, bootp_len,
+		    get_option(ifp, bootp, bootp_len,
 		    DHO_RAPIDCOMMIT, NULL))
 		{
 			state->state = DHS_REQUEST;
@@ -3322,20 +3551,27 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 			if ((state->offer = malloc(bootp_len)) == NULL) {
 				logerr(__func__);
 				state->offer_len = 0;
+				dhcp_optidx_set(&state->offer_idx, NULL, 0);
 				return;
 			}
 		}
 		state->offer_len = bootp_len;
 		memcpy(state->offer, bootp, bootp_len);
+		dhcp_optidx_take(ifp->ctx, &state->offer_idx,
+		    bootp, state->offer, state->offer_len);
 		bootp_copied = true;
 		if (ifp->ctx->options & DHCPCD_TEST) {
 			free(state->old);
+			dhcp_optidx_free(state->old_idx);
 			state->old = state->new;
 			state->old_len = state->new_len;
+			state->old_idx = state->new_idx;
 			state->new = state->offer;
 			state->new_len = state->offer_len;
+			state->new_idx = state->offer_idx;
 			state->offer = NULL;
 			state->offer_len = 0;
+			state->offer_idx = NULL;
 			state->reason = "TEST";
 			script_runreason(ifp, state->reason);
 			eloop_exit(ifp->ctx->eloop, EXIT_SUCCESS);
@@ -3372,7 +3608,7 @@ dhcp_handledhcp(struct interface *ifp, struct bootp *bootp, size_t bootp_len,
 			/* We only allow ACK of rapid commit DISCOVER. */
 			if (has_option_mask(ifo->requestmask,
 			    DHO_RAPIDCOMMIT) &&
-			    get_option(ifp->ctx, bootp, bootp_len,
+			    get_option(ifp, bootp, bootp_len,
 			    DHO_RAPIDCOMMIT, NULL))
 				state->state = DHS_REQUEST;
 			else {
@@ -3400,11 +3636,14 @@ rapidcommit:
 			if ((state->offer = malloc(bootp_len)) == NULL) {
 				logerr(__func__);
 				state->offer_len = 0;
+				dhcp_optidx_set(&state->offer_idx, NULL, 0);
 				return;
 			}
 		}
 		state->offer_len = bootp_len;
 		memcpy(state->offer, bootp, bootp_len);
+		dhcp_optidx_take(ifp->ctx, &state->offer_idx,
+		    bootp, state->offer, state->offer_len);
 	}
 
 	lease->frominfo = 0;
@@ -3529,6 +3768,7 @@ static void
 dhcp_handlebootp(struct interface *ifp, struct bootp *bootp, size_t len,
     struct in_addr *from)
 {
+	struct dhcpcd_ctx *ctx = ifp->ctx;
 	size_t v;
 
 	if (len < offsetof(struct bootp, vend)) {
@@ -3552,7 +3792,11 @@ dhcp_handlebootp(struct interface *ifp, struct bootp *bootp, size_t len,
 		len++;
 	}
 
+	/* Index the options once for every lookup from here on,
+	 * including any redirection to another interface. */
+	dhcp_optidx_recv(ctx, bootp, len);
 	dhcp_handledhcp(ifp, bootp, len, from);
+	dhcp_optidx_unpin(ctx);
 }
 
 void
@@ -3596,8 +3840,12 @@ dhcp_packet(struct interface *ifp, uint8_t *data, size_t len,
 			return;
 		}
 		len -= fl;
-		/* Move the data to avoid alignment errors. */
-		memmove(data, data + fl, len);
+		/* Move the data to avoid alignment errors.
+		 * Frames from a ring are already aligned. */
+		if (((uintptr_t)(data + fl) & (sizeof(uint32_t) - 1)) == 0)
+			data += fl;
+		else
+			memmove(data, data + fl, len);
 	}
 
 	/* Validate filter. */
@@ -3629,7 +3877,7 @@ static void
 dhcp_readbpf(void *arg, unsigned short events)
 {
 	struct interface *ifp = arg;
-	uint8_t buf[FRAMELEN_MAX];
+	void *frame;
 	ssize_t bytes;
 	struct dhcp_state *state = D_STATE(ifp);
 	struct bpf *bpf = state->bpf;
@@ -3639,7 +3887,7 @@ dhcp_readbpf(void *arg, unsigned short events)
 
 	bpf->bpf_flags &= ~BPF_EOF;
 	while (!(bpf->bpf_flags & BPF_EOF)) {
-		bytes = bpf_read(bpf, buf, sizeof(buf));
+		bytes = bpf_read(bpf, &frame);
 		if (bytes == -1) {
 			if (state->state != DHS_NONE) {
 				logerr("%s: %s", __func__, ifp->name);
@@ -3647,7 +3895,9 @@ dhcp_readbpf(void *arg, unsigned short events)
 			}
 			break;
 		}
-		dhcp_packet(ifp, buf, (size_t)bytes, bpf->bpf_flags);
+		if (bytes == 0)
+			break;
+		dhcp_packet(ifp, frame, (size_t)bytes, bpf->bpf_flags);
 		/* Check we still have a state after processing. */
 		if ((state = D_STATE(ifp)) == NULL)
 			break;
@@ -3815,8 +4065,11 @@ dhcp_free(struct interface *ifp)
 	if (state) {
 		state->state = DHS_NONE;
 		free(state->old);
+		dhcp_optidx_free(state->old_idx);
 		free(state->new);
+		dhcp_optidx_free(state->new_idx);
 		free(state->offer);
+		dhcp_optidx_free(state->offer_idx);
 		free(state->clientid);
 		free(state);
 	}
@@ -3842,8 +4095,10 @@ dhcp_free(struct interface *ifp)
 			ctx->udp_wfd = -1;
 		}
 
-		free(ctx->opt_buffer);
-		ctx->opt_buffer = NULL;
+		dhcp_optidx_free(ctx->opt_recv);
+		ctx->opt_recv = NULL;
+		dhcp_optidx_free(ctx->opt_scratch);
+		ctx->opt_scratch = NULL;
 	}
 }
 
@@ -3892,7 +4147,7 @@ dhcp_init(struct interface *ifp)
 	/* We need to drop the leasefile so that dhcp_start
 	 * doesn't load it. */
 	if (ifo->options & DHCPCD_REQUEST)
-		dhcp_unlink(ifp->ctx, state->leasefile);
+		lease_unlink(ifp->ctx, state->leasefile);
 
 	free(state->clientid);
 	state->clientid = NULL;
@@ -3965,9 +4220,9 @@ dhcp_start1(void *arg)
 	/* Listen on *.*.*.*:bootpc so that the kernel never sends an
 	 * ICMP port unreachable message back to the DHCP server.
 	 * Only do this in manager mode so we don't swallow messages
-	 * for dhcpcd running on another interface. */
+	 * for dhcpcd running on another interface or worker. */
 	if ((ctx->options & (DHCPCD_MANAGER|DHCPCD_PRIVSEP)) == DHCPCD_MANAGER
-	    && ctx->udp_rfd == -1)
+	    && !IN_WORKER(ctx) && ctx->udp_rfd == -1)
 	{
 		ctx->udp_rfd = dhcp_openudp(NULL);
 		if (ctx->udp_rfd == -1) {
@@ -3997,6 +4252,7 @@ dhcp_start1(void *arg)
 	free(state->offer);
 	state->offer = NULL;
 	state->offer_len = 0;
+	dhcp_optidx_set(&state->offer_idx, NULL, 0);
 
 #ifdef ARPING
 	if (ifo->arping_len && state->arping_index < ifo->arping_len) {
@@ -4019,6 +4275,8 @@ dhcp_start1(void *arg)
 	nolease = state->offer && ifp->ctx->options & DHCPCD_TEST;
 	if (!nolease && ifo->options & DHCPCD_DHCP) {
 		state->offer_len = read_lease(ifp, &state->offer);
+		dhcp_optidx_take(ifp->ctx, &state->offer_idx,
+		    state->offer, state->offer, state->offer_len);
 		/* Check the saved lease matches the type we want */
 		if (state->offer) {
 #ifdef IN_IFF_DUPLICATED
@@ -4040,6 +4298,7 @@ dhcp_start1(void *arg)
 				free(state->offer);
 				state->offer = NULL;
 				state->offer_len = 0;
+				dhcp_optidx_set(&state->offer_idx, NULL, 0);
 			}
 		}
 	}
@@ -4061,6 +4320,8 @@ dhcp_start1(void *arg)
 				memcpy(state->new,
 				    state->offer, state->offer_len);
 				state->new_len = state->offer_len;
+				dhcp_optidx_set(&state->new_idx,
+				    state->new, state->new_len);
 				state->addr = ia;
 				state->added |= STATE_ADDED | STATE_FAKE;
 				rt_build(ifp->ctx, AF_INET);
@@ -4071,9 +4332,10 @@ dhcp_start1(void *arg)
 			free(state->offer);
 			state->offer = NULL;
 			state->offer_len = 0;
+			dhcp_optidx_set(&state->offer_idx, NULL, 0);
 		} else if (!(ifo->options & DHCPCD_LASTLEASE_EXTEND) &&
 		    state->lease.leasetime != DHCP_INFINITE_LIFETIME &&
-		    dhcp_filemtime(ifp->ctx, state->leasefile, &mtime) == 0)
+		    lease_mtime(ifp->ctx, state->leasefile, &mtime) == 0)
 		{
 			time_t now;
 
@@ -4087,6 +4349,7 @@ dhcp_start1(void *arg)
 				free(state->offer);
 				state->offer = NULL;
 				state->offer_len = 0;
+				dhcp_optidx_set(&state->offer_idx, NULL, 0);
 				state->lease.addr.s_addr = 0;
 				/* Technically we should discard the lease
 				 * as it's expired, just as DHCPv6 addresses
@@ -4281,7 +4544,10 @@ dhcp_handleifa(int cmd, struct ipv4_addr *ia, pid_t pid)
 		return ia;
 
 	free(state->old);
+	dhcp_optidx_free(state->old_idx);
 	state->old = state->new;
+	state->old_idx = state->new_idx;
+	state->new_idx = NULL;
 	state->new_len = dhcp_message_new(&state->new, &ia->addr, &ia->mask);
 	if (state->new == NULL)
 		return ia;
@@ -4290,6 +4556,7 @@ dhcp_handleifa(int cmd, struct ipv4_addr *ia, pid_t pid)
 			if (i != DHO_ROUTER && has_option_mask(ifo->dstmask,i))
 				dhcp_message_add_addr(state->new, i, ia->brd);
 	}
+	dhcp_optidx_set(&state->new_idx, state->new, state->new_len);
 	state->reason = "STATIC";
 	rt_build(ifp->ctx, AF_INET);
 	script_runreason(ifp, state->reason);
@@ -4316,6 +4583,8 @@ dhcp_dump(struct interface *ifp)
 		return -1;
 	}
 	state->new_len = read_lease(ifp, &state->new);
+	dhcp_optidx_take(ifp->ctx, &state->new_idx,
+	    state->new, state->new, state->new_len);
 	if (state->new == NULL) {
 		logerr("read_lease");
 		return -1;
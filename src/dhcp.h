@@ -214,10 +214,13 @@ struct dhcp_state {
 	size_t sent_len;
 	struct bootp *offer;
 	size_t offer_len;
+	struct dhcp_optidx *offer_idx;
 	struct bootp *new;
 	size_t new_len;
+	struct dhcp_optidx *new_idx;
 	struct bootp *old;
 	size_t old_len;
+	struct dhcp_optidx *old_idx;
 	struct dhcp_lease lease;
 	const char *reason;
 	unsigned int interval;
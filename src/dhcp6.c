@@ -55,9 +55,11 @@
 #include "if.h"
 #include "if-options.h"
 #include "ipv6nd.h"
+#include "lease.h"
 #include "logerr.h"
 #include "privsep.h"
 #include "script.h"
+#include "workers.h"
 
 #ifdef HAVE_SYS_BITOPS_H
 #include <sys/bitops.h>
@@ -321,51 +323,364 @@ dhcp6_makevendor(void *data, const struct interface *ifp)
 	return sizeof(o) + len;
 }
 
-static void *
-dhcp6_findoption(void *data, size_t data_len, uint16_t code, uint16_t *len)
+/*
+ * Each message we look at is indexed in one pass so that options,
+ * and the options encapsulated in IA_NA, IA_TA, IA_PD and their
+ * addresses and prefixes, can be found again without rescanning.
+ * Encapsulated options of a parent are stored contiguously after
+ * the top level options, so finding the children of a parent
+ * only walks that parent's children.
+ * As with DHCP, a message is indexed once when it is received or read
+ * from a lease, and that index moves with the message when it is stored
+ * in our state.
+ * The recv, new and old messages in our state each own their index
+ * and free it with the message.
+ * The message we send is indexed when it is made, as the elapsed time
+ * and authentication are filled in for each retransmission.
+ * Only if an index could not be allocated is a message indexed into
+ * a scratch index on each lookup.
+ */
+#define	D6_OPTIDX_NONE		UINT32_MAX
+#define	D6_OPTIDX_TRUNC		0x01	/* stopped at a bad option */
+
+struct dhcp6_optent {
+	uint16_t oe_code;
+	uint16_t oe_len;
+	uint32_t oe_off;	/* offset of the data in the message */
+	uint32_t oe_next;	/* next top level option of this code */
+	uint32_t oe_child;	/* first encapsulated option */
+	uint16_t oe_nchild;
+	uint16_t oe_flags;
+};
+
+struct dhcp6_optidx {
+	const struct dhcp6_message *idx_msg;	/* message indexed */
+	size_t idx_len;
+	struct dhcp6_optent *idx_ent;
+	size_t idx_nent;
+	size_t idx_entsize;
+	size_t idx_ntop;
+	unsigned int idx_flags;
+	uint32_t idx_first[256];	/* first top level by code */
+};
+
+/* Returns the length of the fixed data before encapsulated options. */
+static size_t
+dhcp6_optidx_hdrlen(uint16_t code, bool top)
+{
+
+	if (top) {
+		switch (code) {
+		case D6_OPTION_IA_TA:
+			return sizeof(struct dhcp6_ia_ta);
+		case D6_OPTION_IA_NA:
+		case D6_OPTION_IA_PD:
+			return sizeof(struct dhcp6_ia_na);
+		}
+		return 0;
+	}
+
+	switch (code) {
+	case D6_OPTION_IA_ADDR:
+		return sizeof(struct dhcp6_ia_addr);
+	case D6_OPTION_IAPREFIX:
+		return sizeof(struct dhcp6_pd_addr);
+	}
+	return 0;
+}
+
+/* Index the options found at off for len bytes as consecutive entries.
+ * Returns the number of entries added, or -1 on error. */
+static int
+dhcp6_optidx_parse(struct dhcp6_optidx *idx, size_t off, size_t len,
+    bool top, uint16_t *flags)
 {
-	uint8_t *d;
+	const uint8_t *d = (const uint8_t *)idx->idx_msg + off;
+	struct dhcp6_optent *oe;
 	struct dhcp6_option o;
+	size_t first = idx->idx_nent, last, i, hl;
+	uint16_t cflags;
+	int n;
 
-	code = htons(code);
-	for (d = data; data_len != 0; d += o.len, data_len -= o.len) {
-		if (data_len < sizeof(o)) {
-			errno = EINVAL;
-			return NULL;
+	*flags = 0;
+	while (len != 0) {
+		if (len < sizeof(o)) {
+			*flags |= D6_OPTIDX_TRUNC;
+			break;
 		}
 		memcpy(&o, d, sizeof(o));
-		d += sizeof(o);
-		data_len -= sizeof(o);
-		o.len = htons(o.len);
-		if (data_len < o.len) {
-			errno = EINVAL;
-			return NULL;
+		o.len = ntohs(o.len);
+		if (len - sizeof(o) < o.len) {
+			*flags |= D6_OPTIDX_TRUNC;
+			break;
 		}
-		if (o.code == code) {
-			if (len != NULL)
-				*len = o.len;
-			return d;
+		if (idx->idx_nent == idx->idx_entsize) {
+			size_t nsize = idx->idx_entsize ?
+			    idx->idx_entsize * 2 : 32;
+
+			oe = realloc(idx->idx_ent, nsize * sizeof(*oe));
+			if (oe == NULL)
+				return -1;
+			idx->idx_ent = oe;
+			idx->idx_entsize = nsize;
 		}
+		oe = &idx->idx_ent[idx->idx_nent++];
+		oe->oe_code = ntohs(o.code);
+		oe->oe_len = o.len;
+		oe->oe_off = (uint32_t)(off + sizeof(o));
+		oe->oe_next = D6_OPTIDX_NONE;
+		oe->oe_child = D6_OPTIDX_NONE;
+		oe->oe_nchild = 0;
+		oe->oe_flags = 0;
+		d += sizeof(o) + o.len;
+		off += sizeof(o) + o.len;
+		len -= sizeof(o) + o.len;
+	}
+
+	/* Now index the encapsulated options, which places them
+	 * contiguously after this level. */
+	last = idx->idx_nent;
+	for (i = first; i < last; i++) {
+		oe = &idx->idx_ent[i];
+		hl = dhcp6_optidx_hdrlen(oe->oe_code, top);
+		if (hl == 0 || oe->oe_len <= hl)
+			continue;
+		oe->oe_child = (uint32_t)idx->idx_nent;
+		n = dhcp6_optidx_parse(idx, oe->oe_off + hl,
+		    oe->oe_len - hl, false, &cflags);
+		if (n == -1)
+			return -1;
+		/* idx_ent may have moved */
+		oe = &idx->idx_ent[i];
+		oe->oe_nchild = (uint16_t)n;
+		oe->oe_flags = cflags;
+	}
+
+	return (int)(last - first);
+}
+
+static int
+dhcp6_optidx_build(struct dhcp6_optidx *idx,
+    const struct dhcp6_message *m, size_t len)
+{
+	struct dhcp6_optent *oe;
+	uint16_t flags;
+	size_t i;
+	int n;
+
+	idx->idx_msg = m;
+	idx->idx_len = len;
+	idx->idx_nent = 0;
+
+	n = dhcp6_optidx_parse(idx, sizeof(*m), len - sizeof(*m),
+	    true, &flags);
+	if (n == -1) {
+		idx->idx_msg = NULL;
+		return -1;
+	}
+	idx->idx_ntop = (size_t)n;
+	idx->idx_flags = flags;
+
+	/* Chain the top level options by code, in message order. */
+	for (i = 0; i < __arraycount(idx->idx_first); i++)
+		idx->idx_first[i] = D6_OPTIDX_NONE;
+	for (i = idx->idx_ntop; i-- > 0; ) {
+		oe = &idx->idx_ent[i];
+		if (oe->oe_code >= __arraycount(idx->idx_first))
+			continue;
+		oe->oe_next = idx->idx_first[oe->oe_code];
+		idx->idx_first[oe->oe_code] = (uint32_t)i;
+	}
+	return 0;
+}
+
+static void
+dhcp6_optidx_free(struct dhcp6_optidx *idx)
+{
+
+	if (idx == NULL)
+		return;
+	free(idx->idx_ent);
+	free(idx);
+}
+
+/* (Re)index a message just stored in our state, or free the index
+ * if the message has gone.
+ * If we run out of memory the message is looked up without it. */
+static void
+dhcp6_optidx_set(struct dhcp6_optidx **idxp,
+    const struct dhcp6_message *m, size_t len)
+{
+
+	if (m == NULL || len < sizeof(*m) || len > UINT32_MAX) {
+		dhcp6_optidx_free(*idxp);
+		*idxp = NULL;
+		return;
+	}
+	if (*idxp == NULL && (*idxp = calloc(1, sizeof(**idxp))) == NULL) {
+		logerr(__func__);
+		return;
+	}
+	if (dhcp6_optidx_build(*idxp, m, len) == -1) {
+		logerr(__func__);
+		dhcp6_optidx_free(*idxp);
+		*idxp = NULL;
+	}
+}
+
+/* The buffer the message was in is about to be reused or freed. */
+static void
+dhcp6_optidx_unpin(struct dhcpcd_ctx *ctx)
+{
+
+	if (ctx->dhcp6_opt_recv != NULL)
+		ctx->dhcp6_opt_recv->idx_msg = NULL;
+}
+
+/* Index the message being handled, which is pinned to the buffer
+ * it arrived in until dhcp6_optidx_take() moves it into our state. */
+static void
+dhcp6_optidx_recv(struct dhcpcd_ctx *ctx,
+    const struct dhcp6_message *m, size_t len)
+{
+
+	if (len < sizeof(*m) || len > UINT32_MAX) {
+		dhcp6_optidx_unpin(ctx);
+		return;
+	}
+	if (ctx->dhcp6_opt_recv == NULL &&
+	    (ctx->dhcp6_opt_recv = calloc(1,
+	    sizeof(*ctx->dhcp6_opt_recv))) == NULL)
+	{
+		logerr(__func__);
+		return;
+	}
+	if (dhcp6_optidx_build(ctx->dhcp6_opt_recv, m, len) == -1) {
+		logerr(__func__);
+		dhcp6_optidx_free(ctx->dhcp6_opt_recv);
+		ctx->dhcp6_opt_recv = NULL;
+	}
+}
+
+/* The message being handled from has been copied to m in our state,
+ * so move its index over rather than index the copy again. */
+static void
+dhcp6_optidx_take(struct dhcpcd_ctx *ctx, struct dhcp6_optidx **idxp,
+    const struct dhcp6_message *from, const struct dhcp6_message *m,
+    size_t len)
+{
+	struct dhcp6_optidx *idx = ctx->dhcp6_opt_recv;
+
+	if (idx == NULL || idx->idx_msg != from || idx->idx_len != len) {
+		dhcp6_optidx_unpin(ctx);
+		dhcp6_optidx_set(idxp, m, len);
+		return;
 	}
 
-	errno = ENOENT;
+	/* Offsets are from the start of the message,
+	 * so only the message has to change.
+	 * Keep the old index to build the next message in. */
+	idx->idx_msg = m;
+	ctx->dhcp6_opt_recv = *idxp;
+	dhcp6_optidx_unpin(ctx);
+	*idxp = idx;
+}
+
+static const struct dhcp6_optidx *
+dhcp6_optidx_get(const struct interface *ifp,
+    const struct dhcp6_message *m, size_t len)
+{
+	const struct dhcp6_state *state = D6_CSTATE(ifp);
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	const struct dhcp6_optidx *idx;
+
+	if (len < sizeof(*m) || len > UINT32_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Messages may swap places in our state, so match on
+	 * the message rather than where it is stored. */
+	if (state != NULL) {
+		idx = state->send_idx;
+		if (idx != NULL && idx->idx_msg == m && idx->idx_len == len)
+			return idx;
+		idx = state->recv_idx;
+		if (idx != NULL && idx->idx_msg == m && idx->idx_len == len)
+			return idx;
+		idx = state->new_idx;
+		if (idx != NULL && idx->idx_msg == m && idx->idx_len == len)
+			return idx;
+		idx = state->old_idx;
+		if (idx != NULL && idx->idx_msg == m && idx->idx_len == len)
+			return idx;
+	}
+	idx = ctx->dhcp6_opt_recv;
+	if (idx != NULL && idx->idx_msg == m && idx->idx_len == len)
+		return idx;
+
+	if (ctx->dhcp6_opt_scratch == NULL &&
+	    (ctx->dhcp6_opt_scratch = calloc(1,
+	    sizeof(*ctx->dhcp6_opt_scratch))) == NULL)
+		return NULL;
+	if (dhcp6_optidx_build(ctx->dhcp6_opt_scratch, m, len) == -1)
+		return NULL;
+	return ctx->dhcp6_opt_scratch;
+}
+
+/* Returns the next option of code encapsulated by parent after prev,
+ * or the first when prev is NULL. */
+static const struct dhcp6_optent *
+dhcp6_optidx_child(const struct dhcp6_optidx *idx,
+    const struct dhcp6_optent *parent, uint16_t code,
+    const struct dhcp6_optent *prev)
+{
+	const struct dhcp6_optent *oe, *oe_end;
+
+	if (parent->oe_child == D6_OPTIDX_NONE)
+		return NULL;
+	oe = prev ? prev + 1 : &idx->idx_ent[parent->oe_child];
+	oe_end = &idx->idx_ent[parent->oe_child + parent->oe_nchild];
+	for (; oe < oe_end; oe++) {
+		if (oe->oe_code == code)
+			return oe;
+	}
 	return NULL;
 }
 
+#define	D6_OPTIDX_DATA(m, oe)	((uint8_t *)(m) + (oe)->oe_off)
+
 static void *
-dhcp6_findmoption(void *data, size_t data_len, uint16_t code,
-    uint16_t *len)
+dhcp6_findmoption(const struct interface *ifp, void *data, size_t data_len,
+    uint16_t code, uint16_t *len)
 {
-	uint8_t *d;
+	const struct dhcp6_optidx *idx;
+	const struct dhcp6_optent *oe;
+	size_t i;
 
-	if (data_len < sizeof(struct dhcp6_message)) {
-		errno = EINVAL;
-		return false;
+	if ((idx = dhcp6_optidx_get(ifp, data, data_len)) == NULL)
+		return NULL;
+
+	oe = NULL;
+	if (code < __arraycount(idx->idx_first)) {
+		if (idx->idx_first[code] != D6_OPTIDX_NONE)
+			oe = &idx->idx_ent[idx->idx_first[code]];
+	} else {
+		for (i = 0; i < idx->idx_ntop; i++) {
+			if (idx->idx_ent[i].oe_code == code) {
+				oe = &idx->idx_ent[i];
+				break;
+			}
+		}
 	}
-	d = data;
-	d += sizeof(struct dhcp6_message);
-	data_len -= sizeof(struct dhcp6_message);
-	return dhcp6_findoption(d, data_len, code, len);
+
+	if (oe == NULL) {
+		errno = idx->idx_flags & D6_OPTIDX_TRUNC ? EINVAL : ENOENT;
+		return NULL;
+	}
+	if (len != NULL)
+		*len = oe->oe_len;
+	return D6_OPTIDX_DATA(data, oe);
 }
 
 static const uint8_t *
@@ -417,7 +732,7 @@ dhcp6_updateelapsed(struct interface *ifp, struct dhcp6_message *m, size_t len)
 	unsigned long long hsec;
 	uint16_t sec;
 
-	opt = dhcp6_findmoption(m, len, D6_OPTION_ELAPSED, &opt_len);
+	opt = dhcp6_findmoption(ifp, m, len, D6_OPTION_ELAPSED, &opt_len);
 	if (opt == NULL)
 		return false;
 	if (opt_len != sizeof(sec)) {
@@ -656,6 +971,7 @@ dhcp6_makemessage(struct interface *ifp)
 	if (state->send) {
 		free(state->send);
 		state->send = NULL;
+		dhcp6_optidx_set(&state->send_idx, NULL, 0);
 	}
 
 	ifo = ifp->options;
@@ -764,7 +1080,8 @@ dhcp6_makemessage(struct interface *ifp)
 			m = state->new;
 			ml = state->new_len;
 		}
-		si = dhcp6_findmoption(m, ml, D6_OPTION_SERVERID, &si_len);
+		si = dhcp6_findmoption(ifp, m, ml,
+		    D6_OPTION_SERVERID, &si_len);
 		if (si == NULL)
 			return -1;
 		len += sizeof(o) + si_len;
@@ -861,7 +1178,8 @@ dhcp6_makemessage(struct interface *ifp)
 			unicast = NULL;
 			break;
 		}
-		unicast = dhcp6_findmoption(m, ml, D6_OPTION_UNICAST, &uni_len);
+		unicast = dhcp6_findmoption(ifp, m, ml,
+		    D6_OPTION_UNICAST, &uni_len);
 		break;
 	default:
 		unicast = NULL;
@@ -871,7 +1189,9 @@ dhcp6_makemessage(struct interface *ifp)
 	/* In non manager mode we listen and send from fixed addresses.
 	 * We should try and match an address we have to unicast to,
 	 * but for now this is the safest policy. */
-	if (unicast != NULL && !(ifp->ctx->options & DHCPCD_MANAGER)) {
+	if (unicast != NULL &&
+	    (!(ifp->ctx->options & DHCPCD_MANAGER) || IN_WORKER(ifp->ctx)))
+	{
 		logdebugx("%s: ignoring unicast option as not manager",
 		    ifp->name);
 		unicast = NULL;
@@ -1140,6 +1460,7 @@ dhcp6_makemessage(struct interface *ifp)
 	}
 #endif
 
+	dhcp6_optidx_set(&state->send_idx, state->send, state->send_len);
 	return 0;
 }
 
@@ -1190,7 +1511,7 @@ dhcp6_update_auth(struct interface *ifp, struct dhcp6_message *m, size_t len)
 	uint8_t *opt;
 	uint16_t opt_len;
 
-	opt = dhcp6_findmoption(m, len, D6_OPTION_AUTH, &opt_len);
+	opt = dhcp6_findmoption(ifp, m, len, D6_OPTION_AUTH, &opt_len);
 	if (opt == NULL)
 		return -1;
 
@@ -1622,6 +1943,7 @@ dhcp6_startdiscover(void *arg)
 	free(state->new);
 	state->new = NULL;
 	state->new_len = 0;
+	dhcp6_optidx_set(&state->new_idx, NULL, 0);
 
 	if (dhcp6_makemessage(ifp) == -1)
 		logerr("%s: %s", __func__, ifp->name);
@@ -1719,13 +2041,16 @@ dhcp6_fail(struct interface *ifp)
 		dhcp6_delete_delegates(ifp);
 #endif
 		free(state->old);
+		dhcp6_optidx_free(state->old_idx);
 		state->old = state->new;
 		state->old_len = state->new_len;
+		state->old_idx = state->new_idx;
 		state->new = NULL;
 		state->new_len = 0;
+		state->new_idx = NULL;
 		if (state->old != NULL)
 			script_runreason(ifp, "EXPIRE6");
-		dhcp_unlink(ifp->ctx, state->leasefile);
+		lease_unlink(ifp->ctx, state->leasefile);
 		dhcp6_addrequestedaddrs(ifp);
 	}
 
@@ -1997,26 +2322,34 @@ dhcp6_startrelease(struct interface *ifp)
 	}
 }
 
+/* ia is an entry of idx, which callers walking the index pass in
+ * so that a scratch index is not rebuilt under them. */
 static int
 dhcp6_checkstatusok(const struct interface *ifp,
-    struct dhcp6_message *m, uint8_t *p, size_t len)
+    struct dhcp6_message *m, size_t len,
+    const struct dhcp6_optidx *idx, const struct dhcp6_optent *ia)
 {
 	struct dhcp6_state *state;
+	const struct dhcp6_optent *oe;
 	uint8_t *opt;
 	uint16_t opt_len, code;
 	size_t mlen;
-	void * (*f)(void *, size_t, uint16_t, uint16_t *), *farg;
 	char buf[32], *sbuf;
 	const char *status;
 	int loglevel;
 
 	state = D6_STATE(ifp);
-	f = p ? dhcp6_findoption : dhcp6_findmoption;
-	if (p)
-		farg = p;
-	else
-		farg = m;
-	if ((opt = f(farg, len, D6_OPTION_STATUS_CODE, &opt_len)) == NULL) {
+	if (ia == NULL)
+		opt = dhcp6_findmoption(ifp, m, len,
+		    D6_OPTION_STATUS_CODE, &opt_len);
+	else if ((oe = dhcp6_optidx_child(idx, ia,
+	    D6_OPTION_STATUS_CODE, NULL)) != NULL)
+	{
+		opt = D6_OPTIDX_DATA(m, oe);
+		opt_len = oe->oe_len;
+	} else
+		opt = NULL;
+	if (opt == NULL) {
 		//logdebugx("%s: no status", ifp->name);
 		state->lerror = 0;
 		errno = ESRCH;
@@ -2109,28 +2442,27 @@ dhcp6_findaddr(struct dhcpcd_ctx *ctx, const struct in6_addr *addr,
 
 static int
 dhcp6_findna(struct interface *ifp, uint16_t ot, const uint8_t *iaid,
-    uint8_t *d, size_t l, const struct timespec *acquired)
+    struct dhcp6_message *m, const struct dhcp6_optidx *idx,
+    const struct dhcp6_optent *iae, const struct timespec *acquired)
 {
 	struct dhcp6_state *state;
-	uint8_t *o, *nd;
-	uint16_t ol;
+	const struct dhcp6_optent *oe;
 	struct ipv6_addr *a;
 	int i;
 	struct dhcp6_ia_addr ia;
 
 	i = 0;
 	state = D6_STATE(ifp);
-	while ((o = dhcp6_findoption(d, l, D6_OPTION_IA_ADDR, &ol))) {
-		/* Set d and l first to ensure we find the next option. */
-		nd = o + ol;
-		l -= (size_t)(nd - d);
-		d = nd;
-		if (ol < sizeof(ia)) {
+	for (oe = dhcp6_optidx_child(idx, iae, D6_OPTION_IA_ADDR, NULL);
+	    oe != NULL;
+	    oe = dhcp6_optidx_child(idx, iae, D6_OPTION_IA_ADDR, oe))
+	{
+		if (oe->oe_len < sizeof(ia)) {
 			errno = EINVAL;
 			logerrx("%s: IA Address option truncated", ifp->name);
 			continue;
 		}
-		memcpy(&ia, o, sizeof(ia));
+		memcpy(&ia, D6_OPTIDX_DATA(m, oe), sizeof(ia));
 		ia.pltime = ntohl(ia.pltime);
 		ia.vltime = ntohl(ia.vltime);
 		/* RFC 3315 22.6 */
@@ -2183,10 +2515,12 @@ dhcp6_findna(struct interface *ifp, uint16_t ot, const uint8_t *iaid,
 #ifndef SMALL
 static int
 dhcp6_findpd(struct interface *ifp, const uint8_t *iaid,
-    uint8_t *d, size_t l, const struct timespec *acquired)
+    struct dhcp6_message *m, const struct dhcp6_optidx *idx,
+    const struct dhcp6_optent *iae, const struct timespec *acquired)
 {
 	struct dhcp6_state *state;
-	uint8_t *o, *nd;
+	const struct dhcp6_optent *oe, *xe;
+	uint8_t *o;
 	struct ipv6_addr *a;
 	int i;
 	uint8_t nb, *pw;
@@ -2196,18 +2530,17 @@ dhcp6_findpd(struct interface *ifp, const uint8_t *iaid,
 
 	i = 0;
 	state = D6_STATE(ifp);
-	while ((o = dhcp6_findoption(d, l, D6_OPTION_IAPREFIX, &ol))) {
-		/* Set d and l first to ensure we find the next option. */
-		nd = o + ol;
-		l -= (size_t)(nd - d);
-		d = nd;
-		if (ol < sizeof(pdp)) {
+	for (oe = dhcp6_optidx_child(idx, iae, D6_OPTION_IAPREFIX, NULL);
+	    oe != NULL;
+	    oe = dhcp6_optidx_child(idx, iae, D6_OPTION_IAPREFIX, oe))
+	{
+		if (oe->oe_len < sizeof(pdp)) {
 			errno = EINVAL;
 			logerrx("%s: IA Prefix option truncated", ifp->name);
 			continue;
 		}
 
-		memcpy(&pdp, o, sizeof(pdp));
+		memcpy(&pdp, D6_OPTIDX_DATA(m, oe), sizeof(pdp));
 		pdp.pltime = ntohl(pdp.pltime);
 		pdp.vltime = ntohl(pdp.vltime);
 		/* RFC 3315 22.6 */
@@ -2219,9 +2552,6 @@ dhcp6_findpd(struct interface *ifp, const uint8_t *iaid,
 			continue;
 		}
 
-		o += sizeof(pdp);
-		ol = (uint16_t)(ol - sizeof(pdp));
-
 		/* pdp.prefix is not aligned so copy it out. */
 		memcpy(&pdp_prefix, &pdp.prefix, sizeof(pdp_prefix));
 		TAILQ_FOREACH(a, &state->addrs, next) {
@@ -2261,9 +2591,11 @@ dhcp6_findpd(struct interface *ifp, const uint8_t *iaid,
 
 		a->prefix_exclude_len = 0;
 		memset(&a->prefix_exclude, 0, sizeof(a->prefix_exclude));
-		o = dhcp6_findoption(o, ol, D6_OPTION_PD_EXCLUDE, &ol);
-		if (o == NULL)
+		xe = dhcp6_optidx_child(idx, oe, D6_OPTION_PD_EXCLUDE, NULL);
+		if (xe == NULL)
 			continue;
+		o = D6_OPTIDX_DATA(m, xe);
+		ol = xe->oe_len;
 
 		/* RFC 6603 4.2 says option length MUST be between 2 and 17.
 		 * This allows 1 octet for prefix length and 16 for the
@@ -2310,11 +2642,11 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 {
 	struct dhcp6_state *state;
 	const struct if_options *ifo;
-	struct dhcp6_option o;
-	uint8_t *d, *p;
+	const struct dhcp6_optidx *idx;
+	const struct dhcp6_optent *oe;
 	struct dhcp6_ia_na ia;
 	int i, e, error;
-	size_t j;
+	size_t j, k;
 	uint16_t nl;
 	uint8_t iaid[4];
 	char buf[sizeof(iaid) * 3];
@@ -2328,6 +2660,11 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 		return -1;
 	}
 
+	if ((idx = dhcp6_optidx_get(ifp, m, l)) == NULL) {
+		logerr(__func__);
+		return -1;
+	}
+
 	ifo = ifp->options;
 	i = e = 0;
 	state = D6_STATE(ifp);
@@ -2336,22 +2673,9 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 			ap->flags |= IPV6_AF_STALE;
 	}
 
-	d = (uint8_t *)m + sizeof(*m);
-	l -= sizeof(*m);
-	while (l > sizeof(o)) {
-		memcpy(&o, d, sizeof(o));
-		o.len = ntohs(o.len);
-		if (o.len > l || sizeof(o) + o.len > l) {
-			errno = EINVAL;
-			logerrx("%s: option overflow", ifp->name);
-			break;
-		}
-		p = d + sizeof(o);
-		d = p + o.len;
-		l -= sizeof(o) + o.len;
-
-		o.code = ntohs(o.code);
-		switch(o.code) {
+	for (k = 0; k < idx->idx_ntop; k++) {
+		oe = &idx->idx_ent[k];
+		switch(oe->oe_code) {
 		case D6_OPTION_IA_TA:
 			nl = 4;
 			break;
@@ -2362,19 +2686,17 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 		default:
 			continue;
 		}
-		if (o.len < nl) {
+		if (oe->oe_len < nl) {
 			errno = EINVAL;
 			logerrx("%s: IA option truncated", ifp->name);
 			continue;
 		}
 
-		memcpy(&ia, p, nl);
-		p += nl;
-		o.len = (uint16_t)(o.len - nl);
+		memcpy(&ia, D6_OPTIDX_DATA(m, oe), nl);
 
 		for (j = 0; j < ifo->ia_len; j++) {
 			ifia = &ifo->ia[j];
-			if (ifia->ia_type == o.code &&
+			if (ifia->ia_type == oe->oe_code &&
 			    memcmp(ifia->iaid, ia.iaid, sizeof(ia.iaid)) == 0)
 				break;
 		}
@@ -2388,7 +2710,7 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 			continue;
 		}
 
-		if (o.code != D6_OPTION_IA_TA) {
+		if (oe->oe_code != D6_OPTION_IA_TA) {
 			ia.t1 = ntohl(ia.t1);
 			ia.t2 = ntohl(ia.t2);
 			/* RFC 3315 22.4 */
@@ -2402,15 +2724,15 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 			}
 		} else
 			ia.t1 = ia.t2 = 0; /* appease gcc */
-		if ((error = dhcp6_checkstatusok(ifp, NULL, p, o.len)) != 0) {
+		if ((error = dhcp6_checkstatusok(ifp, m, l, idx, oe)) != 0) {
 			if (error == D6_STATUS_NOBINDING)
 				state->has_no_binding = true;
 			e = 1;
 			continue;
 		}
-		if (o.code == D6_OPTION_IA_PD) {
+		if (oe->oe_code == D6_OPTION_IA_PD) {
 #ifndef SMALL
-			if (dhcp6_findpd(ifp, ia.iaid, p, o.len,
+			if (dhcp6_findpd(ifp, ia.iaid, m, idx, oe,
 					 acquired) == 0)
 			{
 				logwarnx("%s: %s: DHCPv6 REPLY missing Prefix",
@@ -2419,7 +2741,7 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 			}
 #endif
 		} else {
-			if (dhcp6_findna(ifp, o.code, ia.iaid, p, o.len,
+			if (dhcp6_findna(ifp, oe->oe_code, ia.iaid, m, idx, oe,
 					 acquired) == 0)
 			{
 				logwarnx("%s: %s: DHCPv6 REPLY missing "
@@ -2428,7 +2750,7 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 				continue;
 			}
 		}
-		if (o.code != D6_OPTION_IA_TA) {
+		if (oe->oe_code != D6_OPTION_IA_TA) {
 			if (ia.t1 != 0 &&
 			    (ia.t1 < state->renew || state->renew == 0))
 				state->renew = ia.t1;
@@ -2438,6 +2760,10 @@ dhcp6_findia(struct interface *ifp, struct dhcp6_message *m, size_t l,
 		}
 		i++;
 	}
+	if (idx->idx_flags & D6_OPTIDX_TRUNC) {
+		errno = EINVAL;
+		logerrx("%s: option overflow", ifp->name);
+	}
 
 	if (i == 0 && e)
 		return -1;
@@ -2542,7 +2868,7 @@ dhcp6_validatelease(struct interface *ifp,
 
 	state = D6_STATE(ifp);
 	errno = 0;
-	if (dhcp6_checkstatusok(ifp, m, NULL, len) != 0)
+	if (dhcp6_checkstatusok(ifp, m, len, NULL, NULL) != 0)
 		return -1;
 	ok_errno = errno;
 
@@ -2595,11 +2921,12 @@ dhcp6_readlease(struct interface *ifp, int validate)
 	} else {
 		logdebugx("%s: reading lease: %s",
 		    ifp->name, state->leasefile);
-		bytes = dhcp_readfile(ifp->ctx, state->leasefile,
+		bytes = lease_read(ifp->ctx, state->leasefile,
 		    buf.buf, sizeof(buf.buf));
 	}
 	if (bytes == -1)
 		goto ex;
+	dhcp6_optidx_recv(ifp->ctx, &buf.dhcp6, (size_t)bytes);
 
 	if (ifp->ctx->options & DHCPCD_DUMPLEASE || state->leasefile[0] == '\0')
 		goto out;
@@ -2612,7 +2939,7 @@ dhcp6_readlease(struct interface *ifp, int validate)
 	if (!validate)
 		goto auth;
 
-	if (dhcp_filemtime(ifp->ctx, state->leasefile, &mtime) == -1)
+	if (lease_mtime(ifp->ctx, state->leasefile, &mtime) == -1)
 		goto ex;
 	clock_gettime(CLOCK_MONOTONIC, &state->acquired);
 	if ((now = time(NULL)) == -1)
@@ -2637,7 +2964,8 @@ dhcp6_readlease(struct interface *ifp, int validate)
 auth:
 #ifdef AUTH
 	/* Authenticate the message */
-	o = dhcp6_findmoption(&buf.dhcp6, (size_t)bytes, D6_OPTION_AUTH, &ol);
+	o = dhcp6_findmoption(ifp, &buf.dhcp6, (size_t)bytes,
+	    D6_OPTION_AUTH, &ol);
 	if (o) {
 		if (dhcp_auth_validate(&state->auth, &ifp->options->auth,
 		    buf.buf, (size_t)bytes, 6, buf.dhcp6.type, o, ol) == NULL)
@@ -2669,14 +2997,18 @@ out:
 
 	memcpy(state->new, buf.buf, (size_t)bytes);
 	state->new_len = (size_t)bytes;
+	dhcp6_optidx_take(ifp->ctx, &state->new_idx,
+	    &buf.dhcp6, state->new, state->new_len);
 	return bytes;
 
 ex:
+	dhcp6_optidx_unpin(ifp->ctx);
 	dhcp6_freedrop_addrs(ifp, 0, NULL);
-	dhcp_unlink(ifp->ctx, state->leasefile);
+	lease_unlink(ifp->ctx, state->leasefile);
 	free(state->new);
 	state->new = NULL;
 	state->new_len = 0;
+	dhcp6_optidx_set(&state->new_idx, NULL, 0);
 	dhcp6_addrequestedaddrs(ifp);
 	return bytes == 0 ? 0 : -1;
 }
@@ -3072,7 +3404,7 @@ dhcp6_bind(struct interface *ifp, const char *op, const char *sfrom)
 
 		if (state->reason == NULL)
 			state->reason = "INFORM6";
-		o = dhcp6_findmoption(state->new, state->new_len,
+		o = dhcp6_findmoption(ifp, state->new, state->new_len,
 				      D6_OPTION_INFO_REFRESH_TIME, &ol);
 		if (o == NULL || ol != sizeof(uint32_t))
 			state->renew = IRT_DEFAULT;
@@ -3151,12 +3483,16 @@ dhcp6_bind(struct interface *ifp, const char *op, const char *sfrom)
 	if (state->state != DH6S_CONFIRM && !timedout) {
 		state->acquired = now;
 		free(state->old);
+		dhcp6_optidx_free(state->old_idx);
 		state->old = state->new;
 		state->old_len = state->new_len;
+		state->old_idx = state->new_idx;
 		state->new = state->recv;
 		state->new_len = state->recv_len;
+		state->new_idx = state->recv_idx;
 		state->recv = NULL;
 		state->recv_len = 0;
+		state->recv_idx = NULL;
 		confirmed = false;
 	} else {
 		/* Reduce timers based on when we got the lease. */
@@ -3194,17 +3530,26 @@ dhcp6_bind(struct interface *ifp, const char *op, const char *sfrom)
 			state->state = DH6S_BOUND;
 		state->failed = false;
 
-		if (state->renew && state->renew != ND6_INFINITE_LIFETIME)
-			eloop_timeout_add_sec(ifp->ctx->eloop,
-			    state->renew,
-			    state->state == DH6S_INFORMED ?
-			    dhcp6_startinform : dhcp6_startrenew, ifp);
+		if (state->renew && state->renew != ND6_INFINITE_LIFETIME) {
+			if (state->state == DH6S_INFORMED)
+				eloop_timeout_add_sec_slack(ifp->ctx->eloop,
+				    state->renew,
+				    ELOOP_SLACK_SEC(state->renew),
+				    dhcp6_startinform, ifp);
+			else
+				eloop_timeout_add_sec_slack(ifp->ctx->eloop,
+				    state->renew,
+				    ELOOP_SLACK_SEC(state->renew),
+				    dhcp6_startrenew, ifp);
+		}
 		if (state->rebind && state->rebind != ND6_INFINITE_LIFETIME)
-			eloop_timeout_add_sec(ifp->ctx->eloop,
-			    state->rebind, dhcp6_startrebind, ifp);
+			eloop_timeout_add_sec_slack(ifp->ctx->eloop,
+			    state->rebind, ELOOP_SLACK_SEC(state->rebind),
+			    dhcp6_startrebind, ifp);
 		if (state->expire != ND6_INFINITE_LIFETIME)
-			eloop_timeout_add_sec(ifp->ctx->eloop,
-			    state->expire, dhcp6_startexpire, ifp);
+			eloop_timeout_add_sec_slack(ifp->ctx->eloop,
+			    state->expire, ELOOP_SLACK_SEC(state->expire),
+			    dhcp6_startexpire, ifp);
 
 		if (ifp->options->options & DHCPCD_CONFIGURE) {
 			ipv6_addaddrs(&state->addrs);
@@ -3233,9 +3578,9 @@ dhcp6_bind(struct interface *ifp, const char *op, const char *sfrom)
 		if (!confirmed && !timedout) {
 			logdebugx("%s: writing lease: %s",
 			    ifp->name, state->leasefile);
-			if (dhcp_writefile(ifp->ctx, state->leasefile, 0640,
+			if (lease_write(ifp->ctx, state->leasefile, 0640,
 			    state->new, state->new_len) == -1)
-				logerr("dhcp_writefile: %s",state->leasefile);
+				logerr("lease_write: %s", state->leasefile);
 		}
 #ifndef SMALL
 		dhcp6_delegate_prefix(ifp);
@@ -3287,7 +3632,9 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 		return;
 	}
 
-	if (dhcp6_findmoption(r, len, D6_OPTION_SERVERID, NULL) == NULL) {
+	if (dhcp6_findmoption(ifp, r, len,
+	    D6_OPTION_SERVERID, NULL) == NULL)
+	{
 		logdebugx("%s: no DHCPv6 server ID from %s", ifp->name, sfrom);
 		return;
 	}
@@ -3298,14 +3645,16 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 	    i++, opt++)
 	{
 		if (has_option_mask(ifo->requiremask6, opt->option) &&
-		    !dhcp6_findmoption(r, len, (uint16_t)opt->option, NULL))
+		    !dhcp6_findmoption(ifp, r, len,
+		    (uint16_t)opt->option, NULL))
 		{
 			logwarnx("%s: reject DHCPv6 (no option %s) from %s",
 			    ifp->name, opt->var, sfrom);
 			return;
 		}
 		if (has_option_mask(ifo->rejectmask6, opt->option) &&
-		    dhcp6_findmoption(r, len, (uint16_t)opt->option, NULL))
+		    dhcp6_findmoption(ifp, r, len,
+		    (uint16_t)opt->option, NULL))
 		{
 			logwarnx("%s: reject DHCPv6 (option %s) from %s",
 			    ifp->name, opt->var, sfrom);
@@ -3315,7 +3664,7 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 
 #ifdef AUTH
 	/* Authenticate the message */
-	auth = dhcp6_findmoption(r, len, D6_OPTION_AUTH, &auth_len);
+	auth = dhcp6_findmoption(ifp, r, len, D6_OPTION_AUTH, &auth_len);
 	if (auth != NULL) {
 		if (dhcp_auth_validate(&state->auth, &ifo->auth,
 		    (uint8_t *)r, len, 6, r->type, auth, auth_len) == NULL)
@@ -3345,7 +3694,7 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 	case DHCP6_REPLY:
 		switch(state->state) {
 		case DH6S_INFORM:
-			if (dhcp6_checkstatusok(ifp, r, NULL, len) != 0)
+			if (dhcp6_checkstatusok(ifp, r, len, NULL, NULL) != 0)
 				return;
 			break;
 		case DH6S_CONFIRM:
@@ -3360,8 +3709,8 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 			 * Normally we get an ADVERTISE for a DISCOVER. */
 			if (!has_option_mask(ifo->requestmask6,
 			    D6_OPTION_RAPID_COMMIT) ||
-			    !dhcp6_findmoption(r, len, D6_OPTION_RAPID_COMMIT,
-					      NULL))
+			    !dhcp6_findmoption(ifp, r, len,
+					      D6_OPTION_RAPID_COMMIT, NULL))
 			{
 				valid_op = false;
 				break;
@@ -3422,7 +3771,8 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 			break;
 		}
 		/* RFC7083 */
-		o = dhcp6_findmoption(r, len, D6_OPTION_SOL_MAX_RT, &ol);
+		o = dhcp6_findmoption(ifp, r, len,
+		    D6_OPTION_SOL_MAX_RT, &ol);
 		if (o && ol == sizeof(uint32_t)) {
 			uint32_t max_rt;
 
@@ -3438,7 +3788,8 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 				logerr("%s: invalid SOL_MAX_RT %u",
 				    ifp->name, max_rt);
 		}
-		o = dhcp6_findmoption(r, len, D6_OPTION_INF_MAX_RT, &ol);
+		o = dhcp6_findmoption(ifp, r, len,
+		    D6_OPTION_INF_MAX_RT, &ol);
 		if (o && ol == sizeof(uint32_t)) {
 			uint32_t max_rt;
 
@@ -3468,7 +3819,8 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 #ifdef AUTH
 		}
 		loginfox("%s: %s from %s", ifp->name, op, sfrom);
-		o = dhcp6_findmoption(r, len, D6_OPTION_RECONF_MSG, &ol);
+		o = dhcp6_findmoption(ifp, r, len,
+		    D6_OPTION_RECONF_MSG, &ol);
 		if (o == NULL) {
 			logerrx("%s: missing Reconfigure Message option",
 			    ifp->name);
@@ -3523,11 +3875,14 @@ dhcp6_recvif(struct interface *ifp, const char *sfrom,
 		state->recv = malloc(len);
 		if (state->recv == NULL) {
 			logerr(__func__);
+			dhcp6_optidx_set(&state->recv_idx, NULL, 0);
 			return;
 		}
 	}
 	memcpy(state->recv, r, len);
 	state->recv_len = len;
+	dhcp6_optidx_take(ctx, &state->recv_idx, r,
+	    state->recv, state->recv_len);
 
 	if (r->type == DHCP6_ADVERTISE) {
 		struct ipv6_addr *ia;
@@ -3554,8 +3909,9 @@ bind:
 	dhcp6_bind(ifp, op, sfrom);
 }
 
-void
-dhcp6_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, struct ipv6_addr *ia)
+static void
+dhcp6_recvmsg1(struct dhcpcd_ctx *ctx, struct msghdr *msg,
+    struct ipv6_addr *ia)
 {
 	struct sockaddr_in6 *from = msg->msg_name;
 	size_t len = msg->msg_iov[0].iov_len;
@@ -3583,10 +3939,13 @@ dhcp6_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, struct ipv6_addr *ia)
 	}
 
 	r = (struct dhcp6_message *)msg->msg_iov[0].iov_base;
+	/* Index the options once for every lookup from here on,
+	 * including any redirection to another interface. */
+	dhcp6_optidx_recv(ctx, r, len);
 
 	uint8_t duid[DUID_LEN], *dp;
 	size_t duid_len;
-	o = dhcp6_findmoption(r, len, D6_OPTION_CLIENTID, &ol);
+	o = dhcp6_findmoption(ifp, r, len, D6_OPTION_CLIENTID, &ol);
 	if (ifp->options->options & DHCPCD_ANONYMOUS) {
 		duid_len = duid_make(duid, ifp, DUID_LL);
 		dp = duid;
@@ -3600,7 +3959,7 @@ dhcp6_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, struct ipv6_addr *ia)
 		return;
 	}
 
-	if (dhcp6_findmoption(r, len, D6_OPTION_SERVERID, NULL) == NULL) {
+	if (dhcp6_findmoption(ifp, r, len, D6_OPTION_SERVERID, NULL) == NULL) {
 		logdebugx("%s: no DHCPv6 server ID from %s",
 		    ifp->name, sfrom);
 		return;
@@ -3679,8 +4038,8 @@ dhcp6_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, struct ipv6_addr *ia)
 	close(fd);
 
 	/* Copy across ServerID so we can work with our own server. */
-	si1 = dhcp6_findmoption(r, len, D6_OPTION_SERVERID, &si_len1);
-	si2 = dhcp6_findmoption(tbuf, (size_t)tlen,
+	si1 = dhcp6_findmoption(ifp, r, len, D6_OPTION_SERVERID, &si_len1);
+	si2 = dhcp6_findmoption(ifp, tbuf, (size_t)tlen,
 	    D6_OPTION_SERVERID, &si_len2);
 	if (si1 != NULL && si2 != NULL && si_len1 == si_len2)
 		memcpy(si2, si1, si_len2);
@@ -3692,6 +4051,14 @@ recvif:
 	dhcp6_recvif(ifp, sfrom, r, len);
 }
 
+void
+dhcp6_recvmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, struct ipv6_addr *ia)
+{
+
+	dhcp6_recvmsg1(ctx, msg, ia);
+	dhcp6_optidx_unpin(ctx);
+}
+
 static void
 dhcp6_recv(struct dhcpcd_ctx *ctx, struct ipv6_addr *ia, unsigned short events)
 {
@@ -3856,8 +4223,9 @@ dhcp6_start1(void *arg)
 	size_t i;
 	const struct dhcp_compat *dhc;
 
+	/* Workers cannot share the wildcard socket. */
 	if ((ctx->options & (DHCPCD_MANAGER|DHCPCD_PRIVSEP)) == DHCPCD_MANAGER &&
-	    ctx->dhcp6_rfd == -1)
+	    !IN_WORKER(ctx) && ctx->dhcp6_rfd == -1)
 	{
 		ctx->dhcp6_rfd = dhcp6_openudp(0, NULL);
 		if (ctx->dhcp6_rfd == -1) {
@@ -4055,7 +4423,7 @@ dhcp6_freedrop(struct interface *ifp, int drop, const char *reason)
 				dhcp6_startrelease(ifp);
 				return;
 			}
-			dhcp_unlink(ifp->ctx, state->leasefile);
+			lease_unlink(ifp->ctx, state->leasefile);
 		}
 #ifdef AUTH
 		else if (state->auth.reconf != NULL) {
@@ -4066,16 +4434,19 @@ dhcp6_freedrop(struct interface *ifp, int drop, const char *reason)
 			 * If dhcpcd is restarted, the token is lost.
 			 * XXX persist this in another file?
 			 */
-			dhcp_unlink(ifp->ctx, state->leasefile);
+			lease_unlink(ifp->ctx, state->leasefile);
 		}
 #endif
 
 		dhcp6_freedrop_addrs(ifp, drop, NULL);
 		free(state->old);
+		dhcp6_optidx_free(state->old_idx);
 		state->old = state->new;
 		state->old_len = state->new_len;
+		state->old_idx = state->new_idx;
 		state->new = NULL;
 		state->new_len = 0;
+		state->new_idx = NULL;
 		if (drop && state->old &&
 		    (options & DHCPCD_NODROP) != DHCPCD_NODROP)
 		{
@@ -4084,8 +4455,12 @@ dhcp6_freedrop(struct interface *ifp, int drop, const char *reason)
 			script_runreason(ifp, reason);
 		}
 		free(state->old);
+		dhcp6_optidx_free(state->old_idx);
+		dhcp6_optidx_free(state->new_idx);
 		free(state->send);
+		dhcp6_optidx_free(state->send_idx);
 		free(state->recv);
+		dhcp6_optidx_free(state->recv_idx);
 		free(state);
 		ifp->if_data[IF_DATA_DHCP6] = NULL;
 	}
@@ -4104,6 +4479,12 @@ dhcp6_freedrop(struct interface *ifp, int drop, const char *reason)
 		close(ctx->dhcp6_rfd);
 		ctx->dhcp6_rfd = -1;
 	}
+	if (ifp == NULL) {
+		dhcp6_optidx_free(ctx->dhcp6_opt_recv);
+		ctx->dhcp6_opt_recv = NULL;
+		dhcp6_optidx_free(ctx->dhcp6_opt_scratch);
+		ctx->dhcp6_opt_scratch = NULL;
+	}
 }
 
 void
@@ -4161,11 +4542,12 @@ dhcp6_handleifa(int cmd, struct ipv6_addr *ia, pid_t pid)
 	struct dhcp6_state *state;
 	struct interface *ifp = ia->iface;
 
-	/* If not running in manager mode, listen to this address */
+	/* If not running in manager mode or in a worker,
+	 * listen to this address */
 	if (cmd == RTM_NEWADDR &&
 	    !(ia->addr_flags & IN6_IFF_NOTUSEABLE) &&
 	    ifp->active == IF_ACTIVE_USER &&
-	    !(ifp->ctx->options & DHCPCD_MANAGER) &&
+	    (!(ifp->ctx->options & DHCPCD_MANAGER) || IN_WORKER(ifp->ctx)) &&
 	    ifp->options->options & DHCPCD_DHCP6)
 	{
 #ifdef PRIVSEP
@@ -4196,18 +4578,12 @@ dhcp6_env(FILE *fp, const char *prefix, const struct interface *ifp,
 	const struct if_options *ifo;
 	struct dhcp_opt *opt, *vo;
 	const uint8_t *p;
-	struct dhcp6_option o;
-	size_t i;
+	const struct dhcp6_optidx *idx;
+	const struct dhcp6_optent *oe;
+	size_t i, k;
 	char *pfx;
 	uint32_t en;
 	const struct dhcpcd_ctx *ctx;
-#ifndef SMALL
-	const struct dhcp6_state *state;
-	const struct ipv6_addr *ap;
-#endif
-
-	if (m == NULL)
-		goto delegated;
 
 	if (len < sizeof(*m)) {
 		/* Should be impossible with guards at packet in
@@ -4218,6 +4594,8 @@ dhcp6_env(FILE *fp, const char *prefix, const struct interface *ifp,
 
 	ifo = ifp->options;
 	ctx = ifp->ctx;
+	if ((idx = dhcp6_optidx_get(ifp, m, len)) == NULL)
+		return -1;
 
 	/* Zero our indexes */
 	for (i = 0, opt = ctx->dhcp6_opts;
@@ -4237,32 +4615,19 @@ dhcp6_env(FILE *fp, const char *prefix, const struct interface *ifp,
 
 	/* Unlike DHCP, DHCPv6 options *may* occur more than once.
 	 * There is also no provision for option concatenation unlike DHCP. */
-	p = (const uint8_t *)m + sizeof(*m);
-	len -= sizeof(*m);
-	for (; len != 0; p += o.len, len -= o.len) {
-		if (len < sizeof(o)) {
-			errno = EINVAL;
-			break;
-		}
-		memcpy(&o, p, sizeof(o));
-		p += sizeof(o);
-		len -= sizeof(o);
-		o.len = ntohs(o.len);
-		if (len < o.len) {
-			errno =	EINVAL;
-			break;
-		}
-		o.code = ntohs(o.code);
-		if (has_option_mask(ifo->nomask6, o.code))
+	for (k = 0; k < idx->idx_ntop; k++) {
+		oe = &idx->idx_ent[k];
+		p = (const uint8_t *)m + oe->oe_off;
+		if (has_option_mask(ifo->nomask6, oe->oe_code))
 			continue;
 		for (i = 0, opt = ifo->dhcp6_override;
 		    i < ifo->dhcp6_override_len;
 		    i++, opt++)
-			if (opt->option == o.code)
+			if (opt->option == oe->oe_code)
 				break;
 		if (i == ifo->dhcp6_override_len &&
-		    o.code == D6_OPTION_VENDOR_OPTS &&
-		    o.len > sizeof(en))
+		    oe->oe_code == D6_OPTION_VENDOR_OPTS &&
+		    oe->oe_len > sizeof(en))
 		{
 			memcpy(&en, p, sizeof(en));
 			en = ntohl(en);
@@ -4273,7 +4638,7 @@ dhcp6_env(FILE *fp, const char *prefix, const struct interface *ifp,
 			for (i = 0, opt = ctx->dhcp6_opts;
 			    i < ctx->dhcp6_opts_len;
 			    i++, opt++)
-				if (opt->option == o.code)
+				if (opt->option == oe->oe_code)
 					break;
 			if (i == ctx->dhcp6_opts_len)
 				opt = NULL;
@@ -4281,20 +4646,32 @@ dhcp6_env(FILE *fp, const char *prefix, const struct interface *ifp,
 		if (opt) {
 			dhcp_envoption(ifp->ctx,
 			    fp, pfx, ifp->name,
-			    opt, dhcp6_getoption, p, o.len);
+			    opt, dhcp6_getoption, p, oe->oe_len);
 		}
 		if (vo) {
 			dhcp_envoption(ifp->ctx,
 			    fp, pfx, ifp->name,
 			    vo, dhcp6_getoption,
 			    p + sizeof(en),
-			    o.len - sizeof(en));
+			    oe->oe_len - sizeof(en));
 		}
 	}
+	if (idx->idx_flags & D6_OPTIDX_TRUNC)
+		errno = EINVAL;
 	free(pfx);
+	return 1;
+}
 
-delegated:
+/* Kept apart from dhcp6_env as it follows the address set
+ * rather than the message. */
+ssize_t
+dhcp6_env_delegated(FILE *fp, const char *prefix,
+    const struct interface *ifp)
+{
 #ifndef SMALL
+	const struct dhcp6_state *state;
+	const struct ipv6_addr *ap;
+
 	/* Needed for Delegated Prefixes */
 	state = D6_CSTATE(ifp);
 	TAILQ_FOREACH(ap, &state->addrs, next) {
@@ -4317,6 +4694,10 @@ delegated:
 	}
 	if (fputc('\0', fp) == EOF)
 		return -1;
+#else
+	UNUSED(fp);
+	UNUSED(prefix);
+	UNUSED(ifp);
 #endif
 
 	return 1;
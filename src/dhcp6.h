@@ -193,12 +193,16 @@ struct dhcp6_state {
 
 	struct dhcp6_message *send;
 	size_t send_len;
+	struct dhcp6_optidx *send_idx;
 	struct dhcp6_message *recv;
 	size_t recv_len;
+	struct dhcp6_optidx *recv_idx;
 	struct dhcp6_message *new;
 	size_t new_len;
+	struct dhcp6_optidx *new_idx;
 	struct dhcp6_message *old;
 	size_t old_len;
+	struct dhcp6_optidx *old_idx;
 
 	struct timespec acquired;
 	uint32_t renew;
@@ -241,6 +245,7 @@ void dhcp6_reboot(struct interface *);
 void dhcp6_renew(struct interface *);
 ssize_t dhcp6_env(FILE *, const char *, const struct interface *,
     const struct dhcp6_message *, size_t);
+ssize_t dhcp6_env_delegated(FILE *, const char *, const struct interface *);
 void dhcp6_free(struct interface *);
 void dhcp6_handleifa(int, struct ipv6_addr *, pid_t);
 bool dhcp6_dadcompleted(const struct interface *);
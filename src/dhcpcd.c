@@ -68,9 +68,11 @@ static const char dhcpcd_copyright[] = "Copyright (c) 2006-2021 Roy Marples";
 #include "ipv4ll.h"
 #include "ipv6.h"
 #include "ipv6nd.h"
+#include "lease.h"
 #include "logerr.h"
 #include "privsep.h"
 #include "script.h"
+#include "workers.h"
 
 #ifdef HAVE_CAPSICUM
 #include <sys/capsicum.h>
@@ -128,7 +130,6 @@ printf("usage: "PACKAGE"\t[-146ABbDdEGgHJKLMNPpqTV]\n"
 static void
 free_globals(struct dhcpcd_ctx *ctx)
 {
-	struct dhcp_opt *opt;
 
 	if (ctx->ifac) {
 		for (; ctx->ifac > 0; ctx->ifac--)
@@ -148,45 +149,6 @@ free_globals(struct dhcpcd_ctx *ctx)
 		free(ctx->ifcv);
 		ctx->ifcv = NULL;
 	}
-
-#ifdef INET
-	if (ctx->dhcp_opts) {
-		for (opt = ctx->dhcp_opts;
-		    ctx->dhcp_opts_len > 0;
-		    opt++, ctx->dhcp_opts_len--)
-			free_dhcp_opt_embenc(opt);
-		free(ctx->dhcp_opts);
-		ctx->dhcp_opts = NULL;
-	}
-#endif
-#ifdef INET6
-	if (ctx->nd_opts) {
-		for (opt = ctx->nd_opts;
-		    ctx->nd_opts_len > 0;
-		    opt++, ctx->nd_opts_len--)
-			free_dhcp_opt_embenc(opt);
-		free(ctx->nd_opts);
-		ctx->nd_opts = NULL;
-	}
-#ifdef DHCP6
-	if (ctx->dhcp6_opts) {
-		for (opt = ctx->dhcp6_opts;
-		    ctx->dhcp6_opts_len > 0;
-		    opt++, ctx->dhcp6_opts_len--)
-			free_dhcp_opt_embenc(opt);
-		free(ctx->dhcp6_opts);
-		ctx->dhcp6_opts = NULL;
-	}
-#endif
-#endif
-	if (ctx->vivso) {
-		for (opt = ctx->vivso;
-		    ctx->vivso_len > 0;
-		    opt++, ctx->vivso_len--)
-			free_dhcp_opt_embenc(opt);
-		free(ctx->vivso);
-		ctx->vivso = NULL;
-	}
 }
 
 static void
@@ -326,6 +288,27 @@ dhcpcd_ipwaited(struct dhcpcd_ctx *ctx)
 	return 1;
 }
 
+/* Log how long each phase of startup takes, up to being configured. */
+static void
+dhcpcd_startphase(struct dhcpcd_ctx *ctx, const char *phase)
+{
+	struct timespec now;
+	unsigned long long secs, psecs;
+	unsigned int nsecs, pnsecs;
+
+	if (!timespecisset(&ctx->start_ts))
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	psecs = eloop_timespec_diff(&now, &ctx->phase_ts, &pnsecs);
+	secs = eloop_timespec_diff(&now, &ctx->start_ts, &nsecs);
+	ctx->phase_ts = now;
+	logdebugx("startup: %s in %llu.%03ums, %llu.%03ums total", phase,
+	    psecs * MSEC_PER_SEC + pnsecs / NSEC_PER_MSEC,
+	    pnsecs / 1000 % 1000,
+	    secs * MSEC_PER_SEC + nsecs / NSEC_PER_MSEC,
+	    nsecs / 1000 % 1000);
+}
+
 /* Returns the pid of the child, otherwise 0. */
 void
 dhcpcd_daemonise(struct dhcpcd_ctx *ctx)
@@ -344,6 +327,10 @@ dhcpcd_daemonise(struct dhcpcd_ctx *ctx)
 		if (!dhcpcd_ipwaited(ctx))
 			return;
 	}
+	if (timespecisset(&ctx->start_ts)) {
+		dhcpcd_startphase(ctx, "configured");
+		timespecclear(&ctx->start_ts);
+	}
 
 	if (ctx->options & DHCPCD_ONESHOT) {
 		loginfox("exiting due to oneshot");
@@ -356,6 +343,14 @@ dhcpcd_daemonise(struct dhcpcd_ctx *ctx)
 	    !(ctx->options & DHCPCD_DAEMONISE))
 		return;
 
+#ifdef WORKERS
+	/* The manager forks once enough workers would. */
+	if (IN_WORKER(ctx)) {
+		workers_daemonised(ctx);
+		return;
+	}
+#endif
+
 	/* Don't use loginfo because this makes no sense in a log. */
 	if (!(logopts & LOGERR_QUIET) && ctx->stderr_valid)
 		(void)fprintf(stderr,
@@ -452,8 +447,11 @@ configure_interface1(struct interface *ifp)
 			ifo->options |= DHCPCD_STATIC;
 	}
 
-	if (ifo->metric != -1)
+	if (ifo->metric != -1 && ifp->metric != (unsigned int)ifo->metric) {
 		ifp->metric = (unsigned int)ifo->metric;
+		/* Our mirror of the kernel routes is ordered by it. */
+		rt_kroutes_invalidate(ifp->ctx, AF_UNSPEC);
+	}
 
 #ifdef INET6
 	/* We want to setup INET6 on the interface as soon as possible. */
@@ -725,6 +723,9 @@ dhcpcd_handlecarrier(struct interface *ifp, int carrier, unsigned int flags)
 	ifp->flags = flags;
 
 	if (!if_is_link_up(ifp)) {
+		/* The kernel may flush routes without telling us. */
+		if (was_link_up)
+			rt_kroutes_invalidate(ifp->ctx, AF_UNSPEC);
 		if (!ifp->active || (!was_link_up && !was_roaming))
 			return;
 
@@ -1039,6 +1040,12 @@ dhcpcd_handleinterface(void *arg, int action, const char *ifname)
 	const char * const argv[] = { ifname };
 	int e;
 
+#ifdef WORKERS
+	/* Another worker looks after it. */
+	if (!workers_ownsif(ctx, ifname))
+		return 0;
+#endif
+
 	if (action == -1) {
 		ifp = if_find(ctx->ifaces, ifname);
 		if (ifp == NULL) {
@@ -1049,7 +1056,9 @@ dhcpcd_handleinterface(void *arg, int action, const char *ifname)
 			logdebugx("%s: interface departed", ifp->name);
 			stop_interface(ifp, "DEPARTED");
 		}
+		control_ifdeparted(ifp);
 		TAILQ_REMOVE(ctx->ifaces, ifp, next);
+		if_hashdel(ifp);
 		if_free(ifp);
 		return 0;
 	}
@@ -1084,6 +1093,10 @@ dhcpcd_handleinterface(void *arg, int action, const char *ifname)
 	} else {
 		TAILQ_REMOVE(ifs, ifp, next);
 		TAILQ_INSERT_TAIL(ctx->ifaces, ifp, next);
+		if_hashadd(ifp);
+		control_ifchanged(ifp);
+		/* Kernel routes on unknown interfaces are not mirrored. */
+		rt_kroutes_invalidate(ctx, AF_UNSPEC);
 		if (ifp->active) {
 			logdebugx("%s: interface added", ifp->name);
 			dhcpcd_initstate(ifp, 0);
@@ -1117,14 +1130,15 @@ dhcpcd_handlelink(void *arg, unsigned short events)
 	if (events != ELE_READ)
 		logerrx("%s: unexpected event 0x%04x", __func__, events);
 
+	/* Routes are rebuilt once the whole batch has been read. */
+	rt_build_hold(ctx);
 	if (if_handlelink(ctx) == -1) {
-		if (errno == ENOBUFS || errno == ENOMEM) {
+		if (errno == ENOBUFS || errno == ENOMEM)
 			dhcpcd_linkoverflow(ctx);
-			return;
-		}
-		if (errno != ENOTSUP)
+		else if (errno != ENOTSUP)
 			logerr(__func__);
 	}
+	rt_build_release(ctx);
 }
 
 static void
@@ -1173,8 +1187,6 @@ dhcpcd_linkoverflow(struct dhcpcd_ctx *ctx)
 {
 	socklen_t socklen;
 	int rcvbuflen;
-	char buf[2048];
-	ssize_t rlen;
 	size_t rcnt;
 	struct if_head *ifaces;
 	struct ifaddrs *ifaddrs;
@@ -1196,14 +1208,11 @@ dhcpcd_linkoverflow(struct dhcpcd_ctx *ctx)
 
 	/* Drain the socket.
 	 * We cannot open a new one due to privsep. */
-	rcnt = 0;
-	do {
-		rlen = read(ctx->link_fd, buf, sizeof(buf));
-		if (++rcnt % 1000 == 0)
-			logwarnx("drained %zu messages", rcnt);
-	} while (rlen != -1 || errno == ENOBUFS || errno == ENOMEM);
-	if (rcnt % 1000 != 0)
-		logwarnx("drained %zu messages", rcnt);
+	rcnt = if_drainlink(ctx);
+	logwarnx("drained %zu messages", rcnt);
+
+	/* We have lost route messages as well. */
+	rt_kroutes_invalidate(ctx, AF_UNSPEC);
 
 	/* Work out the current interfaces. */
 	ifaces = if_discover(ctx, &ifaddrs, ctx->ifc, ctx->ifv);
@@ -1232,6 +1241,7 @@ dhcpcd_linkoverflow(struct dhcpcd_ctx *ctx)
 			continue;
 		}
 		TAILQ_INSERT_TAIL(ctx->ifaces, ifp, next);
+		if_hashadd(ifp);
 		if (ifp->active) {
 			dhcpcd_initstate(ifp, 0);
 			eloop_timeout_add_sec(ctx->eloop, 0,
@@ -1351,6 +1361,7 @@ reconf_reboot(struct dhcpcd_ctx *ctx, int action, int argc, char **argv, int oi)
 			dhcpcd_prestartinterface(ifp);
 		}
 	}
+	report_optshare(ctx);
 }
 
 static void
@@ -1407,6 +1418,101 @@ dhcpcd_renew(struct dhcpcd_ctx *ctx)
 	}
 }
 
+#ifdef ELOOP_STATS
+struct dhcpcd_cbstats {
+	const struct eloop_cbstats **cs;
+	size_t len;
+	size_t n;
+};
+
+static void
+dhcpcd_cbstats_add(void *arg, const struct eloop_cbstats *cs)
+{
+	struct dhcpcd_cbstats *s = arg;
+
+	if (s->n == s->len) {
+		const struct eloop_cbstats **ncs;
+		size_t len = s->len == 0 ? 32 : s->len * 2;
+
+		ncs = reallocarray(s->cs, len, sizeof(*ncs));
+		if (ncs == NULL)
+			return;
+		s->cs = ncs;
+		s->len = len;
+	}
+	s->cs[s->n++] = cs;
+}
+
+static int
+dhcpcd_cbstats_cmp(const void *a, const void *b)
+{
+	const struct eloop_cbstats *ca, *cb;
+
+	ca = *(const struct eloop_cbstats * const *)a;
+	cb = *(const struct eloop_cbstats * const *)b;
+
+	if (ca->total_ns == cb->total_ns)
+		return 0;
+	return ca->total_ns < cb->total_ns ? 1 : -1;
+}
+
+/* Returns the histogram bound in us under which pct of calls took. */
+static unsigned long long
+dhcpcd_cbstats_pct(const struct eloop_cbstats *cs, unsigned int pct)
+{
+	unsigned long long want, sum = 0;
+	size_t b;
+
+	want = (cs->count * pct + 99) / 100;
+	for (b = 0; b < ELOOP_STATS_BUCKETS - 1; b++) {
+		sum += cs->hist[b];
+		if (sum >= want)
+			break;
+	}
+	return 1ULL << b;
+}
+
+/* Log the time spent in each eloop callback, most expensive first. */
+static void
+dhcpcd_logstats(struct dhcpcd_ctx *ctx)
+{
+	static const char *kinds[] = { "", "event", "timeout", "signal" };
+	struct dhcpcd_cbstats s = { .cs = NULL };
+	struct eloop_stats es;
+	const struct eloop_cbstats *cs;
+	struct timespec now;
+	unsigned long long secs;
+	unsigned int nsecs;
+	size_t i;
+
+	eloop_stats(ctx->eloop, &es, dhcpcd_cbstats_add, &s);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = eloop_timespec_diff(&now, &es.since, &nsecs);
+	loginfox("eloop: %llu wakeups in %llu.%03us, "
+	    "polling %llu.%03llus, dispatching %llu.%06llus",
+	    es.wakeups, secs, nsecs / NSEC_PER_MSEC,
+	    es.poll_ns / NSEC_PER_SEC,
+	    (es.poll_ns % NSEC_PER_SEC) / NSEC_PER_MSEC,
+	    es.dispatch_ns / NSEC_PER_SEC,
+	    (es.dispatch_ns % NSEC_PER_SEC) / 1000);
+
+	if (s.n != 0)
+		qsort(s.cs, s.n, sizeof(*s.cs), dhcpcd_cbstats_cmp);
+	for (i = 0; i < s.n; i++) {
+		cs = s.cs[i];
+		loginfox("eloop: %s %s: %llu calls, %llu.%06llus total, "
+		    "max %lluus, 50%% <%lluus, 99%% <%lluus",
+		    kinds[cs->kind < __arraycount(kinds) ? cs->kind : 0],
+		    cs->name, cs->count,
+		    cs->total_ns / NSEC_PER_SEC,
+		    (cs->total_ns % NSEC_PER_SEC) / 1000,
+		    cs->max_ns / 1000,
+		    dhcpcd_cbstats_pct(cs, 50), dhcpcd_cbstats_pct(cs, 99));
+	}
+	free(s.cs);
+}
+#endif
+
 #ifdef USE_SIGNALS
 #define sigmsg "received %s, %s"
 void
@@ -1415,6 +1521,10 @@ dhcpcd_signal_cb(int sig, void *arg)
 	struct dhcpcd_ctx *ctx = arg;
 	unsigned long long opts;
 	int exit_code;
+#ifndef PRIVSEP
+	pid_t pid;
+	int status;
+#endif
 
 	if (ctx->options & DHCPCD_DUMPLEASE) {
 		eloop_exit(ctx->eloop, EXIT_FAILURE);
@@ -1428,6 +1538,13 @@ dhcpcd_signal_cb(int sig, void *arg)
 		return;
 	}
 
+#ifdef WORKERS
+	if (IN_WORKERS_MANAGER(ctx)) {
+		workers_signal(ctx, sig);
+		return;
+	}
+#endif
+
 	opts = 0;
 	exit_code = EXIT_FAILURE;
 	switch (sig) {
@@ -1457,6 +1574,9 @@ dhcpcd_signal_cb(int sig, void *arg)
 		return;
 	case SIGUSR2:
 		loginfox(sigmsg, "SIGUSR2", "reopening log");
+#ifdef ELOOP_STATS
+		dhcpcd_logstats(ctx);
+#endif
 #ifdef PRIVSEP
 		if (IN_PRIVSEP(ctx)) {
 			if (ps_root_logreopen(ctx) == -1)
@@ -1471,8 +1591,8 @@ dhcpcd_signal_cb(int sig, void *arg)
 #ifdef PRIVSEP
 		ps_root_signalcb(sig, ctx);
 #else
-		while (waitpid(-1, NULL, WNOHANG) > 0)
-			;
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+			script_reap(ctx, pid, status);
 #endif
 		return;
 	default:
@@ -1501,7 +1621,8 @@ dhcpcd_handleargs(struct dhcpcd_ctx *ctx, struct fd_list *fd,
 	 * as the other end should be blocking until it gets the
 	 * expected reply we should be safely able just to change the
 	 * write callback on the fd */
-	/* Make any change here in privsep-control.c as well. */
+	/* Make any change here in privsep-control.c and workers.c
+	 * as well. */
 	if (strcmp(*argv, "--version") == 0) {
 		return control_queue(fd, UNCONST(VERSION),
 		    strlen(VERSION) + 1);
@@ -1893,6 +2014,8 @@ main(int argc, char **argv, char **envp)
 	}
 
 	memset(&ctx, 0, sizeof(ctx));
+	clock_gettime(CLOCK_MONOTONIC, &ctx.start_ts);
+	ctx.phase_ts = ctx.start_ts;
 
 	ifo = NULL;
 	ctx.cffile = CONFIG;
@@ -1904,6 +2027,8 @@ main(int argc, char **argv, char **envp)
 #endif
 
 	TAILQ_INIT(&ctx.control_fds);
+	control_state_init(&ctx);
+	TAILQ_INIT(&ctx.script_jobs);
 #ifdef USE_SIGNALS
 	ctx.fork_fd = -1;
 #endif
@@ -1924,6 +2049,7 @@ main(int argc, char **argv, char **envp)
 #ifdef PRIVSEP
 	ctx.ps_log_fd = -1;
 	TAILQ_INIT(&ctx.ps_processes);
+	TAILQ_INIT(&ctx.ps_root_requests);
 #endif
 
 	/* Check our streams for validity */
@@ -2129,6 +2255,8 @@ printpidfile:
 	if (chdir("/") == -1)
 		logerr("%s: chdir: /", __func__);
 
+	dhcpcd_startphase(&ctx, "config");
+
 	/* Freeing allocated addresses from dumping leases can trigger
 	 * eloop removals as well, so init here. */
 	if ((ctx.eloop = eloop_new()) == NULL) {
@@ -2322,6 +2450,7 @@ printpidfile:
 		logerr("fork");
 		goto exit_failure;
 	case 0:
+		eloop_forked(ctx.eloop);
 		ctx.fork_fd = fork_fd[1];
 		close(fork_fd[0]);
 #ifdef PRIVSEP_RIGHTS
@@ -2435,6 +2564,7 @@ start_manager:
 	if (ctx.options & DHCPCD_FORKED)
 		goto run_loop;
 #endif
+	dhcpcd_startphase(&ctx, "processes");
 
 	if (!(ctx.options & DHCPCD_TEST)) {
 		if (control_start(&ctx,
@@ -2446,6 +2576,24 @@ start_manager:
 		}
 	}
 
+	setproctitle("%s%s%s",
+	    ctx.options & DHCPCD_MANAGER ? "[manager]" : argv[optind],
+	    ctx.options & DHCPCD_IPV4 ? " [ip4]" : "",
+	    ctx.options & DHCPCD_IPV6 ? " [ip6]" : "");
+
+#ifdef WORKERS
+	switch (workers_start(&ctx)) {
+	case -1:
+		logerr("workers_start");
+		goto exit_failure;
+	case 0:
+		break;
+	default:
+		/* The workers look after the interfaces. */
+		goto run_loop;
+	}
+#endif
+
 #ifdef PLUGIN_DEV
 	/* Start any dev listening plugin which may want to
 	 * change the interface name provided by the kernel */
@@ -2455,11 +2603,6 @@ start_manager:
 		dev_start(&ctx, dhcpcd_handleinterface);
 #endif
 
-	setproctitle("%s%s%s",
-	    ctx.options & DHCPCD_MANAGER ? "[manager]" : argv[optind],
-	    ctx.options & DHCPCD_IPV4 ? " [ip4]" : "",
-	    ctx.options & DHCPCD_IPV6 ? " [ip6]" : "");
-
 	if (if_opensockets(&ctx) == -1) {
 		logerr("%s: if_opensockets", __func__);
 		goto exit_failure;
@@ -2496,7 +2639,15 @@ start_manager:
 		logerr("%s: if_discover", __func__);
 		goto exit_failure;
 	}
+	TAILQ_FOREACH(ifp, ctx.ifaces, next) {
+		if_hashadd(ifp);
+	}
+	dhcpcd_startphase(&ctx, "discovery");
 	for (i = 0; i < ctx.ifc; i++) {
+#ifdef WORKERS
+		if (!workers_ownsif(&ctx, ctx.ifv[i]))
+			continue;
+#endif
 		if ((ifp = if_find(ctx.ifaces, ctx.ifv[i])) == NULL)
 			logerrx("%s: interface not found",
 			    ctx.ifv[i]);
@@ -2509,7 +2660,13 @@ start_manager:
 			break;
 	}
 	if (ifp == NULL) {
-		if (ctx.ifc == 0) {
+		if (IN_WORKER(&ctx)) {
+			/* Other workers have the interfaces,
+			 * so there is nothing to wait for here. */
+			logdebugx("no valid interfaces found");
+			ctx.options |= DHCPCD_NOWAITIP;
+			dhcpcd_daemonise(&ctx);
+		} else if (ctx.ifc == 0) {
 			int loglevel;
 
 			loglevel = ctx.options & DHCPCD_INACTIVE ?
@@ -2518,7 +2675,7 @@ start_manager:
 			dhcpcd_daemonise(&ctx);
 		} else
 			goto exit_failure;
-		if (!(ctx.options & DHCPCD_LINK)) {
+		if (!(ctx.options & DHCPCD_LINK) && !IN_WORKER(&ctx)) {
 			logerrx("aborting as link detection is disabled");
 			goto exit_failure;
 		}
@@ -2528,6 +2685,7 @@ start_manager:
 		if (ifp->active)
 			dhcpcd_initstate1(ifp, argc, argv, 0);
 	}
+	report_optshare(&ctx);
 	if_learnaddrs(&ctx, ctx.ifaces, &ifaddrs);
 
 	if (ctx.options & DHCPCD_BACKGROUND)
@@ -2574,6 +2732,17 @@ start_manager:
 	}
 	free_options(&ctx, ifo);
 	ifo = NULL;
+	dhcpcd_startphase(&ctx, "interfaces");
+
+	/* Under privilege separation, fetch all the leases at once
+	 * rather than a round trip for each interface. */
+	len = lease_prefetch(&ctx);
+	if (len == -1)
+		logerr("%s: lease_prefetch", __func__);
+	else if (len != 0) {
+		logdebugx("prefetched %zd leases", len);
+		dhcpcd_startphase(&ctx, "leases");
+	}
 
 	TAILQ_FOREACH(ifp, ctx.ifaces, next) {
 		if (ifp->active)
@@ -2597,8 +2766,13 @@ exit_failure:
 	i = EXIT_FAILURE;
 
 exit1:
+	/* Ensure any queued scripts have run before we exit. */
+	script_wait(&ctx);
 	if (!(ctx.options & DHCPCD_TEST) && control_stop(&ctx) == -1)
 		logerr("%s: control_stop", __func__);
+#ifdef WORKERS
+	workers_free(&ctx);
+#endif
 	if (ifaddrs != NULL) {
 #ifdef PRIVSEP_GETIFADDRS
 		if (IN_PRIVSEP(&ctx))
@@ -2614,11 +2788,15 @@ exit1:
 	if (ctx.ifaces) {
 		while ((ifp = TAILQ_FIRST(ctx.ifaces))) {
 			TAILQ_REMOVE(ctx.ifaces, ifp, next);
+			if_hashdel(ifp);
 			if_free(ifp);
 		}
 		free(ctx.ifaces);
 		ctx.ifaces = NULL;
 	}
+	if_hashfree(&ctx);
+	control_state_free(&ctx);
+	lease_free(&ctx);
 	free_options(&ctx, ifo);
 #ifdef HAVE_OPEN_MEMSTREAM
 	if (ctx.script_fp)
@@ -2634,6 +2812,8 @@ exit1:
 	}
 	if_closesockets(&ctx);
 	free_globals(&ctx);
+	free_definitions(&ctx);
+	free_cfcompiled(&ctx);
 #ifdef INET6
 	ipv6_ctxfree(&ctx);
 #endif
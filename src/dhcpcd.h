@@ -73,6 +73,8 @@
 struct interface {
 	struct dhcpcd_ctx *ctx;
 	TAILQ_ENTRY(interface) next;
+	struct interface *hindex_next;	/* ctx->ifindex_hash chain */
+	struct interface *hname_next;	/* ctx->ifname_hash chain */
 	char name[IF_NAMESIZE];
 	unsigned int index;
 	unsigned int active;
@@ -90,6 +92,10 @@ struct interface {
 	char profile[PROFILE_LEN];
 	struct if_options *options;
 	void *if_data[IF_DATA_MAX];
+
+	uint64_t ctl_gen;		/* generation of the last change */
+	TAILQ_ENTRY(interface) ctl_next; /* ctx->ctl_ifaces */
+	struct env_frag *env_frags;	/* cached lease environments */
 };
 TAILQ_HEAD(if_head, interface);
 
@@ -134,17 +140,40 @@ struct dhcpcd_ctx {
 	char **ifv;	/* listed interfaces */
 	int ifcc;	/* configured interfaces */
 	char **ifcv;	/* configured interfaces */
+	unsigned int cf_gen;	/* bumped as options are loaded */
+	uint64_t cf_defhash;	/* hash of the loaded option definitions */
+	struct cf_compiled *cf_compiled;	/* dhcpcd.conf */
+	struct if_optshare *optshares;	/* tables shared between ifaces */
+	struct timespec start_ts;	/* cleared once configured */
+	struct timespec phase_ts;	/* end of the last startup phase */
 	uint8_t duid_type;
 	unsigned char *duid;
 	size_t duid_len;
 	struct if_head *ifaces;
+	struct interface **ifindex_hash;	/* ifaces by index */
+	struct interface **ifname_hash;		/* ifaces by name */
+	size_t ifhash_len;
+	size_t ifhash_count;
 
 	char *ctl_buf;
 	size_t ctl_buflen;
 	size_t ctl_bufpos;
 	size_t ctl_extra;
 
+	uint64_t ctl_gen;		/* control state generation */
+	uint64_t ctl_gen_floor;		/* deltas before this need resync */
+	struct if_head ctl_ifaces;	/* changed ifaces by ctl_gen */
+	struct ctl_gone_head ctl_gone;	/* departed ifaces by cg_gen */
+	size_t ctl_ngone;
+
 	rb_tree_t routes;	/* our routes */
+	rb_tree_t kroutes;	/* mirror of kernel routes */
+	unsigned int kroutes_valid; /* address families kroutes holds */
+	unsigned int rt_hold;	/* defer rt_build while non zero */
+	unsigned int rt_dirty;	/* address families to rebuild */
+	struct if_txop *tx_ops;	/* route and address changes to send */
+	size_t tx_nops;
+	size_t tx_opslen;
 #ifdef RT_FREE_ROUTE_TABLE
 	rb_tree_t froutes;	/* free routes for re-use */
 #endif
@@ -159,6 +188,11 @@ struct dhcpcd_ctx {
 #ifndef SMALL
 	int link_rcvbuf;
 #endif
+	unsigned int lease_delay;	/* seconds to hold lease writes */
+	bool lease_log;			/* keep all leases in LEASELOG */
+	struct lease_store *lease_store;
+	struct lease_store *lease_cache;	/* prefetched by the manager */
+
 	int seq;	/* route message sequence no */
 	int sseq;	/* successful seq no sent */
 
@@ -175,6 +209,8 @@ struct dhcpcd_ctx {
 	size_t script_buflen;
 	char **script_env;
 	size_t script_envlen;
+	TAILQ_HEAD(, script_job) script_jobs;
+	size_t script_jobs_running;
 
 	int control_fd;
 	int control_unpriv_fd;
@@ -183,6 +219,13 @@ struct dhcpcd_ctx {
 	char control_sock_unpriv[sizeof(CONTROLSOCKET) + IF_NAMESIZE + 7];
 	gid_t control_group;
 
+#ifdef WORKERS
+	unsigned int workers;		/* share interfaces over N processes */
+	struct wk_manager *wk_manager;	/* set in the manager of workers */
+	struct wk_worker *wk_worker;	/* set in a worker */
+	struct fd_list *wk_client;	/* request the worker is answering */
+#endif
+
 	/* DHCP Enterprise options, RFC3925 */
 	struct dhcp_opt *vivso;
 	size_t vivso_len;
@@ -206,6 +249,12 @@ struct dhcpcd_ctx {
 	int ps_log_fd;		/* chroot logging */
 	int ps_log_root_fd;	/* outside chroot log reader */
 	struct eloop *ps_eloop;	/* eloop for polling root data */
+	uint16_t ps_root_rid;	/* last request id sent to root */
+	TAILQ_HEAD(, psr_request) ps_root_requests; /* awaiting a reply */
+	size_t ps_root_nrequests;
+#ifdef PRIVSEP_RING
+	struct ps_ringpool *ps_rings;	/* shared memory to the manager */
+#endif
 	struct fd_list *ps_control;		/* Queue for the above */
 	struct fd_list *ps_control_client;	/* Queue for the above */
 #endif
@@ -217,11 +266,10 @@ struct dhcpcd_ctx {
 	int udp_rfd;
 	int udp_wfd;
 
-	/* Our aggregate option buffer.
-	 * We ONLY use this when options are split, which for most purposes is
-	 * practically never. See RFC3396 for details. */
-	uint8_t *opt_buffer;
-	size_t opt_buffer_len;
+	/* Option index for the message being handled. */
+	struct dhcp_optidx *opt_recv;
+	/* Option index when no other could be allocated. */
+	struct dhcp_optidx *opt_scratch;
 #endif
 #ifdef INET6
 	uint8_t *secret;
@@ -239,6 +287,11 @@ struct dhcpcd_ctx {
 	int dhcp6_wfd;
 	struct dhcp_opt *dhcp6_opts;
 	size_t dhcp6_opts_len;
+
+	/* Option index for the message being handled. */
+	struct dhcp6_optidx *dhcp6_opt_recv;
+	/* Option index when no other could be allocated. */
+	struct dhcp6_optidx *dhcp6_opt_scratch;
 #endif
 
 #ifndef __linux__
@@ -52,7 +52,18 @@
  * signalfd(2) is available for Linux which probably works in a similar way
  * but it's yet another fd to use.
  *
- * Taking this all into account, ppoll(2) is the default mechanism used here.
+ * io_uring(7) can be used on Linux to submit the poll changes and wait
+ * for events and timeouts in one syscall per loop iteration.
+ * It uses signalfd for signals, needs the ring mapped into each process
+ * and is not available everywhere.
+ *
+ * Taking this all into account, ppoll(2) is the default mechanism used here,
+ * on Linux as everywhere else.
+ * configure tests for ppoll, then pollts, then pselect.
+ * kqueue, epoll and io_uring are only used when asked for with
+ * ./configure --with-poll=kqueue|epoll|io_uring.
+ * Should config.h define more than one, the order below picks
+ * ppoll, pollts, kqueue, epoll, io_uring and then pselect.
  */
 
 #if (defined(__unix__) || defined(unix)) && !defined(USG)
@@ -80,19 +91,26 @@
 /* Prioritise which mechanism we want to use.*/
 #if defined(HAVE_PPOLL)
 #undef HAVE_EPOLL
+#undef HAVE_IO_URING
 #undef HAVE_KQUEUE
 #undef HAVE_PSELECT
 #elif defined(HAVE_POLLTS)
 #define HAVE_PPOLL
 #define ppoll pollts
 #undef HAVE_EPOLL
+#undef HAVE_IO_URING
 #undef HAVE_KQUEUE
 #undef HAVE_PSELECT
 #elif defined(HAVE_KQUEUE)
 #undef HAVE_EPOLL
+#undef HAVE_IO_URING
 #undef HAVE_PSELECT
 #elif defined(HAVE_EPOLL)
 #undef HAVE_KQUEUE
+#undef HAVE_IO_URING
+#undef HAVE_PSELECT
+#elif defined(HAVE_IO_URING)
+#undef HAVE_KQUEUE
 #undef HAVE_PSELECT
 #elif !defined(HAVE_PSELECT)
 #define HAVE_PPOLL
@@ -110,6 +128,12 @@
 #elif defined(HAVE_EPOLL)
 #include <sys/epoll.h>
 #define	NFD 1
+#elif defined(HAVE_IO_URING)
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <poll.h>
 #elif defined(HAVE_PPOLL)
 #include <poll.h>
 #define NFD 1
@@ -122,6 +146,9 @@
 #ifndef UNUSED
 #define UNUSED(a) (void)((a))
 #endif
+#ifndef __arraycount
+#define __arraycount(a) (sizeof(a) / sizeof(a[0]))
+#endif
 #ifndef __unused
 #ifdef __GNUC__
 #define __unused   __attribute__((__unused__))
@@ -174,51 +201,168 @@
 #define	UTIME_MAX	(TIME_MAX * 2) + 1
 #endif
 
+/*
+ * Events are indexed by their fd in a dense table so that adding,
+ * modifying and deleting an event does not need to search for it.
+ * Each event is stamped with a generation when added so that anything
+ * returned by the kernel for an event deleted during dispatch, or for
+ * an event since re-added on the same fd, can be ignored.
+ */
 struct eloop_event {
 	TAILQ_ENTRY(eloop_event) next;
 	int fd;
+	unsigned int gen;
 	void (*cb)(void *, unsigned short);
 	void *cb_arg;
 	unsigned short events;
 #ifdef HAVE_PPOLL
-	struct pollfd *pollfd;
+	size_t pollfd;
+#endif
+#ifdef ELOOP_STATS
+	struct eloop_stat *stat;
 #endif
 };
 
+/*
+ * Timeouts are kept in a binary min-heap ordered by their absolute
+ * monotonic deadline, with a sequence number to keep timeouts which
+ * expire at the same time in the order they were added.
+ * Each timeout is also hashed on its argument so that an existing
+ * timeout for a callback and argument can be found without walking
+ * every pending timeout.
+ */
 struct eloop_timeout {
 	TAILQ_ENTRY(eloop_timeout) next;
-	unsigned int seconds;
-	unsigned int nseconds;
+	struct eloop_timeout *hnext;
+	struct timespec when;
+	unsigned long long seq;
+	size_t heap_idx;
 	void (*callback)(void *);
 	void *arg;
 	int queue;
+#ifdef ELOOP_STATS
+	struct eloop_stat *stat;
+#endif
+};
+
+#ifdef ELOOP_STATS
+/*
+ * Callbacks are accounted by name and kind.
+ * Each event and timeout points to its stats, so the hash is only
+ * searched when a callback is added.
+ */
+#define	ELOOP_STATS_HASH	64
+
+struct eloop_stat {
+	struct eloop_stat *next;
+	struct eloop_cbstats s;
+};
+
+/* Define the functions which take the callback name. */
+#undef eloop_event_add
+#undef eloop_q_timeout_add_tv
+#undef eloop_q_timeout_add_sec
+#undef eloop_q_timeout_add_msec
+#undef eloop_q_timeout_add_sec_slack
+#undef eloop_q_timeout_add_msec_slack
+#undef eloop_signal_set_cb
+#define	eloop_event_add		eloop_event_add_named
+#define	eloop_q_timeout_add_tv	eloop_q_timeout_add_tv_named
+#define	eloop_q_timeout_add_sec	eloop_q_timeout_add_sec_named
+#define	eloop_q_timeout_add_msec eloop_q_timeout_add_msec_named
+#define	eloop_q_timeout_add_sec_slack eloop_q_timeout_add_sec_slack_named
+#define	eloop_q_timeout_add_msec_slack eloop_q_timeout_add_msec_slack_named
+#define	eloop_signal_set_cb	eloop_signal_set_cb_named
+#define	ELOOP_NAMEP		, const char *name
+#define	ELOOP_NAME		, name
+#else
+#define	ELOOP_NAMEP
+#define	ELOOP_NAME
+#endif
+
+#ifdef HAVE_IO_URING
+/*
+ * Each SQE and CQE carries user_data.
+ * Events use their generation and fd which can never be less than
+ * 1 << 32, so the values below are free for our own use.
+ */
+#define	ELOOP_RING_IGNORE	0
+#define	ELOOP_RING_TIMEOUT	1
+#define	ELOOP_RING_SIGNAL	2
+#define	ELOOP_RING_ENTRIES	256
+
+struct eloop_ring {
+	pid_t pid;
+	void *sq_ring;
+	size_t sq_ring_len;
+	void *cq_ring;
+	size_t cq_ring_len;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_array;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+	bool signal_armed;
+	bool timeout_armed;
+	struct __kernel_timespec timeout;
 };
 
+/* Like the signal handler used by the other mechanisms, the signalfd
+ * belongs to the process and is polled by whichever eloop is running. */
+static int _eloop_sigfd = -1;
+#endif
+
+#if defined(HAVE_EPOLL) || defined(HAVE_IO_URING)
+#define	ELOOP_EVENT_DATA(e) \
+	((uint64_t)(e)->gen << 32 | (uint32_t)(e)->fd)
+#endif
+
 struct eloop {
-	TAILQ_HEAD (event_head, eloop_event) events;
+	struct eloop_event **events;
+	size_t events_len;
 	size_t nevents;
-	struct event_head free_events;
+	unsigned int events_gen;
+	TAILQ_HEAD (event_head, eloop_event) free_events;
 
 	struct timespec now;
-	TAILQ_HEAD (timeout_head, eloop_timeout) timeouts;
-	struct timeout_head free_timeouts;
+	struct eloop_timeout **timeouts;
+	size_t ntimeouts;
+	size_t timeouts_len;
+	struct eloop_timeout **timeout_hash;
+	size_t timeout_hash_len;
+	unsigned long long timeout_seq;
+	TAILQ_HEAD (timeout_head, eloop_timeout) free_timeouts;
 
 	const int *signals;
 	size_t nsignals;
 	void (*signal_cb)(int, void *);
 	void *signal_cb_ctx;
 
-#if defined(HAVE_KQUEUE) || defined(HAVE_EPOLL)
+#ifdef ELOOP_STATS
+	struct eloop_stat *stats_hash[ELOOP_STATS_HASH];
+	struct eloop_stat *signal_stat;
+	struct eloop_stats stats;
+#endif
+
+#if defined(HAVE_KQUEUE) || defined(HAVE_EPOLL) || defined(HAVE_IO_URING)
 	int fd;
 #endif
 #if defined(HAVE_KQUEUE)
 	struct kevent *fds;
 #elif defined(HAVE_EPOLL)
 	struct epoll_event *fds;
+#elif defined(HAVE_IO_URING)
+	struct eloop_ring ring;
 #elif defined(HAVE_PPOLL)
 	struct pollfd *fds;
 #endif
-#if !defined(HAVE_PSELECT)
+#if !defined(HAVE_PSELECT) && !defined(HAVE_IO_URING)
 	size_t nfds;
 #endif
 
@@ -247,22 +391,254 @@ eloop_realloca(void *ptr, size_t n, size_t size)
 #endif
 
 
+#ifdef ELOOP_STATS
+static struct eloop_stat *
+eloop_stat_find(struct eloop *eloop, const char *name, unsigned int kind)
+{
+	struct eloop_stat *st;
+	const unsigned char *p;
+	unsigned int h = 2166136261U;
+
+	/* FNV-1a */
+	for (p = (const unsigned char *)name; *p != '\0'; p++) {
+		h ^= *p;
+		h *= 16777619U;
+	}
+	h = (h ^ kind) % ELOOP_STATS_HASH;
+
+	for (st = eloop->stats_hash[h]; st != NULL; st = st->next) {
+		if (st->s.kind == kind &&
+		    (st->s.name == name || strcmp(st->s.name, name) == 0))
+			return st;
+	}
+
+	/* If we cannot allocate then the callback goes unaccounted. */
+	st = calloc(1, sizeof(*st));
+	if (st == NULL)
+		return NULL;
+	st->s.name = name;
+	st->s.kind = kind;
+	st->next = eloop->stats_hash[h];
+	eloop->stats_hash[h] = st;
+	return st;
+}
+#endif
+
+#ifdef HAVE_IO_URING
+static int
+eloop_ring_enter(struct eloop *eloop, unsigned int min_complete)
+{
+	struct eloop_ring *r = &eloop->ring;
+	unsigned int queued;
+
+	queued = *r->sq_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	if (queued == 0 && min_complete == 0)
+		return 0;
+	return (int)syscall(__NR_io_uring_enter, eloop->fd, queued,
+	    min_complete, min_complete != 0 ? IORING_ENTER_GETEVENTS : 0,
+	    NULL, 0);
+}
+
+/* Returns the next free SQE, submitting the queue if it's full. */
+static struct io_uring_sqe *
+eloop_ring_sqe(struct eloop *eloop, uint8_t opcode, int fd, uint64_t udata)
+{
+	struct eloop_ring *r = &eloop->ring;
+	struct io_uring_sqe *sqe;
+	unsigned int tail = *r->sq_tail, idx;
+
+	if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) ==
+	    r->sq_entries)
+	{
+		if (eloop_ring_enter(eloop, 0) == -1)
+			return NULL;
+		if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) ==
+		    r->sq_entries)
+		{
+			errno = EBUSY;
+			return NULL;
+		}
+	}
+
+	idx = tail & r->sq_mask;
+	sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->user_data = udata;
+	r->sq_array[idx] = idx;
+	return sqe;
+}
+
+/* Make the SQE from eloop_ring_sqe visible to the kernel. */
+static void
+eloop_ring_queue(struct eloop *eloop)
+{
+	struct eloop_ring *r = &eloop->ring;
+
+	__atomic_store_n(r->sq_tail, *r->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Polls are oneshot and re-armed after each dispatch.
+ * Multishot polls only fire on a new wakeup, but our callbacks read
+ * one message at a time and rely on being called again if more remain.
+ */
+static int
+eloop_ring_poll(struct eloop *eloop, int fd, unsigned short events,
+    uint64_t udata)
+{
+	struct io_uring_sqe *sqe;
+	uint32_t mask = 0;
+
+	sqe = eloop_ring_sqe(eloop, IORING_OP_POLL_ADD, fd, udata);
+	if (sqe == NULL)
+		return -1;
+	if (events & ELE_READ)
+		mask |= POLLIN;
+	if (events & ELE_WRITE)
+		mask |= POLLOUT;
+#if BYTE_ORDER == BIG_ENDIAN
+	mask = mask << 16 | mask >> 16;
+#endif
+	sqe->poll32_events = mask;
+	eloop_ring_queue(eloop);
+	return 0;
+}
+
+static int
+eloop_ring_poll_remove(struct eloop *eloop, uint64_t udata)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = eloop_ring_sqe(eloop, IORING_OP_POLL_REMOVE, -1,
+	    ELOOP_RING_IGNORE);
+	if (sqe == NULL)
+		return -1;
+	sqe->addr = udata;
+	eloop_ring_queue(eloop);
+	return 0;
+}
+
+static void
+eloop_ring_close(struct eloop *eloop)
+{
+	struct eloop_ring *r = &eloop->ring;
+
+	/* A forked child has no mappings to unmap. */
+	if (r->pid == getpid()) {
+		if (r->sqes != NULL)
+			munmap(r->sqes, r->sqes_len);
+		if (r->cq_ring != NULL && r->cq_ring != r->sq_ring)
+			munmap(r->cq_ring, r->cq_ring_len);
+		if (r->sq_ring != NULL)
+			munmap(r->sq_ring, r->sq_ring_len);
+	}
+	r->sqes = NULL;
+	r->sq_ring = r->cq_ring = NULL;
+	r->signal_armed = false;
+	r->timeout_armed = false;
+	if (eloop->fd != -1) {
+		close(eloop->fd);
+		eloop->fd = -1;
+	}
+}
+
+/*
+ * The rings are not inherited over fork(2) as the kernel would then
+ * see SQEs from both processes.
+ * The child must call eloop_forked() before using the eloop again.
+ */
+static void *
+eloop_ring_mmap(int fd, size_t len, off_t off)
+{
+	void *p;
+
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, fd, off);
+	if (p == MAP_FAILED)
+		return NULL;
+	if (madvise(p, len, MADV_DONTFORK) == -1) {
+		munmap(p, len);
+		return NULL;
+	}
+	return p;
+}
+
+static int
+eloop_ring_open(struct eloop *eloop)
+{
+	struct eloop_ring *r = &eloop->ring;
+	struct io_uring_params p;
+	int fd;
+	uint8_t *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	fd = (int)syscall(__NR_io_uring_setup, ELOOP_RING_ENTRIES, &p);
+	if (fd == -1)
+		return -1;
+	eloop->fd = fd;
+	r->pid = getpid();
+
+	r->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_ring_len = p.cq_off.cqes +
+	    p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_ring_len > r->sq_ring_len)
+			r->sq_ring_len = r->cq_ring_len;
+		r->cq_ring_len = r->sq_ring_len;
+	}
+	r->sq_ring = eloop_ring_mmap(fd, r->sq_ring_len, IORING_OFF_SQ_RING);
+	if (r->sq_ring == NULL)
+		goto err;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_ring = r->sq_ring;
+	else {
+		r->cq_ring = eloop_ring_mmap(fd, r->cq_ring_len,
+		    IORING_OFF_CQ_RING);
+		if (r->cq_ring == NULL)
+			goto err;
+	}
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = eloop_ring_mmap(fd, r->sqes_len, IORING_OFF_SQES);
+	if (r->sqes == NULL)
+		goto err;
+
+	sq = r->sq_ring;
+	r->sq_head = (void *)(sq + p.sq_off.head);
+	r->sq_tail = (void *)(sq + p.sq_off.tail);
+	r->sq_mask = *(unsigned int *)(void *)(sq + p.sq_off.ring_mask);
+	r->sq_entries = p.sq_entries;
+	r->sq_array = (void *)(sq + p.sq_off.array);
+	cq = r->cq_ring;
+	r->cq_head = (void *)(cq + p.cq_off.head);
+	r->cq_tail = (void *)(cq + p.cq_off.tail);
+	r->cq_mask = *(unsigned int *)(void *)(cq + p.cq_off.ring_mask);
+	r->cqes = (void *)(cq + p.cq_off.cqes);
+	r->signal_armed = false;
+	r->timeout_armed = false;
+	return fd;
+
+err:
+	eloop_ring_close(eloop);
+	return -1;
+}
+#endif
+
+
+#if defined(HAVE_KQUEUE) || defined(HAVE_EPOLL)
+/* Ensure there is room for the kernel to return every event. */
 static int
 eloop_event_setup_fds(struct eloop *eloop)
 {
-	struct eloop_event *e, *ne;
 #if defined(HAVE_KQUEUE)
 	struct kevent *pfd;
 	size_t nfds = eloop->nsignals;
 #elif defined(HAVE_EPOLL)
 	struct epoll_event *pfd;
 	size_t nfds = 0;
-#elif defined(HAVE_PPOLL)
-	struct pollfd *pfd;
-	size_t nfds = 0;
 #endif
 
-#ifndef HAVE_PSELECT
 	nfds += eloop->nevents * NFD;
 	if (eloop->nfds < nfds) {
 		pfd = eloop_realloca(eloop->fds, nfds, sizeof(*pfd));
@@ -271,32 +647,79 @@ eloop_event_setup_fds(struct eloop *eloop)
 		eloop->fds = pfd;
 		eloop->nfds = nfds;
 	}
+
+	eloop->events_need_setup = false;
+	return 0;
+}
 #endif
 
 #ifdef HAVE_PPOLL
-	pfd = eloop->fds;
+static void
+eloop_event_setup_pollfd(struct eloop_event *e, struct pollfd *pfd)
+{
+
+	pfd->fd = e->fd;
+	pfd->events = 0;
+	if (e->events & ELE_READ)
+		pfd->events |= POLLIN;
+	if (e->events & ELE_WRITE)
+		pfd->events |= POLLOUT;
+}
 #endif
-	TAILQ_FOREACH_SAFE(e, &eloop->events, next, ne) {
-		if (e->fd == -1) {
-			TAILQ_REMOVE(&eloop->events, e, next);
-			TAILQ_INSERT_TAIL(&eloop->free_events, e, next);
-			continue;
-		}
+
+static struct eloop_event *
+eloop_event_find(const struct eloop *eloop, int fd)
+{
+
+	if (fd < 0 || (size_t)fd >= eloop->events_len)
+		return NULL;
+	return eloop->events[fd];
+}
+
+/* Grow the event table so fd can index it. */
+static int
+eloop_event_grow(struct eloop *eloop, int fd)
+{
+	struct eloop_event **events;
+	size_t len;
+
+	if ((size_t)fd < eloop->events_len)
+		return 0;
+	len = eloop->events_len == 0 ? 64 : eloop->events_len;
+	while (len <= (size_t)fd)
+		len *= 2;
+	events = eloop_realloca(eloop->events, len, sizeof(*events));
+	if (events == NULL)
+		return -1;
+	memset(events + eloop->events_len, 0,
+	    (len - eloop->events_len) * sizeof(*events));
+	eloop->events = events;
+	eloop->events_len = len;
+	return 0;
+}
+
+/* Unlink the event, it can be reused straight away as the generation
+ * tells stale kernel events for it apart. */
+static void
+eloop_event_free(struct eloop *eloop, struct eloop_event *e)
+{
 #ifdef HAVE_PPOLL
-		e->pollfd = pfd;
-		pfd->fd = e->fd;
-		pfd->events = 0;
-		if (e->events & ELE_READ)
-			pfd->events |= POLLIN;
-		if (e->events & ELE_WRITE)
-			pfd->events |= POLLOUT;
-		pfd->revents = 0;
-		pfd++;
-#endif
+	struct pollfd *pfd;
+	struct eloop_event *le;
+
+	/* Move the last pollfd into the hole. */
+	pfd = &eloop->fds[eloop->nevents - 1];
+	if (e->pollfd != eloop->nevents - 1) {
+		le = eloop->events[pfd->fd];
+		le->pollfd = e->pollfd;
+		eloop->fds[e->pollfd] = *pfd;
 	}
+#endif
 
-	eloop->events_need_setup = false;
-	return 0;
+	eloop->events[e->fd] = NULL;
+	e->fd = -1;
+	eloop->nevents--;
+	TAILQ_INSERT_TAIL(&eloop->free_events, e, next);
 }
 
 size_t
@@ -308,31 +731,46 @@ eloop_event_count(const struct eloop *eloop)
 
 int
 eloop_event_add(struct eloop *eloop, int fd, unsigned short events,
-    void (*cb)(void *, unsigned short), void *cb_arg)
+    void (*cb)(void *, unsigned short), void *cb_arg ELOOP_NAMEP)
 {
 	struct eloop_event *e;
 	bool added;
 #if defined(HAVE_KQUEUE)
 	struct kevent ke[2], *kep = &ke[0];
 	size_t n;
+	void *udata;
 #elif defined(HAVE_EPOLL)
 	struct epoll_event epe;
 	int op;
+#elif defined(HAVE_IO_URING)
+	const unsigned short pollev = ELE_READ | ELE_WRITE;
+	bool arm;
+#elif defined(HAVE_PPOLL)
+	struct pollfd *pfd;
 #endif
 
 	assert(eloop != NULL);
 	assert(cb != NULL && cb_arg != NULL);
-	if (fd == -1 || !(events & (ELE_READ | ELE_WRITE | ELE_HANGUP))) {
+	if (fd < 0 || !(events & (ELE_READ | ELE_WRITE | ELE_HANGUP))) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	TAILQ_FOREACH(e, &eloop->events, next) {
-		if (e->fd == fd)
-			break;
-	}
-
+	e = eloop_event_find(eloop, fd);
 	if (e == NULL) {
+		if (eloop_event_grow(eloop, fd) == -1)
+			return -1;
+#ifdef HAVE_PPOLL
+		if (eloop->nevents == eloop->nfds) {
+			size_t nfds = eloop->nfds == 0 ? 64 : eloop->nfds * 2;
+
+			pfd = eloop_realloca(eloop->fds, nfds, sizeof(*pfd));
+			if (pfd == NULL)
+				return -1;
+			eloop->fds = pfd;
+			eloop->nfds = nfds;
+		}
+#endif
 		added = true;
 		e = TAILQ_FIRST(&eloop->free_events);
 		if (e != NULL)
@@ -343,67 +781,96 @@ eloop_event_add(struct eloop *eloop, int fd, unsigned short events,
 				return -1;
 			}
 		}
-		TAILQ_INSERT_HEAD(&eloop->events, e, next);
-		eloop->nevents++;
+		eloop->events[fd] = e;
 		e->fd = fd;
+		e->gen = ++eloop->events_gen;
 		e->events = 0;
+#ifdef HAVE_PPOLL
+		e->pollfd = eloop->nevents;
+		eloop->fds[e->pollfd].revents = 0;
+#endif
+		eloop->nevents++;
 	} else
 		added = false;
 
 	e->cb = cb;
 	e->cb_arg = cb_arg;
+#ifdef ELOOP_STATS
+	if (added || e->stat == NULL || e->stat->s.name != name)
+		e->stat = eloop_stat_find(eloop, name, ELOOP_STATS_EVENT);
+#endif
 
 #if defined(HAVE_KQUEUE)
 	n = 2;
+	udata = (void *)(uintptr_t)e->gen;
 	if (events & ELE_READ && !(e->events & ELE_READ))
-		EV_SET(kep++, (uintptr_t)fd, EVFILT_READ, EV_ADD, 0, 0, e);
+		EV_SET(kep++, (uintptr_t)fd, EVFILT_READ, EV_ADD, 0, 0, udata);
 	else if (!(events & ELE_READ) && e->events & ELE_READ)
-		EV_SET(kep++, (uintptr_t)fd, EVFILT_READ, EV_DELETE, 0, 0, e);
+		EV_SET(kep++, (uintptr_t)fd, EVFILT_READ, EV_DELETE,
+		    0, 0, udata);
 	else
 		n--;
 	if (events & ELE_WRITE && !(e->events & ELE_WRITE))
-		EV_SET(kep++, (uintptr_t)fd, EVFILT_WRITE, EV_ADD, 0, 0, e);
+		EV_SET(kep++, (uintptr_t)fd, EVFILT_WRITE, EV_ADD,
+		    0, 0, udata);
 	else if (!(events & ELE_WRITE) && e->events & ELE_WRITE)
-		EV_SET(kep++, (uintptr_t)fd, EVFILT_WRITE, EV_DELETE, 0, 0, e);
+		EV_SET(kep++, (uintptr_t)fd, EVFILT_WRITE, EV_DELETE,
+		    0, 0, udata);
 	else
 		n--;
 #ifdef EVFILT_PROCDESC
 	if (events & ELE_HANGUP)
 		EV_SET(kep++, (uintptr_t)fd, EVFILT_PROCDESC, EV_ADD,
-		    NOTE_EXIT, 0, e);
+		    NOTE_EXIT, 0, udata);
 	else
 		n--;
 #endif
 	if (n != 0 && _kevent(eloop->fd, ke, n, NULL, 0, NULL) == -1) {
-		if (added) {
-			TAILQ_REMOVE(&eloop->events, e, next);
-			TAILQ_INSERT_TAIL(&eloop->free_events, e, next);
-		}
+		if (added)
+			eloop_event_free(eloop, e);
 		return -1;
 	}
 #elif defined(HAVE_EPOLL)
 	memset(&epe, 0, sizeof(epe));
-	epe.data.ptr = e;
+	epe.data.u64 = ELOOP_EVENT_DATA(e);
 	if (events & ELE_READ)
 		epe.events |= EPOLLIN;
 	if (events & ELE_WRITE)
 		epe.events |= EPOLLOUT;
 	op = added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
 	if (epe.events != 0 && epoll_ctl(eloop->fd, op, fd, &epe) == -1) {
-		if (added) {
-			TAILQ_REMOVE(&eloop->events, e, next);
-			TAILQ_INSERT_TAIL(&eloop->free_events, e, next);
-		}
+		if (added)
+			eloop_event_free(eloop, e);
+		return -1;
+	}
+#elif defined(HAVE_IO_URING)
+	/* A poll cannot be modified, so replace it under a new generation
+	 * so that anything still returned for the old one is ignored. */
+	arm = added;
+	if (!added && (events & pollev) != (e->events & pollev)) {
+		if (e->events & pollev &&
+		    eloop_ring_poll_remove(eloop, ELOOP_EVENT_DATA(e)) == -1)
+			return -1;
+		e->gen = ++eloop->events_gen;
+		arm = true;
+	}
+	if (arm && events & pollev &&
+	    eloop_ring_poll(eloop, fd, events, ELOOP_EVENT_DATA(e)) == -1)
+	{
+		if (added)
+			eloop_event_free(eloop, e);
 		return -1;
 	}
-#elif defined(HAVE_PPOLL)
-	e->pollfd = NULL;
-	UNUSED(added);
 #else
 	UNUSED(added);
 #endif
 	e->events = events;
-	eloop->events_need_setup = true;
+#ifdef HAVE_PPOLL
+	eloop_event_setup_pollfd(e, &eloop->fds[e->pollfd]);
+#elif defined(HAVE_KQUEUE) || defined(HAVE_EPOLL)
+	if (added)
+		eloop->events_need_setup = true;
+#endif
 	return 0;
 }
 
@@ -417,15 +884,12 @@ eloop_event_delete(struct eloop *eloop, int fd)
 #endif
 
 	assert(eloop != NULL);
-	if (fd == -1) {
+	if (fd < 0) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	TAILQ_FOREACH(e, &eloop->events, next) {
-		if (e->fd == fd)
-			break;
-	}
+	e = eloop_event_find(eloop, fd);
 	if (e == NULL) {
 		errno = ENOENT;
 		return -1;
@@ -434,11 +898,11 @@ eloop_event_delete(struct eloop *eloop, int fd)
 #if defined(HAVE_KQUEUE)
 	n = 0;
 	if (e->events & ELE_READ) {
-		EV_SET(kep++, (uintptr_t)fd, EVFILT_READ, EV_DELETE, 0, 0, e);
+		EV_SET(kep++, (uintptr_t)fd, EVFILT_READ, EV_DELETE, 0, 0, 0);
 		n++;
 	}
 	if (e->events & ELE_WRITE) {
-		EV_SET(kep++, (uintptr_t)fd, EVFILT_WRITE, EV_DELETE, 0, 0, e);
+		EV_SET(kep++, (uintptr_t)fd, EVFILT_WRITE, EV_DELETE, 0, 0, 0);
 		n++;
 	}
 	if (n != 0 && _kevent(eloop->fd, ke, n, NULL, 0, NULL) == -1)
@@ -446,10 +910,15 @@ eloop_event_delete(struct eloop *eloop, int fd)
 #elif defined(HAVE_EPOLL)
 	if (epoll_ctl(eloop->fd, EPOLL_CTL_DEL, fd, NULL) == -1)
 		return -1;
+#elif defined(HAVE_IO_URING)
+	/* Submit the removal now as the poll holds a reference to the file
+	 * which the caller is likely to close and maybe bind again. */
+	if (e->events & (ELE_READ | ELE_WRITE) &&
+	    (eloop_ring_poll_remove(eloop, ELOOP_EVENT_DATA(e)) == -1 ||
+	    eloop_ring_enter(eloop, 0) == -1))
+		return -1;
 #endif
-	e->fd = -1;
-	eloop->nevents--;
-	eloop->events_need_setup = true;
+	eloop_event_free(eloop, e);
 	return 1;
 }
 
@@ -488,99 +957,440 @@ eloop_timespec_diff(const struct timespec *tsp, const struct timespec *usp,
 	return secs;
 }
 
+#ifdef ELOOP_STATS
+static inline void
+eloop_stat_begin(struct timespec *ts)
+{
+
+	clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
 static void
-eloop_reduce_timers(struct eloop *eloop)
+eloop_stat_end(struct eloop *eloop, struct eloop_stat *st,
+    const struct timespec *begin)
 {
-	struct timespec now;
-	unsigned long long secs;
+	struct timespec end;
+	unsigned long long ns, us;
 	unsigned int nsecs;
-	struct eloop_timeout *t;
+	size_t b;
 
-	clock_gettime(CLOCK_MONOTONIC, &now);
-	secs = eloop_timespec_diff(&now, &eloop->now, &nsecs);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = eloop_timespec_diff(&end, begin, &nsecs) * NSEC_PER_SEC + nsecs;
+	eloop->stats.dispatch_ns += ns;
+	if (st == NULL)
+		return;
 
-	TAILQ_FOREACH(t, &eloop->timeouts, next) {
-		if (secs > t->seconds) {
-			t->seconds = 0;
-			t->nseconds = 0;
-		} else {
-			t->seconds -= (unsigned int)secs;
-			if (nsecs > t->nseconds) {
-				if (t->seconds == 0)
-					t->nseconds = 0;
-				else {
-					t->seconds--;
-					t->nseconds = NSEC_PER_SEC
-					    - (nsecs - t->nseconds);
-				}
-			} else
-				t->nseconds -= nsecs;
+	st->s.count++;
+	st->s.total_ns += ns;
+	if (ns > st->s.max_ns)
+		st->s.max_ns = ns;
+	for (b = 0, us = ns / 1000; us != 0; us >>= 1) {
+		if (++b == ELOOP_STATS_BUCKETS - 1)
+			break;
+	}
+	st->s.hist[b]++;
+}
+
+void
+eloop_stats(const struct eloop *eloop, struct eloop_stats *stats,
+    void (*cb)(void *, const struct eloop_cbstats *), void *cb_arg)
+{
+	const struct eloop_stat *st;
+	size_t h;
+
+	assert(eloop != NULL);
+	if (stats != NULL)
+		*stats = eloop->stats;
+	if (cb == NULL)
+		return;
+	for (h = 0; h < ELOOP_STATS_HASH; h++) {
+		for (st = eloop->stats_hash[h]; st != NULL; st = st->next) {
+			if (st->s.count != 0)
+				cb(cb_arg, &st->s);
 		}
 	}
+}
 
-	eloop->now = now;
+/* Callbacks keep pointers to their stats, so zero rather than free. */
+void
+eloop_stats_reset(struct eloop *eloop)
+{
+	struct eloop_stat *st;
+	size_t h;
+
+	assert(eloop != NULL);
+	for (h = 0; h < ELOOP_STATS_HASH; h++) {
+		for (st = eloop->stats_hash[h]; st != NULL; st = st->next) {
+			st->s.count = st->s.total_ns = st->s.max_ns = 0;
+			memset(st->s.hist, 0, sizeof(st->s.hist));
+		}
+	}
+	memset(&eloop->stats, 0, sizeof(eloop->stats));
+	clock_gettime(CLOCK_MONOTONIC, &eloop->stats.since);
+}
+
+/* Account the time spent polling, that is the time since begin
+ * less any spent dispatching from within the poll. */
+static void
+eloop_stats_poll(struct eloop *eloop, const struct timespec *begin,
+    unsigned long long dispatch_ns)
+{
+	struct timespec end;
+	unsigned long long ns;
+	unsigned int nsecs;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = eloop_timespec_diff(&end, begin, &nsecs) * NSEC_PER_SEC + nsecs;
+	dispatch_ns = eloop->stats.dispatch_ns - dispatch_ns;
+	if (ns > dispatch_ns)
+		eloop->stats.poll_ns += ns - dispatch_ns;
+	eloop->stats.wakeups++;
+}
+
+static void
+eloop_stats_free(struct eloop *eloop)
+{
+	struct eloop_stat *st;
+	size_t h;
+
+	for (h = 0; h < ELOOP_STATS_HASH; h++) {
+		while ((st = eloop->stats_hash[h]) != NULL) {
+			eloop->stats_hash[h] = st->next;
+			free(st);
+		}
+	}
+}
+#endif
+
+static inline void
+eloop_event_cb(struct eloop *eloop, struct eloop_event *e,
+    unsigned short events)
+{
+#ifdef ELOOP_STATS
+	/* The callback could delete the event and it be reused. */
+	struct eloop_stat *st = e->stat;
+	struct timespec ts;
+
+	eloop_stat_begin(&ts);
+	e->cb(e->cb_arg, events);
+	eloop_stat_end(eloop, st, &ts);
+#else
+	UNUSED(eloop);
+	e->cb(e->cb_arg, events);
+#endif
+}
+
+static inline void
+eloop_timeout_cb(struct eloop *eloop, struct eloop_timeout *t)
+{
+#ifdef ELOOP_STATS
+	/* eloop->now was just read to find the timeout expired. */
+	struct timespec ts = eloop->now;
+
+	t->callback(t->arg);
+	eloop_stat_end(eloop, t->stat, &ts);
+#else
+	UNUSED(eloop);
+	t->callback(t->arg);
+#endif
+}
+
+static inline void
+eloop_signal_cb(struct eloop *eloop, int sig)
+{
+#ifdef ELOOP_STATS
+	struct timespec ts;
+
+	eloop_stat_begin(&ts);
+	eloop->signal_cb(sig, eloop->signal_cb_ctx);
+	eloop_stat_end(eloop, eloop->signal_stat, &ts);
+#else
+	eloop->signal_cb(sig, eloop->signal_cb_ctx);
+#endif
+}
+
+static int
+eloop_timespec_cmp(const struct timespec *tsp, const struct timespec *usp)
+{
+
+	if (tsp->tv_sec < usp->tv_sec)
+		return -1;
+	if (tsp->tv_sec > usp->tv_sec)
+		return 1;
+	if (tsp->tv_nsec < usp->tv_nsec)
+		return -1;
+	if (tsp->tv_nsec > usp->tv_nsec)
+		return 1;
+	return 0;
+}
+
+static bool
+eloop_timeout_before(const struct eloop_timeout *t,
+    const struct eloop_timeout *u)
+{
+	int cmp;
+
+	cmp = eloop_timespec_cmp(&t->when, &u->when);
+	if (cmp != 0)
+		return cmp < 0;
+	return t->seq < u->seq;
+}
+
+static void
+eloop_timeout_heap_set(struct eloop *eloop, size_t idx, struct eloop_timeout *t)
+{
+
+	eloop->timeouts[idx] = t;
+	t->heap_idx = idx;
+}
+
+static void
+eloop_timeout_heap_up(struct eloop *eloop, size_t idx)
+{
+	struct eloop_timeout *t = eloop->timeouts[idx], *p;
+	size_t pidx;
+
+	while (idx != 0) {
+		pidx = (idx - 1) / 2;
+		p = eloop->timeouts[pidx];
+		if (!eloop_timeout_before(t, p))
+			break;
+		eloop_timeout_heap_set(eloop, idx, p);
+		idx = pidx;
+	}
+	eloop_timeout_heap_set(eloop, idx, t);
+}
+
+static void
+eloop_timeout_heap_down(struct eloop *eloop, size_t idx)
+{
+	struct eloop_timeout *t = eloop->timeouts[idx], *c;
+	size_t cidx;
+
+	for (;;) {
+		cidx = idx * 2 + 1;
+		if (cidx >= eloop->ntimeouts)
+			break;
+		if (cidx + 1 < eloop->ntimeouts &&
+		    eloop_timeout_before(eloop->timeouts[cidx + 1],
+		    eloop->timeouts[cidx]))
+			cidx++;
+		c = eloop->timeouts[cidx];
+		if (!eloop_timeout_before(c, t))
+			break;
+		eloop_timeout_heap_set(eloop, idx, c);
+		idx = cidx;
+	}
+	eloop_timeout_heap_set(eloop, idx, t);
+}
+
+static void
+eloop_timeout_heap_remove(struct eloop *eloop, struct eloop_timeout *t)
+{
+	size_t idx = t->heap_idx;
+	struct eloop_timeout *last;
+
+	assert(idx < eloop->ntimeouts && eloop->timeouts[idx] == t);
+	last = eloop->timeouts[--eloop->ntimeouts];
+	if (last == t)
+		return;
+	eloop_timeout_heap_set(eloop, idx, last);
+	if (idx != 0 &&
+	    eloop_timeout_before(last, eloop->timeouts[(idx - 1) / 2]))
+		eloop_timeout_heap_up(eloop, idx);
+	else
+		eloop_timeout_heap_down(eloop, idx);
+}
+
+static size_t
+eloop_timeout_hash(const struct eloop *eloop, const void *arg)
+{
+	uintptr_t h = (uintptr_t)arg;
+
+	/* Pointers are aligned, so mix the higher bits in. */
+	h ^= h >> 4 ^ h >> 12;
+	return (size_t)(h & (eloop->timeout_hash_len - 1));
+}
+
+static int
+eloop_timeout_hash_grow(struct eloop *eloop)
+{
+	struct eloop_timeout **hash, **ohash, *t, *nt;
+	size_t i, len, olen;
+
+	olen = eloop->timeout_hash_len;
+	len = olen == 0 ? 64 : olen * 2;
+	hash = calloc(len, sizeof(*hash));
+	if (hash == NULL)
+		return -1;
+
+	ohash = eloop->timeout_hash;
+	eloop->timeout_hash = hash;
+	eloop->timeout_hash_len = len;
+	for (i = 0; i < olen; i++) {
+		for (t = ohash[i]; t != NULL; t = nt) {
+			size_t h = eloop_timeout_hash(eloop, t->arg);
+
+			nt = t->hnext;
+			t->hnext = hash[h];
+			hash[h] = t;
+		}
+	}
+	free(ohash);
+	return 0;
+}
+
+static void
+eloop_timeout_unlink(struct eloop *eloop, struct eloop_timeout *t)
+{
+	struct eloop_timeout **tp;
+
+	tp = &eloop->timeout_hash[eloop_timeout_hash(eloop, t->arg)];
+	for (; *tp != NULL; tp = &(*tp)->hnext) {
+		if (*tp == t) {
+			*tp = t->hnext;
+			break;
+		}
+	}
+	eloop_timeout_heap_remove(eloop, t);
+}
+
+/*
+ * Move the deadline later by up to slack milliseconds so that it lands
+ * on the coarsest boundary of the monotonic clock inside the window.
+ * This is how Linux applies timer slack: any two windows which share
+ * a boundary agree on it, so overlapping timeouts expire together
+ * without having to know about each other.
+ */
+static void
+eloop_timeout_slack(struct timespec *when, unsigned int slack)
+{
+	unsigned long long ns, limit, mask;
+
+	if (slack == 0 ||
+	    (unsigned long long)when->tv_sec >= ULLONG_MAX / NSEC_PER_SEC - 1)
+		return;
+
+	ns = (unsigned long long)when->tv_sec * NSEC_PER_SEC +
+	    (unsigned long long)when->tv_nsec;
+	limit = ns + (unsigned long long)slack * NSEC_PER_MSEC;
+
+	/* Clear every bit below the highest one which differs. */
+	mask = ns ^ limit;
+	mask |= mask >> 1;
+	mask |= mask >> 2;
+	mask |= mask >> 4;
+	mask |= mask >> 8;
+	mask |= mask >> 16;
+	mask |= mask >> 32;
+	limit &= ~(mask >> 1);
+
+	when->tv_sec = (time_t)(limit / NSEC_PER_SEC);
+	when->tv_nsec = (long)(limit % NSEC_PER_SEC);
 }
 
 /*
  * This implementation should cope with UINT_MAX seconds on a system
- * where time_t is INT32_MAX. It should also cope with the monotonic timer
- * wrapping, although this is highly unlikely.
+ * where time_t is INT32_MAX by clamping the deadline to TIME_MAX.
  * unsigned int should match or be greater than any on wire specified timeout.
  */
 static int
 eloop_q_timeout_add(struct eloop *eloop, int queue,
-    unsigned int seconds, unsigned int nseconds,
-    void (*callback)(void *), void *arg)
+    unsigned int seconds, unsigned int nseconds, unsigned int slack,
+    void (*callback)(void *), void *arg ELOOP_NAMEP)
 {
-	struct eloop_timeout *t, *tt = NULL;
+	struct eloop_timeout *t;
+	struct timespec now;
+	size_t h;
 
 	assert(eloop != NULL);
 	assert(callback != NULL);
 	assert(nseconds <= NSEC_PER_SEC);
 
 	/* Remove existing timeout if present. */
-	TAILQ_FOREACH(t, &eloop->timeouts, next) {
-		if (t->callback == callback && t->arg == arg) {
-			TAILQ_REMOVE(&eloop->timeouts, t, next);
-			break;
+	t = NULL;
+	if (eloop->timeout_hash_len != 0) {
+		h = eloop_timeout_hash(eloop, arg);
+		for (t = eloop->timeout_hash[h]; t != NULL; t = t->hnext) {
+			if (t->callback == callback && t->arg == arg)
+				break;
 		}
 	}
 
-	if (t == NULL) {
+	if (t != NULL)
+		eloop_timeout_unlink(eloop, t);
+	else {
+		/* Ensure we have room for another timeout. */
+		if (eloop->ntimeouts == eloop->timeouts_len) {
+			struct eloop_timeout **heap;
+			size_t len;
+
+			len = eloop->timeouts_len == 0 ?
+			    64 : eloop->timeouts_len * 2;
+			heap = eloop_realloca(eloop->timeouts,
+			    len, sizeof(*heap));
+			if (heap == NULL)
+				return -1;
+			eloop->timeouts = heap;
+			eloop->timeouts_len = len;
+		}
+		if (eloop->ntimeouts >= eloop->timeout_hash_len &&
+		    eloop_timeout_hash_grow(eloop) == -1)
+			return -1;
+
 		/* No existing, so allocate or grab one from the free pool. */
 		if ((t = TAILQ_FIRST(&eloop->free_timeouts))) {
 			TAILQ_REMOVE(&eloop->free_timeouts, t, next);
 		} else {
 			if ((t = malloc(sizeof(*t))) == NULL)
 				return -1;
+#ifdef ELOOP_STATS
+			t->stat = NULL;
+#endif
 		}
 	}
 
-	eloop_reduce_timers(eloop);
-
-	t->seconds = seconds;
-	t->nseconds = nseconds;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	eloop->now = now;
+	if ((unsigned long long)seconds >
+	    TIME_MAX - (unsigned long long)now.tv_sec)
+	{
+		t->when.tv_sec = (time_t)TIME_MAX;
+		t->when.tv_nsec = 0;
+	} else {
+		t->when.tv_sec = now.tv_sec + (time_t)seconds;
+		t->when.tv_nsec = now.tv_nsec + (long)nseconds;
+		if (t->when.tv_nsec >= NSEC_PER_SEC) {
+			if (t->when.tv_sec == (time_t)TIME_MAX)
+				t->when.tv_nsec = 0;
+			else {
+				t->when.tv_sec++;
+				t->when.tv_nsec -= NSEC_PER_SEC;
+			}
+		}
+		eloop_timeout_slack(&t->when, slack);
+	}
+	t->seq = eloop->timeout_seq++;
 	t->callback = callback;
 	t->arg = arg;
 	t->queue = queue;
+#ifdef ELOOP_STATS
+	if (t->stat == NULL || t->stat->s.name != name)
+		t->stat = eloop_stat_find(eloop, name, ELOOP_STATS_TIMEOUT);
+#endif
 
-	/* The timeout list should be in chronological order,
-	 * soonest first. */
-	TAILQ_FOREACH(tt, &eloop->timeouts, next) {
-		if (t->seconds < tt->seconds ||
-		    (t->seconds == tt->seconds && t->nseconds < tt->nseconds))
-		{
-			TAILQ_INSERT_BEFORE(tt, t, next);
-			return 0;
-		}
-	}
-	TAILQ_INSERT_TAIL(&eloop->timeouts, t, next);
+	h = eloop_timeout_hash(eloop, arg);
+	t->hnext = eloop->timeout_hash[h];
+	eloop->timeout_hash[h] = t;
+	eloop_timeout_heap_set(eloop, eloop->ntimeouts++, t);
+	eloop_timeout_heap_up(eloop, t->heap_idx);
 	return 0;
 }
 
 int
 eloop_q_timeout_add_tv(struct eloop *eloop, int queue,
-    const struct timespec *when, void (*callback)(void *), void *arg)
+    const struct timespec *when, void (*callback)(void *), void *arg
+    ELOOP_NAMEP)
 {
 
 	if (when->tv_sec < 0 || (unsigned long)when->tv_sec > UINT_MAX) {
@@ -593,21 +1403,33 @@ eloop_q_timeout_add_tv(struct eloop *eloop, int queue,
 	}
 
 	return eloop_q_timeout_add(eloop, queue,
-	    (unsigned int)when->tv_sec, (unsigned int)when->tv_sec,
-	    callback, arg);
+	    (unsigned int)when->tv_sec, (unsigned int)when->tv_nsec, 0,
+	    callback, arg ELOOP_NAME);
 }
 
 int
 eloop_q_timeout_add_sec(struct eloop *eloop, int queue, unsigned int seconds,
-    void (*callback)(void *), void *arg)
+    void (*callback)(void *), void *arg ELOOP_NAMEP)
 {
 
-	return eloop_q_timeout_add(eloop, queue, seconds, 0, callback, arg);
+	return eloop_q_timeout_add(eloop, queue, seconds, 0, 0, callback, arg
+	    ELOOP_NAME);
 }
 
 int
-eloop_q_timeout_add_msec(struct eloop *eloop, int queue, unsigned long when,
-    void (*callback)(void *), void *arg)
+eloop_q_timeout_add_sec_slack(struct eloop *eloop, int queue,
+    unsigned int seconds, unsigned int slack,
+    void (*callback)(void *), void *arg ELOOP_NAMEP)
+{
+
+	return eloop_q_timeout_add(eloop, queue, seconds, 0, slack,
+	    callback, arg ELOOP_NAME);
+}
+
+int
+eloop_q_timeout_add_msec_slack(struct eloop *eloop, int queue,
+    unsigned long when, unsigned int slack,
+    void (*callback)(void *), void *arg ELOOP_NAMEP)
 {
 	unsigned long seconds, nseconds;
 
@@ -619,28 +1441,44 @@ eloop_q_timeout_add_msec(struct eloop *eloop, int queue, unsigned long when,
 
 	nseconds = (when % MSEC_PER_SEC) * NSEC_PER_MSEC;
 	return eloop_q_timeout_add(eloop, queue,
-		(unsigned int)seconds, (unsigned int)nseconds, callback, arg);
+		(unsigned int)seconds, (unsigned int)nseconds, slack,
+		callback, arg ELOOP_NAME);
+}
+
+int
+eloop_q_timeout_add_msec(struct eloop *eloop, int queue, unsigned long when,
+    void (*callback)(void *), void *arg ELOOP_NAMEP)
+{
+
+	return eloop_q_timeout_add_msec_slack(eloop, queue, when, 0,
+	    callback, arg ELOOP_NAME);
 }
 
 int
 eloop_q_timeout_delete(struct eloop *eloop, int queue,
     void (*callback)(void *), void *arg)
 {
-	struct eloop_timeout *t, *tt;
+	struct eloop_timeout *t, **tp;
 	int n;
 
 	assert(eloop != NULL);
 
+	if (eloop->timeout_hash_len == 0)
+		return 0;
+
 	n = 0;
-	TAILQ_FOREACH_SAFE(t, &eloop->timeouts, next, tt) {
+	tp = &eloop->timeout_hash[eloop_timeout_hash(eloop, arg)];
+	while ((t = *tp) != NULL) {
 		if ((queue == 0 || t->queue == queue) &&
 		    t->arg == arg &&
 		    (!callback || t->callback == callback))
 		{
-			TAILQ_REMOVE(&eloop->timeouts, t, next);
+			*tp = t->hnext;
+			eloop_timeout_heap_remove(eloop, t);
 			TAILQ_INSERT_TAIL(&eloop->free_timeouts, t, next);
 			n++;
-		}
+		} else
+			tp = &t->hnext;
 	}
 	return n;
 }
@@ -655,6 +1493,15 @@ eloop_exit(struct eloop *eloop, int code)
 	eloop->exitnow = true;
 }
 
+bool
+eloop_exiting(const struct eloop *eloop)
+{
+
+	assert(eloop != NULL);
+
+	return eloop->exitnow;
+}
+
 void
 eloop_enter(struct eloop *eloop)
 {
@@ -668,11 +1515,13 @@ eloop_enter(struct eloop *eloop)
 int
 eloop_forked(struct eloop *eloop)
 {
-#if defined(HAVE_KQUEUE) || defined(HAVE_EPOLL)
+#if defined(HAVE_KQUEUE) || defined(HAVE_EPOLL) || defined(HAVE_IO_URING)
 	struct eloop_event *e;
+	size_t fd;
 #if defined(HAVE_KQUEUE)
 	struct kevent *pfds, *pfd;
 	size_t i;
+	void *udata;
 #elif defined(HAVE_EPOLL)
 	struct epoll_event epe = { .events = 0 };
 #endif
@@ -681,9 +1530,11 @@ eloop_forked(struct eloop *eloop)
 #if defined(HAVE_KQUEUE) || defined(HAVE_EPOLL)
 	if (eloop->fd != -1)
 		close(eloop->fd);
+#elif defined(HAVE_IO_URING)
+	eloop_ring_close(eloop);
+#endif
 	if (eloop_open(eloop) == -1)
 		return -1;
-#endif
 
 #ifdef HAVE_KQUEUE
 	pfds = malloc((eloop->nsignals + (eloop->nevents * NFD)) * sizeof(*pfds));
@@ -698,29 +1549,35 @@ eloop_forked(struct eloop *eloop)
 		i = 0;
 #endif
 
-	TAILQ_FOREACH(e, &eloop->events, next) {
-		if (e->fd == -1)
+	for (fd = 0; fd < eloop->events_len; fd++) {
+		if ((e = eloop->events[fd]) == NULL)
 			continue;
 #if defined(HAVE_KQUEUE)
+		udata = (void *)(uintptr_t)e->gen;
 		if (e->events & ELE_READ) {
 			EV_SET(pfd++, (uintptr_t)e->fd,
-			    EVFILT_READ, EV_ADD, 0, 0, e);
+			    EVFILT_READ, EV_ADD, 0, 0, udata);
 			i++;
 		}
 		if (e->events & ELE_WRITE) {
 			EV_SET(pfd++, (uintptr_t)e->fd,
-			    EVFILT_WRITE, EV_ADD, 0, 0, e);
+			    EVFILT_WRITE, EV_ADD, 0, 0, udata);
 			i++;
 		}
 #elif defined(HAVE_EPOLL)
 		memset(&epe, 0, sizeof(epe));
-		epe.data.ptr = e;
+		epe.data.u64 = ELOOP_EVENT_DATA(e);
 		if (e->events & ELE_READ)
 			epe.events |= EPOLLIN;
 		if (e->events & ELE_WRITE)
 			epe.events |= EPOLLOUT;
 		if (epoll_ctl(eloop->fd, EPOLL_CTL_ADD, e->fd, &epe) == -1)
 			return -1;
+#elif defined(HAVE_IO_URING)
+		if (e->events & (ELE_READ | ELE_WRITE) &&
+		    eloop_ring_poll(eloop, e->fd, e->events,
+		    ELOOP_EVENT_DATA(e)) == -1)
+			return -1;
 #endif
 	}
 
@@ -763,6 +1620,9 @@ eloop_open(struct eloop *eloop)
 
 	eloop->fd = fd;
 	return fd;
+#elif defined(HAVE_IO_URING)
+	assert(eloop != NULL);
+	return eloop_ring_open(eloop);
 #else
 	UNUSED(eloop);
 	return 0;
@@ -772,7 +1632,7 @@ eloop_open(struct eloop *eloop)
 int
 eloop_signal_set_cb(struct eloop *eloop,
     const int *signals, size_t nsignals,
-    void (*signal_cb)(int, void *), void *signal_cb_ctx)
+    void (*signal_cb)(int, void *), void *signal_cb_ctx ELOOP_NAMEP)
 {
 #ifdef HAVE_KQUEUE
 	size_t i;
@@ -800,6 +1660,10 @@ eloop_signal_set_cb(struct eloop *eloop,
 	eloop->nsignals = nsignals;
 	eloop->signal_cb = signal_cb;
 	eloop->signal_cb_ctx = signal_cb_ctx;
+#ifdef ELOOP_STATS
+	eloop->signal_stat = signal_cb == NULL ? NULL :
+	    eloop_stat_find(eloop, name, ELOOP_STATS_SIGNAL);
+#endif
 
 #ifdef HAVE_KQUEUE
 	if (signal_cb == NULL)
@@ -818,7 +1682,7 @@ out:
 	return error;
 }
 
-#ifndef HAVE_KQUEUE
+#if !defined(HAVE_KQUEUE) && !defined(HAVE_IO_URING)
 static volatile int _eloop_sig[ELOOP_NSIGNALS];
 static volatile size_t _eloop_nsig;
 
@@ -843,7 +1707,9 @@ eloop_signal_mask(struct eloop *eloop, sigset_t *oldset)
 {
 	sigset_t newset;
 	size_t i;
-#ifndef HAVE_KQUEUE
+#if defined(HAVE_IO_URING)
+	int fd;
+#elif !defined(HAVE_KQUEUE)
 	struct sigaction sa = {
 	    .sa_sigaction = eloop_signal3,
 	    .sa_flags = SA_SIGINFO,
@@ -858,7 +1724,14 @@ eloop_signal_mask(struct eloop *eloop, sigset_t *oldset)
 	if (sigprocmask(SIG_SETMASK, &newset, oldset) == -1)
 		return -1;
 
-#ifndef HAVE_KQUEUE
+#if defined(HAVE_IO_URING)
+	/* Signals stay blocked and are read from the signalfd instead.
+	 * An existing signalfd just has its mask changed. */
+	fd = signalfd(_eloop_sigfd, &newset, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	_eloop_sigfd = fd;
+#elif !defined(HAVE_KQUEUE)
 	sigemptyset(&sa.sa_mask);
 
 	for (i = 0; i < eloop->nsignals; i++) {
@@ -885,13 +1758,14 @@ eloop_new(void)
 		return NULL;
 	}
 
-	TAILQ_INIT(&eloop->events);
 	TAILQ_INIT(&eloop->free_events);
-	TAILQ_INIT(&eloop->timeouts);
 	TAILQ_INIT(&eloop->free_timeouts);
 	eloop->exitcode = EXIT_FAILURE;
+#ifdef ELOOP_STATS
+	eloop->stats.since = eloop->now;
+#endif
 
-#if defined(HAVE_KQUEUE) || defined(HAVE_EPOLL)
+#if defined(HAVE_KQUEUE) || defined(HAVE_EPOLL) || defined(HAVE_IO_URING)
 	if (eloop_open(eloop) == -1) {
 		eloop_free(eloop);
 		return NULL;
@@ -906,32 +1780,58 @@ eloop_clear(struct eloop *eloop, ...)
 {
 	va_list va1, va2;
 	int except_fd;
-	struct eloop_event *e, *ne;
+	size_t fd;
+	struct eloop_event *e;
 	struct eloop_timeout *t;
+#ifdef HAVE_PPOLL
+	struct pollfd *pfd;
+#endif
 
 	if (eloop == NULL)
 		return;
 
 	va_start(va1, eloop);
-	TAILQ_FOREACH_SAFE(e, &eloop->events, next, ne) {
+	for (fd = 0; fd < eloop->events_len; fd++) {
+		if ((e = eloop->events[fd]) == NULL)
+			continue;
 		va_copy(va2, va1);
 		do
 			except_fd = va_arg(va2, int);
 		while (except_fd != -1 && except_fd != e->fd);
 		va_end(va2);
-		if (e->fd == except_fd && e->fd != -1)
+		if (e->fd == except_fd)
 			continue;
-		TAILQ_REMOVE(&eloop->events, e, next);
-		if (e->fd != -1) {
-			close(e->fd);
-			eloop->nevents--;
-		}
+		eloop->events[fd] = NULL;
+		close(e->fd);
+		eloop->nevents--;
 		free(e);
 	}
 	va_end(va1);
 
-#if !defined(HAVE_PSELECT)
-	/* Free the pollfd buffer and ensure it's re-created before
+#if defined(HAVE_PPOLL)
+	/* Pack the remaining pollfds and shrink the buffer as we
+	 * probably respond to a lot less fds after forking. */
+	eloop->nevents = 0;
+	for (fd = 0; fd < eloop->events_len; fd++) {
+		if ((e = eloop->events[fd]) == NULL)
+			continue;
+		e->pollfd = eloop->nevents++;
+		eloop_event_setup_pollfd(e, &eloop->fds[e->pollfd]);
+		eloop->fds[e->pollfd].revents = 0;
+	}
+	if (eloop->nevents == 0) {
+		free(eloop->fds);
+		eloop->fds = NULL;
+		eloop->nfds = 0;
+	} else {
+		pfd = eloop_realloca(eloop->fds, eloop->nevents, sizeof(*pfd));
+		if (pfd != NULL) {
+			eloop->fds = pfd;
+			eloop->nfds = eloop->nevents;
+		}
+	}
+#elif defined(HAVE_KQUEUE) || defined(HAVE_EPOLL)
+	/* Free the kernel event buffer and ensure it's re-created before
 	 * the next run. This allows us to shrink it incase we use a lot less
 	 * signals and fds to respond to after forking. */
 	free(eloop->fds);
@@ -944,14 +1844,22 @@ eloop_clear(struct eloop *eloop, ...)
 		TAILQ_REMOVE(&eloop->free_events, e, next);
 		free(e);
 	}
-	while ((t = TAILQ_FIRST(&eloop->timeouts))) {
-		TAILQ_REMOVE(&eloop->timeouts, t, next);
-		free(t);
-	}
+	while (eloop->ntimeouts != 0)
+		free(eloop->timeouts[--eloop->ntimeouts]);
+	free(eloop->timeouts);
+	eloop->timeouts = NULL;
+	eloop->timeouts_len = 0;
+	free(eloop->timeout_hash);
+	eloop->timeout_hash = NULL;
+	eloop->timeout_hash_len = 0;
 	while ((t = TAILQ_FIRST(&eloop->free_timeouts))) {
 		TAILQ_REMOVE(&eloop->free_timeouts, t, next);
 		free(t);
 	}
+#ifdef ELOOP_STATS
+	/* A forked process starts accounting afresh. */
+	eloop_stats_reset(eloop);
+#endif
 	eloop->cleared = true;
 }
 
@@ -960,10 +1868,18 @@ eloop_free(struct eloop *eloop)
 {
 
 	eloop_clear(eloop, -1);
+	if (eloop == NULL)
+		return;
 #if defined(HAVE_KQUEUE) || defined(HAVE_EPOLL)
-	if (eloop != NULL && eloop->fd != -1)
+	if (eloop->fd != -1)
 		close(eloop->fd);
+#elif defined(HAVE_IO_URING)
+	eloop_ring_close(eloop);
+#endif
+#ifdef ELOOP_STATS
+	eloop_stats_free(eloop);
 #endif
+	free(eloop->events);
 	free(eloop);
 }
 
@@ -983,12 +1899,13 @@ eloop_run_kqueue(struct eloop *eloop, const struct timespec *ts)
 	for (nn = n, ke = eloop->fds; nn != 0; nn--, ke++) {
 		if (eloop->cleared || eloop->exitnow)
 			break;
-		e = (struct eloop_event *)ke->udata;
 		if (ke->filter == EVFILT_SIGNAL) {
-			eloop->signal_cb((int)ke->ident,
-			    eloop->signal_cb_ctx);
+			eloop_signal_cb(eloop, (int)ke->ident);
 			continue;
 		}
+		e = eloop_event_find(eloop, (int)ke->ident);
+		if (e == NULL || e->gen != (unsigned int)(uintptr_t)ke->udata)
+			continue;
 		if (ke->filter == EVFILT_READ)
 			events = ELE_READ;
 		else if (ke->filter == EVFILT_WRITE)
@@ -1007,7 +1924,7 @@ eloop_run_kqueue(struct eloop *eloop, const struct timespec *ts)
 			events |= ELE_HANGUP;
 		if (ke->flags & EV_ERROR)
 			events |= ELE_ERROR;
-		e->cb(e->cb_arg, events);
+		eloop_event_cb(eloop, e, events);
 	}
 	return n;
 }
@@ -1046,8 +1963,8 @@ eloop_run_epoll(struct eloop *eloop,
 	for (nn = n, epe = eloop->fds; nn != 0; nn--, epe++) {
 		if (eloop->cleared || eloop->exitnow)
 			break;
-		e = (struct eloop_event *)epe->data.ptr;
-		if (e->fd == -1)
+		e = eloop_event_find(eloop, (int)(uint32_t)epe->data.u64);
+		if (e == NULL || e->gen != (unsigned int)(epe->data.u64 >> 32))
 			continue;
 		events = 0;
 		if (epe->events & EPOLLIN)
@@ -1058,7 +1975,147 @@ eloop_run_epoll(struct eloop *eloop,
 			events |= ELE_HANGUP;
 		if (epe->events & EPOLLERR)
 			events |= ELE_ERROR;
-		e->cb(e->cb_arg, events);
+		eloop_event_cb(eloop, e, events);
+	}
+	return n;
+}
+
+#elif defined(HAVE_IO_URING)
+
+/* Arm the ring timeout to expire when the next eloop timeout does. */
+static int
+eloop_ring_timeout(struct eloop *eloop, const struct timespec *ts)
+{
+	struct eloop_ring *r = &eloop->ring;
+	struct io_uring_sqe *sqe;
+	struct __kernel_timespec kts;
+
+	kts.tv_sec = eloop->now.tv_sec + ts->tv_sec;
+	kts.tv_nsec = eloop->now.tv_nsec + ts->tv_nsec;
+	if (kts.tv_nsec >= NSEC_PER_SEC) {
+		kts.tv_sec++;
+		kts.tv_nsec -= NSEC_PER_SEC;
+	}
+	if (r->timeout_armed) {
+		if (r->timeout.tv_sec == kts.tv_sec &&
+		    r->timeout.tv_nsec == kts.tv_nsec)
+			return 0;
+		sqe = eloop_ring_sqe(eloop, IORING_OP_TIMEOUT_REMOVE, -1,
+		    ELOOP_RING_IGNORE);
+		if (sqe == NULL)
+			return -1;
+		sqe->addr = ELOOP_RING_TIMEOUT;
+		eloop_ring_queue(eloop);
+		r->timeout_armed = false;
+	}
+
+	/* The kernel copies the timespec when the SQE is submitted. */
+	r->timeout = kts;
+	sqe = eloop_ring_sqe(eloop, IORING_OP_TIMEOUT, -1, ELOOP_RING_TIMEOUT);
+	if (sqe == NULL)
+		return -1;
+	sqe->addr = (uint64_t)(uintptr_t)&r->timeout;
+	sqe->len = 1;
+	sqe->timeout_flags = IORING_TIMEOUT_ABS;
+	eloop_ring_queue(eloop);
+	r->timeout_armed = true;
+	return 0;
+}
+
+static void
+eloop_ring_signal(struct eloop *eloop)
+{
+	struct signalfd_siginfo ssi;
+
+	/* Like the other mechanisms, deliver one signal per wakeup.
+	 * The poll is re-armed before waiting again so any others
+	 * are delivered straight away. */
+	if (read(_eloop_sigfd, &ssi, sizeof(ssi)) == sizeof(ssi))
+		eloop_signal_cb(eloop, (int)ssi.ssi_signo);
+}
+
+static int
+eloop_run_io_uring(struct eloop *eloop, const struct timespec *ts)
+{
+	struct eloop_ring *r = &eloop->ring;
+	struct io_uring_cqe *cqe;
+	struct eloop_event *e;
+	unsigned int head, tail, gen;
+	uint64_t udata;
+	int res, n, fd;
+	unsigned short events;
+
+	if (ts != NULL && eloop_ring_timeout(eloop, ts) == -1)
+		return -1;
+	if (!r->signal_armed && _eloop_sigfd != -1 &&
+	    eloop->signal_cb != NULL)
+	{
+		if (eloop_ring_poll(eloop, _eloop_sigfd, ELE_READ,
+		    ELOOP_RING_SIGNAL) == -1)
+			return -1;
+		r->signal_armed = true;
+	}
+
+	/* Submit any queued polls and wait in one syscall.
+	 * EBUSY means completions must be reaped before we can submit. */
+	if (eloop_ring_enter(eloop, 1) == -1 && errno != EBUSY)
+		return -1;
+
+	n = 0;
+	head = *r->cq_head;
+	tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; n++) {
+		if (eloop->cleared || eloop->exitnow)
+			break;
+		cqe = &r->cqes[head & r->cq_mask];
+		udata = cqe->user_data;
+		res = cqe->res;
+		/* Release the CQE before calling back as the callback may
+		 * need to submit and wait on the ring as well. */
+		__atomic_store_n(r->cq_head, ++head, __ATOMIC_RELEASE);
+
+		switch (udata) {
+		case ELOOP_RING_IGNORE:
+			continue;
+		case ELOOP_RING_TIMEOUT:
+			if (res != -ECANCELED)
+				r->timeout_armed = false;
+			continue;
+		case ELOOP_RING_SIGNAL:
+			r->signal_armed = false;
+			if (res >= 0 && eloop->signal_cb != NULL)
+				eloop_ring_signal(eloop);
+			continue;
+		}
+
+		fd = (int)(uint32_t)udata;
+		gen = (unsigned int)(udata >> 32);
+		e = eloop_event_find(eloop, fd);
+		if (e == NULL || e->gen != gen)
+			continue;
+		events = 0;
+		if (res < 0)
+			events |= ELE_ERROR;
+		else {
+			if (res & POLLIN)
+				events |= ELE_READ;
+			if (res & POLLOUT)
+				events |= ELE_WRITE;
+			if (res & POLLHUP)
+				events |= ELE_HANGUP;
+			if (res & POLLERR)
+				events |= ELE_ERROR;
+			if (res & POLLNVAL)
+				events |= ELE_NVAL;
+		}
+		eloop_event_cb(eloop, e, events);
+
+		/* Polls are oneshot, re-arm unless the callback deleted
+		 * or changed the event. */
+		e = eloop_event_find(eloop, fd);
+		if (e != NULL && e->gen == gen &&
+		    e->events & (ELE_READ | ELE_WRITE))
+			eloop_ring_poll(eloop, fd, e->events, udata);
 	}
 	return n;
 }
@@ -1070,6 +2127,7 @@ eloop_run_ppoll(struct eloop *eloop,
     const struct timespec *ts, const sigset_t *signals)
 {
 	int n, nn;
+	size_t i;
 	struct eloop_event *e;
 	struct pollfd *pfd;
 	unsigned short events;
@@ -1078,31 +2136,37 @@ eloop_run_ppoll(struct eloop *eloop,
 	if (n == -1 || n == 0)
 		return n;
 
+	/*
+	 * Walk backwards so that when a callback deletes an event,
+	 * the pollfd moved into its place has already been seen.
+	 * Each revents is cleared once seen and freshly added events
+	 * start clear, so neither is dispatched by mistake.
+	 */
 	nn = n;
-	TAILQ_FOREACH(e, &eloop->events, next) {
+	for (i = eloop->nevents; i != 0 && nn != 0; i--) {
 		if (eloop->cleared || eloop->exitnow)
 			break;
-		/* Skip freshly added events */
-		if ((pfd = e->pollfd) == NULL)
+		if (i > eloop->nevents)
 			continue;
-		if (e->pollfd->revents) {
-			nn--;
-			events = 0;
-			if (pfd->revents & POLLIN)
-				events |= ELE_READ;
-			if (pfd->revents & POLLOUT)
-				events |= ELE_WRITE;
-			if (pfd->revents & POLLHUP)
-				events |= ELE_HANGUP;
-			if (pfd->revents & POLLERR)
-				events |= ELE_ERROR;
-			if (pfd->revents & POLLNVAL)
-				events |= ELE_NVAL;
-			if (events)
-				e->cb(e->cb_arg, events);
-		}
-		if (nn == 0)
-			break;
+		pfd = &eloop->fds[i - 1];
+		if (pfd->revents == 0)
+			continue;
+		nn--;
+		events = 0;
+		if (pfd->revents & POLLIN)
+			events |= ELE_READ;
+		if (pfd->revents & POLLOUT)
+			events |= ELE_WRITE;
+		if (pfd->revents & POLLHUP)
+			events |= ELE_HANGUP;
+		if (pfd->revents & POLLERR)
+			events |= ELE_ERROR;
+		if (pfd->revents & POLLNVAL)
+			events |= ELE_NVAL;
+		pfd->revents = 0;
+		e = eloop->events[pfd->fd];
+		if (events)
+			eloop_event_cb(eloop, e, events);
 	}
 	return n;
 }
@@ -1115,14 +2179,16 @@ eloop_run_pselect(struct eloop *eloop,
 {
 	fd_set read_fds, write_fds;
 	int maxfd, n;
+	size_t fd;
+	unsigned int gen = eloop->events_gen;
 	struct eloop_event *e;
 	unsigned short events;
 
 	FD_ZERO(&read_fds);
 	FD_ZERO(&write_fds);
 	maxfd = 0;
-	TAILQ_FOREACH(e, &eloop->events, next) {
-		if (e->fd == -1)
+	for (fd = 0; fd < eloop->events_len; fd++) {
+		if ((e = eloop->events[fd]) == NULL)
 			continue;
 		if (e->events & ELE_READ) {
 			FD_SET(e->fd, &read_fds);
@@ -1141,10 +2207,12 @@ eloop_run_pselect(struct eloop *eloop,
 	if (n == -1 || n == 0)
 		return n;
 
-	TAILQ_FOREACH(e, &eloop->events, next) {
+	for (fd = 0; fd <= (size_t)maxfd; fd++) {
 		if (eloop->cleared || eloop->exitnow)
 			break;
-		if (e->fd == -1)
+		/* Skip freshly added events */
+		e = eloop_event_find(eloop, (int)fd);
+		if (e == NULL || e->gen > gen)
 			continue;
 		events = 0;
 		if (FD_ISSET(e->fd, &read_fds))
@@ -1152,7 +2220,7 @@ eloop_run_pselect(struct eloop *eloop,
 		if (FD_ISSET(e->fd, &write_fds))
 			events |= ELE_WRITE;
 		if (events)
-			e->cb(e->cb_arg, events);
+			eloop_event_cb(eloop, e, events);
 	}
 
 	return n;
@@ -1165,9 +2233,15 @@ eloop_start(struct eloop *eloop, sigset_t *signals)
 	int error;
 	struct eloop_timeout *t;
 	struct timespec ts, *tsp;
+	unsigned long long secs;
+	unsigned int nsecs;
+#ifdef ELOOP_STATS
+	struct timespec pts;
+	unsigned long long dispatch_ns;
+#endif
 
 	assert(eloop != NULL);
-#ifdef HAVE_KQUEUE
+#if defined(HAVE_KQUEUE) || defined(HAVE_IO_URING)
 	UNUSED(signals);
 #endif
 
@@ -1175,57 +2249,69 @@ eloop_start(struct eloop *eloop, sigset_t *signals)
 		if (eloop->exitnow)
 			break;
 
-#ifndef HAVE_KQUEUE
+#if !defined(HAVE_KQUEUE) && !defined(HAVE_IO_URING)
 		if (_eloop_nsig != 0) {
 			int n = _eloop_sig[--_eloop_nsig];
 
 			if (eloop->signal_cb != NULL)
-				eloop->signal_cb(n, eloop->signal_cb_ctx);
+				eloop_signal_cb(eloop, n);
 			continue;
 		}
 #endif
 
-		t = TAILQ_FIRST(&eloop->timeouts);
+		t = eloop->ntimeouts != 0 ? eloop->timeouts[0] : NULL;
 		if (t == NULL && eloop->nevents == 0)
 			break;
 
-		if (t != NULL)
-			eloop_reduce_timers(eloop);
-
-		if (t != NULL && t->seconds == 0 && t->nseconds == 0) {
-			TAILQ_REMOVE(&eloop->timeouts, t, next);
-			t->callback(t->arg);
-			TAILQ_INSERT_TAIL(&eloop->free_timeouts, t, next);
-			continue;
-		}
-
 		if (t != NULL) {
-			if (t->seconds > INT_MAX) {
+			clock_gettime(CLOCK_MONOTONIC, &eloop->now);
+			if (eloop_timespec_cmp(&t->when, &eloop->now) <= 0) {
+				eloop_timeout_unlink(eloop, t);
+				eloop_timeout_cb(eloop, t);
+				TAILQ_INSERT_TAIL(&eloop->free_timeouts,
+				    t, next);
+				continue;
+			}
+
+			secs = eloop_timespec_diff(&t->when, &eloop->now,
+			    &nsecs);
+			if (secs > INT_MAX) {
 				ts.tv_sec = (time_t)INT_MAX;
 				ts.tv_nsec = 0;
 			} else {
-				ts.tv_sec = (time_t)t->seconds;
-				ts.tv_nsec = (long)t->nseconds;
+				ts.tv_sec = (time_t)secs;
+				ts.tv_nsec = (long)nsecs;
 			}
 			tsp = &ts;
 		} else
 			tsp = NULL;
 
 		eloop->cleared = false;
+#if defined(HAVE_KQUEUE) || defined(HAVE_EPOLL)
 		if (eloop->events_need_setup)
 			eloop_event_setup_fds(eloop);
+#endif
 
+#ifdef ELOOP_STATS
+		eloop_stat_begin(&pts);
+		dispatch_ns = eloop->stats.dispatch_ns;
+#endif
 #if defined(HAVE_KQUEUE)
 		UNUSED(signals);
 		error = eloop_run_kqueue(eloop, tsp);
 #elif defined(HAVE_EPOLL)
 		error = eloop_run_epoll(eloop, tsp, signals);
+#elif defined(HAVE_IO_URING)
+		error = eloop_run_io_uring(eloop, tsp);
 #elif defined(HAVE_PPOLL)
 		error = eloop_run_ppoll(eloop, tsp, signals);
 #elif defined(HAVE_PSELECT)
 		error = eloop_run_pselect(eloop, tsp, signals);
 #else
 #error no polling mechanism to run!
+#endif
+#ifdef ELOOP_STATS
+		eloop_stats_poll(eloop, &pts, dispatch_ns);
 #endif
 		if (error == -1) {
 			if (errno == EINTR)
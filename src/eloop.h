@@ -29,6 +29,7 @@
 #ifndef ELOOP_H
 #define ELOOP_H
 
+#include <stdbool.h>
 #include <time.h>
 
 /* Handy macros to create subsecond timeouts */
@@ -59,36 +60,139 @@ struct eloop;
 #define	ELE_NVAL	0x0400
 
 size_t eloop_event_count(const struct eloop  *);
-int eloop_event_add(struct eloop *, int, unsigned short,
-    void (*)(void *, unsigned short), void *);
 int eloop_event_delete(struct eloop *, int);
 
 unsigned long long eloop_timespec_diff(const struct timespec *tsp,
     const struct timespec *usp, unsigned int *nsp);
+/*
+ * A timeout added with slack may fire up to that many milliseconds
+ * after it is due.
+ * Timeouts whose windows overlap are then likely to expire together,
+ * waking the loop once rather than once each.
+ */
+#define	ELOOP_SLACK_MAX		MSEC_PER_SEC
+/* Lifetimes given in seconds can be a tenth of a percent late. */
+#define	ELOOP_SLACK_SEC(s) \
+    ((s) >= ELOOP_SLACK_MAX ? ELOOP_SLACK_MAX : (unsigned int)(s))
+
+int eloop_q_timeout_delete(struct eloop *, int, void (*)(void *), void *);
+#define eloop_timeout_delete(eloop, cb, ctx) \
+    eloop_q_timeout_delete((eloop), ELOOP_QUEUE, (cb), (ctx))
+
+int eloop_signal_mask(struct eloop *, sigset_t *oldset);
+
+#ifdef ELOOP_STATS
+/*
+ * Time spent in each callback is accounted against the name of the
+ * function given, so each function adding one passes the name along.
+ */
+#define eloop_event_add(eloop, fd, events, cb, arg) \
+    eloop_event_add_named((eloop), (fd), (events), (cb), (arg), #cb)
+#define eloop_timeout_add_tv(eloop, tv, cb, ctx) \
+    eloop_q_timeout_add_tv_named((eloop), ELOOP_QUEUE, (tv), (cb), (ctx), #cb)
+#define eloop_timeout_add_sec(eloop, tv, cb, ctx) \
+    eloop_q_timeout_add_sec_named((eloop), ELOOP_QUEUE, (tv), (cb), (ctx), \
+    #cb)
+#define eloop_timeout_add_msec(eloop, ms, cb, ctx) \
+    eloop_q_timeout_add_msec_named((eloop), ELOOP_QUEUE, (ms), (cb), (ctx), \
+    #cb)
+#define eloop_q_timeout_add_tv(eloop, q, tv, cb, ctx) \
+    eloop_q_timeout_add_tv_named((eloop), (q), (tv), (cb), (ctx), #cb)
+#define eloop_q_timeout_add_sec(eloop, q, tv, cb, ctx) \
+    eloop_q_timeout_add_sec_named((eloop), (q), (tv), (cb), (ctx), #cb)
+#define eloop_q_timeout_add_msec(eloop, q, ms, cb, ctx) \
+    eloop_q_timeout_add_msec_named((eloop), (q), (ms), (cb), (ctx), #cb)
+#define eloop_timeout_add_sec_slack(eloop, tv, sl, cb, ctx) \
+    eloop_q_timeout_add_sec_slack_named((eloop), ELOOP_QUEUE, (tv), (sl), \
+    (cb), (ctx), #cb)
+#define eloop_timeout_add_msec_slack(eloop, ms, sl, cb, ctx) \
+    eloop_q_timeout_add_msec_slack_named((eloop), ELOOP_QUEUE, (ms), (sl), \
+    (cb), (ctx), #cb)
+#define eloop_q_timeout_add_sec_slack(eloop, q, tv, sl, cb, ctx) \
+    eloop_q_timeout_add_sec_slack_named((eloop), (q), (tv), (sl), \
+    (cb), (ctx), #cb)
+#define eloop_q_timeout_add_msec_slack(eloop, q, ms, sl, cb, ctx) \
+    eloop_q_timeout_add_msec_slack_named((eloop), (q), (ms), (sl), \
+    (cb), (ctx), #cb)
+#define eloop_signal_set_cb(eloop, signals, nsignals, cb, ctx) \
+    eloop_signal_set_cb_named((eloop), (signals), (nsignals), (cb), (ctx), \
+    #cb)
+int eloop_event_add_named(struct eloop *, int, unsigned short,
+    void (*)(void *, unsigned short), void *, const char *);
+int eloop_q_timeout_add_tv_named(struct eloop *, int,
+    const struct timespec *, void (*)(void *), void *, const char *);
+int eloop_q_timeout_add_sec_named(struct eloop *, int,
+    unsigned int, void (*)(void *), void *, const char *);
+int eloop_q_timeout_add_msec_named(struct eloop *, int,
+    unsigned long, void (*)(void *), void *, const char *);
+int eloop_q_timeout_add_sec_slack_named(struct eloop *, int,
+    unsigned int, unsigned int, void (*)(void *), void *, const char *);
+int eloop_q_timeout_add_msec_slack_named(struct eloop *, int,
+    unsigned long, unsigned int, void (*)(void *), void *, const char *);
+int eloop_signal_set_cb_named(struct eloop *, const int *, size_t,
+    void (*)(int, void *), void *, const char *);
+
+/* Latency histogram buckets.
+ * Bucket 0 is under 1us, bucket n is under 2^n us and the last
+ * bucket holds anything longer. */
+#define	ELOOP_STATS_BUCKETS	24
+
+#define	ELOOP_STATS_EVENT	1
+#define	ELOOP_STATS_TIMEOUT	2
+#define	ELOOP_STATS_SIGNAL	3
+
+struct eloop_cbstats {
+	const char *name;
+	unsigned int kind;
+	unsigned long long count;
+	unsigned long long total_ns;
+	unsigned long long max_ns;
+	unsigned long long hist[ELOOP_STATS_BUCKETS];
+};
+
+struct eloop_stats {
+	struct timespec since;		/* when accounting started */
+	unsigned long long wakeups;	/* returns from polling */
+	unsigned long long poll_ns;	/* waiting for something to do */
+	unsigned long long dispatch_ns;	/* in callbacks */
+};
+
+void eloop_stats(const struct eloop *, struct eloop_stats *,
+    void (*)(void *, const struct eloop_cbstats *), void *);
+void eloop_stats_reset(struct eloop *);
+#else
+int eloop_event_add(struct eloop *, int, unsigned short,
+    void (*)(void *, unsigned short), void *);
 #define eloop_timeout_add_tv(eloop, tv, cb, ctx) \
     eloop_q_timeout_add_tv((eloop), ELOOP_QUEUE, (tv), (cb), (ctx))
 #define eloop_timeout_add_sec(eloop, tv, cb, ctx) \
     eloop_q_timeout_add_sec((eloop), ELOOP_QUEUE, (tv), (cb), (ctx))
 #define eloop_timeout_add_msec(eloop, ms, cb, ctx) \
     eloop_q_timeout_add_msec((eloop), ELOOP_QUEUE, (ms), (cb), (ctx))
-#define eloop_timeout_delete(eloop, cb, ctx) \
-    eloop_q_timeout_delete((eloop), ELOOP_QUEUE, (cb), (ctx))
 int eloop_q_timeout_add_tv(struct eloop *, int,
     const struct timespec *, void (*)(void *), void *);
 int eloop_q_timeout_add_sec(struct eloop *, int,
     unsigned int, void (*)(void *), void *);
+#define eloop_timeout_add_sec_slack(eloop, tv, sl, cb, ctx) \
+    eloop_q_timeout_add_sec_slack((eloop), ELOOP_QUEUE, (tv), (sl), (cb), (ctx))
+#define eloop_timeout_add_msec_slack(eloop, ms, sl, cb, ctx) \
+    eloop_q_timeout_add_msec_slack((eloop), ELOOP_QUEUE, (ms), (sl), (cb), \
+    (ctx))
 int eloop_q_timeout_add_msec(struct eloop *, int,
     unsigned long, void (*)(void *), void *);
-int eloop_q_timeout_delete(struct eloop *, int, void (*)(void *), void *);
-
+int eloop_q_timeout_add_sec_slack(struct eloop *, int,
+    unsigned int, unsigned int, void (*)(void *), void *);
+int eloop_q_timeout_add_msec_slack(struct eloop *, int,
+    unsigned long, unsigned int, void (*)(void *), void *);
 int eloop_signal_set_cb(struct eloop *, const int *, size_t,
     void (*)(int, void *), void *);
-int eloop_signal_mask(struct eloop *, sigset_t *oldset);
+#endif
 
 struct eloop * eloop_new(void);
 void eloop_clear(struct eloop *, ...);
 void eloop_free(struct eloop *);
 void eloop_exit(struct eloop *, int);
+bool eloop_exiting(const struct eloop *);
 void eloop_enter(struct eloop *);
 int eloop_forked(struct eloop *);
 int eloop_open(struct eloop *);
@@ -30,6 +30,7 @@
 
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/param.h>
 #include <sys/stat.h>
@@ -44,6 +45,9 @@
 #include <linux/netlink.h>
 #include <linux/sockios.h>
 #include <linux/rtnetlink.h>
+#ifdef SO_MEMINFO
+#include <linux/sock_diag.h>
+#endif
 
 #include <arpa/inet.h>
 #include <net/if.h>
@@ -145,8 +149,37 @@ struct priv {
 	int route_fd;
 	int generic_fd;
 	uint32_t route_pid;
+
+	/* Kernel notifications on link_fd are read in batches. */
+	uint8_t *link_buf;
+	size_t link_buflen;		/* per message */
+	int link_rcvbuf;		/* as reported by the kernel */
+	size_t link_qhiwat;		/* most bytes seen queued */
+
+	/* Requests queued by if_txroute and if_txaddress6,
+	 * one for each of ctx->tx_ops. */
+	uint8_t *tx_buf;
+	size_t tx_buflen;
+	size_t tx_bufsize;
 };
 
+/* recvmmsg(2) was added in Linux-2.6.33 and glibc-2.12. */
+#ifdef MSG_WAITFORONE
+#define	HAVE_RECVMMSG
+#define	IF_LINK_BATCH		8
+#else
+#define	IF_LINK_BATCH		1
+#endif
+/* Each message gets this much space, doubled if one is truncated. */
+#define	IF_LINK_BUFLEN		(16 * 1024)
+#define	IF_LINK_BUFLEN_MAX	(256 * 1024)
+/* Stop reading after this many batches to let other events run. */
+#define	IF_LINK_BUDGET		32
+/* We grow SO_RCVBUF when the queue is over half full,
+ * unless the user set link_rcvbuf.
+ * Under privsep it starts at this size instead. */
+#define	IF_LINK_RCVBUF_MAX	(8 * 1024 * 1024)
+
 /* We need this to send a broadcast for InfiniBand.
  * Our old code used sendto, but our new code writes to a raw BPF socket.
  * What header structure does IPoIB use? */
@@ -160,6 +193,8 @@ static const uint8_t ipv4_bcast_addr[] = {
 #endif
 
 static int if_addressexists(struct interface *, struct in_addr *);
+static bool if_linkrcvbuf_user(struct dhcpcd_ctx *);
+static void if_setlinkrcvbuf(struct dhcpcd_ctx *, int, const char *);
 
 #define PROC_INET6	"/proc/net/if_inet6"
 #define PROC_PROMOTE	"/proc/sys/net/ipv4/conf/%s/promote_secondaries"
@@ -486,6 +521,17 @@ if_opensockets_os(struct dhcpcd_ctx *ctx)
 	if (priv->generic_fd == -1)
 		return -1;
 
+	len = sizeof(priv->link_rcvbuf);
+	if (getsockopt(ctx->link_fd, SOL_SOCKET, SO_RCVBUF,
+	    &priv->link_rcvbuf, &len) == -1)
+		priv->link_rcvbuf = 0;
+
+	/* The manager sandbox cannot grow the buffer as it fills,
+	 * so start it at the largest size we would grow it to. */
+	if (IN_PRIVSEP(ctx) && !if_linkrcvbuf_user(ctx) &&
+	    priv->link_rcvbuf != 0)
+		if_setlinkrcvbuf(ctx, IF_LINK_RCVBUF_MAX / 2, "privsep");
+
 	return 0;
 }
 
@@ -498,6 +544,8 @@ if_closesockets_os(struct dhcpcd_ctx *ctx)
 		priv = (struct priv *)ctx->priv;
 		close(priv->route_fd);
 		close(priv->generic_fd);
+		free(priv->link_buf);
+		free(priv->tx_buf);
 	}
 }
 
@@ -540,40 +588,20 @@ if_roaming(struct interface *ifp)
 #endif
 }
 
-int
-if_getnetlink(struct dhcpcd_ctx *ctx, struct iovec *iov, int fd, int flags,
-    int (*cb)(struct dhcpcd_ctx *, void *, struct nlmsghdr *), void *cbarg)
+static int
+if_nlmsgs(struct dhcpcd_ctx *ctx, int fd, void *buf, size_t len,
+    int (*cb)(struct dhcpcd_ctx *, void *, struct nlmsghdr *), void *cbarg,
+    int *rp, bool *againp)
 {
-	struct sockaddr_nl nladdr = { .nl_pid = 0 };
-	struct msghdr msg = {
-	    .msg_name = &nladdr, .msg_namelen = sizeof(nladdr),
-	    .msg_iov = iov, .msg_iovlen = 1,
-	};
-	ssize_t len;
 	struct nlmsghdr *nlm;
-	int r = 0;
+	int r = *rp;
 	unsigned int again;
 	bool terminated;
 
-recv_again:
-	len = recvmsg(fd, &msg, flags);
-	if (len == -1 || len == 0)
-		return (int)len;
-
-	/* Check sender */
-	if (msg.msg_namelen != sizeof(nladdr)) {
-		errno = EINVAL;
-		return -1;
-	}
-
-	/* Ignore message if it is not from kernel */
-	if (nladdr.nl_pid != 0)
-		return 0;
-
 	again = 0;
 	terminated = false;
-	for (nlm = iov->iov_base;
-	     nlm && NLMSG_OK(nlm, (size_t)len);
+	for (nlm = buf;
+	     nlm && NLMSG_OK(nlm, len);
 	     nlm = NLMSG_NEXT(nlm, len))
 	{
 		again = (nlm->nlmsg_flags & NLM_F_MULTI);
@@ -610,7 +638,44 @@ recv_again:
 			r = cb(ctx, cbarg, nlm);
 	}
 
-	if ((again || !terminated) && (ctx != NULL && ctx->link_fd != fd))
+	*rp = r;
+	*againp = again || !terminated;
+	return 0;
+}
+
+int
+if_getnetlink(struct dhcpcd_ctx *ctx, struct iovec *iov, int fd, int flags,
+    int (*cb)(struct dhcpcd_ctx *, void *, struct nlmsghdr *), void *cbarg)
+{
+	struct sockaddr_nl nladdr = { .nl_pid = 0 };
+	struct msghdr msg = {
+	    .msg_name = &nladdr, .msg_namelen = sizeof(nladdr),
+	    .msg_iov = iov, .msg_iovlen = 1,
+	};
+	ssize_t len;
+	int r = 0;
+	bool again;
+
+recv_again:
+	len = recvmsg(fd, &msg, flags);
+	if (len == -1 || len == 0)
+		return (int)len;
+
+	/* Check sender */
+	if (msg.msg_namelen != sizeof(nladdr)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Ignore message if it is not from kernel */
+	if (nladdr.nl_pid != 0)
+		return 0;
+
+	if (if_nlmsgs(ctx, fd, iov->iov_base, (size_t)len,
+	    cb, cbarg, &r, &again) == -1)
+		return -1;
+
+	if (again && (ctx != NULL && ctx->link_fd != fd))
 		goto recv_again;
 
 	return r;
@@ -1045,17 +1110,241 @@ link_netlink(struct dhcpcd_ctx *ctx, void *arg, struct nlmsghdr *nlm)
 	return 0;
 }
 
+static bool
+if_linkrcvbuf_user(struct dhcpcd_ctx *ctx)
+{
+
+#ifndef SMALL
+	return ctx->link_rcvbuf != 0;
+#else
+	UNUSED(ctx);
+	return false;
+#endif
+}
+
+static void
+if_setlinkrcvbuf(struct dhcpcd_ctx *ctx, int rcvbuf, const char *why)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+	socklen_t len;
+
+	len = sizeof(rcvbuf);
+	/* Only root can go over net.core.rmem_max. */
+	if (setsockopt(ctx->link_fd, SOL_SOCKET,
+	    SO_RCVBUFFORCE, &rcvbuf, len) == -1 &&
+	    setsockopt(ctx->link_fd, SOL_SOCKET,
+	    SO_RCVBUF, &rcvbuf, len) == -1)
+	{
+		logerr("%s: SO_RCVBUF", __func__);
+		priv->link_rcvbuf = 0;
+		return;
+	}
+
+	len = sizeof(rcvbuf);
+	if (getsockopt(ctx->link_fd, SOL_SOCKET, SO_RCVBUF,
+	    &rcvbuf, &len) == -1)
+	{
+		logerr("%s: getsockopt", __func__);
+		priv->link_rcvbuf = 0;
+		return;
+	}
+	if (rcvbuf <= priv->link_rcvbuf) {
+		/* Limited by net.core.rmem_max, stop trying. */
+		priv->link_rcvbuf = IF_LINK_RCVBUF_MAX;
+		return;
+	}
+	logdebugx("%s: route socket receive buffer now %d bytes",
+	    why, rcvbuf);
+	priv->link_rcvbuf = rcvbuf;
+}
+
+static void
+if_linkrcvbuf(struct dhcpcd_ctx *ctx, const char *why)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+	int rcvbuf;
+
+	/* Respect the users choice.
+	 * The sandbox cannot change it, it was sized before we entered. */
+	if (if_linkrcvbuf_user(ctx) || IN_PRIVSEP(ctx) ||
+	    priv->link_rcvbuf == 0 || priv->link_rcvbuf >= IF_LINK_RCVBUF_MAX)
+		return;
+
+	/* The kernel doubles what we ask for and reports that,
+	 * so asking for what it reported doubles the buffer. */
+	rcvbuf = priv->link_rcvbuf;
+	if (rcvbuf > IF_LINK_RCVBUF_MAX / 2)
+		rcvbuf = IF_LINK_RCVBUF_MAX / 2;
+	if_setlinkrcvbuf(ctx, rcvbuf, why);
+}
+
+#ifdef SO_MEMINFO
+/* How much is still queued after reading a full batch
+ * tells us how close we are to overflowing. */
+static void
+if_linkqueue(struct dhcpcd_ctx *ctx)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+	uint32_t meminfo[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(meminfo);
+
+	if (getsockopt(ctx->link_fd, SOL_SOCKET, SO_MEMINFO,
+	    meminfo, &len) == -1 ||
+	    len < sizeof(uint32_t) * (SK_MEMINFO_RCVBUF + 1))
+		return;
+
+	if (meminfo[SK_MEMINFO_RMEM_ALLOC] > priv->link_qhiwat)
+		priv->link_qhiwat = meminfo[SK_MEMINFO_RMEM_ALLOC];
+	if (meminfo[SK_MEMINFO_RMEM_ALLOC] > meminfo[SK_MEMINFO_RCVBUF] / 2)
+		if_linkrcvbuf(ctx, "busy");
+}
+#endif
+
+static ssize_t
+if_linkrecv(int fd, struct mmsghdr *mmsg, unsigned int n)
+{
+#ifdef HAVE_RECVMMSG
+
+	return recvmmsg(fd, mmsg, n, MSG_DONTWAIT, NULL);
+#else
+	ssize_t len;
+
+	len = recvmsg(fd, &mmsg->msg_hdr, MSG_DONTWAIT);
+	if (len == -1)
+		return -1;
+	mmsg->msg_len = (unsigned int)len;
+	return 1;
+#endif
+}
+
 int
 if_handlelink(struct dhcpcd_ctx *ctx)
 {
-	unsigned char buf[16 * 1024];
-	struct iovec iov = {
-		.iov_base = buf,
-		.iov_len = sizeof(buf),
-	};
+	struct priv *priv = (struct priv *)ctx->priv;
+	struct sockaddr_nl nladdr[IF_LINK_BATCH];
+	struct iovec iov[IF_LINK_BATCH];
+	struct mmsghdr mmsg[IF_LINK_BATCH];
+	unsigned int i, budget;
+	ssize_t n;
+	int r = 0, error = 0;
+	bool again, truncated = false;
+
+	if (priv->link_buf == NULL) {
+		priv->link_buflen = IF_LINK_BUFLEN;
+		priv->link_buf = malloc(priv->link_buflen * IF_LINK_BATCH);
+		if (priv->link_buf == NULL)
+			return -1;
+	}
 
-	return if_getnetlink(ctx, &iov, ctx->link_fd, MSG_DONTWAIT,
-	    &link_netlink, NULL);
+	for (budget = 0; budget < IF_LINK_BUDGET; budget++) {
+		for (i = 0; i < IF_LINK_BATCH; i++) {
+			iov[i].iov_base = priv->link_buf + priv->link_buflen * i;
+			iov[i].iov_len = priv->link_buflen;
+			memset(&mmsg[i], 0, sizeof(mmsg[i]));
+			mmsg[i].msg_hdr.msg_name = &nladdr[i];
+			mmsg[i].msg_hdr.msg_namelen = sizeof(nladdr[i]);
+			mmsg[i].msg_hdr.msg_iov = &iov[i];
+			mmsg[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		n = if_linkrecv(ctx->link_fd, mmsg, IF_LINK_BATCH);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			/* We will drain the socket and learn the current
+			 * state, ensure it's less likely to happen again. */
+			if (errno == ENOBUFS)
+				if_linkrcvbuf(ctx, "overflow");
+			return -1;
+		}
+
+		for (i = 0; i < (unsigned int)n; i++) {
+			if (mmsg[i].msg_hdr.msg_flags & MSG_TRUNC) {
+				truncated = true;
+				continue;
+			}
+			/* Ignore message if it is not from kernel */
+			if (mmsg[i].msg_hdr.msg_namelen != sizeof(nladdr[i]) ||
+			    nladdr[i].nl_pid != 0)
+				continue;
+			/* Keep going as the rest of the batch
+			 * cannot be read again. */
+			if (if_nlmsgs(ctx, ctx->link_fd, iov[i].iov_base,
+			    mmsg[i].msg_len, link_netlink, NULL,
+			    &r, &again) == -1 && error == 0)
+				error = errno;
+		}
+
+		if (n < IF_LINK_BATCH)
+			break;
+#ifdef SO_MEMINFO
+		if (budget == 0)
+			if_linkqueue(ctx);
+#endif
+	}
+
+	/* A truncated message is lost, so grow our buffer for next time
+	 * and report it like an overflow so our state is refreshed. */
+	if (truncated) {
+		if (priv->link_buflen < IF_LINK_BUFLEN_MAX) {
+			uint8_t *nbuf;
+			size_t nlen = priv->link_buflen * 2;
+
+			nbuf = realloc(priv->link_buf, nlen * IF_LINK_BATCH);
+			if (nbuf != NULL) {
+				priv->link_buf = nbuf;
+				priv->link_buflen = nlen;
+			}
+		}
+		logwarnx("%s: route message truncated, using %zu bytes",
+		    __func__, priv->link_buflen);
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	if (error != 0) {
+		errno = error;
+		return -1;
+	}
+	return r;
+}
+
+size_t
+if_drainlink(struct dhcpcd_ctx *ctx)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+	struct iovec iov[IF_LINK_BATCH];
+	struct mmsghdr mmsg[IF_LINK_BATCH];
+	unsigned int i;
+	ssize_t n;
+	size_t drained = 0;
+
+	/* Truncating is fine as we are discarding, but have a buffer
+	 * as some kernels ignore MSG_TRUNC for netlink. */
+	if (priv->link_buf == NULL) {
+		priv->link_buflen = IF_LINK_BUFLEN;
+		priv->link_buf = malloc(priv->link_buflen * IF_LINK_BATCH);
+		if (priv->link_buf == NULL)
+			return 0;
+	}
+
+	for (;;) {
+		for (i = 0; i < IF_LINK_BATCH; i++) {
+			iov[i].iov_base = priv->link_buf + priv->link_buflen * i;
+			iov[i].iov_len = priv->link_buflen;
+			memset(&mmsg[i], 0, sizeof(mmsg[i]));
+			mmsg[i].msg_hdr.msg_iov = &iov[i];
+			mmsg[i].msg_hdr.msg_iovlen = 1;
+		}
+		n = if_linkrecv(ctx->link_fd, mmsg, IF_LINK_BATCH);
+		if (n == -1) {
+			if (errno == ENOBUFS || errno == ENOMEM)
+				continue;
+			break;
+		}
+		drained += (size_t)n;
+	}
+	return drained;
 }
 
 #ifdef PRIVSEP
@@ -1137,6 +1426,160 @@ if_sendnetlink(struct dhcpcd_ctx *ctx, int protocol, struct nlmsghdr *hdr,
 	return if_getnetlink(ctx, &riov, s, 0, cb, cbarg);
 }
 
+/*
+ * Send netlink requests in one write and collect the ACK for each.
+ * Each request must ask for an ACK and have a sequence number one
+ * higher than the one before, which is how the ACKs are matched.
+ * The result of each request is stored in errors.
+ */
+ssize_t
+if_sendnetlinkbatch(int fd, void *data, size_t len,
+    int *errors, size_t nerrors)
+{
+	struct sockaddr_nl snl = { .nl_family = AF_NETLINK };
+	struct iovec iov = { .iov_base = data, .iov_len = len };
+	struct msghdr msg = {
+	    .msg_name = &snl, .msg_namelen = sizeof(snl),
+	    .msg_iov = &iov, .msg_iovlen = 1
+	};
+	struct nlmsghdr *nlm;
+	struct nlmsgerr *err;
+	unsigned char buf[16 * 1024];
+	socklen_t snllen;
+	ssize_t rlen;
+	size_t n, i, pending;
+	uint32_t seq = 0;
+
+	n = 0;
+	for (nlm = data; NLMSG_OK(nlm, len); nlm = NLMSG_NEXT(nlm, len)) {
+		if (n == 0)
+			seq = nlm->nlmsg_seq;
+		if (n == nerrors || !(nlm->nlmsg_flags & NLM_F_ACK) ||
+		    nlm->nlmsg_seq != seq + (uint32_t)n)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		errors[n++] = -1;
+	}
+	if (n == 0 || len != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (sendmsg(fd, &msg, 0) == -1)
+		return -1;
+
+	/* The kernel carries on after a failed request,
+	 * so expect an ACK for each one. */
+	pending = n;
+	while (pending != 0) {
+		snllen = sizeof(snl);
+		rlen = recvfrom(fd, buf, sizeof(buf), 0,
+		    (struct sockaddr *)&snl, &snllen);
+		if (rlen == -1) {
+			for (i = 0; i < n; i++) {
+				if (errors[i] == -1)
+					errors[i] = errno;
+			}
+			break;
+		}
+		if (snllen != sizeof(snl) || snl.nl_pid != 0)
+			continue;
+
+		len = (size_t)rlen;
+		for (nlm = (void *)buf;
+		     NLMSG_OK(nlm, len);
+		     nlm = NLMSG_NEXT(nlm, len))
+		{
+			if (nlm->nlmsg_type != NLMSG_ERROR ||
+			    nlm->nlmsg_len - sizeof(*nlm) < sizeof(*err))
+				continue;
+			i = nlm->nlmsg_seq - seq;
+			if (i >= n || errors[i] != -1)
+				continue;
+			err = (struct nlmsgerr *)NLMSG_DATA(nlm);
+			errors[i] = -err->error;
+			pending--;
+		}
+	}
+
+	return (ssize_t)n;
+}
+
+static int
+if_txnetlink(struct dhcpcd_ctx *ctx, struct nlmsghdr *hdr,
+    void (*cb)(void *, void *, int), void *obj, void *cbarg)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+	size_t len = NLMSG_ALIGN(hdr->nlmsg_len);
+
+	if (priv->tx_buflen + len > priv->tx_bufsize) {
+		size_t nlen = priv->tx_bufsize == 0 ? 4096 : priv->tx_bufsize;
+		void *nbuf;
+
+		while (priv->tx_buflen + len > nlen)
+			nlen *= 2;
+		if ((nbuf = realloc(priv->tx_buf, nlen)) == NULL)
+			return -1;
+		priv->tx_buf = nbuf;
+		priv->tx_bufsize = nlen;
+	}
+
+	if (if_txqueue(ctx, cb, obj, cbarg, 0) == -1)
+		return -1;
+
+	/* The sequence number is set by if_txcommit_os. */
+	hdr->nlmsg_flags |= NLM_F_ACK;
+	memcpy(priv->tx_buf + priv->tx_buflen, hdr, hdr->nlmsg_len);
+	memset(priv->tx_buf + priv->tx_buflen + hdr->nlmsg_len, 0,
+	    len - hdr->nlmsg_len);
+	priv->tx_buflen += len;
+	return 0;
+}
+
+void
+if_txcommit_os(struct dhcpcd_ctx *ctx)
+{
+	struct priv *priv = (struct priv *)ctx->priv;
+	struct nlmsghdr *nlm;
+	struct if_txop *op;
+	int errors[IF_NLBATCH_MAX];
+	uint8_t *bp, *ep;
+	size_t i, n, len;
+	ssize_t r;
+
+	op = ctx->tx_ops;
+	bp = priv->tx_buf;
+	ep = bp + priv->tx_buflen;
+	while (bp < ep) {
+		/* Number the next IF_NLBATCH_MAX requests
+		 * so if_sendnetlinkbatch can match the ACKs.
+		 * It works on uint32_t offsets from the first sequence
+		 * number, so a batch which wraps still matches. */
+		len = 0;
+		for (n = 0; n < IF_NLBATCH_MAX && bp + len < ep; n++) {
+			nlm = (struct nlmsghdr *)(void *)(bp + len);
+			nlm->nlmsg_seq = (uint32_t)++ctx->seq;
+			len += NLMSG_ALIGN(nlm->nlmsg_len);
+		}
+
+#ifdef PRIVSEP
+		if (ctx->options & DHCPCD_PRIVSEP)
+			r = ps_root_sendnetlinkbatch(ctx, NETLINK_ROUTE,
+			    bp, len, errors, n);
+		else
+#endif
+		r = if_sendnetlinkbatch(priv->route_fd, bp, len, errors, n);
+
+		for (i = 0; i < n; i++, op++)
+			op->error = r == -1 ? errno : errors[i];
+		bp += len;
+	}
+
+	priv->tx_buflen = 0;
+}
+
 #define NLMSG_TAIL(nmsg)						\
 	((struct rtattr *)(((ptrdiff_t)(nmsg))+NLMSG_ALIGN((nmsg)->nlmsg_len)))
 
@@ -1533,69 +1976,68 @@ struct nlmr
 	char buffer[256];
 };
 
-int
-if_route(unsigned char cmd, const struct rt *rt)
+static void
+if_routemsg(struct nlmr *nlm, unsigned char cmd, const struct rt *rt)
 {
-	struct nlmr nlm;
 	bool gateway_unspec;
 
-	memset(&nlm, 0, sizeof(nlm));
-	nlm.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	memset(nlm, 0, sizeof(*nlm));
+	nlm->hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
 	switch (cmd) {
 	case RTM_CHANGE:
-		nlm.hdr.nlmsg_type = RTM_NEWROUTE;
-		nlm.hdr.nlmsg_flags = NLM_F_CREATE | NLM_F_REPLACE;
+		nlm->hdr.nlmsg_type = RTM_NEWROUTE;
+		nlm->hdr.nlmsg_flags = NLM_F_CREATE | NLM_F_REPLACE;
 		break;
 	case RTM_ADD:
-		nlm.hdr.nlmsg_type = RTM_NEWROUTE;
-		nlm.hdr.nlmsg_flags = NLM_F_CREATE | NLM_F_EXCL;
+		nlm->hdr.nlmsg_type = RTM_NEWROUTE;
+		nlm->hdr.nlmsg_flags = NLM_F_CREATE | NLM_F_EXCL;
 		break;
 	case RTM_DELETE:
-		nlm.hdr.nlmsg_type = RTM_DELROUTE;
+		nlm->hdr.nlmsg_type = RTM_DELROUTE;
 		break;
 	}
-	nlm.hdr.nlmsg_flags |= NLM_F_REQUEST;
-	nlm.rt.rtm_family = (unsigned char)rt->rt_dest.sa_family;
-	nlm.rt.rtm_table = RT_TABLE_MAIN;
+	nlm->hdr.nlmsg_flags |= NLM_F_REQUEST;
+	nlm->rt.rtm_family = (unsigned char)rt->rt_dest.sa_family;
+	nlm->rt.rtm_table = RT_TABLE_MAIN;
 
 	gateway_unspec = sa_is_unspecified(&rt->rt_gateway);
 
 	if (cmd == RTM_DELETE) {
-		nlm.rt.rtm_scope = RT_SCOPE_NOWHERE;
+		nlm->rt.rtm_scope = RT_SCOPE_NOWHERE;
 	} else {
 		/* Address generated routes are RTPROT_KERNEL,
 		 * otherwise RTPROT_BOOT */
 #ifdef RTPROT_RA
 		if (rt->rt_dflags & RTDF_RA)
-			nlm.rt.rtm_protocol = RTPROT_RA;
+			nlm->rt.rtm_protocol = RTPROT_RA;
 		else
 #endif
 #ifdef RTPROT_DHCP
 		if (rt->rt_dflags & RTDF_DHCP)
-			nlm.rt.rtm_protocol = RTPROT_DHCP;
+			nlm->rt.rtm_protocol = RTPROT_DHCP;
 		else
 #endif
 		if (rt->rt_dflags & RTDF_IFA_ROUTE)
-			nlm.rt.rtm_protocol = RTPROT_KERNEL;
+			nlm->rt.rtm_protocol = RTPROT_KERNEL;
 		else
-			nlm.rt.rtm_protocol = RTPROT_BOOT;
+			nlm->rt.rtm_protocol = RTPROT_BOOT;
 		if (rt->rt_ifp->flags & IFF_LOOPBACK)
-			nlm.rt.rtm_scope = RT_SCOPE_HOST;
+			nlm->rt.rtm_scope = RT_SCOPE_HOST;
 		else if (gateway_unspec)
-			nlm.rt.rtm_scope = RT_SCOPE_LINK;
+			nlm->rt.rtm_scope = RT_SCOPE_LINK;
 		else
-			nlm.rt.rtm_scope = RT_SCOPE_UNIVERSE;
+			nlm->rt.rtm_scope = RT_SCOPE_UNIVERSE;
 		if (rt->rt_flags & RTF_REJECT)
-			nlm.rt.rtm_type = RTN_UNREACHABLE;
+			nlm->rt.rtm_type = RTN_UNREACHABLE;
 		else
-			nlm.rt.rtm_type = RTN_UNICAST;
+			nlm->rt.rtm_type = RTN_UNICAST;
 	}
 
 #define ADDSA(type, sa)							\
-	add_attr_l(&nlm.hdr, sizeof(nlm), (type),			\
+	add_attr_l(&nlm->hdr, sizeof(*nlm), (type),			\
 	    (const char *)(sa) + sa_addroffset((sa)),			\
 	    (unsigned short)sa_addrlen((sa)));
-	nlm.rt.rtm_dst_len = (unsigned char)sa_toprefix(&rt->rt_netmask);
+	nlm->rt.rtm_dst_len = (unsigned char)sa_toprefix(&rt->rt_netmask);
 	/* rt->rt_dest and rt->gateway are unions where sockaddr_in6
 	 * is the biggest member. However, we access them as the
 	 * generic sockaddr and coverity thinks this will overrun. */
@@ -1619,7 +2061,7 @@ if_route(unsigned char cmd, const struct rt *rt)
 			metrics->rta_len = RTA_LENGTH(0);
 			rta_add_attr_32(metrics, sizeof(metricsbuf),
 			    RTAX_MTU, rt->rt_mtu);
-			add_attr_l(&nlm.hdr, sizeof(nlm), RTA_METRICS,
+			add_attr_l(&nlm->hdr, sizeof(*nlm), RTA_METRICS,
 			    RTA_DATA(metrics),
 			    (unsigned short)RTA_PAYLOAD(metrics));
 		}
@@ -1642,22 +2084,40 @@ if_route(unsigned char cmd, const struct rt *rt)
 				pref = ICMPV6_ROUTER_PREF_INVALID;
 				break;
 			}
-			add_attr_8(&nlm.hdr, sizeof(nlm), RTA_PREF, pref);
+			add_attr_8(&nlm->hdr, sizeof(*nlm), RTA_PREF, pref);
 		}
 #endif
 	}
 
 	if (!sa_is_loopback(&rt->rt_gateway))
-		add_attr_32(&nlm.hdr, sizeof(nlm), RTA_OIF, rt->rt_ifp->index);
+		add_attr_32(&nlm->hdr, sizeof(*nlm), RTA_OIF,
+		    rt->rt_ifp->index);
 
 	if (rt->rt_metric != 0)
-		add_attr_32(&nlm.hdr, sizeof(nlm), RTA_PRIORITY,
+		add_attr_32(&nlm->hdr, sizeof(*nlm), RTA_PRIORITY,
 		    rt->rt_metric);
+}
+
+int
+if_route(unsigned char cmd, const struct rt *rt)
+{
+	struct nlmr nlm;
 
+	if_routemsg(&nlm, cmd, rt);
 	return if_sendnetlink(rt->rt_ifp->ctx, NETLINK_ROUTE, &nlm.hdr,
 	    NULL, NULL);
 }
 
+int
+if_txroute(unsigned char cmd, struct rt *rt,
+    void (*cb)(void *, void *, int), void *cbarg)
+{
+	struct nlmr nlm;
+
+	if_routemsg(&nlm, cmd, rt);
+	return if_txnetlink(rt->rt_ifp->ctx, &nlm.hdr, cb, rt, cbarg);
+}
+
 static int
 _if_initrt(struct dhcpcd_ctx *ctx, void *arg,
     struct nlmsghdr *nlm)
@@ -1696,6 +2156,140 @@ if_initrt(struct dhcpcd_ctx *ctx, rb_tree_t *kroutes, int af)
 /* Linux is a special snowflake when it comes to BPF. */
 const char *bpf_name = "Packet Socket";
 
+#if defined(PACKET_RX_RING) && defined(TPACKET3_HDRLEN)
+/*
+ * A TPACKET_V3 ring lets the kernel batch frames into blocks which we
+ * walk in place, saving a syscall and a copy per frame.
+ * Blocks are only handed to us when full or after BPF_RING_TOV ms,
+ * so keep it short as this is directly added to DHCP and ARP latency.
+ */
+#define	BPF_RING
+#define	BPF_RING_BLKSIZE	(1 << 15)
+#define	BPF_RING_BLKNR		4
+#define	BPF_RING_FRAMESIZE	(1 << 14) /* TPACKET_V3 packs frames */
+#define	BPF_RING_TOV		10	/* ms */
+
+struct bpf_ring {
+	uint8_t *br_map;
+	size_t br_mapsize;
+	size_t br_blksize;
+	unsigned int br_blknr;
+	unsigned int br_blk;		/* block to read next */
+	struct tpacket_block_desc *br_pbd; /* block we own, if any */
+	struct tpacket3_hdr *br_pkt;	/* next frame in br_pbd */
+	uint32_t br_npkts;		/* frames left in br_pbd */
+};
+
+static void
+bpf_ring_close(struct bpf *bpf)
+{
+	struct bpf_ring *br = bpf->bpf_ring;
+
+	if (br == NULL)
+		return;
+	if (br->br_map != MAP_FAILED)
+		munmap(br->br_map, br->br_mapsize);
+	free(br);
+	bpf->bpf_ring = NULL;
+}
+
+static int
+bpf_ring_open(struct bpf *bpf)
+{
+	struct bpf_ring *br;
+	int v = TPACKET_V3;
+	long pagesize;
+	struct tpacket_req3 req = {
+		.tp_block_nr = BPF_RING_BLKNR,
+		.tp_frame_size = BPF_RING_FRAMESIZE,
+		.tp_retire_blk_tov = BPF_RING_TOV,
+	};
+
+	/* The block size must be a multiple of the page size. */
+	pagesize = sysconf(_SC_PAGESIZE);
+	if (pagesize == -1)
+		return -1;
+	req.tp_block_size = (unsigned int)roundup(BPF_RING_BLKSIZE, pagesize);
+	req.tp_frame_nr = (req.tp_block_size / req.tp_frame_size) *
+	    req.tp_block_nr;
+
+	if (setsockopt(bpf->bpf_fd, SOL_PACKET, PACKET_VERSION,
+	    &v, sizeof(v)) == -1)
+		return -1;
+	if (setsockopt(bpf->bpf_fd, SOL_PACKET, PACKET_RX_RING,
+	    &req, sizeof(req)) == -1)
+		return -1;
+
+	br = calloc(1, sizeof(*br));
+	if (br == NULL)
+		return -1;
+	bpf->bpf_ring = br;
+	br->br_blksize = req.tp_block_size;
+	br->br_blknr = req.tp_block_nr;
+	br->br_mapsize = br->br_blksize * br->br_blknr;
+	br->br_map = mmap(NULL, br->br_mapsize, PROT_READ | PROT_WRITE,
+	    MAP_SHARED, bpf->bpf_fd, 0);
+	if (br->br_map == MAP_FAILED) {
+		bpf_ring_close(bpf);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Frames are returned in place, so each one is only valid until the
+ * next call. Once the last frame of a block is consumed, the next call
+ * gives the block back to the kernel. As such, BPF_EOF is only set
+ * when a call returns no frame.
+ */
+static ssize_t
+bpf_ring_read(struct bpf *bpf, void **data)
+{
+	struct bpf_ring *br = bpf->bpf_ring;
+	struct tpacket_block_desc *pbd;
+	struct tpacket3_hdr *pkt;
+
+	for (;;) {
+		if (br->br_pbd != NULL) {
+			if (br->br_npkts != 0)
+				break;
+			__atomic_store_n(&br->br_pbd->hdr.bh1.block_status,
+			    TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+			br->br_pbd = NULL;
+			if (++br->br_blk == br->br_blknr)
+				br->br_blk = 0;
+		}
+
+		pbd = (void *)(br->br_map + br->br_blk * br->br_blksize);
+		if (!(__atomic_load_n(&pbd->hdr.bh1.block_status,
+		    __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+		{
+			bpf->bpf_flags |= BPF_EOF;
+			return 0;
+		}
+		br->br_pbd = pbd;
+		br->br_npkts = pbd->hdr.bh1.num_pkts;
+		br->br_pkt = (void *)
+		    ((uint8_t *)pbd + pbd->hdr.bh1.offset_to_first_pkt);
+	}
+
+	pkt = br->br_pkt;
+	br->br_pkt = (void *)((uint8_t *)pkt + pkt->tp_next_offset);
+	br->br_npkts--;
+
+	*data = (uint8_t *)pkt + pkt->tp_mac;
+	if (pkt->tp_status & TP_STATUS_CSUMNOTREADY)
+		bpf->bpf_flags |= BPF_PARTIALCSUM;
+	else
+		bpf->bpf_flags &= ~BPF_PARTIALCSUM;
+	if (bpf_frame_bcast(bpf->bpf_ifp, *data) == 0)
+		bpf->bpf_flags |= BPF_BCAST;
+	else
+		bpf->bpf_flags &= ~BPF_BCAST;
+	return (ssize_t)pkt->tp_snaplen;
+}
+#endif
+
 /* Linux is a special snowflake for opening BPF. */
 struct bpf *
 bpf_open(const struct interface *ifp,
@@ -1723,15 +2317,26 @@ bpf_open(const struct interface *ifp,
 		return NULL;
 	bpf->bpf_ifp = ifp;
 
+	/* Don't pass a protocol here, otherwise we start receiving
+	 * frames for all interfaces before the bind below and these
+	 * would be stuck in the socket queue if we then use a ring. */
+	bpf->bpf_fd = xsocket(PF_PACKET, SOCK_RAW | SOCK_CXNB, 0);
+	if (bpf->bpf_fd == -1)
+		goto eexit;
+
+#ifdef BPF_RING
+	if (bpf_ring_open(bpf) == -1)
+		logdebug("%s: %s: packet ring", ifp->name, __func__);
+	if (bpf->bpf_ring == NULL) {
+#endif
 	/* Allocate a suitably large buffer for a single packet. */
 	bpf->bpf_size = ETH_DATA_LEN;
 	bpf->bpf_buffer = malloc(bpf->bpf_size);
 	if (bpf->bpf_buffer == NULL)
 		goto eexit;
-
-	bpf->bpf_fd = xsocket(PF_PACKET, SOCK_RAW|SOCK_CXNB,htons(ETH_P_ALL));
-	if (bpf->bpf_fd == -1)
-		goto eexit;
+#ifdef BPF_RING
+	}
+#endif
 
 	/* We cannot validate the correct interface,
 	 * so we MUST set this first. */
@@ -1741,11 +2346,14 @@ bpf_open(const struct interface *ifp,
 	if (filter(bpf, ia) != 0)
 		goto eexit;
 
-	/* In the ideal world, this would be set before the bind and filter. */
+	/* In the ideal world, this would be set before the bind and filter.
+	 * The ring reports this in the frame header instead. */
 #ifdef PACKET_AUXDATA
 	n = 1;
-	if (setsockopt(bpf->bpf_fd, SOL_PACKET, PACKET_AUXDATA,
-	    &n, sizeof(n)) != 0) {
+	if (bpf->bpf_ring == NULL &&
+	    setsockopt(bpf->bpf_fd, SOL_PACKET, PACKET_AUXDATA,
+	    &n, sizeof(n)) != 0)
+	{
 		if (errno != ENOPROTOOPT)
 			goto eexit;
 	}
@@ -1765,15 +2373,18 @@ bpf_open(const struct interface *ifp,
 eexit:
 	if (bpf->bpf_fd != -1)
 		close(bpf->bpf_fd);
+#ifdef BPF_RING
+	bpf_ring_close(bpf);
+#endif
 	free(bpf->bpf_buffer);
 	free(bpf);
 	return NULL;
 }
 
-/* BPF requires that we read the entire buffer.
- * So we pass the buffer in the API so we can loop on >1 packet. */
+/* Return a pointer to the next frame rather than copying it out.
+ * It is only valid until the next call. */
 ssize_t
-bpf_read(struct bpf *bpf, void *data, size_t len)
+bpf_read(struct bpf *bpf, void **data)
 {
 	ssize_t bytes;
 	struct iovec iov = {
@@ -1790,6 +2401,11 @@ bpf_read(struct bpf *bpf, void *data, size_t len)
 	struct tpacket_auxdata *aux;
 #endif
 
+#ifdef BPF_RING
+	if (bpf->bpf_ring != NULL)
+		return bpf_ring_read(bpf, data);
+#endif
+
 #ifdef PACKET_AUXDATA
 	msg.msg_control = cmsgbuf.buf;
 	msg.msg_controllen = sizeof(cmsgbuf.buf);
@@ -1805,9 +2421,7 @@ bpf_read(struct bpf *bpf, void *data, size_t len)
 			bpf->bpf_flags |= BPF_BCAST;
 		else
 			bpf->bpf_flags &= ~BPF_BCAST;
-		if ((size_t)bytes > len)
-			bytes = (ssize_t)len;
-		memcpy(data, bpf->bpf_buffer, (size_t)bytes);
+		*data = bpf->bpf_buffer;
 #ifdef PACKET_AUXDATA
 		for (cmsg = CMSG_FIRSTHDR(&msg);
 		     cmsg;
@@ -1825,6 +2439,18 @@ bpf_read(struct bpf *bpf, void *data, size_t len)
 	return bytes;
 }
 
+void
+bpf_close(struct bpf *bpf)
+{
+
+	close(bpf->bpf_fd);
+#ifdef BPF_RING
+	bpf_ring_close(bpf);
+#endif
+	free(bpf->bpf_buffer);
+	free(bpf);
+}
+
 int
 bpf_attach(int s, void *filter, unsigned int filter_len)
 {
@@ -1834,17 +2460,21 @@ bpf_attach(int s, void *filter, unsigned int filter_len)
 	};
 
 	/* Install the filter. */
-	if (setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &pf, sizeof(pf)) == -1)
-		return -1;
+	return setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &pf, sizeof(pf));
+}
 
+int
+bpf_lock(const struct bpf *bpf)
+{
 #ifdef SO_LOCK_FILTER
 	int on = 1;
 
-	if (setsockopt(s, SOL_SOCKET, SO_LOCK_FILTER, &on, sizeof(on)) == -1)
-		return -1;
-#endif
-
+	return setsockopt(bpf->bpf_fd, SOL_SOCKET, SO_LOCK_FILTER,
+	    &on, sizeof(on));
+#else
+	UNUSED(bpf);
 	return 0;
+#endif
 }
 
 int
@@ -1912,33 +2542,33 @@ __unused const struct in_addr *addr, __unused const char *alias)
 #endif
 
 #ifdef INET6
-int
-if_address6(unsigned char cmd, const struct ipv6_addr *ia)
+static void
+if_address6msg(struct nlma *nlm, unsigned char cmd,
+    const struct ipv6_addr *ia)
 {
-	struct nlma nlm;
 	struct ifa_cacheinfo cinfo;
 #if defined(IFA_F_MANAGETEMPADDR) || defined(IFA_F_NOPREFIXROUTE)
 	uint32_t flags = 0;
 #endif
 
-	memset(&nlm, 0, sizeof(nlm));
-	nlm.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
-	nlm.hdr.nlmsg_flags = NLM_F_REQUEST;
-	nlm.hdr.nlmsg_type = cmd;
+	memset(nlm, 0, sizeof(*nlm));
+	nlm->hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+	nlm->hdr.nlmsg_flags = NLM_F_REQUEST;
+	nlm->hdr.nlmsg_type = cmd;
 	if (cmd == RTM_NEWADDR)
-		nlm.hdr.nlmsg_flags |= NLM_F_CREATE | NLM_F_REPLACE;
-	nlm.ifa.ifa_index = ia->iface->index;
-	nlm.ifa.ifa_family = AF_INET6;
+		nlm->hdr.nlmsg_flags |= NLM_F_CREATE | NLM_F_REPLACE;
+	nlm->ifa.ifa_index = ia->iface->index;
+	nlm->ifa.ifa_family = AF_INET6;
 
 	/* Add as /128 if no IFA_F_NOPREFIXROUTE ? */
-	nlm.ifa.ifa_prefixlen = ia->prefix_len;
+	nlm->ifa.ifa_prefixlen = ia->prefix_len;
 
 #if 0
 	/* This creates the aliased interface */
-	add_attr_l(&nlm.hdr, sizeof(nlm), IFA_LABEL,
+	add_attr_l(&nlm->hdr, sizeof(*nlm), IFA_LABEL,
 	    ia->iface->alias, (unsigned short)(strlen(ia->iface->alias) + 1));
 #endif
-	add_attr_l(&nlm.hdr, sizeof(nlm), IFA_LOCAL,
+	add_attr_l(&nlm->hdr, sizeof(*nlm), IFA_LOCAL,
 	    &ia->addr.s6_addr, sizeof(ia->addr.s6_addr));
 
 	if (cmd == RTM_NEWADDR) {
@@ -1948,7 +2578,7 @@ if_address6(unsigned char cmd, const struct ipv6_addr *ia)
 #ifdef IFA_F_NOPREFIXROUTE
 			flags |= IFA_F_TEMPORARY;
 #else
-			nlm.ifa.ifa_flags |= IFA_F_TEMPORARY;
+			nlm->ifa.ifa_flags |= IFA_F_TEMPORARY;
 #endif
 		}
 #elif IFA_F_MANAGETEMPADDR
@@ -1960,20 +2590,38 @@ if_address6(unsigned char cmd, const struct ipv6_addr *ia)
 			flags |= IFA_F_NOPREFIXROUTE;
 #endif
 #if defined(IFA_F_MANAGETEMPADDR) || defined(IFA_F_NOPREFIXROUTE)
-		add_attr_32(&nlm.hdr, sizeof(nlm), IFA_FLAGS, flags);
+		add_attr_32(&nlm->hdr, sizeof(*nlm), IFA_FLAGS, flags);
 #endif
 
 		memset(&cinfo, 0, sizeof(cinfo));
 		cinfo.ifa_prefered = ia->prefix_pltime;
 		cinfo.ifa_valid = ia->prefix_vltime;
-		add_attr_l(&nlm.hdr, sizeof(nlm), IFA_CACHEINFO,
+		add_attr_l(&nlm->hdr, sizeof(*nlm), IFA_CACHEINFO,
 		    &cinfo, sizeof(cinfo));
 	}
 
+}
+
+int
+if_address6(unsigned char cmd, const struct ipv6_addr *ia)
+{
+	struct nlma nlm;
+
+	if_address6msg(&nlm, cmd, ia);
 	return if_sendnetlink(ia->iface->ctx, NETLINK_ROUTE, &nlm.hdr,
 	    NULL, NULL);
 }
 
+int
+if_txaddress6(unsigned char cmd, struct ipv6_addr *ia,
+    void (*cb)(void *, void *, int), void *cbarg)
+{
+	struct nlma nlm;
+
+	if_address6msg(&nlm, cmd, ia);
+	return if_txnetlink(ia->iface->ctx, &nlm.hdr, cb, ia, cbarg);
+}
+
 int
 if_addrflags6(const struct interface *ifp, const struct in6_addr *addr,
     __unused const char *alias)
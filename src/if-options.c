@@ -55,6 +55,7 @@
 #include "ipv4.h"
 #include "logerr.h"
 #include "sa.h"
+#include "workers.h"
 
 #define	IN_CONFIG_BLOCK(ifo)	((ifo)->options & DHCPCD_FORKED)
 #define	SET_CONFIG_BLOCK(ifo)	((ifo)->options |= DHCPCD_FORKED)
@@ -166,6 +167,9 @@ const struct option cf_options[] = {
 	{"inactive",        no_argument,       NULL, O_INACTIVE},
 	{"mudurl",          required_argument, NULL, O_MUDURL},
 	{"link_rcvbuf",     required_argument, NULL, O_LINK_RCVBUF},
+	{"lease_delay",     required_argument, NULL, O_LEASE_DELAY},
+	{"lease_log",       no_argument,       NULL, O_LEASE_LOG},
+	{"workers",         required_argument, NULL, O_WORKERS},
 	{"configure",       no_argument,       NULL, O_CONFIGURE},
 	{"noconfigure",     no_argument,       NULL, O_NOCONFIGURE},
 	{NULL,              0,                 NULL, '\0'}
@@ -570,6 +574,266 @@ free_dhcp_opt_embenc(struct dhcp_opt *opt)
 	opt->encopts = NULL;
 }
 
+/* Options which build the tables held in struct if_optshare. */
+static bool
+optshare_opt(int opt)
+{
+
+	switch (opt) {
+	case O_DEFINE:
+	case O_DEFINEND:
+	case O_DEFINE6:
+	case O_VENDOPT:
+	case O_EMBED:
+	case O_ENCAP:
+	case O_VENDCLASS:
+		return true;
+	}
+	return false;
+}
+
+static size_t
+dhcp_opts_size(const struct dhcp_opt *opts, size_t len)
+{
+	size_t i, size = len * sizeof(*opts);
+	const struct dhcp_opt *opt;
+
+	for (i = 0, opt = opts; i < len; i++, opt++) {
+		if (opt->var != NULL)
+			size += strlen(opt->var) + 1;
+		size += dhcp_opts_size(opt->embopts, opt->embopts_len);
+		size += dhcp_opts_size(opt->encopts, opt->encopts_len);
+	}
+	return size;
+}
+
+static void
+free_dhcp_opts(struct dhcp_opt *opts, size_t len)
+{
+	size_t i;
+	struct dhcp_opt *opt;
+
+	for (i = 0, opt = opts; i < len; i++, opt++)
+		free_dhcp_opt_embenc(opt);
+	free(opts);
+}
+
+static int
+dup_dhcp_opts(struct dhcp_opt **dst, const struct dhcp_opt *src, size_t len)
+{
+	size_t i;
+	struct dhcp_opt *opts, *opt;
+
+	*dst = NULL;
+	if (len == 0)
+		return 0;
+	if ((opts = calloc(len, sizeof(*opts))) == NULL)
+		return -1;
+	for (i = 0, opt = opts; i < len; i++, opt++, src++) {
+		*opt = *src;
+		opt->var = NULL;
+		opt->embopts = opt->encopts = NULL;
+		opt->embopts_len = opt->encopts_len = 0;
+		if (src->var != NULL && (opt->var = strdup(src->var)) == NULL)
+			goto err;
+		if (dup_dhcp_opts(&opt->embopts,
+		    src->embopts, src->embopts_len) == -1)
+			goto err;
+		opt->embopts_len = src->embopts_len;
+		if (dup_dhcp_opts(&opt->encopts,
+		    src->encopts, src->encopts_len) == -1)
+			goto err;
+		opt->encopts_len = src->encopts_len;
+	}
+	*dst = opts;
+	return 0;
+
+err:
+	free_dhcp_opts(opts, i + 1);
+	return -1;
+}
+
+static size_t
+optshare_size(const struct if_optshare *os)
+{
+	size_t i, size;
+
+	size = dhcp_opts_size(os->os_dhcp, os->os_dhcp_len);
+	size += dhcp_opts_size(os->os_nd, os->os_nd_len);
+	size += dhcp_opts_size(os->os_dhcp6, os->os_dhcp6_len);
+	size += dhcp_opts_size(os->os_vivso, os->os_vivso_len);
+	size += os->os_vivco_len * sizeof(*os->os_vivco);
+	for (i = 0; i < os->os_vivco_len; i++)
+		size += os->os_vivco[i].len;
+	return size;
+}
+
+static void
+optshare_unref(struct dhcpcd_ctx *ctx, struct if_optshare *os)
+{
+	struct if_optshare **osp;
+	size_t i;
+
+	if (--os->os_refs != 0)
+		return;
+
+	for (osp = &ctx->optshares; *osp != os; osp = &(*osp)->os_next)
+		;
+	*osp = os->os_next;
+
+	free_dhcp_opts(os->os_dhcp, os->os_dhcp_len);
+	free_dhcp_opts(os->os_nd, os->os_nd_len);
+	free_dhcp_opts(os->os_dhcp6, os->os_dhcp6_len);
+	free_dhcp_opts(os->os_vivso, os->os_vivso_len);
+	for (i = 0; i < os->os_vivco_len; i++)
+		free(os->os_vivco[i].data);
+	free(os->os_vivco);
+	free(os->os_key);
+	free(os);
+}
+
+static void
+optshare_set(struct if_options *ifo, struct if_optshare *os)
+{
+
+	ifo->optshare = os;
+	ifo->dhcp_override = os->os_dhcp;
+	ifo->dhcp_override_len = os->os_dhcp_len;
+	ifo->nd_override = os->os_nd;
+	ifo->nd_override_len = os->os_nd_len;
+	ifo->dhcp6_override = os->os_dhcp6;
+	ifo->dhcp6_override_len = os->os_dhcp6_len;
+	ifo->vivso_override = os->os_vivso;
+	ifo->vivso_override_len = os->os_vivso_len;
+	ifo->vivco = os->os_vivco;
+	ifo->vivco_len = os->os_vivco_len;
+}
+
+/* Stop sharing the tables because ifo is about to change them. */
+static int
+optshare_copy(struct dhcpcd_ctx *ctx, struct if_options *ifo)
+{
+	struct if_optshare *os = ifo->optshare;
+	struct if_optshare nos = { .os_refs = 0 };
+	size_t i;
+
+	if (dup_dhcp_opts(&nos.os_dhcp, os->os_dhcp, os->os_dhcp_len) == -1)
+		goto err;
+	nos.os_dhcp_len = os->os_dhcp_len;
+	if (dup_dhcp_opts(&nos.os_nd, os->os_nd, os->os_nd_len) == -1)
+		goto err;
+	nos.os_nd_len = os->os_nd_len;
+	if (dup_dhcp_opts(&nos.os_dhcp6, os->os_dhcp6, os->os_dhcp6_len) == -1)
+		goto err;
+	nos.os_dhcp6_len = os->os_dhcp6_len;
+	if (dup_dhcp_opts(&nos.os_vivso, os->os_vivso, os->os_vivso_len) == -1)
+		goto err;
+	nos.os_vivso_len = os->os_vivso_len;
+	if (os->os_vivco_len != 0) {
+		nos.os_vivco = calloc(os->os_vivco_len, sizeof(*nos.os_vivco));
+		if (nos.os_vivco == NULL)
+			goto err;
+		for (i = 0; i < os->os_vivco_len; i++) {
+			nos.os_vivco[i].len = os->os_vivco[i].len;
+			nos.os_vivco[i].data = malloc(os->os_vivco[i].len);
+			if (nos.os_vivco[i].data == NULL)
+				goto err;
+			nos.os_vivco_len++;
+			memcpy(nos.os_vivco[i].data, os->os_vivco[i].data,
+			    os->os_vivco[i].len);
+		}
+	}
+
+	optshare_set(ifo, &nos);
+	ifo->optshare = NULL;
+	optshare_unref(ctx, os);
+	return 0;
+
+err:
+	logerr(__func__);
+	free_dhcp_opts(nos.os_dhcp, nos.os_dhcp_len);
+	free_dhcp_opts(nos.os_nd, nos.os_nd_len);
+	free_dhcp_opts(nos.os_dhcp6, nos.os_dhcp6_len);
+	free_dhcp_opts(nos.os_vivso, nos.os_vivso_len);
+	for (i = 0; i < nos.os_vivco_len; i++)
+		free(nos.os_vivco[i].data);
+	free(nos.os_vivco);
+	return -1;
+}
+
+/*
+ * Share the tables built for ifo with any other interface which built
+ * them from the same options, otherwise offer them up for sharing.
+ * key is the options, and their arguments, which built the tables.
+ */
+static void
+optshare_add(struct dhcpcd_ctx *ctx, struct if_options *ifo,
+    uint8_t *key, size_t keylen)
+{
+	struct if_optshare *os;
+	size_t i;
+
+	for (os = ctx->optshares; os != NULL; os = os->os_next) {
+		if (os->os_keylen == keylen &&
+		    memcmp(os->os_key, key, keylen) == 0)
+			break;
+	}
+	if (os != NULL) {
+		free(key);
+		free_dhcp_opts(ifo->dhcp_override, ifo->dhcp_override_len);
+		free_dhcp_opts(ifo->nd_override, ifo->nd_override_len);
+		free_dhcp_opts(ifo->dhcp6_override, ifo->dhcp6_override_len);
+		free_dhcp_opts(ifo->vivso_override, ifo->vivso_override_len);
+		for (i = 0; i < ifo->vivco_len; i++)
+			free(ifo->vivco[i].data);
+		free(ifo->vivco);
+		os->os_refs++;
+		optshare_set(ifo, os);
+		return;
+	}
+
+	if ((os = calloc(1, sizeof(*os))) == NULL) {
+		logerr(__func__);
+		free(key);
+		return;
+	}
+	os->os_refs = 1;
+	os->os_key = key;
+	os->os_keylen = keylen;
+	os->os_dhcp = ifo->dhcp_override;
+	os->os_dhcp_len = ifo->dhcp_override_len;
+	os->os_nd = ifo->nd_override;
+	os->os_nd_len = ifo->nd_override_len;
+	os->os_dhcp6 = ifo->dhcp6_override;
+	os->os_dhcp6_len = ifo->dhcp6_override_len;
+	os->os_vivso = ifo->vivso_override;
+	os->os_vivso_len = ifo->vivso_override_len;
+	os->os_vivco = ifo->vivco;
+	os->os_vivco_len = ifo->vivco_len;
+	os->os_next = ctx->optshares;
+	ctx->optshares = os;
+	ifo->optshare = os;
+}
+
+void
+report_optshare(struct dhcpcd_ctx *ctx)
+{
+	struct if_optshare *os;
+	size_t n = 0, refs = 0, size, used = 0, saved = 0;
+
+	for (os = ctx->optshares; os != NULL; os = os->os_next) {
+		size = optshare_size(os);
+		n++;
+		refs += os->os_refs;
+		used += size;
+		saved += size * (os->os_refs - 1);
+	}
+	if (n == 0)
+		return;
+	logdebugx("options: %zu interfaces share %zu definition tables, "
+	    "%zu bytes used, %zu bytes saved", refs, n, used, saved);
+}
+
 static char *
 strwhite(const char *s)
 {
@@ -666,6 +930,10 @@ parse_option(struct dhcpcd_ctx *ctx, const char *ifname, struct if_options *ifo,
  * in the options declaration above. */
 #define ARG_REQUIRED if (arg == NULL) goto arg_required
 
+	if (ifo->optshare != NULL && optshare_opt(opt) &&
+	    optshare_copy(ctx, ifo) == -1)
+		return -1;
+
 	switch(opt) {
 	case 'f': /* FALLTHROUGH */
 	case 'g': /* FALLTHROUGH */
@@ -2260,6 +2528,32 @@ invalid_token:
 			logerrx("failed to convert link_rcvbuf %s", arg);
 			return -1;
 		}
+#endif
+		break;
+	case O_LEASE_DELAY:
+		ARG_REQUIRED;
+		ctx->lease_delay = (unsigned int)strtou(arg, NULL, 0, 0,
+		    UINT32_MAX, &e);
+		if (e) {
+			logerrx("failed to convert lease_delay %s", arg);
+			return -1;
+		}
+		break;
+	case O_LEASE_LOG:
+		ctx->lease_log = true;
+		break;
+	case O_WORKERS:
+#ifdef WORKERS
+		ARG_REQUIRED;
+		ctx->workers = (unsigned int)strtou(arg, NULL, 0, 0,
+		    WORKERS_MAX, &e);
+		if (e) {
+			logerrx("failed to convert workers %s", arg);
+			return -1;
+		}
+#else
+		if (ifname == NULL)
+			logwarnx("workers not compiled in");
 #endif
 		break;
 	case O_CONFIGURE:
@@ -2348,6 +2642,7 @@ default_config(struct dhcpcd_ctx *ctx)
 		logerr(__func__);
 		return NULL;
 	}
+	ctx->cf_gen++;
 	ifo->options |= DHCPCD_IF_UP | DHCPCD_LINK | DHCPCD_INITIAL_DELAY;
 	ifo->timeout = DEFAULT_TIMEOUT;
 	ifo->reboot = DEFAULT_REBOOT;
@@ -2369,21 +2664,387 @@ default_config(struct dhcpcd_ctx *ctx)
 	return ifo;
 }
 
-struct if_options *
-read_config(struct dhcpcd_ctx *ctx,
-    const char *ifname, const char *ssid, const char *profile)
+/* Hash of a config file, to see if it needs compiling again. */
+static uint64_t
+cf_hash(const char *buf, size_t len)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	/* FNV-1a */
+	while (len-- != 0) {
+		h ^= (uint8_t)*buf++;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/* Split a config line into the option and its argument. */
+static char *
+cf_splitline(char *line, char **option)
+{
+	char *p;
+
+	*option = strsep(&line, " \t");
+	if (line)
+		line = strskipwhite(line);
+	/* Trim trailing whitespace */
+	if (line) {
+		p = line + strlen(line) - 1;
+		while (p != line &&
+		    (*p == ' ' || *p == '\t') &&
+		    *(p - 1) != '\\')
+			*p-- = '\0';
+	}
+	return line;
+}
+
+/* Read a config file into buf, NUL terminated. */
+static ssize_t
+cf_readfile(struct dhcpcd_ctx *ctx, const char *file, char *buf, size_t len)
 {
-	struct if_options *ifo;
-	char buf[UDPLEN_MAX], *bp; /* 64k max config file size */
-	char *line, *option, *p;
 	ssize_t buflen;
-	size_t vlen;
-	int skip, have_profile, new_block, had_block;
+
+	buflen = dhcp_readfile(ctx, file, buf, len);
+	if (buflen == -1)
+		return -1;
+	if (buflen == 0 || buf[buflen - 1] != '\0') {
+		if ((size_t)buflen < len - 1)
+			buflen++;
+		buf[buflen - 1] = '\0';
+	}
+	return buflen;
+}
+
+void
+free_definitions(struct dhcpcd_ctx *ctx)
+{
+	struct dhcp_opt *opt;
+
+#ifdef INET
+	if (ctx->dhcp_opts) {
+		for (opt = ctx->dhcp_opts;
+		    ctx->dhcp_opts_len > 0;
+		    opt++, ctx->dhcp_opts_len--)
+			free_dhcp_opt_embenc(opt);
+		free(ctx->dhcp_opts);
+		ctx->dhcp_opts = NULL;
+	}
+#endif
+#ifdef INET6
+	if (ctx->nd_opts) {
+		for (opt = ctx->nd_opts;
+		    ctx->nd_opts_len > 0;
+		    opt++, ctx->nd_opts_len--)
+			free_dhcp_opt_embenc(opt);
+		free(ctx->nd_opts);
+		ctx->nd_opts = NULL;
+	}
+#ifdef DHCP6
+	if (ctx->dhcp6_opts) {
+		for (opt = ctx->dhcp6_opts;
+		    ctx->dhcp6_opts_len > 0;
+		    opt++, ctx->dhcp6_opts_len--)
+			free_dhcp_opt_embenc(opt);
+		free(ctx->dhcp6_opts);
+		ctx->dhcp6_opts = NULL;
+	}
+#endif
+#endif
+	if (ctx->vivso) {
+		for (opt = ctx->vivso;
+		    ctx->vivso_len > 0;
+		    opt++, ctx->vivso_len--)
+			free_dhcp_opt_embenc(opt);
+		free(ctx->vivso);
+		ctx->vivso = NULL;
+	}
+	ctx->cf_defhash = 0;
+}
+
+/*
+ * Load the option definitions into ctx.
+ * They only change if EMBEDDED_CONFIG does, so a reload with the same
+ * definitions keeps the tables already built.
+ */
+static int
+read_definitions(struct dhcpcd_ctx *ctx, struct if_options *ifo,
+    char *buf, size_t len)
+{
+	char *bp, *line, *option;
+	ssize_t buflen;
+	uint64_t hash;
+	struct dhcp_opt *ldop, *edop;
 #if !defined(INET) || !defined(INET6)
 	size_t i;
 	struct dhcp_opt *opt;
 #endif
+
+#ifdef EMBEDDED_CONFIG
+	buflen = cf_readfile(ctx, EMBEDDED_CONFIG, buf, len);
+	if (buflen == -1) {
+		logerr("%s: %s", __func__, EMBEDDED_CONFIG);
+		return -1;
+	}
+#else
+	buflen = (ssize_t)strlcpy(buf, dhcpcd_embedded_conf, len);
+	if ((size_t)buflen >= len) {
+		logerrx("%s: embedded config too big", __func__);
+		return -1;
+	}
+	/* Our embedded config is NULL terminated */
+#endif
+
+	hash = cf_hash(buf, (size_t)buflen);
+	if (hash == ctx->cf_defhash)
+		return 0;
+	free_definitions(ctx);
+
+	/* Space for initial estimates */
+#if defined(INET) && defined(INITDEFINES)
+	ifo->dhcp_override =
+	    calloc(INITDEFINES, sizeof(*ifo->dhcp_override));
+	if (ifo->dhcp_override == NULL)
+		logerr(__func__);
+	else
+		ifo->dhcp_override_len = INITDEFINES;
+#endif
+
+#if defined(INET6) && defined(INITDEFINENDS)
+	ifo->nd_override =
+	    calloc(INITDEFINENDS, sizeof(*ifo->nd_override));
+	if (ifo->nd_override == NULL)
+		logerr(__func__);
+	else
+		ifo->nd_override_len = INITDEFINENDS;
+#endif
+#if defined(INET6) && defined(INITDEFINE6S)
+	ifo->dhcp6_override =
+	    calloc(INITDEFINE6S, sizeof(*ifo->dhcp6_override));
+	if (ifo->dhcp6_override == NULL)
+		logerr(__func__);
+	else
+		ifo->dhcp6_override_len = INITDEFINE6S;
+#endif
+
+	bp = buf;
+	while ((line = get_line(&bp, &buflen)) != NULL) {
+		line = cf_splitline(line, &option);
+		parse_config_line(ctx, NULL, ifo, option, line,
+		    &ldop, &edop);
+	}
+
+#ifdef INET
+	ctx->dhcp_opts = ifo->dhcp_override;
+	ctx->dhcp_opts_len = ifo->dhcp_override_len;
+#else
+	for (i = 0, opt = ifo->dhcp_override;
+	    i < ifo->dhcp_override_len;
+	    i++, opt++)
+		free_dhcp_opt_embenc(opt);
+	free(ifo->dhcp_override);
+#endif
+	ifo->dhcp_override = NULL;
+	ifo->dhcp_override_len = 0;
+
+#ifdef INET6
+	ctx->nd_opts = ifo->nd_override;
+	ctx->nd_opts_len = ifo->nd_override_len;
+#ifdef DHCP6
+	ctx->dhcp6_opts = ifo->dhcp6_override;
+	ctx->dhcp6_opts_len = ifo->dhcp6_override_len;
+#endif
+#else
+	for (i = 0, opt = ifo->nd_override;
+	    i < ifo->nd_override_len;
+	    i++, opt++)
+		free_dhcp_opt_embenc(opt);
+	free(ifo->nd_override);
+	for (i = 0, opt = ifo->dhcp6_override;
+	    i < ifo->dhcp6_override_len;
+	    i++, opt++)
+		free_dhcp_opt_embenc(opt);
+	free(ifo->dhcp6_override);
+#endif
+	ifo->nd_override = NULL;
+	ifo->nd_override_len = 0;
+	ifo->dhcp6_override = NULL;
+	ifo->dhcp6_override_len = 0;
+
+	ctx->vivso = ifo->vivso_override;
+	ctx->vivso_len = ifo->vivso_override_len;
+	ifo->vivso_override = NULL;
+	ifo->vivso_override_len = 0;
+
+	ctx->cf_defhash = hash;
+	return 0;
+}
+
+void
+free_cfcompiled(struct dhcpcd_ctx *ctx)
+{
+
+	if (ctx->cf_compiled == NULL)
+		return;
+	free(ctx->cf_compiled->cc_recs);
+	free(ctx->cf_compiled->cc_file);
+	free(ctx->cf_compiled);
+	ctx->cf_compiled = NULL;
+}
+
+static struct cf_rec *
+cf_addrec(struct cf_compiled *cc, int opt, const char *arg)
+{
+	size_t arglen = arg != NULL ? strlen(arg) + 1 : 0;
+	size_t len = ROUNDUP8(sizeof(struct cf_rec) + arglen);
+	size_t nsize;
+	uint8_t *nr;
+	struct cf_rec *cr;
+
+	if (cc->cc_len + len > cc->cc_size) {
+		nsize = cc->cc_size != 0 ? cc->cc_size * 2 : 4096;
+		while (cc->cc_len + len > nsize)
+			nsize *= 2;
+		nr = realloc(cc->cc_recs, nsize);
+		if (nr == NULL)
+			return NULL;
+		cc->cc_recs = nr;
+		cc->cc_size = nsize;
+	}
+	cr = (void *)(cc->cc_recs + cc->cc_len);
+	memset(cr, 0, len);
+	cr->cr_len = (uint32_t)len;
+	cr->cr_opt = opt;
+	cr->cr_arglen = (uint32_t)arglen;
+	if (arg != NULL)
+		memcpy(cr->cr_arg, arg, arglen);
+	cc->cc_len += len;
+	return cr;
+}
+
+/*
+ * Compile the config file in buf into records of option values and
+ * their arguments, with each block pointing at the next one.
+ * Options which are unknown or lack a required argument are reported
+ * here, once, and left out.
+ */
+static struct cf_compiled *
+cf_compile(struct dhcpcd_ctx *ctx, char *buf, ssize_t buflen)
+{
+	struct cf_compiled *cc;
+	struct cf_rec *cr;
+	char *bp, *line, *option;
+	size_t i, block = SIZE_MAX;
+	int opt;
+
+	if ((cc = calloc(1, sizeof(*cc))) == NULL)
+		return NULL;
+	bp = buf;
+	while ((line = get_line(&bp, &buflen)) != NULL) {
+		line = cf_splitline(line, &option);
+		if (strcmp(option, "interface") == 0)
+			opt = CF_INTERFACE;
+		else if (strcmp(option, "ssid") == 0)
+			opt = CF_SSID;
+		else if (strcmp(option, "profile") == 0)
+			opt = CF_PROFILE;
+		else {
+			for (i = 0; i < __arraycount(cf_options); i++) {
+				if (cf_options[i].name != NULL &&
+				    strcmp(cf_options[i].name, option) == 0)
+					break;
+			}
+			if (i == __arraycount(cf_options)) {
+				if (!(ctx->options & DHCPCD_PRINT_PIDFILE))
+					logerrx("unknown option: %s", option);
+				continue;
+			}
+			if (cf_options[i].has_arg == required_argument &&
+			    line == NULL)
+			{
+				logerrx("option requires an argument -- %s",
+				    option);
+				continue;
+			}
+			opt = cf_options[i].val;
+		}
+
+		if (opt < 0 && block != SIZE_MAX) {
+			cr = (void *)(cc->cc_recs + block);
+			cr->cr_next = (uint32_t)cc->cc_len;
+		}
+		if (opt < 0)
+			block = cc->cc_len;
+		if (cf_addrec(cc, opt, line) == NULL) {
+			free(cc->cc_recs);
+			free(cc);
+			return NULL;
+		}
+	}
+	if (block != SIZE_MAX) {
+		cr = (void *)(cc->cc_recs + block);
+		cr->cr_next = (uint32_t)cc->cc_len;
+	}
+	return cc;
+}
+
+/*
+ * Make sure ctx->cf_compiled matches the config file.
+ * The mtime is enough unless the file changed within the second it was
+ * last read, otherwise a file with the same hash is not compiled again.
+ */
+static int
+cf_load(struct dhcpcd_ctx *ctx, char *buf, size_t len, time_t *mtime)
+{
+	struct cf_compiled *cc = ctx->cf_compiled;
+	ssize_t buflen;
+	uint64_t hash;
+	time_t now;
+
+	if (cc != NULL && strcmp(cc->cc_file, ctx->cffile) != 0) {
+		free_cfcompiled(ctx);
+		cc = NULL;
+	}
+
+	now = time(NULL);
+	if (dhcp_filemtime(ctx, ctx->cffile, mtime) == -1)
+		return -1;
+	if (cc != NULL && cc->cc_trusted && cc->cc_mtime == *mtime)
+		return 0;
+
+	buflen = cf_readfile(ctx, ctx->cffile, buf, len);
+	if (buflen == -1)
+		return -1;
+	hash = cf_hash(buf, (size_t)buflen);
+	if (cc == NULL || cc->cc_hash != hash) {
+		if ((cc = cf_compile(ctx, buf, buflen)) == NULL)
+			return -1;
+		if ((cc->cc_file = strdup(ctx->cffile)) == NULL) {
+			free(cc->cc_recs);
+			free(cc);
+			return -1;
+		}
+		free_cfcompiled(ctx);
+		ctx->cf_compiled = cc;
+		cc->cc_hash = hash;
+	}
+	cc->cc_mtime = *mtime;
+	cc->cc_trusted = *mtime < now;
+	return 0;
+}
+
+struct if_options *
+read_config(struct dhcpcd_ctx *ctx,
+    const char *ifname, const char *ssid, const char *profile)
+{
+	struct if_options *ifo;
+	char buf[UDPLEN_MAX], *arg, **n; /* 64k max config file size */
+	size_t vlen, off, next, keylen, keysize;
+	uint8_t *key, *nkey;
+	bool share;
+	int skip, have_profile, new_block, had_block;
 	struct dhcp_opt *ldop, *edop;
+	const struct cf_compiled *cc;
+	const struct cf_rec *cr;
 
 	/* Seed our default options */
 	if ((ifo = default_config(ctx)) == NULL)
@@ -2425,145 +3086,30 @@ read_config(struct dhcpcd_ctx *ctx,
 
 	/* Parse our embedded options file */
 	if (ifname == NULL && !(ctx->options & DHCPCD_PRINT_PIDFILE)) {
-		/* Space for initial estimates */
-#if defined(INET) && defined(INITDEFINES)
-		ifo->dhcp_override =
-		    calloc(INITDEFINES, sizeof(*ifo->dhcp_override));
-		if (ifo->dhcp_override == NULL)
-			logerr(__func__);
-		else
-			ifo->dhcp_override_len = INITDEFINES;
-#endif
-
-#if defined(INET6) && defined(INITDEFINENDS)
-		ifo->nd_override =
-		    calloc(INITDEFINENDS, sizeof(*ifo->nd_override));
-		if (ifo->nd_override == NULL)
-			logerr(__func__);
-		else
-			ifo->nd_override_len = INITDEFINENDS;
-#endif
-#if defined(INET6) && defined(INITDEFINE6S)
-		ifo->dhcp6_override =
-		    calloc(INITDEFINE6S, sizeof(*ifo->dhcp6_override));
-		if (ifo->dhcp6_override == NULL)
-			logerr(__func__);
-		else
-			ifo->dhcp6_override_len = INITDEFINE6S;
-#endif
-
-		/* Now load our embedded config */
-#ifdef EMBEDDED_CONFIG
-		buflen = dhcp_readfile(ctx, EMBEDDED_CONFIG, buf, sizeof(buf));
-		if (buflen == -1) {
-			logerr("%s: %s", __func__, EMBEDDED_CONFIG);
+		if (read_definitions(ctx, ifo, buf, sizeof(buf)) == -1)
 			return ifo;
-		}
-		if (buf[buflen - 1] != '\0') {
-			if ((size_t)buflen < sizeof(buf) - 1)
-				buflen++;
-			buf[buflen - 1] = '\0';
-		}
-#else
-		buflen = (ssize_t)strlcpy(buf, dhcpcd_embedded_conf,
-		    sizeof(buf));
-		if ((size_t)buflen >= sizeof(buf)) {
-			logerrx("%s: embedded config too big", __func__);
-			return ifo;
-		}
-		/* Our embedded config is NULL terminated */
-#endif
-		bp = buf;
-		while ((line = get_line(&bp, &buflen)) != NULL) {
-			option = strsep(&line, " \t");
-			if (line)
-				line = strskipwhite(line);
-			/* Trim trailing whitespace */
-			if (line) {
-				p = line + strlen(line) - 1;
-				while (p != line &&
-				    (*p == ' ' || *p == '\t') &&
-				    *(p - 1) != '\\')
-					*p-- = '\0';
-			}
-			parse_config_line(ctx, NULL, ifo, option, line,
-			    &ldop, &edop);
-		}
-
-#ifdef INET
-		ctx->dhcp_opts = ifo->dhcp_override;
-		ctx->dhcp_opts_len = ifo->dhcp_override_len;
-#else
-		for (i = 0, opt = ifo->dhcp_override;
-		    i < ifo->dhcp_override_len;
-		    i++, opt++)
-			free_dhcp_opt_embenc(opt);
-		free(ifo->dhcp_override);
-#endif
-		ifo->dhcp_override = NULL;
-		ifo->dhcp_override_len = 0;
-
-#ifdef INET6
-		ctx->nd_opts = ifo->nd_override;
-		ctx->nd_opts_len = ifo->nd_override_len;
-#ifdef DHCP6
-		ctx->dhcp6_opts = ifo->dhcp6_override;
-		ctx->dhcp6_opts_len = ifo->dhcp6_override_len;
-#endif
-#else
-		for (i = 0, opt = ifo->nd_override;
-		    i < ifo->nd_override_len;
-		    i++, opt++)
-			free_dhcp_opt_embenc(opt);
-		free(ifo->nd_override);
-		for (i = 0, opt = ifo->dhcp6_override;
-		    i < ifo->dhcp6_override_len;
-		    i++, opt++)
-			free_dhcp_opt_embenc(opt);
-		free(ifo->dhcp6_override);
-#endif
-		ifo->nd_override = NULL;
-		ifo->nd_override_len = 0;
-		ifo->dhcp6_override = NULL;
-		ifo->dhcp6_override_len = 0;
-
-		ctx->vivso = ifo->vivso_override;
-		ctx->vivso_len = ifo->vivso_override_len;
-		ifo->vivso_override = NULL;
-		ifo->vivso_override_len = 0;
 	}
 
 	/* Parse our options file */
-	buflen = dhcp_readfile(ctx, ctx->cffile, buf, sizeof(buf));
-	if (buflen == -1) {
+	if (cf_load(ctx, buf, sizeof(buf), &ifo->mtime) == -1) {
 		/* dhcpcd can continue without it, but no DNS options
 		 * would be requested ... */
 		logerr("%s: %s", __func__, ctx->cffile);
 		return ifo;
 	}
-	if (buf[buflen - 1] != '\0') {
-		if ((size_t)buflen < sizeof(buf) - 1)
-			buflen++;
-		buf[buflen - 1] = '\0';
-	}
-	dhcp_filemtime(ctx, ctx->cffile, &ifo->mtime);
+	cc = ctx->cf_compiled;
 
 	ldop = edop = NULL;
+	key = NULL;
+	keylen = keysize = 0;
+	share = ifname != NULL;
 	skip = have_profile = new_block = 0;
 	had_block = ifname == NULL ? 1 : 0;
-	bp = buf;
-	while ((line = get_line(&bp, &buflen)) != NULL) {
-		option = strsep(&line, " \t");
-		if (line)
-			line = strskipwhite(line);
-		/* Trim trailing whitespace */
-		if (line) {
-			p = line + strlen(line) - 1;
-			while (p != line &&
-			    (*p == ' ' || *p == '\t') &&
-			    *(p - 1) != '\\')
-				*p-- = '\0';
-		}
+	for (off = 0; off < cc->cc_len; off = next) {
+		cr = (const void *)(cc->cc_recs + off);
+		next = off + cr->cr_len;
+		arg = cr->cr_arglen != 0 ? UNCONST(cr->cr_arg) : NULL;
+
 		if (skip == 0 && new_block) {
 			had_block = 1;
 			new_block = 0;
@@ -2571,20 +3117,22 @@ read_config(struct dhcpcd_ctx *ctx,
 			SET_CONFIG_BLOCK(ifo);
 		}
 
-		/* Start of an interface block, skip if not ours */
-		if (strcmp(option, "interface") == 0) {
-			char **n;
-
+		switch (cr->cr_opt) {
+		case CF_INTERFACE:
+			/* Start of an interface block, skip if not ours */
 			new_block = 1;
-			if (line == NULL) {
+			if (arg == NULL) {
 				/* No interface given */
 				skip = 1;
+				next = cr->cr_next;
 				continue;
 			}
-			if (ifname && strcmp(line, ifname) == 0)
+			if (ifname && strcmp(arg, ifname) == 0)
 				skip = 0;
-			else
+			else {
 				skip = 1;
+				next = cr->cr_next;
+			}
 			if (ifname)
 				continue;
 
@@ -2595,48 +3143,75 @@ read_config(struct dhcpcd_ctx *ctx,
 				continue;
 			}
 			ctx->ifcv = n;
-			ctx->ifcv[ctx->ifcc] = strdup(line);
+			ctx->ifcv[ctx->ifcc] = strdup(arg);
 			if (ctx->ifcv[ctx->ifcc] == NULL) {
 				logerr(__func__);
 				continue;
 			}
 			ctx->ifcc++;
 			continue;
-		}
-		/* Start of an ssid block, skip if not ours */
-		if (strcmp(option, "ssid") == 0) {
+		case CF_SSID:
+			/* Start of an ssid block, skip if not ours */
 			new_block = 1;
-			if (ssid && line && strcmp(line, ssid) == 0)
+			if (ssid && arg && strcmp(arg, ssid) == 0)
 				skip = 0;
-			else
+			else {
 				skip = 1;
+				next = cr->cr_next;
+			}
 			continue;
-		}
-		/* Start of a profile block, skip if not ours */
-		if (strcmp(option, "profile") == 0) {
+		case CF_PROFILE:
+			/* Start of a profile block, skip if not ours */
 			new_block = 1;
-			if (profile && line && strcmp(line, profile) == 0) {
+			if (profile && arg && strcmp(arg, profile) == 0) {
 				skip = 0;
 				have_profile = 1;
-			} else
+			} else {
 				skip = 1;
+				next = cr->cr_next;
+			}
 			continue;
 		}
 		/* Skip arping if we have selected a profile but not parsing
 		 * one. */
-		if (profile && !have_profile && strcmp(option, "arping") == 0)
+		if (profile && !have_profile && cr->cr_opt == O_ARPING)
 			continue;
 		if (skip)
 			continue;
 
-		parse_config_line(ctx, ifname, ifo, option, line, &ldop, &edop);
+		/* Remember what builds the tables we can share. */
+		if (share && optshare_opt(cr->cr_opt)) {
+			if (keylen + cr->cr_len > keysize) {
+				keysize = (keylen + cr->cr_len) * 2;
+				nkey = realloc(key, keysize);
+				if (nkey == NULL) {
+					logerr(__func__);
+					share = false;
+				} else
+					key = nkey;
+			}
+			if (share) {
+				memcpy(key + keylen, cr, cr->cr_len);
+				keylen += cr->cr_len;
+			}
+		}
+
+		/* Options parse their argument in place. */
+		if (arg != NULL)
+			arg = memcpy(buf, arg, cr->cr_arglen);
+		parse_option(ctx, ifname, ifo, cr->cr_opt, arg, &ldop, &edop);
 	}
 
 	if (profile && !have_profile) {
+		free(key);
 		free_options(ctx, ifo);
 		errno = ENOENT;
 		return NULL;
 	}
+	if (share && key != NULL)
+		optshare_add(ctx, ifo, key, keylen);
+	else
+		free(key);
 
 	if (!had_block)
 		ifo->options &= ~DHCPCD_WAITOPTS;
@@ -2655,6 +3230,7 @@ add_options(struct dhcpcd_ctx *ctx, const char *ifname,
 	if (argc == 0)
 		return 1;
 
+	ctx->cf_gen++;
 	optind = 0;
 	r = 1;
 	/* Don't apply the command line wait options to each interface,
@@ -2720,12 +3296,22 @@ free_options(struct dhcpcd_ctx *ctx, struct if_options *ifo)
 		}
 	}
 #endif
-	rt_headclear0(ctx, &ifo->routes, AF_UNSPEC);
+	rt_headclear(&ifo->routes, AF_UNSPEC);
 
 	free(ifo->arping);
 	free(ifo->blacklist);
 	free(ifo->fallback);
 
+	if (ifo->optshare != NULL) {
+		optshare_unref(ctx, ifo->optshare);
+		ifo->dhcp_override_len = ifo->nd_override_len = 0;
+		ifo->dhcp6_override_len = ifo->vivso_override_len = 0;
+		ifo->vivco_len = 0;
+		ifo->dhcp_override = ifo->nd_override = NULL;
+		ifo->dhcp6_override = ifo->vivso_override = NULL;
+		ifo->vivco = NULL;
+	}
+
 	for (opt = ifo->dhcp_override;
 	    ifo->dhcp_override_len > 0;
 	    opt++, ifo->dhcp_override_len--)
@@ -183,9 +183,39 @@
 #define O_CONFIGURE		O_BASE + 50
 #define O_NOCONFIGURE		O_BASE + 51
 #define O_RANDOMISE_HWADDR	O_BASE + 52
+#define O_LEASE_DELAY		O_BASE + 53
+#define O_LEASE_LOG		O_BASE + 54
+#define O_WORKERS		O_BASE + 55
 
 extern const struct option cf_options[];
 
+/*
+ * dhcpcd.conf compiled into a flat run of records so it can be applied
+ * to each interface without parsing the text again.
+ * Block markers use a negative option and point to the next marker.
+ */
+#define CF_INTERFACE		-1
+#define CF_SSID			-2
+#define CF_PROFILE		-3
+
+struct cf_rec {
+	uint32_t cr_len;	/* length of this record, 8 byte aligned */
+	uint32_t cr_next;	/* offset of the next block marker */
+	int cr_opt;		/* cf_options val or CF_* marker */
+	uint32_t cr_arglen;	/* including NUL, 0 for no argument */
+	char cr_arg[];
+};
+
+struct cf_compiled {
+	char *cc_file;
+	time_t cc_mtime;
+	uint64_t cc_hash;
+	bool cc_trusted;	/* mtime is older than when we read it */
+	uint8_t *cc_recs;
+	size_t cc_len;
+	size_t cc_size;
+};
+
 struct if_sla {
 	char ifname[IF_NAMESIZE];
 	uint32_t sla;
@@ -214,6 +244,24 @@ struct vivco {
 	uint8_t *data;
 };
 
+/* Option tables shared by interfaces which built them the same way. */
+struct if_optshare {
+	struct if_optshare *os_next;
+	unsigned int os_refs;
+	uint8_t *os_key;	/* the records which built the tables */
+	size_t os_keylen;
+	struct dhcp_opt *os_dhcp;
+	size_t os_dhcp_len;
+	struct dhcp_opt *os_nd;
+	size_t os_nd_len;
+	struct dhcp_opt *os_dhcp6;
+	size_t os_dhcp6_len;
+	struct dhcp_opt *os_vivso;
+	size_t os_vivso_len;
+	struct vivco *os_vivco;
+	size_t os_vivco_len;
+};
+
 struct if_options {
 	time_t mtime;
 	uint8_t iaid[4];
@@ -278,6 +326,7 @@ struct if_options {
 	size_t vivco_len;
 	struct dhcp_opt *vivso_override;
 	size_t vivso_override_len;
+	struct if_optshare *optshare;	/* if the above are shared */
 
 	struct auth auth;
 };
@@ -289,5 +338,8 @@ int add_options(struct dhcpcd_ctx *, const char *,
     struct if_options *, int, char **);
 void free_dhcp_opt_embenc(struct dhcp_opt *);
 void free_options(struct dhcpcd_ctx *, struct if_options *);
+void free_definitions(struct dhcpcd_ctx *);
+void free_cfcompiled(struct dhcpcd_ctx *);
+void report_optshare(struct dhcpcd_ctx *);
 
 #endif
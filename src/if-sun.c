@@ -130,8 +130,11 @@ if_init(struct interface *ifp)
 		return -1;
 #endif
 
-	if (ifp->index == 0)
+	if (ifp->index == 0) {
+		if_hashdel(ifp);
 		ifp->index = if_nametoindex(ifp->name);
+		if_hashadd(ifp);
+	}
 
 	return 0;
 }
@@ -1652,7 +1655,9 @@ if_address(unsigned char cmd, const struct ipv4_addr *ia)
 	}
 
 	/* We need to update the index now */
+	if_hashdel(ia->iface);
 	ia->iface->index = if_nametoindex(ia->alias);
+	if_hashadd(ia->iface);
 
 	sa_in_init(&addr.sa, &ia->addr);
 	sa_in_init(&mask.sa, &ia->mask);
@@ -77,6 +77,8 @@
 #include "ipv6nd.h"
 #include "logerr.h"
 #include "privsep.h"
+#include "script.h"
+#include "workers.h"
 
 void
 if_free(struct interface *ifp)
@@ -99,6 +101,9 @@ if_free(struct interface *ifp)
 	ipv6_free(ifp);
 #endif
 	rt_freeif(ifp);
+	script_freeenv(ifp);
+	if (ifp->ctl_gen != 0)
+		TAILQ_REMOVE(&ifp->ctx->ctl_ifaces, ifp, ctl_next);
 	free_options(ifp->ctx, ifp->options);
 	free(ifp);
 }
@@ -143,7 +148,117 @@ if_closesockets(struct dhcpcd_ctx *ctx)
 		if_closesockets_os(ctx);
 		free(ctx->priv);
 	}
+
+	free(ctx->tx_ops);
+	ctx->tx_ops = NULL;
+	ctx->tx_nops = ctx->tx_opslen = 0;
+}
+
+#ifndef __linux__
+size_t
+if_drainlink(struct dhcpcd_ctx *ctx)
+{
+	char buf[2048];
+	ssize_t rlen;
+	size_t rcnt = 0;
+
+	do {
+		rlen = read(ctx->link_fd, buf, sizeof(buf));
+		if (rlen != -1)
+			rcnt++;
+	} while (rlen != -1 || errno == ENOBUFS || errno == ENOMEM);
+	return rcnt;
+}
+#endif
+
+int
+if_txqueue(struct dhcpcd_ctx *ctx, void (*cb)(void *, void *, int),
+    void *obj, void *cbarg, int error)
+{
+	struct if_txop *op;
+
+	if (ctx->tx_nops == ctx->tx_opslen) {
+		size_t len = ctx->tx_opslen == 0 ? 16 : ctx->tx_opslen * 2;
+
+		op = reallocarray(ctx->tx_ops, len, sizeof(*op));
+		if (op == NULL)
+			return -1;
+		ctx->tx_ops = op;
+		ctx->tx_opslen = len;
+	}
+
+	op = &ctx->tx_ops[ctx->tx_nops++];
+	op->cb = cb;
+	op->cbarg = cbarg;
+	op->obj = obj;
+	op->error = error;
+	return 0;
+}
+
+int
+if_txcommit(struct dhcpcd_ctx *ctx)
+{
+	struct if_txop *ops, *op;
+	size_t nops, opslen;
+	int nerrors = 0;
+
+	if (ctx->tx_nops == 0)
+		return 0;
+
+	if_txcommit_os(ctx);
+
+	/* Detach the queue so callbacks can queue more changes. */
+	ops = ctx->tx_ops;
+	nops = ctx->tx_nops;
+	opslen = ctx->tx_opslen;
+	ctx->tx_ops = NULL;
+	ctx->tx_nops = ctx->tx_opslen = 0;
+
+	for (op = ops; op < ops + nops; op++) {
+		if (op->error != 0)
+			nerrors++;
+		if (op->cb != NULL)
+			op->cb(op->cbarg, op->obj, op->error);
+	}
+
+	if (ctx->tx_ops == NULL) {
+		ctx->tx_ops = ops;
+		ctx->tx_opslen = opslen;
+	} else
+		free(ops);
+	return nerrors;
+}
+
+#ifndef __linux__
+/* Changes cannot be batched, so make them now and report at commit. */
+int
+if_txroute(unsigned char cmd, struct rt *rt,
+    void (*cb)(void *, void *, int), void *cbarg)
+{
+	int error;
+
+	error = if_route(cmd, rt) == -1 ? errno : 0;
+	return if_txqueue(rt->rt_ifp->ctx, cb, rt, cbarg, error);
+}
+
+#ifdef INET6
+int
+if_txaddress6(unsigned char cmd, struct ipv6_addr *ia,
+    void (*cb)(void *, void *, int), void *cbarg)
+{
+	int error;
+
+	error = if_address6(cmd, ia) == -1 ? errno : 0;
+	return if_txqueue(ia->iface->ctx, cb, ia, cbarg, error);
+}
+#endif
+
+void
+if_txcommit_os(__unused struct dhcpcd_ctx *ctx)
+{
+
 }
+#endif
 
 int
 if_ioctl(struct dhcpcd_ctx *ctx, ioctl_request_t req, void *data, size_t len)
@@ -503,6 +618,12 @@ if_discover(struct dhcpcd_ctx *ctx, struct ifaddrs **ifaddrs,
 		if (ifp)
 			continue;
 
+#ifdef WORKERS
+		/* Another worker looks after it. */
+		if (!workers_ownsif(ctx, spec.devname))
+			continue;
+#endif
+
 		if (argc > 0) {
 			for (i = 0; i < argc; i++) {
 				if (strcmp(argv[i], spec.devname) == 0)
@@ -793,24 +914,175 @@ if_nametospec(const char *ifname, struct if_spec *spec)
 	return 0;
 }
 
+/*
+ * Interfaces in ctx->ifaces are also hashed by index and name
+ * so that finding the interface for each packet or route message
+ * does not walk the list.
+ * Anything adding to or removing from ctx->ifaces must call
+ * if_hashadd() or if_hashdel() as well.
+ */
+
+static size_t
+if_hashindex(unsigned int idx, size_t len)
+{
+
+	return (size_t)idx & (len - 1);
+}
+
+static size_t
+if_hashname(const char *name, size_t len)
+{
+	uint32_t h = 2166136261U;
+
+	/* FNV-1a */
+	for (; *name != '\0'; name++) {
+		h ^= (uint8_t)*name;
+		h *= 16777619U;
+	}
+	return (size_t)h & (len - 1);
+}
+
+static int
+if_hashgrow(struct dhcpcd_ctx *ctx)
+{
+	struct interface **ih, **nh, *ifp, *ifn;
+	size_t i, h, len;
+
+	len = ctx->ifhash_len == 0 ? 64 : ctx->ifhash_len * 2;
+	ih = calloc(len, sizeof(*ih));
+	nh = calloc(len, sizeof(*nh));
+	if (ih == NULL || nh == NULL) {
+		free(ih);
+		free(nh);
+		return -1;
+	}
+
+	for (i = 0; i < ctx->ifhash_len; i++) {
+		for (ifp = ctx->ifindex_hash[i]; ifp != NULL; ifp = ifn) {
+			ifn = ifp->hindex_next;
+			h = if_hashindex(ifp->index, len);
+			ifp->hindex_next = ih[h];
+			ih[h] = ifp;
+		}
+		for (ifp = ctx->ifname_hash[i]; ifp != NULL; ifp = ifn) {
+			ifn = ifp->hname_next;
+			h = if_hashname(ifp->name, len);
+			ifp->hname_next = nh[h];
+			nh[h] = ifp;
+		}
+	}
+
+	free(ctx->ifindex_hash);
+	free(ctx->ifname_hash);
+	ctx->ifindex_hash = ih;
+	ctx->ifname_hash = nh;
+	ctx->ifhash_len = len;
+	return 0;
+}
+
+void
+if_hashadd(struct interface *ifp)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	size_t h;
+
+	if (ctx->ifhash_count >= ctx->ifhash_len &&
+	    if_hashgrow(ctx) == -1)
+	{
+		/* We can still work with the old table,
+		 * lookups will just be slower. */
+		logerr(__func__);
+		if (ctx->ifhash_len == 0)
+			return;
+	}
+
+	h = if_hashindex(ifp->index, ctx->ifhash_len);
+	ifp->hindex_next = ctx->ifindex_hash[h];
+	ctx->ifindex_hash[h] = ifp;
+	h = if_hashname(ifp->name, ctx->ifhash_len);
+	ifp->hname_next = ctx->ifname_hash[h];
+	ctx->ifname_hash[h] = ifp;
+	ctx->ifhash_count++;
+}
+
+void
+if_hashdel(struct interface *ifp)
+{
+	struct dhcpcd_ctx *ctx = ifp->ctx;
+	struct interface **ifpp;
+
+	if (ctx->ifhash_len == 0)
+		return;
+
+	for (ifpp = &ctx->ifindex_hash[if_hashindex(ifp->index,
+	    ctx->ifhash_len)]; *ifpp != NULL; ifpp = &(*ifpp)->hindex_next)
+	{
+		if (*ifpp == ifp) {
+			*ifpp = ifp->hindex_next;
+			break;
+		}
+	}
+	for (ifpp = &ctx->ifname_hash[if_hashname(ifp->name,
+	    ctx->ifhash_len)]; *ifpp != NULL; ifpp = &(*ifpp)->hname_next)
+	{
+		if (*ifpp == ifp) {
+			*ifpp = ifp->hname_next;
+			ctx->ifhash_count--;
+			break;
+		}
+	}
+}
+
+void
+if_hashfree(struct dhcpcd_ctx *ctx)
+{
+
+	free(ctx->ifindex_hash);
+	free(ctx->ifname_hash);
+	ctx->ifindex_hash = ctx->ifname_hash = NULL;
+	ctx->ifhash_len = ctx->ifhash_count = 0;
+}
+
 static struct interface *
 if_findindexname(struct if_head *ifaces, unsigned int idx, const char *name)
 {
+	struct if_spec spec;
+	struct interface *ifp;
+	struct dhcpcd_ctx *ctx;
 
-	if (ifaces != NULL) {
-		struct if_spec spec;
-		struct interface *ifp;
+	if (ifaces == NULL || (ifp = TAILQ_FIRST(ifaces)) == NULL)
+		goto out;
 
-		if (name && if_nametospec(name, &spec) == -1)
-			return NULL;
+	if (name && if_nametospec(name, &spec) == -1)
+		return NULL;
 
-		TAILQ_FOREACH(ifp, ifaces, next) {
-			if ((name && strcmp(ifp->name, spec.devname) == 0) ||
-			    (!name && ifp->index == idx))
-				return ifp;
+	ctx = ifp->ctx;
+	if (ifaces == ctx->ifaces && ctx->ifhash_len != 0) {
+		if (name) {
+			ifp = ctx->ifname_hash[if_hashname(spec.devname,
+			    ctx->ifhash_len)];
+			for (; ifp != NULL; ifp = ifp->hname_next) {
+				if (strcmp(ifp->name, spec.devname) == 0)
+					return ifp;
+			}
+		} else {
+			ifp = ctx->ifindex_hash[if_hashindex(idx,
+			    ctx->ifhash_len)];
+			for (; ifp != NULL; ifp = ifp->hindex_next) {
+				if (ifp->index == idx)
+					return ifp;
+			}
 		}
+		goto out;
 	}
 
+	TAILQ_FOREACH(ifp, ifaces, next) {
+		if ((name && strcmp(ifp->name, spec.devname) == 0) ||
+		    (!name && ifp->index == idx))
+			return ifp;
+	}
+
+out:
 	errno = ENXIO;
 	return NULL;
 }
@@ -945,10 +1217,7 @@ if_findifpfromcmsg(struct dhcpcd_ctx *ctx, struct msghdr *msg, int *hoplimit)
 	}
 
 	/* Find the receiving interface */
-	TAILQ_FOREACH(ifp, ctx->ifaces, next) {
-		if (ifp->index == ifindex)
-			break;
-	}
+	ifp = if_findindex(ctx->ifaces, ifindex);
 	if (ifp == NULL)
 		errno = ESRCH;
 	return ifp;
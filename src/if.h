@@ -145,6 +145,9 @@ struct if_head *if_discover(struct dhcpcd_ctx *, struct ifaddrs **,
 void if_markaddrsstale(struct if_head *);
 void if_learnaddrs(struct dhcpcd_ctx *, struct if_head *, struct ifaddrs **);
 void if_deletestaleaddrs(struct if_head *);
+void if_hashadd(struct interface *);
+void if_hashdel(struct interface *);
+void if_hashfree(struct dhcpcd_ctx *);
 struct interface *if_find(struct if_head *, const char *);
 struct interface *if_findindex(struct if_head *, unsigned int);
 struct interface *if_loopback(struct dhcpcd_ctx *);
@@ -191,6 +194,7 @@ int if_opensockets_os(struct dhcpcd_ctx *);
 void if_closesockets(struct dhcpcd_ctx *);
 void if_closesockets_os(struct dhcpcd_ctx *);
 int if_handlelink(struct dhcpcd_ctx *);
+size_t if_drainlink(struct dhcpcd_ctx *);
 int if_randomisemac(struct interface *);
 int if_setmac(struct interface *ifp, void *, uint8_t);
 
@@ -225,6 +229,25 @@ int xsocketpair(int, int, int, int[2]);
 int if_route(unsigned char, const struct rt *rt);
 int if_initrt(struct dhcpcd_ctx *, rb_tree_t *, int);
 
+/*
+ * Route and address changes can be queued and sent to the kernel
+ * together by if_txcommit, which then calls each callback with
+ * the route or address and the resulting errno, or 0 on success.
+ */
+struct if_txop {
+	void (*cb)(void *, void *, int);
+	void *cbarg;
+	void *obj;
+	int error;
+};
+
+int if_txqueue(struct dhcpcd_ctx *, void (*)(void *, void *, int),
+    void *, void *, int);
+int if_txroute(unsigned char, struct rt *,
+    void (*)(void *, void *, int), void *);
+int if_txcommit(struct dhcpcd_ctx *);
+void if_txcommit_os(struct dhcpcd_ctx *);
+
 int if_missfilter(struct interface *, struct sockaddr *);
 int if_missfilter_apply(struct dhcpcd_ctx *);
 
@@ -245,6 +268,8 @@ struct ipv6_addr;
 
 int if_applyra(const struct ra *);
 int if_address6(unsigned char, const struct ipv6_addr *);
+int if_txaddress6(unsigned char, struct ipv6_addr *,
+    void (*)(void *, void *, int), void *);
 int if_addrflags6(const struct interface *, const struct in6_addr *,
     const char *);
 int if_getlifetime6(struct ipv6_addr *);
@@ -261,5 +286,8 @@ struct interface *if_findifpfromcmsg(struct dhcpcd_ctx *,
 int if_linksocket(struct sockaddr_nl *, int, int);
 int if_getnetlink(struct dhcpcd_ctx *, struct iovec *, int, int,
     int (*)(struct dhcpcd_ctx *, void *, struct nlmsghdr *), void *);
+/* Most netlink requests if_sendnetlinkbatch sends at once. */
+#define	IF_NLBATCH_MAX	64
+ssize_t if_sendnetlinkbatch(int, void *, size_t, int *, size_t);
 #endif
 #endif
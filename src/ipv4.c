@@ -528,6 +528,7 @@ ipv4_deladdr(struct ipv4_addr *addr, int keeparp)
 	    addr->iface->name, addr->saddr);
 
 	r = if_address(RTM_DELADDR, addr);
+	rt_kroutes_invalidate(addr->iface->ctx, AF_INET);
 	if (r == -1 &&
 	    errno != EADDRNOTAVAIL && errno != ESRCH &&
 	    errno != ENXIO && errno != ENODEV)
@@ -919,6 +920,10 @@ ipv4_handleifa(struct dhcpcd_ctx *ctx,
 		errno = ESRCH;
 		return;
 	}
+	/* Deleting an address removes the subnet route
+	 * without the kernel telling us. */
+	if (cmd == RTM_DELADDR)
+		rt_kroutes_invalidate(ctx, AF_INET);
 	if ((ifp = if_find(ifs, ifname)) == NULL)
 		return;
 	if ((state = ipv4_getstate(ifp)) == NULL) {
@@ -147,7 +147,7 @@ ipv6_init(struct dhcpcd_ctx *ctx)
 	return 0;
 }
 
-static ssize_t
+ssize_t
 ipv6_readsecret(struct dhcpcd_ctx *ctx)
 {
 	char line[1024];
@@ -584,8 +584,9 @@ ipv6_checkaddrflags(void *arg)
 		    &ia->addr, ia->prefix_len, flags, 0);
 	} else {
 		/* Still tentative? Check again in a bit. */
-		eloop_timeout_add_msec(ia->iface->ctx->eloop,
-		    RETRANS_TIMER / 2, ipv6_checkaddrflags, ia);
+		eloop_timeout_add_msec_slack(ia->iface->ctx->eloop,
+		    RETRANS_TIMER / 2, RETRANS_TIMER / 4,
+		    ipv6_checkaddrflags, ia);
 	}
 }
 #endif
@@ -624,6 +625,7 @@ ipv6_deleteaddr(struct ipv6_addr *ia)
 	    errno != EADDRNOTAVAIL && errno != ESRCH &&
 	    errno != ENXIO && errno != ENODEV)
 		logerr(__func__);
+	rt_kroutes_invalidate(ia->iface->ctx, AF_INET6);
 
 	ipv6_deletedaddr(ia);
 
@@ -642,32 +644,13 @@ ipv6_deleteaddr(struct ipv6_addr *ia)
 #endif
 }
 
-static int
-ipv6_addaddr1(struct ipv6_addr *ia, const struct timespec *now)
+/* Work out the lifetimes to give the kernel and log what we are adding.
+ * The caller restores the real lifetimes once the address is added. */
+static void
+ipv6_addaddr_pre(struct ipv6_addr *ia, const struct timespec *now)
 {
 	struct interface *ifp;
-	uint32_t pltime, vltime;
 	int loglevel;
-#ifdef ND6_ADVERTISE
-	bool vltime_was_zero = ia->prefix_vltime == 0;
-#endif
-#ifdef __sun
-	struct ipv6_state *state;
-	struct ipv6_addr *ia2;
-
-	/* If we re-add then address on Solaris then the prefix
-	 * route will be scrubbed and re-added. Something might
-	 * be using it, so let's avoid it. */
-	if (ia->flags & IPV6_AF_DADCOMPLETED) {
-		logdebugx("%s: IP address %s already exists",
-		    ia->iface->name, ia->saddr);
-#ifdef ND6_ADVERTISE
-		goto advertise;
-#else
-		return 0;
-#endif
-	}
-#endif
 
 	/* Remember the interface of the address. */
 	ifp = ia->iface;
@@ -676,14 +659,10 @@ ipv6_addaddr1(struct ipv6_addr *ia, const struct timespec *now)
 	    ipv6_iffindaddr(ifp, &ia->addr, IN6_IFF_NOTUSEABLE))
 		ia->flags |= IPV6_AF_DADCOMPLETED;
 
-	/* Adjust plftime and vltime based on acquired time */
-	pltime = ia->prefix_pltime;
-	vltime = ia->prefix_vltime;
-
 	if (ifp->options->options & DHCPCD_LASTLEASE_EXTEND) {
 		/* We don't want the kernel to expire the address.
 		 * The saved times will be re-applied to the ia
-		 * before exiting this function. */
+		 * once added. */
 		ia->prefix_vltime = ia->prefix_pltime = ND6_INFINITE_LIFETIME;
 	}
 
@@ -736,23 +715,27 @@ ipv6_addaddr1(struct ipv6_addr *ia, const struct timespec *now)
 		logdebugx("%s: pltime %"PRIu32" seconds, vltime %"PRIu32
 		    " seconds",
 		    ifp->name, ia->prefix_pltime, ia->prefix_vltime);
+}
 
-	if (if_address6(RTM_NEWADDR, ia) == -1) {
-		logerr(__func__);
-		/* Restore real pltime and vltime */
-		ia->prefix_pltime = pltime;
-		ia->prefix_vltime = vltime;
-		return -1;
-	}
+/* The kernel has the address, pltime and vltime are the real ones. */
+static void
+ipv6_addaddr_post(struct ipv6_addr *ia, uint32_t pltime, uint32_t vltime,
+    __unused bool vltime_was_zero)
+{
+#ifdef __sun
+	struct ipv6_state *state;
+	struct ipv6_addr *ia2;
+#endif
 
 #ifdef IPV6_MANAGETEMPADDR
 	/* RFC4941 Section 3.4 */
 	if (ia->flags & IPV6_AF_TEMPORARY &&
 	    ia->prefix_pltime &&
 	    ia->prefix_vltime &&
-	    ifp->options->options & DHCPCD_SLAACTEMP)
-		eloop_timeout_add_sec(ifp->ctx->eloop,
+	    ia->iface->options->options & DHCPCD_SLAACTEMP)
+		eloop_timeout_add_sec_slack(ia->iface->ctx->eloop,
 		    ia->prefix_pltime - REGEN_ADVANCE,
+		    ELOOP_SLACK_SEC(ia->prefix_pltime - REGEN_ADVANCE),
 		    ipv6_regentempaddr, ia);
 #endif
 
@@ -768,11 +751,12 @@ ipv6_addaddr1(struct ipv6_addr *ia, const struct timespec *now)
 #endif
 
 #ifdef IPV6_POLLADDRFLAG
-	eloop_timeout_delete(ifp->ctx->eloop,
+	eloop_timeout_delete(ia->iface->ctx->eloop,
 		ipv6_checkaddrflags, ia);
 	if (!(ia->flags & IPV6_AF_DADCOMPLETED)) {
-		eloop_timeout_add_msec(ifp->ctx->eloop,
-		    RETRANS_TIMER / 2, ipv6_checkaddrflags, ia);
+		eloop_timeout_add_msec_slack(ia->iface->ctx->eloop,
+		    RETRANS_TIMER / 2, RETRANS_TIMER / 4,
+		    ipv6_checkaddrflags, ia);
 	}
 #endif
 
@@ -782,7 +766,7 @@ ipv6_addaddr1(struct ipv6_addr *ia, const struct timespec *now)
 	 * Otherwise aliasing gets confused if we add another
 	 * address during DaD. */
 
-	state = IPV6_STATE(ifp);
+	state = IPV6_STATE(ia->iface);
 	TAILQ_FOREACH(ia2, &state->addrs, next) {
 		if (IN6_ARE_ADDR_EQUAL(&ia2->addr, &ia->addr))
 			break;
@@ -790,7 +774,7 @@ ipv6_addaddr1(struct ipv6_addr *ia, const struct timespec *now)
 	if (ia2 == NULL) {
 		if ((ia2 = malloc(sizeof(*ia2))) == NULL) {
 			logerr(__func__);
-			return 0; /* Well, we did add the address */
+			return; /* Well, we did add the address */
 		}
 		memcpy(ia2, ia, sizeof(*ia2));
 		TAILQ_INSERT_TAIL(&state->addrs, ia2, next);
@@ -798,14 +782,47 @@ ipv6_addaddr1(struct ipv6_addr *ia, const struct timespec *now)
 #endif
 
 #ifdef ND6_ADVERTISE
-#ifdef __sun
-advertise:
-#endif
 	/* Re-advertise the preferred address to be safe. */
 	if (!vltime_was_zero)
 		ipv6nd_advertise(ia);
 #endif
+}
+
+static int
+ipv6_addaddr1(struct ipv6_addr *ia, const struct timespec *now)
+{
+	uint32_t pltime, vltime;
+	bool vltime_was_zero = ia->prefix_vltime == 0;
 
+#ifdef __sun
+	/* If we re-add then address on Solaris then the prefix
+	 * route will be scrubbed and re-added. Something might
+	 * be using it, so let's avoid it. */
+	if (ia->flags & IPV6_AF_DADCOMPLETED) {
+		logdebugx("%s: IP address %s already exists",
+		    ia->iface->name, ia->saddr);
+#ifdef ND6_ADVERTISE
+		if (!vltime_was_zero)
+			ipv6nd_advertise(ia);
+#endif
+		return 0;
+	}
+#endif
+
+	/* Adjust plftime and vltime based on acquired time */
+	pltime = ia->prefix_pltime;
+	vltime = ia->prefix_vltime;
+	ipv6_addaddr_pre(ia, now);
+
+	if (if_address6(RTM_NEWADDR, ia) == -1) {
+		logerr(__func__);
+		/* Restore real pltime and vltime */
+		ia->prefix_pltime = pltime;
+		ia->prefix_vltime = vltime;
+		return -1;
+	}
+
+	ipv6_addaddr_post(ia, pltime, vltime, vltime_was_zero);
 	return 0;
 }
 
@@ -973,16 +990,84 @@ ipv6_doaddr(struct ipv6_addr *ia, struct timespec *now)
 	return ia->flags & IPV6_AF_NEW ? 1 : 0;
 }
 
+#ifndef ALIAS_ADDR
+/* The real lifetimes of an address being added by ipv6_addaddrs. */
+struct ipv6_addtx {
+	struct ipv6_addr *ia;
+	uint32_t pltime;
+	uint32_t vltime;
+};
+
+static void
+ipv6_txaddaddr(void *arg, void *obj, int error)
+{
+	struct ipv6_addtx *tx = arg;
+	struct ipv6_addr *ia = obj;
+
+	if (error != 0) {
+		errno = error;
+		logerr("%s: %s", __func__, ia->saddr);
+		ia->prefix_pltime = tx->pltime;
+		ia->prefix_vltime = tx->vltime;
+		return;
+	}
+	ipv6_addaddr_post(ia, tx->pltime, tx->vltime, false);
+}
+
+/* Queue adding the address if ipv6_doaddr would add it. */
+static bool
+ipv6_txaddr(struct ipv6_addr *ia, struct timespec *now,
+    struct ipv6_addtx *tx)
+{
+
+	if (ia->flags & (IPV6_AF_DELEGATEDPFX | IPV6_AF_STALE) ||
+	    ia->prefix_vltime == 0 ||
+	    IN6_IS_ADDR_UNSPECIFIED(&ia->addr))
+		return false;
+
+	if (!timespecisset(now))
+		clock_gettime(CLOCK_MONOTONIC, now);
+	tx->ia = ia;
+	tx->pltime = ia->prefix_pltime;
+	tx->vltime = ia->prefix_vltime;
+	ipv6_addaddr_pre(ia, now);
+	if (if_txaddress6(RTM_NEWADDR, ia, ipv6_txaddaddr, tx) == -1) {
+		logerr(__func__);
+		ia->prefix_pltime = tx->pltime;
+		ia->prefix_vltime = tx->vltime;
+		return false;
+	}
+	return true;
+}
+#endif
+
 ssize_t
 ipv6_addaddrs(struct ipv6_addrhead *iaddrs)
 {
 	struct timespec now;
 	struct ipv6_addr *ia, *ian;
 	ssize_t i, r;
+#ifndef ALIAS_ADDR
+	struct ipv6_addtx *txs;
+	size_t n, t;
+
+	/* Send all the new addresses to the kernel at once. */
+	n = 0;
+	TAILQ_FOREACH(ia, iaddrs, next)
+		n++;
+	txs = n > 1 ? reallocarray(NULL, n, sizeof(*txs)) : NULL;
+	t = 0;
+#endif
 
 	i = 0;
 	timespecclear(&now);
 	TAILQ_FOREACH_SAFE(ia, iaddrs, next, ian) {
+#ifndef ALIAS_ADDR
+		if (txs != NULL && ipv6_txaddr(ia, &now, &txs[t])) {
+			t++;
+			continue;
+		}
+#endif
 		r = ipv6_doaddr(ia, &now);
 		if (r != 0)
 			i++;
@@ -991,6 +1076,17 @@ ipv6_addaddrs(struct ipv6_addrhead *iaddrs)
 			ipv6_freeaddr(ia);
 		}
 	}
+
+#ifndef ALIAS_ADDR
+	if (t != 0) {
+		if_txcommit(txs[0].ia->iface->ctx);
+		for (n = 0; n < t; n++) {
+			if (txs[n].ia->flags & IPV6_AF_NEW)
+				i++;
+		}
+	}
+	free(txs);
+#endif
 	return i;
 }
 
@@ -1174,6 +1270,8 @@ ipv6_handleifa(struct dhcpcd_ctx *ctx,
 		ifs = ctx->ifaces;
 	if (ifs == NULL)
 		return;
+	if (cmd == RTM_DELADDR)
+		rt_kroutes_invalidate(ctx, AF_INET6);
 	if ((ifp = if_find(ifs, ifname)) == NULL)
 		return;
 	if ((state = ipv6_getstate(ifp)) == NULL)
@@ -1931,7 +2029,8 @@ ipv6_regen_desync(struct interface *ifp, bool force)
 		state->desync_factor =
 		    arc4random_uniform(MIN(MAX_DESYNC_FACTOR, max));
 	max = TEMP_PREFERRED_LIFETIME - state->desync_factor - REGEN_ADVANCE;
-	eloop_timeout_add_sec(ifp->ctx->eloop, max, ipv6_regentempaddrs, ifp);
+	eloop_timeout_add_sec_slack(ifp->ctx->eloop, max, ELOOP_SLACK_SEC(max),
+	    ipv6_regentempaddrs, ifp);
 }
 
 /* RFC4941 Section 3.3.7 */
@@ -255,6 +255,7 @@ struct ipv6_state {
 
 
 int ipv6_init(struct dhcpcd_ctx *);
+ssize_t ipv6_readsecret(struct dhcpcd_ctx *);
 int ipv6_makestableprivate(struct in6_addr *,
     const struct in6_addr *, int, const struct interface *, int *);
 int ipv6_makeaddr(struct in6_addr *, struct interface *,
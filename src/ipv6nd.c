@@ -996,6 +996,7 @@ ipv6nd_dadcallback(void *arg)
 			if (if_address6(RTM_DELADDR, ia) == -1 &&
 			    errno != EADDRNOTAVAIL && errno != ENXIO)
 				logerr(__func__);
+			rt_kroutes_invalidate(ifp->ctx, AF_INET6);
 			dadcounter = ia->dadcounter;
 			if (ipv6_makestableprivate(&ia->addr,
 			    &ia->prefix, ia->prefix_len,
@@ -1816,6 +1817,8 @@ ipv6nd_expirera(void *arg)
 					    errno != EADDRNOTAVAIL &&
 					    errno != ENXIO)
 						logerr(__func__);
+					rt_kroutes_invalidate(ia->iface->ctx,
+					    AF_INET6);
 				}
 				ia->prefix_vltime = ia->prefix_pltime = 0;
 				ia->flags &=
@@ -1907,8 +1910,8 @@ ipv6nd_expirera(void *arg)
 	}
 
 	if (next != 0)
-		eloop_timeout_add_sec(ifp->ctx->eloop,
-		    next, ipv6nd_expirera, ifp);
+		eloop_timeout_add_sec_slack(ifp->ctx->eloop,
+		    next, ELOOP_SLACK_SEC(next), ipv6nd_expirera, ifp);
 	if (expired) {
 		logwarnx("%s: part of a Router Advertisement expired",
 		    ifp->name);
@@ -0,0 +1,897 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - DHCP client daemon
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "common.h"
+#include "dhcpcd.h"
+#include "eloop.h"
+#include "lease.h"
+#include "logerr.h"
+#include "privsep.h"
+
+struct lease_entry {
+	rb_node_t le_tree;
+	TAILQ_ENTRY(lease_entry) le_next;	/* waiting to be written */
+	bool le_dirty;
+	bool le_gone;		/* removed, log record pending */
+	bool le_remote;		/* prefetched, since changed by the proxy */
+	mode_t le_mode;
+	time_t le_mtime;
+	uint8_t *le_data;
+	size_t le_len;
+	char le_file[];
+};
+TAILQ_HEAD(lease_head, lease_entry);
+
+struct lease_store {
+	struct dhcpcd_ctx *ls_ctx;
+	rb_tree_t ls_tree;		/* entries by file */
+	struct lease_head ls_dirty;	/* in the order written */
+	bool ls_log;			/* lease_log when created */
+	bool ls_timer;			/* flush is scheduled */
+	size_t ls_logsize;		/* bytes in LEASELOG */
+	size_t ls_livesize;		/* bytes live records need */
+	uint8_t *ls_list;		/* records being prefetched */
+	size_t ls_listlen;
+	size_t ls_listsize;
+};
+
+static int
+lease_compare(__unused void *context, const void *node1, const void *node2)
+{
+	const struct lease_entry *le1 = node1, *le2 = node2;
+
+	return strcmp(le1->le_file, le2->le_file);
+}
+
+static int
+lease_compare_key(__unused void *context, const void *node, const void *key)
+{
+	const struct lease_entry *le = node;
+
+	return strcmp(le->le_file, key);
+}
+
+static const rb_tree_ops_t lease_ops = {
+	.rbto_compare_nodes = lease_compare,
+	.rbto_compare_key = lease_compare_key,
+	.rbto_node_offset = offsetof(struct lease_entry, le_tree),
+	.rbto_context = NULL
+};
+
+static size_t
+lease_recsize(const struct lease_entry *le)
+{
+
+	return sizeof(struct lease_rec) + strlen(le->le_file) + le->le_len;
+}
+
+/* FNV-1a of a whole record after lr_sum.
+ * Records are packed, so this works on bytes rather than the header. */
+static uint32_t
+lease_sum(const uint8_t *rec, size_t len)
+{
+	const uint8_t *p = rec + offsetof(struct lease_rec, lr_mtime);
+	const uint8_t *e = rec + len;
+	uint32_t h = 2166136261U;
+
+	for (; p < e; p++) {
+		h ^= *p;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static void
+lease_freeentry(struct lease_store *ls, struct lease_entry *le)
+{
+
+	if (le->le_dirty)
+		TAILQ_REMOVE(&ls->ls_dirty, le, le_next);
+	rb_tree_remove_node(&ls->ls_tree, le);
+	free(le->le_data);
+	free(le);
+}
+
+static struct lease_entry *
+lease_newentry(struct lease_store *ls, const char *file)
+{
+	struct lease_entry *le;
+	size_t flen = strlen(file) + 1;
+
+	le = calloc(1, sizeof(*le) + flen);
+	if (le == NULL)
+		return NULL;
+	memcpy(le->le_file, file, flen);
+	rb_tree_insert_node(&ls->ls_tree, le);
+	return le;
+}
+
+static int
+lease_setdata(struct lease_entry *le, const void *data, size_t len)
+{
+	uint8_t *nd;
+
+	if (len > le->le_len || le->le_data == NULL) {
+		nd = realloc(le->le_data, len != 0 ? len : 1);
+		if (nd == NULL)
+			return -1;
+		le->le_data = nd;
+	}
+	memcpy(le->le_data, data, len);
+	le->le_len = len;
+	return 0;
+}
+
+/* Apply records to the store, returning the bytes used.
+ * Parsing stops at the first record which is torn or corrupt. */
+static size_t
+lease_replay(struct lease_store *ls, const uint8_t *buf, size_t len)
+{
+	const uint8_t *p = buf, *e = buf + len;
+	size_t avail;
+	struct lease_rec lr;
+	struct lease_entry *le;
+	char file[PATH_MAX];
+
+	while ((size_t)(e - p) >= sizeof(lr)) {
+		memcpy(&lr, p, sizeof(lr));
+		avail = (size_t)(e - p) - sizeof(lr);
+		if (lr.lr_magic != LEASE_REC_MAGIC ||
+		    lr.lr_flen == 0 || lr.lr_flen >= sizeof(file) ||
+		    avail < (size_t)lr.lr_flen + lr.lr_len)
+			break;
+		if (lease_sum(p, sizeof(lr) + lr.lr_flen + lr.lr_len) !=
+		    lr.lr_sum)
+			break;
+		memcpy(file, p + sizeof(lr), lr.lr_flen);
+		file[lr.lr_flen] = '\0';
+		le = rb_tree_find_node(&ls->ls_tree, file);
+		if (lr.lr_flags & LEASE_REC_GONE) {
+			if (le != NULL) {
+				ls->ls_livesize -= lease_recsize(le);
+				lease_freeentry(ls, le);
+			}
+		} else {
+			if (le == NULL)
+				le = lease_newentry(ls, file);
+			else
+				ls->ls_livesize -= lease_recsize(le);
+			if (le == NULL ||
+			    lease_setdata(le, p + sizeof(lr) + lr.lr_flen,
+			    lr.lr_len) == -1)
+			{
+				logerr(__func__);
+				if (le != NULL)
+					lease_freeentry(ls, le);
+			} else {
+				le->le_mode = 0640;
+				le->le_mtime = (time_t)lr.lr_mtime;
+				ls->ls_livesize += lease_recsize(le);
+			}
+		}
+		p += sizeof(lr) + lr.lr_flen + lr.lr_len;
+	}
+	return (size_t)(p - buf);
+}
+
+/* Replay the log into the store.
+ * A torn record at the end from a crash is cut off. */
+static void
+lease_loadlog(struct lease_store *ls)
+{
+	int fd;
+	struct stat st;
+	uint8_t *buf;
+	ssize_t bytes;
+
+	fd = open(LEASELOG, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			logerr("%s: %s", __func__, LEASELOG);
+		return;
+	}
+	if (fstat(fd, &st) == -1 || st.st_size == 0) {
+		close(fd);
+		return;
+	}
+	buf = malloc((size_t)st.st_size);
+	if (buf == NULL) {
+		logerr(__func__);
+		close(fd);
+		return;
+	}
+	bytes = read(fd, buf, (size_t)st.st_size);
+	close(fd);
+	if (bytes == -1) {
+		logerr("%s: %s", __func__, LEASELOG);
+		free(buf);
+		return;
+	}
+
+	ls->ls_logsize = lease_replay(ls, buf, (size_t)bytes);
+	if (ls->ls_logsize != (size_t)bytes) {
+		logwarnx("%s: discarding %zu bytes after offset %zu",
+		    LEASELOG, (size_t)bytes - ls->ls_logsize, ls->ls_logsize);
+		if (truncate(LEASELOG, (off_t)ls->ls_logsize) == -1)
+			logerr("%s: truncate", __func__);
+	}
+	free(buf);
+}
+
+static struct lease_store *
+lease_newstore(struct dhcpcd_ctx *ctx)
+{
+	struct lease_store *ls;
+
+	ls = calloc(1, sizeof(*ls));
+	if (ls == NULL)
+		return NULL;
+	ls->ls_ctx = ctx;
+	rb_tree_init(&ls->ls_tree, &lease_ops);
+	TAILQ_INIT(&ls->ls_dirty);
+	return ls;
+}
+
+static void
+lease_freestore(struct lease_store *ls)
+{
+	struct lease_entry *le;
+
+	while ((le = RB_TREE_MIN(&ls->ls_tree)) != NULL)
+		lease_freeentry(ls, le);
+	free(ls->ls_list);
+	free(ls);
+}
+
+static struct lease_store *
+lease_store(struct dhcpcd_ctx *ctx)
+{
+	struct lease_store *ls = ctx->lease_store;
+
+	if (ls != NULL)
+		return ls;
+	if ((ls = lease_newstore(ctx)) == NULL)
+		return NULL;
+	ctx->lease_store = ls;
+	/* Changing lease_log needs a restart to replay the log. */
+	ls->ls_log = ctx->lease_log;
+	if (ls->ls_log)
+		lease_loadlog(ls);
+	return ls;
+}
+
+static void
+lease_flushcb(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+
+	ctx->lease_store->ls_timer = false;
+	lease_flush(ctx);
+}
+
+/* Only the first write in a window arms the timer, otherwise
+ * a steady trickle of renewals would hold back the flush. */
+static void
+lease_queue(struct lease_store *ls, struct lease_entry *le)
+{
+	struct dhcpcd_ctx *ctx = ls->ls_ctx;
+
+	if (!le->le_dirty) {
+		TAILQ_INSERT_TAIL(&ls->ls_dirty, le, le_next);
+		le->le_dirty = true;
+	}
+	if (ctx->lease_delay == 0) {
+		lease_flush(ctx);
+		return;
+	}
+	if (ls->ls_timer)
+		return;
+	if (eloop_timeout_add_sec(ctx->eloop, ctx->lease_delay,
+	    lease_flushcb, ctx) == -1)
+	{
+		logerr(__func__);
+		lease_flush(ctx);
+		return;
+	}
+	ls->ls_timer = true;
+}
+
+static size_t
+lease_putrec0(uint8_t *p, const char *file, time_t mtime,
+    const void *data, size_t len, uint16_t flags)
+{
+	struct lease_rec lr = {
+		.lr_magic = LEASE_REC_MAGIC,
+		.lr_mtime = (int64_t)mtime,
+		.lr_len = (uint32_t)len,
+		.lr_flen = (uint16_t)strlen(file),
+		.lr_flags = flags,
+	};
+	size_t rlen = sizeof(lr) + lr.lr_flen + lr.lr_len;
+
+	memcpy(p, &lr, sizeof(lr));
+	memcpy(p + sizeof(lr), file, lr.lr_flen);
+	if (len != 0)
+		memcpy(p + sizeof(lr) + lr.lr_flen, data, len);
+	lr.lr_sum = lease_sum(p, rlen);
+	memcpy(p + offsetof(struct lease_rec, lr_sum), &lr.lr_sum,
+	    sizeof(lr.lr_sum));
+	return rlen;
+}
+
+static size_t
+lease_putrec(uint8_t *p, const struct lease_entry *le)
+{
+
+	return lease_putrec0(p, le->le_file, le->le_mtime,
+	    le->le_data, le->le_len, le->le_gone ? LEASE_REC_GONE : 0);
+}
+
+/* Rewrite the log with just the live leases. */
+static void
+lease_compact(struct lease_store *ls)
+{
+	struct lease_entry *le;
+	uint8_t *buf, *p;
+
+	buf = malloc(ls->ls_livesize != 0 ? ls->ls_livesize : 1);
+	if (buf == NULL) {
+		logerr(__func__);
+		return;
+	}
+	p = buf;
+	RB_TREE_FOREACH(le, &ls->ls_tree) {
+		if (!le->le_gone)
+			p += lease_putrec(p, le);
+	}
+	if (writefile_atomic(LEASELOG, 0640, 0, buf, (size_t)(p - buf)) == -1)
+		logerr("%s: %s", __func__, LEASELOG);
+	else {
+		if (syncdir(LEASELOG) == -1)
+			logerr("%s: syncdir", __func__);
+		logdebugx("%s: compacted from %zu to %zu bytes",
+		    LEASELOG, ls->ls_logsize, (size_t)(p - buf));
+		ls->ls_logsize = (size_t)(p - buf);
+	}
+	free(buf);
+}
+
+/* Append every pending change to the log with one write and sync. */
+static void
+lease_flushlog(struct lease_store *ls)
+{
+	struct lease_entry *le, *len;
+	size_t size = 0;
+	uint8_t *buf, *p;
+	int fd;
+	ssize_t bytes;
+
+	TAILQ_FOREACH(le, &ls->ls_dirty, le_next) {
+		size += lease_recsize(le);
+	}
+	buf = malloc(size);
+	if (buf == NULL) {
+		logerr(__func__);
+		return;
+	}
+	p = buf;
+	TAILQ_FOREACH(le, &ls->ls_dirty, le_next) {
+		p += lease_putrec(p, le);
+	}
+
+	fd = open(LEASELOG, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0640);
+	if (fd == -1) {
+		logerr("%s: %s", __func__, LEASELOG);
+		free(buf);
+		return;
+	}
+	bytes = write(fd, buf, size);
+	if (bytes == -1 || (size_t)bytes != size || fsync(fd) == -1) {
+		if (bytes != -1 && (size_t)bytes != size)
+			errno = ENOSPC;
+		logerr("%s: %s", __func__, LEASELOG);
+		/* Cut off a partial append, the whole batch is retried. */
+		if (bytes > 0 && ftruncate(fd, (off_t)ls->ls_logsize) == -1)
+			logerr("%s: ftruncate", __func__);
+		close(fd);
+		free(buf);
+		return;
+	}
+	close(fd);
+	free(buf);
+	ls->ls_logsize += size;
+
+	TAILQ_FOREACH_SAFE(le, &ls->ls_dirty, le_next, len) {
+		if (le->le_gone)
+			lease_freeentry(ls, le);
+		else {
+			TAILQ_REMOVE(&ls->ls_dirty, le, le_next);
+			le->le_dirty = false;
+		}
+	}
+
+	if (ls->ls_logsize > LEASE_LOG_MINSIZE &&
+	    ls->ls_logsize > ls->ls_livesize * 2)
+		lease_compact(ls);
+}
+
+/* Write each pending lease to its own file, then sync DBDIR
+ * where they all live once for the whole batch. */
+static void
+lease_flushfiles(struct lease_store *ls)
+{
+	struct lease_entry *le;
+
+	TAILQ_FOREACH(le, &ls->ls_dirty, le_next) {
+		if (writefile_atomic(le->le_file, le->le_mode, le->le_mtime,
+		    le->le_data, le->le_len) == -1)
+			logerr("%s: %s", __func__, le->le_file);
+	}
+	le = TAILQ_FIRST(&ls->ls_dirty);
+	if (syncdir(le->le_file) == -1)
+		logerr("%s: syncdir", __func__);
+	while ((le = TAILQ_FIRST(&ls->ls_dirty)) != NULL)
+		lease_freeentry(ls, le);
+}
+
+void
+lease_flush(struct dhcpcd_ctx *ctx)
+{
+	struct lease_store *ls = ctx->lease_store;
+
+	if (ls == NULL || TAILQ_FIRST(&ls->ls_dirty) == NULL)
+		return;
+	if (ls->ls_timer) {
+		eloop_timeout_delete(ctx->eloop, lease_flushcb, ctx);
+		ls->ls_timer = false;
+	}
+	if (ls->ls_log)
+		lease_flushlog(ls);
+	else
+		lease_flushfiles(ls);
+}
+
+static bool
+lease_isfile(const char *name)
+{
+	size_t len = strlen(name);
+
+	/* As LEASEFILE and LEASEFILE6 name them. */
+	return (len > 6 && strcmp(name + len - 6, ".lease") == 0) ||
+	    (len > 7 && strcmp(name + len - 7, ".lease6") == 0);
+}
+
+static int
+lease_listadd(struct lease_store *ls, const char *file, time_t mtime,
+    const void *data, size_t len, size_t max)
+{
+	size_t rlen = sizeof(struct lease_rec) + strlen(file) + len;
+	size_t nsize;
+	uint8_t *nl;
+
+	/* Too big for a reply, so it's read as normal. */
+	if (rlen > max)
+		return 0;
+	if (ls->ls_listlen + rlen > ls->ls_listsize) {
+		nsize = ls->ls_listsize != 0 ? ls->ls_listsize : max;
+		while (ls->ls_listlen + rlen > nsize)
+			nsize *= 2;
+		nl = realloc(ls->ls_list, nsize);
+		if (nl == NULL)
+			return -1;
+		ls->ls_list = nl;
+		ls->ls_listsize = nsize;
+	}
+	ls->ls_listlen += lease_putrec0(ls->ls_list + ls->ls_listlen,
+	    file, mtime, data, len, 0);
+	return 1;
+}
+
+/* Snapshot every lease the store holds and every lease file in DBDIR
+ * it doesn't, in records no bigger than max. */
+static int
+lease_buildlist(struct lease_store *ls, size_t max)
+{
+	struct lease_entry *le;
+	DIR *dp;
+	struct dirent *d;
+	char file[PATH_MAX];
+	uint8_t *buf;
+	ssize_t bytes;
+	time_t mtime;
+	int err = 0;
+
+	ls->ls_listlen = 0;
+	RB_TREE_FOREACH(le, &ls->ls_tree) {
+		if (!le->le_gone && lease_listadd(ls, le->le_file,
+		    le->le_mtime, le->le_data, le->le_len, max) == -1)
+			return -1;
+	}
+
+	dp = opendir(DBDIR);
+	if (dp == NULL)
+		return errno == ENOENT ? 0 : -1;
+	buf = malloc(max);
+	if (buf == NULL) {
+		closedir(dp);
+		return -1;
+	}
+	while (err != -1 && (d = readdir(dp)) != NULL) {
+		if (!lease_isfile(d->d_name))
+			continue;
+		if ((size_t)snprintf(file, sizeof(file), "%s/%s",
+		    DBDIR, d->d_name) >= sizeof(file))
+			continue;
+		if (rb_tree_find_node(&ls->ls_tree, file) != NULL)
+			continue;
+		bytes = readfile(file, buf, max);
+		if (bytes == -1 || filemtime(file, &mtime) == -1)
+			continue;
+		err = lease_listadd(ls, file, mtime, buf, (size_t)bytes, max);
+	}
+	free(buf);
+	closedir(dp);
+	return err == -1 ? -1 : 0;
+}
+
+/* Return the records from off which fit in len, whole records only.
+ * An offset of 0 takes a new snapshot and a reply of 0 ends it. */
+ssize_t
+lease_list(struct dhcpcd_ctx *ctx, size_t off, void *data, size_t len)
+{
+	struct lease_store *ls;
+	struct lease_rec lr;
+	size_t n, rlen;
+
+	if ((ls = lease_store(ctx)) == NULL)
+		return -1;
+	if (off == 0 && lease_buildlist(ls, len) == -1)
+		return -1;
+	if (off > ls->ls_listlen) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (n = 0; off + n + sizeof(lr) <= ls->ls_listlen; n += rlen) {
+		memcpy(&lr, ls->ls_list + off + n, sizeof(lr));
+		rlen = sizeof(lr) + lr.lr_flen + lr.lr_len;
+		if (n + rlen > len)
+			break;
+	}
+	if (n == 0) {
+		free(ls->ls_list);
+		ls->ls_list = NULL;
+		ls->ls_listlen = ls->ls_listsize = 0;
+		return 0;
+	}
+	memcpy(data, ls->ls_list + off, n);
+	return (ssize_t)n;
+}
+
+#ifdef PRIVSEP
+static void lease_cachefreecb(void *);
+
+static void
+lease_cachefree(struct dhcpcd_ctx *ctx)
+{
+
+	if (ctx->lease_cache == NULL)
+		return;
+	eloop_timeout_delete(ctx->eloop, lease_cachefreecb, ctx);
+	lease_freestore(ctx->lease_cache);
+	ctx->lease_cache = NULL;
+}
+
+static void
+lease_cachefreecb(void *arg)
+{
+
+	lease_cachefree(arg);
+}
+
+/*
+ * The prefetched leases are complete, so a file missing from them
+ * has no lease. The manager is the only writer of leases, so writes
+ * and removals just hand the file back to the privileged proxy.
+ * Returns false if the proxy has to be asked.
+ */
+static bool
+lease_cachefind(struct dhcpcd_ctx *ctx, const char *file,
+    struct lease_entry **lep)
+{
+	struct lease_entry *le;
+
+	if (ctx->lease_cache == NULL)
+		return false;
+	le = rb_tree_find_node(&ctx->lease_cache->ls_tree, file);
+	if (le != NULL && le->le_remote)
+		return false;
+	*lep = le;
+	return true;
+}
+
+static void
+lease_cacheforget(struct dhcpcd_ctx *ctx, const char *file)
+{
+	struct lease_store *ls = ctx->lease_cache;
+	struct lease_entry *le;
+
+	if (ls == NULL)
+		return;
+	le = rb_tree_find_node(&ls->ls_tree, file);
+	if (le == NULL && (le = lease_newentry(ls, file)) == NULL) {
+		/* Can't record it, so stop answering for any lease. */
+		logerr(__func__);
+		lease_cachefree(ctx);
+		return;
+	}
+	le->le_remote = true;
+	free(le->le_data);
+	le->le_data = NULL;
+	le->le_len = 0;
+}
+#endif
+
+ssize_t
+lease_write(struct dhcpcd_ctx *ctx, const char *file, mode_t mode,
+    const void *data, size_t len)
+{
+	struct lease_store *ls;
+	struct lease_entry *le;
+
+#ifdef PRIVSEP
+	if (IN_PRIVSEP(ctx) && !(ctx->options & DHCPCD_PRIVSEPROOT)) {
+		lease_cacheforget(ctx, file);
+		return ps_root_writelease(ctx, file, mode, data, len);
+	}
+#endif
+
+	if ((ls = lease_store(ctx)) == NULL)
+		return -1;
+	le = rb_tree_find_node(&ls->ls_tree, file);
+	if (le == NULL) {
+		if ((le = lease_newentry(ls, file)) == NULL)
+			return -1;
+	} else if (!le->le_gone)
+		ls->ls_livesize -= lease_recsize(le);
+
+	if (lease_setdata(le, data, len) == -1) {
+		if (le->le_data == NULL)
+			lease_freeentry(ls, le);
+		else if (!le->le_gone)
+			ls->ls_livesize += lease_recsize(le);
+		return -1;
+	}
+	le->le_gone = false;
+	le->le_mode = mode;
+	le->le_mtime = time(NULL);
+	ls->ls_livesize += lease_recsize(le);
+	lease_queue(ls, le);
+	return (ssize_t)len;
+}
+
+static ssize_t
+lease_entryread(const struct lease_entry *le, void *data, size_t len)
+{
+
+	if (le == NULL || le->le_gone) {
+		errno = ENOENT;
+		return -1;
+	}
+	/* Match readfile, which can't tell a full buffer from truncation. */
+	if (le->le_len >= len) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	memcpy(data, le->le_data, le->le_len);
+	return (ssize_t)le->le_len;
+}
+
+static int
+lease_entrymtime(const struct lease_entry *le, time_t *time)
+{
+
+	if (le == NULL || le->le_gone) {
+		errno = ENOENT;
+		return -1;
+	}
+	*time = le->le_mtime;
+	return 0;
+}
+
+ssize_t
+lease_read(struct dhcpcd_ctx *ctx, const char *file, void *data, size_t len)
+{
+	struct lease_store *ls;
+	struct lease_entry *le;
+
+#ifdef PRIVSEP
+	if (IN_PRIVSEP(ctx) && !(ctx->options & DHCPCD_PRIVSEPROOT)) {
+		if (lease_cachefind(ctx, file, &le))
+			return lease_entryread(le, data, len);
+		return ps_root_readlease(ctx, file, data, len);
+	}
+#endif
+
+	if ((ls = lease_store(ctx)) == NULL)
+		return -1;
+	le = rb_tree_find_node(&ls->ls_tree, file);
+	if (le == NULL)
+		return readfile(file, data, len);
+	return lease_entryread(le, data, len);
+}
+
+int
+lease_mtime(struct dhcpcd_ctx *ctx, const char *file, time_t *time)
+{
+	struct lease_store *ls;
+	struct lease_entry *le;
+
+#ifdef PRIVSEP
+	if (IN_PRIVSEP(ctx) && !(ctx->options & DHCPCD_PRIVSEPROOT)) {
+		if (lease_cachefind(ctx, file, &le))
+			return lease_entrymtime(le, time);
+		return (int)ps_root_leasemtime(ctx, file, time);
+	}
+#endif
+
+	if ((ls = lease_store(ctx)) == NULL)
+		return -1;
+	le = rb_tree_find_node(&ls->ls_tree, file);
+	if (le == NULL)
+		return filemtime(file, time);
+	return lease_entrymtime(le, time);
+}
+
+int
+lease_unlink(struct dhcpcd_ctx *ctx, const char *file)
+{
+	struct lease_store *ls;
+	struct lease_entry *le;
+
+#ifdef PRIVSEP
+	if (IN_PRIVSEP(ctx) && !(ctx->options & DHCPCD_PRIVSEPROOT)) {
+		lease_cacheforget(ctx, file);
+		return (int)ps_root_unlinklease(ctx, file);
+	}
+#endif
+
+	if ((ls = lease_store(ctx)) == NULL)
+		return -1;
+	le = rb_tree_find_node(&ls->ls_tree, file);
+	if (le == NULL)
+		return unlink(file);
+
+	/* A pending write must not bring the lease back. */
+	if (!ls->ls_log) {
+		lease_freeentry(ls, le);
+		return unlink(file);
+	}
+
+	if (!le->le_gone) {
+		ls->ls_livesize -= lease_recsize(le);
+		le->le_gone = true;
+		le->le_len = 0;
+		lease_queue(ls, le);
+	}
+	/* Remove any lease file from before the log was used. */
+	if (unlink(file) == -1 && errno != ENOENT)
+		return -1;
+	return 0;
+}
+
+/*
+ * Fetch every lease from the privileged proxy in a few large replies,
+ * so starting thousands of interfaces doesn't need a round trip for
+ * each lease and its mtime.
+ * Returns the number of leases fetched.
+ */
+ssize_t
+lease_prefetch(struct dhcpcd_ctx *ctx)
+{
+#ifdef PRIVSEP
+	struct lease_store *ls;
+	struct lease_entry *le;
+	uint8_t *buf;
+	size_t off = 0;
+	ssize_t len, n = 0;
+
+	if (!IN_PRIVSEP(ctx) || ctx->options & DHCPCD_PRIVSEPROOT)
+		return 0;
+
+	lease_cachefree(ctx);
+	if ((ls = lease_newstore(ctx)) == NULL)
+		return -1;
+	if ((buf = malloc(PS_BUFLEN)) == NULL) {
+		lease_freestore(ls);
+		return -1;
+	}
+	for (;;) {
+		len = ps_root_leaselist(ctx, off, buf, PS_BUFLEN);
+		if (len <= 0)
+			break;
+		if (lease_replay(ls, buf, (size_t)len) != (size_t)len) {
+			errno = EINVAL;
+			len = -1;
+			break;
+		}
+		off += (size_t)len;
+	}
+	free(buf);
+	if (len == -1) {
+		lease_freestore(ls);
+		return -1;
+	}
+
+	RB_TREE_FOREACH(le, &ls->ls_tree) {
+		n++;
+	}
+	ctx->lease_cache = ls;
+	eloop_timeout_add_sec(ctx->eloop, LEASE_PREFETCH_TIMEOUT,
+	    lease_cachefreecb, ctx);
+	return n;
+#else
+	UNUSED(ctx);
+	return 0;
+#endif
+}
+
+/* Pending leases belong to the parent, so just drop them. */
+void
+lease_forked(struct dhcpcd_ctx *ctx)
+{
+
+#ifdef PRIVSEP
+	lease_cachefree(ctx);
+#endif
+	if (ctx->lease_store == NULL)
+		return;
+	lease_freestore(ctx->lease_store);
+	ctx->lease_store = NULL;
+}
+
+void
+lease_free(struct dhcpcd_ctx *ctx)
+{
+
+	lease_flush(ctx);
+	lease_forked(ctx);
+}
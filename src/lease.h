@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - DHCP client daemon
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef LEASE_H
+#define LEASE_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Leases are written through a store owned by the process which does
+ * the file I/O, the privileged proxy when privilege separation is on.
+ * Writes are held for lease_delay seconds so that renewals across
+ * many interfaces land on disk together, and every write is atomic.
+ * With lease_log set, all leases are appended to one log file instead
+ * which is compacted once it has grown well past the live leases.
+ */
+
+/* Log record, followed by the file name and then the lease.
+ * The log is local to this host, so host byte order is used. */
+struct lease_rec {
+	uint32_t lr_magic;
+	uint32_t lr_sum;		/* FNV-1a of what follows */
+	int64_t lr_mtime;
+	uint32_t lr_len;		/* lease length */
+	uint16_t lr_flen;		/* file name length */
+	uint16_t lr_flags;
+};
+#define	LEASE_REC_MAGIC		0x444c5231U	/* DLR1 */
+#define	LEASE_REC_GONE		0x0001U		/* lease was removed */
+
+/* Don't bother compacting a log smaller than this. */
+#define	LEASE_LOG_MINSIZE	(64 * 1024)
+
+/* Seconds the manager answers lease reads from the prefetch. */
+#define	LEASE_PREFETCH_TIMEOUT	60
+
+struct dhcpcd_ctx;
+
+ssize_t lease_write(struct dhcpcd_ctx *, const char *, mode_t,
+    const void *, size_t);
+ssize_t lease_read(struct dhcpcd_ctx *, const char *, void *, size_t);
+int lease_mtime(struct dhcpcd_ctx *, const char *, time_t *);
+int lease_unlink(struct dhcpcd_ctx *, const char *);
+ssize_t lease_list(struct dhcpcd_ctx *, size_t, void *, size_t);
+ssize_t lease_prefetch(struct dhcpcd_ctx *);
+void lease_flush(struct dhcpcd_ctx *);
+void lease_forked(struct dhcpcd_ctx *);
+void lease_free(struct dhcpcd_ctx *);
+#endif
@@ -58,7 +58,7 @@ ps_bpf_recvbpf(void *arg, unsigned short events)
 {
 	struct ps_process *psp = arg;
 	struct bpf *bpf = psp->psp_bpf;
-	uint8_t buf[FRAMELEN_MAX];
+	void *frame;
 	ssize_t len;
 	struct ps_msghdr psm = {
 		.ps_id = psp->psp_id,
@@ -72,7 +72,7 @@ ps_bpf_recvbpf(void *arg, unsigned short events)
 	/* A BPF read can read more than one filtered packet at time.
 	 * This mechanism allows us to read each packet from the buffer. */
 	while (!(bpf->bpf_flags & BPF_EOF)) {
-		len = bpf_read(bpf, buf, sizeof(buf));
+		len = bpf_read(bpf, &frame);
 		if (len == -1) {
 			int error = errno;
 
@@ -92,7 +92,7 @@ ps_bpf_recvbpf(void *arg, unsigned short events)
 			break;
 		psm.ps_flags = bpf->bpf_flags;
 		len = ps_sendpsmdata(psp->psp_ctx, psp->psp_ctx->ps_data_fd,
-		    &psm, buf, (size_t)len);
+		    &psm, frame, (size_t)len);
 		if (len == -1)
 			logerr(__func__);
 		if (len == -1 || len == 0)
@@ -254,7 +254,7 @@ ps_bpf_cmd(struct dhcpcd_ctx *ctx, struct ps_msghdr *psm, struct msghdr *msg)
 	    addr != NULL ? " " : "", addr != NULL ? addr : "");
 
 	start = ps_startprocess(psp, ps_bpf_recvmsg, NULL,
-	    ps_bpf_start_bpf, NULL, PSF_DROPPRIVS);
+	    ps_bpf_start_bpf, NULL, PSF_DROPPRIVS | PSF_RING);
 	switch (start) {
 	case -1:
 		ps_freeprocess(psp);
@@ -332,29 +332,27 @@ ps_bpf_send(const struct interface *ifp, const struct in_addr *ia,
 }
 
 #ifdef ARP
+/* One BPF ARP process serves every address on the interface. */
 ssize_t
-ps_bpf_openarp(const struct interface *ifp, const struct in_addr *ia)
+ps_bpf_openarp(const struct interface *ifp)
 {
 
-	assert(ia != NULL);
-	return ps_bpf_send(ifp, ia, PS_BPF_ARP | PS_START,
+	return ps_bpf_send(ifp, NULL, PS_BPF_ARP | PS_START,
 	    ifp, sizeof(*ifp));
 }
 
 ssize_t
-ps_bpf_closearp(const struct interface *ifp, const struct in_addr *ia)
+ps_bpf_closearp(const struct interface *ifp)
 {
 
-	return ps_bpf_send(ifp, ia, PS_BPF_ARP | PS_STOP, NULL, 0);
+	return ps_bpf_send(ifp, NULL, PS_BPF_ARP | PS_STOP, NULL, 0);
 }
 
 ssize_t
-ps_bpf_sendarp(const struct interface *ifp, const struct in_addr *ia,
-    const void *data, size_t len)
+ps_bpf_sendarp(const struct interface *ifp, const void *data, size_t len)
 {
 
-	assert(ia != NULL);
-	return ps_bpf_send(ifp, ia, PS_BPF_ARP, data, len);
+	return ps_bpf_send(ifp, NULL, PS_BPF_ARP, data, len);
 }
 #endif
 
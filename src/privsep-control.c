@@ -199,7 +199,6 @@ ps_ctl_listen(void *arg, unsigned short events)
 	struct dhcpcd_ctx *ctx = arg;
 	char buf[BUFSIZ];
 	ssize_t len;
-	struct fd_list *fd;
 
 	if (!(events & ELE_READ))
 		logerrx("%s: unexpected event 0x%04x", __func__, events);
@@ -214,12 +213,8 @@ ps_ctl_listen(void *arg, unsigned short events)
 	}
 
 	/* Send to our listeners */
-	TAILQ_FOREACH(fd, &ctx->control_fds, next) {
-		if (!(fd->flags & FD_LISTEN))
-			continue;
-		if (control_queue(fd, buf, (size_t)len)== -1)
-			logerr("%s: control_queue", __func__);
-	}
+	if (control_broadcast(ctx, buf, (size_t)len) == -1)
+		logerr("%s: control_broadcast", __func__);
 }
 
 pid_t
@@ -28,6 +28,7 @@
 
 #include <sys/ioctl.h>
 #include <sys/prctl.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/syscall.h>
 #include <sys/termios.h>	/* For TCGETS */
@@ -85,14 +86,40 @@ out:
 	return retval;
 }
 
+static ssize_t
+ps_root_dosendnetlinkbatch(int protocol, struct msghdr *msg,
+    void **rdata, size_t *rlen)
+{
+	static int errors[IF_NLBATCH_MAX];
+	struct sockaddr_nl snl = { .nl_family = AF_NETLINK };
+	struct iovec *iov = msg->msg_iov;
+	int s;
+	ssize_t n;
+
+	if ((s = if_linksocket(&snl, protocol, 0)) == -1)
+		return -1;
+	n = if_sendnetlinkbatch(s, iov->iov_base, iov->iov_len,
+	    errors, __arraycount(errors));
+	close(s);
+	if (n == -1)
+		return -1;
+
+	*rdata = errors;
+	*rlen = (size_t)n * sizeof(errors[0]);
+	return n;
+}
+
 ssize_t
 ps_root_os(struct ps_msghdr *psm, struct msghdr *msg,
-    __unused void **rdata, __unused size_t *rlen)
+    void **rdata, size_t *rlen)
 {
 
 	switch (psm->ps_cmd) {
 	case PS_ROUTE:
 		return ps_root_dosendnetlink((int)psm->ps_flags, msg);
+	case PS_ROUTEBATCH:
+		return ps_root_dosendnetlinkbatch((int)psm->ps_flags, msg,
+		    rdata, rlen);
 	default:
 		errno = ENOTSUP;
 		return -1;
@@ -103,12 +130,29 @@ ssize_t
 ps_root_sendnetlink(struct dhcpcd_ctx *ctx, int protocol, struct msghdr *msg)
 {
 
-	if (ps_sendmsg(ctx, ctx->ps_root->psp_fd, PS_ROUTE,
+	if (ps_root_sendmsg(ctx, PS_ROUTE,
 	    (unsigned long)protocol, msg) == -1)
 		return -1;
 	return ps_root_readerror(ctx, NULL, 0);
 }
 
+ssize_t
+ps_root_sendnetlinkbatch(struct dhcpcd_ctx *ctx, int protocol,
+    void *data, size_t len, int *errors, size_t nerrors)
+{
+	ssize_t n;
+
+	if (ps_root_sendcmd(ctx, PS_ROUTEBATCH,
+	    (unsigned long)protocol, data, len) == -1)
+		return -1;
+	n = ps_root_readerror(ctx, errors, nerrors * sizeof(*errors));
+	if (n != -1 && (size_t)n != nerrors) {
+		errno = EINVAL;
+		return -1;
+	}
+	return n;
+}
+
 #if (BYTE_ORDER == LITTLE_ENDIAN)
 # define SECCOMP_ARG_LO	0
 # define SECCOMP_ARG_HI	sizeof(uint32_t)
@@ -309,6 +353,10 @@ static struct sock_filter ps_seccomp_filter[] = {
 #ifdef __NR_getpid
 	SECCOMP_ALLOW(__NR_getpid),
 #endif
+#ifdef __NR_getrusage
+	/* For eloop statistics */
+	SECCOMP_ALLOW_ARG(__NR_getrusage, 0, RUSAGE_SELF),
+#endif
 #ifdef __NR_getsockopt
 	/* For route socket overflow */
 	SECCOMP_ALLOW_ARG(__NR_getsockopt, 1, SOL_SOCKET),
@@ -325,6 +373,9 @@ static struct sock_filter ps_seccomp_filter[] = {
 	/* SECCOMP BPF is newer than nl80211 so we don't need SIOCGIWESSID
 	 * which lives in the impossible to include linux/wireless.h header */
 #endif
+#ifdef __NR_io_uring_enter
+	SECCOMP_ALLOW(__NR_io_uring_enter),
+#endif
 #ifdef __NR_mmap
 	SECCOMP_ALLOW(__NR_mmap),
 #endif
@@ -361,6 +412,12 @@ static struct sock_filter ps_seccomp_filter[] = {
 #ifdef __NR_recvmsg
 	SECCOMP_ALLOW(__NR_recvmsg),
 #endif
+#ifdef __NR_recvmmsg
+	SECCOMP_ALLOW(__NR_recvmmsg),
+#endif
+#ifdef __NR_recvmmsg_time64
+	SECCOMP_ALLOW(__NR_recvmmsg_time64),
+#endif
 #ifdef __NR_rt_sigreturn
 	SECCOMP_ALLOW(__NR_rt_sigreturn),
 #endif
@@ -385,6 +442,7 @@ static struct sock_filter ps_seccomp_filter[] = {
 	SECCOMP_ALLOW_ARG(__NR_socketcall, 0, SYS_RECV),
 	SECCOMP_ALLOW_ARG(__NR_socketcall, 0, SYS_RECVFROM),
 	SECCOMP_ALLOW_ARG(__NR_socketcall, 0, SYS_RECVMSG),
+	SECCOMP_ALLOW_ARG(__NR_socketcall, 0, SYS_RECVMMSG),
 	SECCOMP_ALLOW_ARG(__NR_socketcall, 0, SYS_SEND),
 	SECCOMP_ALLOW_ARG(__NR_socketcall, 0, SYS_SENDMSG),
 	SECCOMP_ALLOW_ARG(__NR_socketcall, 0, SYS_SENDTO),
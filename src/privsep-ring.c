@@ -0,0 +1,394 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Privilege Separation shared memory ring
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Data read by the unprivileged helpers is passed to the manager over
+ * a single producer, single consumer ring in shared memory rather than
+ * the socket, saving a write and a read for each packet.
+ *
+ * The manager maps the rings before it forks anything so they are
+ * inherited by every process; no fds need to be passed around and the
+ * manager can keep its RLIMIT_NOFILE of zero.
+ * Slot 0 belongs to the network proxy and the rest are handed out by
+ * the privileged proxy to the helpers it starts.
+ * After forking, a helper unmaps every slot but its own.
+ *
+ * The helper only rings the doorbell, a PS_RING message over the
+ * socket, when the manager has said it is waiting, so a busy ring
+ * costs no system calls at all.
+ *
+ * The manager does not trust the helper.
+ * Each record is copied out of the ring before it is looked at and a
+ * length which does not add up closes the ring, leaving the helper
+ * with just the socket.
+ */
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "dhcpcd.h"
+#include "eloop.h"
+#include "logerr.h"
+#include "privsep.h"
+
+#define	PS_RING_NSLOTS		32
+#define	PS_RING_SIZE		(128 * 1024)	/* must be a power of 2 */
+#define	PS_RING_MASK		(PS_RING_SIZE - 1)
+#define	PS_RING_ALIGN(len)	(((len) + 7) & ~(size_t)7)
+
+/* head and tail live on their own cache lines */
+struct ps_ringhdr {
+	uint32_t prh_head;	/* written by the helper */
+	uint8_t prh_pad[60];
+	uint32_t prh_tail;	/* written by the manager */
+	uint32_t prh_wait;	/* manager wants the doorbell */
+	uint32_t prh_closed;	/* manager no longer reads the ring */
+	uint8_t prh_pad2[52];
+};
+
+struct ps_ringpool {
+	uint8_t *rp_base;
+	size_t rp_stride;
+	size_t rp_len;
+	bool rp_used[PS_RING_NSLOTS];
+	uint32_t rp_tail[PS_RING_NSLOTS];	/* manager read positions */
+	int rp_slot;				/* helper slot */
+	uint32_t rp_head;
+	int rp_fd;
+};
+
+static struct ps_ringhdr *
+ps_ring_hdr(const struct ps_ringpool *rp, unsigned int slot)
+{
+
+	return (void *)(rp->rp_base + (rp->rp_stride * slot));
+}
+
+static uint8_t *
+ps_ring_data(const struct ps_ringpool *rp, unsigned int slot)
+{
+
+	return rp->rp_base + (rp->rp_stride * slot) + sizeof(struct ps_ringhdr);
+}
+
+int
+ps_ring_init(struct dhcpcd_ctx *ctx)
+{
+	struct ps_ringpool *rp;
+	long pagesize;
+	unsigned int slot;
+	void *p;
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	if (pagesize == -1)
+		return -1;
+	if ((rp = calloc(1, sizeof(*rp))) == NULL)
+		return -1;
+	rp->rp_stride = sizeof(struct ps_ringhdr) + PS_RING_SIZE;
+	rp->rp_stride = roundup(rp->rp_stride, (size_t)pagesize);
+	rp->rp_len = rp->rp_stride * PS_RING_NSLOTS;
+	p = mmap(NULL, rp->rp_len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_ANON, -1, 0);
+	if (p == MAP_FAILED) {
+		free(rp);
+		return -1;
+	}
+	rp->rp_base = p;
+	rp->rp_slot = -1;
+	rp->rp_fd = -1;
+
+	/* Until we're told otherwise, the first record needs a doorbell. */
+	for (slot = 0; slot < PS_RING_NSLOTS; slot++)
+		ps_ring_hdr(rp, slot)->prh_wait = 1;
+
+	ctx->ps_rings = rp;
+	return 0;
+}
+
+/* Slot 0 is for the network proxy started by the manager. */
+int
+ps_ring_alloc(struct dhcpcd_ctx *ctx)
+{
+	struct ps_ringpool *rp = ctx->ps_rings;
+	int slot, last;
+
+	if (rp == NULL)
+		return -1;
+	if (ctx->options & DHCPCD_PRIVSEPROOT) {
+		slot = 1;
+		last = PS_RING_NSLOTS;
+	} else {
+		slot = 0;
+		last = 1;
+	}
+	for (; slot < last; slot++) {
+		if (!rp->rp_used[slot]) {
+			rp->rp_used[slot] = true;
+			return slot;
+		}
+	}
+	return -1;
+}
+
+void
+ps_ring_release(struct dhcpcd_ctx *ctx, int slot)
+{
+	struct ps_ringpool *rp = ctx->ps_rings;
+
+	if (rp != NULL && slot != -1)
+		rp->rp_used[slot] = false;
+}
+
+/* Called in a new process which is not the privileged proxy. */
+void
+ps_ring_forked(struct dhcpcd_ctx *ctx, int slot, int fd)
+{
+	struct ps_ringpool *rp = ctx->ps_rings;
+	struct ps_ringhdr *hdr;
+	size_t off;
+
+	if (rp == NULL)
+		return;
+	if (slot == -1) {
+		ps_ring_free(ctx);
+		return;
+	}
+
+	off = rp->rp_stride * (size_t)slot;
+	if (off != 0)
+		munmap(rp->rp_base, off);
+	off += rp->rp_stride;
+	if (off != rp->rp_len)
+		munmap(rp->rp_base + off, rp->rp_len - off);
+
+	/* A previous helper may have used the slot. */
+	hdr = ps_ring_hdr(rp, (unsigned int)slot);
+	rp->rp_slot = slot;
+	rp->rp_head = __atomic_load_n(&hdr->prh_head, __ATOMIC_ACQUIRE);
+	rp->rp_fd = fd;
+}
+
+void
+ps_ring_free(struct dhcpcd_ctx *ctx)
+{
+	struct ps_ringpool *rp = ctx->ps_rings;
+
+	if (rp == NULL)
+		return;
+	/* munmap(2) does not mind parts of the range being gone. */
+	munmap(rp->rp_base, rp->rp_len);
+	free(rp);
+	ctx->ps_rings = NULL;
+}
+
+static void
+ps_ring_copyin(uint8_t *data, uint32_t pos, const void *src, size_t len)
+{
+	size_t off = pos & PS_RING_MASK, n = PS_RING_SIZE - off;
+
+	if (n > len)
+		n = len;
+	memcpy(data + off, src, n);
+	if (len != n)
+		memcpy(data, (const uint8_t *)src + n, len - n);
+}
+
+static void
+ps_ring_copyout(const uint8_t *data, uint32_t pos, void *dst, size_t len)
+{
+	size_t off = pos & PS_RING_MASK, n = PS_RING_SIZE - off;
+
+	if (n > len)
+		n = len;
+	memcpy(dst, data + off, n);
+	if (len != n)
+		memcpy((uint8_t *)dst + n, data, len - n);
+}
+
+/*
+ * Append a record if fd is the one our ring stands in for.
+ * When there is no room the caller uses the socket instead, so a packet
+ * can overtake those still in the ring, which is no worse than the
+ * network itself does to us.
+ */
+ssize_t
+ps_ring_writev(struct dhcpcd_ctx *ctx, int fd,
+    const struct iovec *iov, int iovcnt)
+{
+	struct ps_ringpool *rp = ctx->ps_rings;
+	struct ps_ringhdr *hdr;
+	uint8_t *data;
+	uint32_t len, tail, used, pos;
+	size_t tlen = 0, need;
+	int i;
+
+	if (rp == NULL || rp->rp_slot == -1 || fd != rp->rp_fd)
+		return -1;
+	hdr = ps_ring_hdr(rp, (unsigned int)rp->rp_slot);
+	data = ps_ring_data(rp, (unsigned int)rp->rp_slot);
+
+	if (__atomic_load_n(&hdr->prh_closed, __ATOMIC_ACQUIRE)) {
+		logwarnx("%s: closed by the manager", __func__);
+		ps_ring_free(ctx);
+		return -1;
+	}
+
+	for (i = 0; i < iovcnt; i++)
+		tlen += iov[i].iov_len;
+	if (tlen > sizeof(struct ps_msg))
+		return -1;
+	len = (uint32_t)tlen;
+	need = PS_RING_ALIGN(sizeof(len) + tlen);
+
+	tail = __atomic_load_n(&hdr->prh_tail, __ATOMIC_ACQUIRE);
+	used = rp->rp_head - tail;
+	if (used > PS_RING_SIZE || need > PS_RING_SIZE - used)
+		return -1;
+
+	pos = rp->rp_head;
+	ps_ring_copyin(data, pos, &len, sizeof(len));
+	pos += (uint32_t)sizeof(len);
+	for (i = 0; i < iovcnt; i++) {
+		ps_ring_copyin(data, pos, iov[i].iov_base, iov[i].iov_len);
+		pos += (uint32_t)iov[i].iov_len;
+	}
+	rp->rp_head += (uint32_t)need;
+	__atomic_store_n(&hdr->prh_head, rp->rp_head, __ATOMIC_SEQ_CST);
+
+	if (__atomic_exchange_n(&hdr->prh_wait, 0, __ATOMIC_SEQ_CST) != 0) {
+		struct ps_msghdr psm = {
+			.ps_cmd = PS_RING,
+			.ps_flags = (unsigned long)rp->rp_slot,
+		};
+
+		/* The record is in the ring, so just try the doorbell
+		 * again with the next one. */
+		if (write(fd, &psm, sizeof(psm)) == -1) {
+			logerr("%s: write", __func__);
+			__atomic_store_n(&hdr->prh_wait, 1, __ATOMIC_SEQ_CST);
+		}
+	}
+	return (ssize_t)tlen;
+}
+
+/* The manager heard the doorbell for a slot over fd. */
+ssize_t
+ps_ring_drain(struct dhcpcd_ctx *ctx, int fd, const struct ps_msghdr *bell,
+    ssize_t (*callback)(void *, struct ps_msghdr *, struct msghdr *),
+    void *cbctx)
+{
+	struct ps_ringpool *rp = ctx->ps_rings;
+	struct ps_ringhdr *hdr;
+	const uint8_t *data;
+	struct ps_msg psm;
+	struct iovec iov[1];
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 1 };
+	unsigned int slot;
+	uint32_t *tail, head, avail, len;
+
+	/* Only slot 0 may come from the network proxy and
+	 * only the other slots via ps_data_fd. */
+	if (bell->ps_flags >= PS_RING_NSLOTS) {
+		errno = EINVAL;
+		return -1;
+	}
+	slot = (unsigned int)bell->ps_flags;
+	if (rp == NULL || callback == NULL || !IN_PRIVSEP_SE(ctx) ||
+	    (fd == ctx->ps_data_fd) != (slot != 0))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	hdr = ps_ring_hdr(rp, slot);
+	data = ps_ring_data(rp, slot);
+	tail = &rp->rp_tail[slot];
+	if (__atomic_load_n(&hdr->prh_closed, __ATOMIC_RELAXED))
+		return 0;
+
+	for (;;) {
+		/* Don't act on anything more once told to exit,
+		 * leave the rest on the ring for the next wakeup. */
+		if (eloop_exiting(ctx->eloop) ||
+		    ctx->options & DHCPCD_EXITING)
+		{
+			__atomic_store_n(&hdr->prh_wait, 1, __ATOMIC_SEQ_CST);
+			break;
+		}
+
+		head = __atomic_load_n(&hdr->prh_head, __ATOMIC_ACQUIRE);
+		if (head == *tail) {
+			/* Ask for the doorbell, then look again in case
+			 * the helper wrote just before seeing that. */
+			__atomic_store_n(&hdr->prh_wait, 1, __ATOMIC_SEQ_CST);
+			head = __atomic_load_n(&hdr->prh_head,
+			    __ATOMIC_SEQ_CST);
+			if (head == *tail)
+				break;
+			__atomic_store_n(&hdr->prh_wait, 0, __ATOMIC_RELAXED);
+		}
+
+		avail = head - *tail;
+		if (avail > PS_RING_SIZE || avail < sizeof(len))
+			goto invalid;
+		ps_ring_copyout(data, *tail, &len, sizeof(len));
+		if (len < sizeof(psm.psm_hdr) || len > sizeof(psm) ||
+		    PS_RING_ALIGN(sizeof(len) + len) > avail)
+			goto invalid;
+		ps_ring_copyout(data, *tail + (uint32_t)sizeof(len), &psm, len);
+		*tail += (uint32_t)PS_RING_ALIGN(sizeof(len) + len);
+		__atomic_store_n(&hdr->prh_tail, *tail, __ATOMIC_RELEASE);
+
+		/* Process control only comes over the socket. */
+		if (psm.psm_hdr.ps_cmd & (PS_START | PS_STOP) ||
+		    psm.psm_hdr.ps_cmd == PS_RING)
+			goto invalid;
+		if (ps_unrollmsg(&msg, &psm.psm_hdr, psm.psm_data,
+		    len - sizeof(psm.psm_hdr)) == -1)
+			goto invalid;
+
+		errno = 0;
+		if (callback(cbctx, &psm.psm_hdr, &msg) == -1)
+			logerr(__func__);
+	}
+	return 0;
+
+invalid:
+	logerrx("%s: slot %u: invalid record, closing ring", __func__, slot);
+	__atomic_store_n(&hdr->prh_closed, 1, __ATOMIC_RELEASE);
+	return 0;
+}
@@ -51,6 +51,7 @@
 #include "eloop.h"
 #include "if.h"
 #include "ipv6nd.h"
+#include "lease.h"
 #include "logerr.h"
 #include "privsep.h"
 #include "sa.h"
@@ -64,15 +65,166 @@ struct psr_error
 	int psr_errno;
 	char psr_pad[sizeof(ssize_t) - sizeof(int)];
 	size_t psr_datalen;
+	uint16_t psr_rid;
+	uint8_t psr_pad2[sizeof(size_t) - sizeof(uint16_t)];
 };
 
 struct psr_ctx {
 	struct dhcpcd_ctx *psr_ctx;
 	struct psr_error psr_error;
+	uint16_t psr_rid;
 	size_t psr_datalen;
 	void *psr_data;
 };
 
+/*
+ * A request sent to the root process whose reply is handled by a callback
+ * rather than waiting for it.
+ * The root process handles requests in order, but replies to requests
+ * we wait for can be interleaved so each reply carries the request id.
+ */
+struct psr_request {
+	TAILQ_ENTRY(psr_request) next;
+	uint16_t psr_rid;
+	bool psr_done;
+	ssize_t psr_result;
+	int psr_errno;
+	void (*psr_cb)(void *, ssize_t, int);
+	void *psr_cbarg;
+};
+
+/* Limit the replies the root process can queue for us. */
+#define	PSR_REQUESTS_MAX	32
+
+static uint16_t
+ps_root_nextrid(struct dhcpcd_ctx *ctx)
+{
+
+	/* 0 is reserved for messages which are not replied to. */
+	if (++ctx->ps_root_rid == 0)
+		ctx->ps_root_rid = 1;
+	return ctx->ps_root_rid;
+}
+
+ssize_t
+ps_root_sendmsg(struct dhcpcd_ctx *ctx, uint16_t cmd, unsigned long flags,
+    const struct msghdr *msg)
+{
+	struct ps_msghdr psm = {
+		.ps_cmd = cmd,
+		.ps_rid = ps_root_nextrid(ctx),
+		.ps_flags = flags,
+	};
+	size_t i;
+
+	for (i = 0; i < (size_t)msg->msg_iovlen; i++)
+		psm.ps_datalen += msg->msg_iov[i].iov_len;
+	return ps_sendpsmmsg(ctx, ctx->ps_root->psp_fd, &psm, msg);
+}
+
+ssize_t
+ps_root_sendcmd(struct dhcpcd_ctx *ctx, uint16_t cmd, unsigned long flags,
+    const void *data, size_t len)
+{
+	struct ps_msghdr psm = {
+		.ps_cmd = cmd,
+		.ps_rid = ps_root_nextrid(ctx),
+		.ps_flags = flags,
+	};
+
+	return ps_sendpsmdata(ctx, ctx->ps_root->psp_fd, &psm, data, len);
+}
+
+static void
+ps_root_runrequests(void *arg)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct psr_request *psr, *psrn;
+
+	TAILQ_FOREACH_SAFE(psr, &ctx->ps_root_requests, next, psrn) {
+		if (!psr->psr_done)
+			continue;
+		TAILQ_REMOVE(&ctx->ps_root_requests, psr, next);
+		ctx->ps_root_nrequests--;
+		if (psr->psr_cb != NULL)
+			psr->psr_cb(psr->psr_cbarg,
+			    psr->psr_result, psr->psr_errno);
+		free(psr);
+	}
+}
+
+/* Read a reply to a request we are not waiting for. */
+static ssize_t
+ps_root_readrequest(struct dhcpcd_ctx *ctx, bool defer)
+{
+	struct psr_error psr_error;
+	struct psr_request *psr;
+	ssize_t len;
+
+	/* Any data is discarded by the short read. */
+	len = recv(ctx->ps_root->psp_fd, &psr_error, sizeof(psr_error), 0);
+	if (len == -1)
+		return -1;
+	if ((size_t)len < sizeof(psr_error)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	TAILQ_FOREACH(psr, &ctx->ps_root_requests, next) {
+		if (psr->psr_rid == psr_error.psr_rid)
+			break;
+	}
+	/* A reply to a request we stopped waiting for,
+	 * such as when a signal ended the wait early. */
+	if (psr == NULL) {
+		logdebugx("%s: discarding reply %u",
+		    __func__, psr_error.psr_rid);
+		return 0;
+	}
+
+	psr->psr_done = true;
+	psr->psr_result = psr_error.psr_result;
+	psr->psr_errno = psr_error.psr_errno;
+
+	/* We could be waiting for another reply, so run the callback
+	 * once we are back in the main loop. */
+	if (defer)
+		eloop_timeout_add_sec(ctx->eloop, 0, ps_root_runrequests, ctx);
+	else
+		ps_root_runrequests(ctx);
+	return 0;
+}
+
+static void
+ps_root_recvreply(void *arg, unsigned short events)
+{
+	struct dhcpcd_ctx *ctx = arg;
+
+	if (events != ELE_READ)
+		logerrx("%s: unexpected event 0x%04x", __func__, events);
+
+	for (;;) {
+		if (ps_root_readrequest(ctx, false) == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				logerr(__func__);
+			break;
+		}
+	}
+}
+
+void
+ps_root_freerequests(struct dhcpcd_ctx *ctx)
+{
+	struct psr_request *psr;
+
+	while ((psr = TAILQ_FIRST(&ctx->ps_root_requests)) != NULL) {
+		TAILQ_REMOVE(&ctx->ps_root_requests, psr, next);
+		free(psr);
+	}
+	ctx->ps_root_nrequests = 0;
+	eloop_timeout_delete(ctx->eloop, ps_root_runrequests, ctx);
+}
+
 static void
 ps_root_readerrorcb(void *arg, unsigned short events)
 {
@@ -97,6 +249,20 @@ ps_root_readerrorcb(void *arg, unsigned short events)
 		goto out;			\
 	} while (0 /* CONSTCOND */)
 
+	len = recv(ctx->ps_root->psp_fd,
+	    psr_error, sizeof(*psr_error), MSG_PEEK);
+	if (len == -1)
+		PSR_ERROR(errno);
+	else if ((size_t)len < sizeof(*psr_error))
+		PSR_ERROR(EINVAL);
+
+	/* Not our reply, keep waiting. */
+	if (psr_error->psr_rid != psr_ctx->psr_rid) {
+		if (ps_root_readrequest(ctx, true) == -1)
+			PSR_ERROR(errno);
+		return;
+	}
+
 	len = readv(ctx->ps_root->psp_fd, iov, __arraycount(iov));
 	if (len == -1)
 		PSR_ERROR(errno);
@@ -112,7 +278,7 @@ ssize_t
 ps_root_readerror(struct dhcpcd_ctx *ctx, void *data, size_t len)
 {
 	struct psr_ctx psr_ctx = {
-	    .psr_ctx = ctx,
+	    .psr_ctx = ctx, .psr_rid = ctx->ps_root_rid,
 	    .psr_data = data, .psr_datalen = len,
 	};
 
@@ -128,6 +294,45 @@ ps_root_readerror(struct dhcpcd_ctx *ctx, void *data, size_t len)
 	return psr_ctx.psr_error.psr_result;
 }
 
+/*
+ * Send a request to the root process and call cb with the result
+ * from the main loop, so we don't block while the root process works.
+ * cb can be NULL if the result is of no interest.
+ */
+ssize_t
+ps_root_sendcmdcb(struct dhcpcd_ctx *ctx, uint16_t cmd, unsigned long flags,
+    const void *data, size_t len,
+    void (*cb)(void *, ssize_t, int), void *cbarg)
+{
+	struct psr_request *psr;
+	ssize_t result;
+
+	/* Too many replies in flight, just wait for this one. */
+	if (ctx->ps_root_nrequests >= PSR_REQUESTS_MAX) {
+		if (ps_root_sendcmd(ctx, cmd, flags, data, len) == -1)
+			return -1;
+		result = ps_root_readerror(ctx, NULL, 0);
+		if (cb != NULL)
+			cb(cbarg, result, errno);
+		return 0;
+	}
+
+	psr = malloc(sizeof(*psr));
+	if (psr == NULL)
+		return -1;
+	if (ps_root_sendcmd(ctx, cmd, flags, data, len) == -1) {
+		free(psr);
+		return -1;
+	}
+	psr->psr_rid = ctx->ps_root_rid;
+	psr->psr_done = false;
+	psr->psr_cb = cb;
+	psr->psr_cbarg = cbarg;
+	TAILQ_INSERT_TAIL(&ctx->ps_root_requests, psr, next);
+	ctx->ps_root_nrequests++;
+	return 0;
+}
+
 #ifdef PRIVSEP_GETIFADDRS
 static void
 ps_root_mreaderrorcb(void *arg, unsigned short events)
@@ -152,6 +357,13 @@ ps_root_mreaderrorcb(void *arg, unsigned short events)
 	else if ((size_t)len < sizeof(*psr_error))
 		PSR_ERROR(EINVAL);
 
+	/* Not our reply, keep waiting. */
+	if (psr_error->psr_rid != psr_ctx->psr_rid) {
+		if (ps_root_readrequest(ctx, true) == -1)
+			PSR_ERROR(errno);
+		return;
+	}
+
 	if (psr_error->psr_datalen > SSIZE_MAX)
 		PSR_ERROR(ENOBUFS);
 	else if (psr_error->psr_datalen != 0) {
@@ -178,7 +390,7 @@ ssize_t
 ps_root_mreaderror(struct dhcpcd_ctx *ctx, void **data, size_t *len)
 {
 	struct psr_ctx psr_ctx = {
-	    .psr_ctx = ctx,
+	    .psr_ctx = ctx, .psr_rid = ctx->ps_root_rid,
 	};
 
 	if (eloop_event_add(ctx->ps_eloop, ctx->ps_root->psp_fd, ELE_READ,
@@ -197,13 +409,14 @@ ps_root_mreaderror(struct dhcpcd_ctx *ctx, void **data, size_t *len)
 #endif
 
 static ssize_t
-ps_root_writeerror(struct dhcpcd_ctx *ctx, ssize_t result,
+ps_root_writeerror(struct dhcpcd_ctx *ctx, uint16_t rid, ssize_t result,
     void *data, size_t len)
 {
 	struct psr_error psr = {
 		.psr_result = result,
 		.psr_errno = errno,
 		.psr_datalen = len,
+		.psr_rid = rid,
 	};
 	struct iovec iov[] = {
 		{ .iov_base = &psr, .iov_len = sizeof(psr) },
@@ -211,7 +424,8 @@ ps_root_writeerror(struct dhcpcd_ctx *ctx, ssize_t result,
 	};
 
 #ifdef PRIVSEP_DEBUG
-	logdebugx("%s: result %zd errno %d", __func__, result, errno);
+	logdebugx("%s: rid %u result %zd errno %d",
+	    __func__, rid, result, errno);
 #endif
 
 	return writev(ctx->ps_root->psp_fd, iov, __arraycount(iov));
@@ -262,35 +476,6 @@ ps_root_doioctl(unsigned long req, void *data, size_t len)
 	return err;
 }
 
-static ssize_t
-ps_root_run_script(struct dhcpcd_ctx *ctx, const void *data, size_t len)
-{
-	const char *envbuf = data;
-	char * const argv[] = { ctx->script, NULL };
-	pid_t pid;
-	int status;
-
-	if (len == 0)
-		return 0;
-
-	if (script_buftoenv(ctx, UNCONST(envbuf), len) == NULL)
-		return -1;
-
-	pid = script_exec(argv, ctx->script_env);
-	if (pid == -1)
-		return -1;
-
-	/* Wait for the script to finish */
-	while (waitpid(pid, &status, 0) == -1) {
-		if (errno != EINTR) {
-			logerr(__func__);
-			status = 0;
-			break;
-		}
-	}
-	return status;
-}
-
 static bool
 ps_root_validpath(const struct dhcpcd_ctx *ctx, uint16_t cmd, const char *path)
 {
@@ -325,7 +510,7 @@ ps_root_validpath(const struct dhcpcd_ctx *ctx, uint16_t cmd, const char *path)
 }
 
 static ssize_t
-ps_root_dowritefile(const struct dhcpcd_ctx *ctx,
+ps_root_dowritefile(struct dhcpcd_ctx *ctx, uint16_t cmd,
     mode_t mode, void *data, size_t len)
 {
 	char *file = data, *nc;
@@ -336,9 +521,12 @@ ps_root_dowritefile(const struct dhcpcd_ctx *ctx,
 		return -1;
 	}
 
-	if (!ps_root_validpath(ctx, PS_WRITEFILE, file))
+	if (!ps_root_validpath(ctx, cmd, file))
 		return -1;
 	nc++;
+	if (cmd == PS_LEASEWRITE)
+		return lease_write(ctx, file, mode, nc,
+		    len - (size_t)(nc - file));
 	return writefile(file, mode, nc, len - (size_t)(nc - file));
 }
 
@@ -538,7 +726,9 @@ ps_root_recvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 		}
 		break;
 	case PS_SCRIPT:
-		err = ps_root_run_script(ctx, data, len);
+		/* Queue the script and reply straight away so the
+		 * manager is not blocked waiting for it to finish. */
+		err = script_queue(ctx, data, len);
 		break;
 	case PS_STOPPROCS:
 		ctx->options |= DHCPCD_EXITING;
@@ -567,8 +757,9 @@ ps_root_recvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 		}
 		break;
 	case PS_WRITEFILE:
-		err = ps_root_dowritefile(ctx, (mode_t)psm->ps_flags,
-		    data, len);
+	case PS_LEASEWRITE:
+		err = ps_root_dowritefile(ctx, psm->ps_cmd,
+		    (mode_t)psm->ps_flags, data, len);
 		break;
 	case PS_FILEMTIME:
 		err = filemtime(data, &mtime);
@@ -577,6 +768,42 @@ ps_root_recvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 			rlen = sizeof(mtime);
 		}
 		break;
+	case PS_LEASEREAD:
+		if (!ps_root_validpath(ctx, psm->ps_cmd, data)) {
+			err = -1;
+			break;
+		}
+		err = lease_read(ctx, data, buf, sizeof(buf));
+		if (err != -1) {
+			rdata = buf;
+			rlen = (size_t)err;
+		}
+		break;
+	case PS_LEASEMTIME:
+		if (!ps_root_validpath(ctx, psm->ps_cmd, data)) {
+			err = -1;
+			break;
+		}
+		err = lease_mtime(ctx, data, &mtime);
+		if (err != -1) {
+			rdata = &mtime;
+			rlen = sizeof(mtime);
+		}
+		break;
+	case PS_LEASEUNLINK:
+		if (!ps_root_validpath(ctx, psm->ps_cmd, data)) {
+			err = -1;
+			break;
+		}
+		err = lease_unlink(ctx, data);
+		break;
+	case PS_LEASELIST:
+		err = lease_list(ctx, (size_t)psm->ps_flags, buf, sizeof(buf));
+		if (err != -1) {
+			rdata = buf;
+			rlen = (size_t)err;
+		}
+		break;
 	case PS_LOGREOPEN:
 		err = logopen(ctx->logfile);
 		break;
@@ -613,7 +840,8 @@ ps_root_recvmsgcb(void *arg, struct ps_msghdr *psm, struct msghdr *msg)
 		break;
 	}
 
-	err = ps_root_writeerror(ctx, err, rlen != 0 ? rdata : 0, rlen);
+	err = ps_root_writeerror(ctx, psm->ps_rid, err,
+	    rlen != 0 ? rdata : 0, rlen);
 	if (free_rdata)
 		free(rdata);
 	return err;
@@ -736,6 +964,8 @@ ps_root_signalcb(int sig, void *arg)
 		return;
 
 	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		if (script_reap(ctx, pid, status))
+			continue;
 		psp = ps_findprocesspid(ctx, pid);
 		if (psp != NULL) {
 			ifname = psp->psp_ifname;
@@ -903,6 +1133,11 @@ ps_root_start(struct dhcpcd_ctx *ctx)
 	    ps_root_dispatch, ctx) == -1)
 		return 1;
 
+	/* Replies to requests we don't wait for. */
+	if (eloop_event_add(ctx->eloop, psp->psp_fd, ELE_READ,
+	    ps_root_recvreply, ctx) == -1)
+		return -1;
+
 	return pid;
 }
 
@@ -922,6 +1157,7 @@ ps_root_stop(struct dhcpcd_ctx *ctx)
 	    ctx->eloop == NULL)
 		return 0;
 
+	ps_root_freerequests(ctx);
 	if (ps_stopprocess(ctx->ps_root) == -1)
 		return -1;
 	ctx->ps_root = NULL;
@@ -935,35 +1171,43 @@ ps_root_stopprocesses(struct dhcpcd_ctx *ctx)
 	if (!(IN_PRIVSEP_SE(ctx)))
 		return 0;
 
-	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, PS_STOPPROCS, 0,
-	    NULL, 0) == -1)
+	if (ps_root_sendcmd(ctx, PS_STOPPROCS, 0, NULL, 0) == -1)
 		return -1;
 	return ps_root_readerror(ctx, NULL, 0);
 }
 
+static void
+ps_root_scriptcb(__unused void *arg, ssize_t result, int error)
+{
+
+	if (result == -1) {
+		errno = error;
+		logerr("ps_root_script");
+	}
+}
+
 ssize_t
 ps_root_script(struct dhcpcd_ctx *ctx, const void *data, size_t len)
 {
 
-	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, PS_SCRIPT,
-	    0, data, len) == -1)
-		return -1;
-	return ps_root_readerror(ctx, NULL, 0);
+	/* The root process just queues the script, so there is
+	 * no need to wait for that. */
+	return ps_root_sendcmdcb(ctx, PS_SCRIPT, 0, data, len,
+	    ps_root_scriptcb, ctx);
 }
 
 ssize_t
 ps_root_ioctl(struct dhcpcd_ctx *ctx, ioctl_request_t req, void *data,
     size_t len)
 {
-	int fd = ctx->ps_root->psp_fd;
 #ifdef IOCTL_REQUEST_TYPE
 	unsigned long ulreq = 0;
 
 	memcpy(&ulreq, &req, sizeof(req));
-	if (ps_sendcmd(ctx, fd, PS_IOCTL, ulreq, data, len) == -1)
+	if (ps_root_sendcmd(ctx, PS_IOCTL, ulreq, data, len) == -1)
 		return -1;
 #else
-	if (ps_sendcmd(ctx, fd, PS_IOCTL, req, data, len) == -1)
+	if (ps_root_sendcmd(ctx, PS_IOCTL, req, data, len) == -1)
 		return -1;
 #endif
 	return ps_root_readerror(ctx, data, len);
@@ -973,7 +1217,7 @@ ssize_t
 ps_root_unlink(struct dhcpcd_ctx *ctx, const char *file)
 {
 
-	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, PS_UNLINK, 0,
+	if (ps_root_sendcmd(ctx, PS_UNLINK, 0,
 	    file, strlen(file) + 1) == -1)
 		return -1;
 	return ps_root_readerror(ctx, NULL, 0);
@@ -983,29 +1227,100 @@ ssize_t
 ps_root_readfile(struct dhcpcd_ctx *ctx, const char *file,
     void *data, size_t len)
 {
-	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, PS_READFILE, 0,
+	if (ps_root_sendcmd(ctx, PS_READFILE, 0,
 	    file, strlen(file) + 1) == -1)
 		return -1;
 	return ps_root_readerror(ctx, data, len);
 }
 
-ssize_t
-ps_root_writefile(struct dhcpcd_ctx *ctx, const char *file, mode_t mode,
+/* Pack file and data as file\0data. */
+static ssize_t
+ps_root_filedata(char *buf, size_t buflen, const char *file,
     const void *data, size_t len)
 {
-	char buf[PS_BUFLEN];
 	size_t flen;
 
-	flen = strlcpy(buf, file, sizeof(buf));
+	flen = strlcpy(buf, file, buflen);
 	flen += 1;
-	if (flen > sizeof(buf) || flen + len > sizeof(buf)) {
+	if (flen > buflen || flen + len > buflen) {
 		errno = ENOBUFS;
 		return -1;
 	}
 	memcpy(buf + flen, data, len);
+	return (ssize_t)(flen + len);
+}
+
+ssize_t
+ps_root_writefile(struct dhcpcd_ctx *ctx, const char *file, mode_t mode,
+    const void *data, size_t len)
+{
+	char buf[PS_BUFLEN];
+	ssize_t blen;
+
+	blen = ps_root_filedata(buf, sizeof(buf), file, data, len);
+	if (blen == -1)
+		return -1;
+	if (ps_root_sendcmd(ctx, PS_WRITEFILE, mode,
+	    buf, (size_t)blen) == -1)
+		return -1;
+	return ps_root_readerror(ctx, NULL, 0);
+}
+
+static void
+ps_root_writeleasecb(__unused void *arg, ssize_t result, int error)
+{
+
+	if (result == -1) {
+		errno = error;
+		logerr("ps_root_writelease");
+	}
+}
+
+ssize_t
+ps_root_writelease(struct dhcpcd_ctx *ctx, const char *file, mode_t mode,
+    const void *data, size_t len)
+{
+	char buf[PS_BUFLEN];
+	ssize_t blen;
+
+	blen = ps_root_filedata(buf, sizeof(buf), file, data, len);
+	if (blen == -1)
+		return -1;
 
-	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, PS_WRITEFILE, mode,
-	    buf, flen + len) == -1)
+	/* The lease store keeps a copy and writes it later,
+	 * so there is no need to wait. */
+	if (ps_root_sendcmdcb(ctx, PS_LEASEWRITE, mode, buf, (size_t)blen,
+	    ps_root_writeleasecb, ctx) == -1)
+		return -1;
+	return (ssize_t)len;
+}
+
+ssize_t
+ps_root_readlease(struct dhcpcd_ctx *ctx, const char *file,
+    void *data, size_t len)
+{
+	if (ps_root_sendcmd(ctx, PS_LEASEREAD, 0,
+	    file, strlen(file) + 1) == -1)
+		return -1;
+	return ps_root_readerror(ctx, data, len);
+}
+
+ssize_t
+ps_root_leasemtime(struct dhcpcd_ctx *ctx, const char *file, time_t *time)
+{
+
+	if (ps_root_sendcmd(ctx, PS_LEASEMTIME, 0,
+	    file, strlen(file) + 1) == -1)
+		return -1;
+	return ps_root_readerror(ctx, time, sizeof(*time));
+}
+
+ssize_t
+ps_root_unlinklease(struct dhcpcd_ctx *ctx, const char *file)
+{
+
+	if (ps_root_sendcmd(ctx, PS_LEASEUNLINK, 0,
+	    file, strlen(file) + 1) == -1)
 		return -1;
 	return ps_root_readerror(ctx, NULL, 0);
 }
@@ -1014,20 +1329,37 @@ ssize_t
 ps_root_filemtime(struct dhcpcd_ctx *ctx, const char *file, time_t *time)
 {
 
-	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, PS_FILEMTIME, 0,
+	if (ps_root_sendcmd(ctx, PS_FILEMTIME, 0,
 	    file, strlen(file) + 1) == -1)
 		return -1;
 	return ps_root_readerror(ctx, time, sizeof(*time));
 }
 
 ssize_t
-ps_root_logreopen(struct dhcpcd_ctx *ctx)
+ps_root_leaselist(struct dhcpcd_ctx *ctx, size_t off, void *data, size_t len)
 {
 
-	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, PS_LOGREOPEN, 0,
-	    NULL, 0) == -1)
+	if (ps_root_sendcmd(ctx, PS_LEASELIST, off, NULL, 0) == -1)
 		return -1;
-	return ps_root_readerror(ctx, NULL, 0);
+	return ps_root_readerror(ctx, data, len);
+}
+
+static void
+ps_root_logreopencb(__unused void *arg, ssize_t result, int error)
+{
+
+	if (result == -1) {
+		errno = error;
+		logerr("ps_root_logreopen");
+	}
+}
+
+ssize_t
+ps_root_logreopen(struct dhcpcd_ctx *ctx)
+{
+
+	return ps_root_sendcmdcb(ctx, PS_LOGREOPEN, 0, NULL, 0,
+	    ps_root_logreopencb, ctx);
 }
 
 #ifdef PRIVSEP_GETIFADDRS
@@ -1041,8 +1373,7 @@ ps_root_getifaddrs(struct dhcpcd_ctx *ctx, struct ifaddrs **ifahead)
 	size_t len;
 	ssize_t err;
 
-	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd,
-	    PS_GETIFADDRS, 0, NULL, 0) == -1)
+	if (ps_root_sendcmd(ctx, PS_GETIFADDRS, 0, NULL, 0) == -1)
 		return -1;
 	err = ps_root_mreaderror(ctx, &buf, &len);
 
@@ -1116,7 +1447,7 @@ ssize_t
 ps_root_ip6forwarding(struct dhcpcd_ctx *ctx, const char *ifname)
 {
 
-	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, PS_IP6FORWARDING, 0,
+	if (ps_root_sendcmd(ctx, PS_IP6FORWARDING, 0,
 	    ifname, ifname != NULL ? strlen(ifname) + 1 : 0) == -1)
 		return -1;
 	return ps_root_readerror(ctx, NULL, 0);
@@ -1128,7 +1459,7 @@ int
 ps_root_getauthrdm(struct dhcpcd_ctx *ctx, uint64_t *rdm)
 {
 
-	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, PS_AUTH_MONORDM, 0,
+	if (ps_root_sendcmd(ctx, PS_AUTH_MONORDM, 0,
 	    rdm, sizeof(*rdm))== -1)
 		return -1;
 	return (int)ps_root_readerror(ctx, rdm, sizeof(*rdm));
@@ -1140,7 +1471,7 @@ int
 ps_root_dev_initialised(struct dhcpcd_ctx *ctx, const char *ifname)
 {
 
-	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, PS_DEV_INITTED, 0,
+	if (ps_root_sendcmd(ctx, PS_DEV_INITTED, 0,
 	    ifname, strlen(ifname) + 1)== -1)
 		return -1;
 	return (int)ps_root_readerror(ctx, NULL, 0);
@@ -1150,7 +1481,7 @@ int
 ps_root_dev_listening(struct dhcpcd_ctx * ctx)
 {
 
-	if (ps_sendcmd(ctx, ctx->ps_root->psp_fd, PS_DEV_LISTENING,
+	if (ps_root_sendcmd(ctx, PS_DEV_LISTENING,
 	    0, NULL, 0) == -1)
 		return -1;
 	return (int)ps_root_readerror(ctx, NULL, 0);
@@ -39,6 +39,13 @@ pid_t ps_root_start(struct dhcpcd_ctx *ctx);
 int ps_root_stop(struct dhcpcd_ctx *ctx);
 void ps_root_signalcb(int, void *);
 
+ssize_t ps_root_sendcmd(struct dhcpcd_ctx *, uint16_t, unsigned long,
+    const void *, size_t);
+ssize_t ps_root_sendmsg(struct dhcpcd_ctx *, uint16_t, unsigned long,
+    const struct msghdr *);
+ssize_t ps_root_sendcmdcb(struct dhcpcd_ctx *, uint16_t, unsigned long,
+    const void *, size_t, void (*)(void *, ssize_t, int), void *);
+void ps_root_freerequests(struct dhcpcd_ctx *);
 ssize_t ps_root_readerror(struct dhcpcd_ctx *, void *, size_t);
 ssize_t ps_root_mreaderror(struct dhcpcd_ctx *, void **, size_t *);
 ssize_t ps_root_ioctl(struct dhcpcd_ctx *, ioctl_request_t, void *, size_t);
@@ -48,6 +55,12 @@ ssize_t ps_root_filemtime(struct dhcpcd_ctx *, const char *, time_t *);
 ssize_t ps_root_readfile(struct dhcpcd_ctx *, const char *, void *, size_t);
 ssize_t ps_root_writefile(struct dhcpcd_ctx *, const char *, mode_t,
     const void *, size_t);
+ssize_t ps_root_writelease(struct dhcpcd_ctx *, const char *, mode_t,
+    const void *, size_t);
+ssize_t ps_root_readlease(struct dhcpcd_ctx *, const char *, void *, size_t);
+ssize_t ps_root_leasemtime(struct dhcpcd_ctx *, const char *, time_t *);
+ssize_t ps_root_unlinklease(struct dhcpcd_ctx *, const char *);
+ssize_t ps_root_leaselist(struct dhcpcd_ctx *, size_t, void *, size_t);
 ssize_t ps_root_logreopen(struct dhcpcd_ctx *);
 ssize_t ps_root_script(struct dhcpcd_ctx *, const void *, size_t);
 ssize_t ps_root_stopprocesses(struct dhcpcd_ctx *);
@@ -67,6 +80,8 @@ ssize_t ps_root_ifignoregroup(struct dhcpcd_ctx *, const char *);
 #endif
 #ifdef __linux__
 ssize_t ps_root_sendnetlink(struct dhcpcd_ctx *, int, struct msghdr *);
+ssize_t ps_root_sendnetlinkbatch(struct dhcpcd_ctx *, int, void *, size_t,
+    int *, size_t);
 #endif
 
 #ifdef PLUGIN_DEV
@@ -70,8 +70,10 @@
 #include "dhcp6.h"
 #include "eloop.h"
 #include "ipv6nd.h"
+#include "lease.h"
 #include "logerr.h"
 #include "privsep.h"
+#include "script.h"
 
 #ifdef HAVE_CAPSICUM
 #include <sys/capsicum.h>
@@ -367,6 +369,11 @@ ps_startprocess(struct ps_process *psp,
 	}
 #endif
 
+#ifdef PRIVSEP_RING
+	if (flags & PSF_RING && psp->psp_ring == -1)
+		psp->psp_ring = ps_ring_alloc(ctx);
+#endif
+
 #ifdef HAVE_CAPSICUM
 	pid = pdfork(&psp->psp_pfd, PD_CLOEXEC);
 #else
@@ -437,9 +444,17 @@ ps_startprocess(struct ps_process *psp,
 		eloop_forked(ctx->ps_eloop);
 
 	pidfile_clean();
+	script_forked(ctx);
+	lease_forked(ctx);
 	ps_freeprocesses(ctx, psp);
 
 	if (ctx->ps_root != psp) {
+#ifdef PRIVSEP_RING
+		/* Helpers of root return data on ps_data_fd. */
+		ps_ring_forked(ctx, psp->psp_ring,
+		    ctx->options & DHCPCD_PRIVSEPROOT ?
+		    ctx->ps_data_fd : psp->psp_fd);
+#endif
 		ctx->options &= ~DHCPCD_PRIVSEPROOT;
 		ctx->ps_root = NULL;
 		if (ctx->ps_log_root_fd != -1) {
@@ -551,6 +566,13 @@ ps_start(struct dhcpcd_ctx *ctx)
 	    dhcpcd_signals, dhcpcd_signals_len,
 	    dhcpcd_signal_cb, ctx);
 
+#ifdef PRIVSEP_RING
+	/* Must be mapped before forking so every process shares it.
+	 * We can still use the sockets without it. */
+	if (ps_ring_init(ctx) == -1)
+		logerr("%s: ps_ring_init", __func__);
+#endif
+
 	switch (pid = ps_root_start(ctx)) {
 	case -1:
 		logerr("ps_root_start");
@@ -770,6 +792,9 @@ ps_freeprocess(struct ps_process *psp)
 
 	TAILQ_REMOVE(&ctx->ps_processes, psp, next);
 
+#ifdef PRIVSEP_RING
+	ps_ring_release(ctx, psp->psp_ring);
+#endif
 	if (psp->psp_fd != -1) {
 		eloop_event_delete(ctx->eloop, psp->psp_fd);
 		close(psp->psp_fd);
@@ -786,8 +811,10 @@ ps_freeprocess(struct ps_process *psp)
 		close(psp->psp_pfd);
 	}
 #endif
-	if (ctx->ps_root == psp)
+	if (ctx->ps_root == psp) {
+		ps_root_freerequests(ctx);
 		ctx->ps_root = NULL;
+	}
 	if (ctx->ps_inet == psp)
 		ctx->ps_inet = NULL;
 	if (ctx->ps_ctl == psp)
@@ -821,6 +848,9 @@ ps_free(struct dhcpcd_ctx *ctx)
 			ps_stopprocess(psp);
 		ps_freeprocess(psp);
 	}
+#ifdef PRIVSEP_RING
+	ps_ring_free(ctx);
+#endif
 }
 
 int
@@ -867,6 +897,23 @@ ps_unrollmsg(struct msghdr *msg, struct ps_msghdr *psm,
 	return 0;
 }
 
+static ssize_t
+ps_writev(struct dhcpcd_ctx *ctx, int fd, const struct iovec *iov, int iovcnt)
+{
+
+#ifdef PRIVSEP_RING
+	ssize_t len;
+
+	/* Use the socket if there is no ring or it's full. */
+	len = ps_ring_writev(ctx, fd, iov, iovcnt);
+	if (len != -1)
+		return len;
+#else
+	UNUSED(ctx);
+#endif
+	return writev(fd, iov, iovcnt);
+}
+
 ssize_t
 ps_sendpsmmsg(struct dhcpcd_ctx *ctx, int fd,
     struct ps_msghdr *psm, const struct msghdr *msg)
@@ -909,7 +956,7 @@ ps_sendpsmmsg(struct dhcpcd_ctx *ctx, int fd,
 	} else
 		iovlen = 1;
 
-	len = writev(fd, iov, iovlen);
+	len = ps_writev(ctx, fd, iov, iovlen);
 	if (len == -1) {
 		if (ctx->options & DHCPCD_FORKED &&
 		    !(ctx->options & DHCPCD_PRIVSEPROOT))
@@ -995,7 +1042,8 @@ ps_sendcmd(struct dhcpcd_ctx *ctx, int fd, uint16_t cmd, unsigned long flags,
 }
 
 static ssize_t
-ps_sendcmdmsg(int fd, uint16_t cmd, const struct msghdr *msg)
+ps_sendcmdmsg(struct dhcpcd_ctx *ctx, int fd, uint16_t cmd,
+    const struct msghdr *msg)
 {
 	struct ps_msghdr psm = { .ps_cmd = cmd };
 	uint8_t data[PS_BUFLEN], *p = data;
@@ -1030,7 +1078,7 @@ ps_sendcmdmsg(int fd, uint16_t cmd, const struct msghdr *msg)
 	iov[1].iov_len = psm.ps_namelen + psm.ps_controllen + psm.ps_datalen;
 	if (psm.ps_datalen != 0)
 		memcpy(p, msg->msg_iov[0].iov_base, psm.ps_datalen);
-	return writev(fd, iov, __arraycount(iov));
+	return ps_writev(ctx, fd, iov, __arraycount(iov));
 
 nobufs:
 	errno = ENOBUFS;
@@ -1068,7 +1116,7 @@ ps_recvmsg(struct dhcpcd_ctx *ctx, int rfd, unsigned short events,
 	}
 
 	iov[0].iov_len = (size_t)len;
-	len = ps_sendcmdmsg(wfd, cmd, &msg);
+	len = ps_sendcmdmsg(ctx, wfd, cmd, &msg);
 	if (len == -1) {
 		logerr("%s: ps_sendcmdmsg", __func__);
 		if (ctx->options & DHCPCD_FORKED)
@@ -1110,6 +1158,12 @@ ps_recvpsmsg(struct dhcpcd_ctx *ctx, int fd, unsigned short events,
 			stop = true;
 			len = 0;
 		}
+#ifdef PRIVSEP_RING
+		/* The data is waiting for us on the ring. */
+		if (psm.psm_hdr.ps_cmd == PS_RING)
+			return ps_ring_drain(ctx, fd, &psm.psm_hdr,
+			    callback, cbctx);
+#endif
 	}
 
 	if (stop) {
@@ -1176,6 +1230,9 @@ ps_newprocess(struct dhcpcd_ctx *ctx, struct ps_id *psid)
 #ifdef HAVE_CAPSICUM
 	psp->psp_pfd = -1;
 #endif
+#ifdef PRIVSEP_RING
+	psp->psp_ring = -1;
+#endif
 
 	if (!(ctx->options & DHCPCD_MANAGER))
 		strlcpy(psp->psp_ifname, ctx->ifv[0], sizeof(psp->psp_name));
@@ -34,6 +34,7 @@
 /* Start flags */
 #define	PSF_DROPPRIVS		0x01
 #define	PSF_ELOOP		0x02
+#define	PSF_RING		0x04	/* return data over a ring */
 
 /* Protocols */
 #define	PS_BOOTP		0x0001
@@ -55,6 +56,13 @@
 #define	PS_CTL_EOF		0x0019
 #define	PS_LOGREOPEN		0x0020
 #define	PS_STOPPROCS		0x0021
+#define	PS_ROUTEBATCH		0x0022	/* NETLINK only */
+#define	PS_RING			0x0023
+#define	PS_LEASEWRITE		0x0024
+#define	PS_LEASEREAD		0x0025
+#define	PS_LEASEMTIME		0x0026
+#define	PS_LEASEUNLINK		0x0027
+#define	PS_LEASELIST		0x0028
 
 /* Domains */
 #define	PS_ROOT			0x0101
@@ -124,6 +132,11 @@
 #endif
 
 #include "config.h"
+
+#if defined(PRIVSEP) && defined(HAVE_ATOMIC)
+#define PRIVSEP_RING
+#endif
+
 #include "arp.h"
 #include "dhcp.h"
 #include "dhcpcd.h"
@@ -149,7 +162,8 @@ struct ps_id {
 
 struct ps_msghdr {
 	uint16_t ps_cmd;
-	uint8_t ps_pad[sizeof(unsigned long) - sizeof(uint16_t)];
+	uint16_t ps_rid;	/* request id echoed in the root reply */
+	uint8_t ps_pad[sizeof(unsigned long) - (sizeof(uint16_t) * 2)];
 	unsigned long ps_flags;
 	struct ps_id ps_id;
 	socklen_t ps_namelen;
@@ -186,6 +200,9 @@ struct ps_process {
 #ifdef HAVE_CAPSICUM
 	int psp_pfd;
 #endif
+#ifdef PRIVSEP_RING
+	int psp_ring;		/* slot the process writes data to */
+#endif
 };
 TAILQ_HEAD(ps_process_head, ps_process);
 
@@ -232,6 +249,17 @@ int ps_rights_limit_fdpair(int []);
 int ps_seccomp_enter(void);
 #endif
 
+#ifdef PRIVSEP_RING
+int ps_ring_init(struct dhcpcd_ctx *);
+int ps_ring_alloc(struct dhcpcd_ctx *);
+void ps_ring_release(struct dhcpcd_ctx *, int);
+void ps_ring_forked(struct dhcpcd_ctx *, int, int);
+ssize_t ps_ring_writev(struct dhcpcd_ctx *, int, const struct iovec *, int);
+ssize_t ps_ring_drain(struct dhcpcd_ctx *, int, const struct ps_msghdr *,
+    ssize_t (*)(void *, struct ps_msghdr *, struct msghdr *), void *);
+void ps_ring_free(struct dhcpcd_ctx *);
+#endif
+
 pid_t ps_startprocess(struct ps_process *,
     void (*recv_msg)(void *, unsigned short),
     void (*recv_unpriv_msg)(void *, unsigned short),
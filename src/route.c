@@ -38,6 +38,7 @@
 #include "config.h"
 #include "common.h"
 #include "dhcpcd.h"
+#include "eloop.h"
 #include "if.h"
 #include "if-options.h"
 #include "ipv4.h"
@@ -236,6 +237,7 @@ rt_init(struct dhcpcd_ctx *ctx)
 {
 
 	rb_tree_init(&ctx->routes, &rt_compare_os_ops);
+	rb_tree_init(&ctx->kroutes, &rt_compare_os_ops);
 #ifdef RT_FREE_ROUTE_TABLE
 	rb_tree_init(&ctx->froutes, &rt_compare_free_ops);
 #endif
@@ -293,16 +295,12 @@ rt_desc(const char *cmd, const struct rt *rt)
 }
 
 void
-rt_headclear0(struct dhcpcd_ctx *ctx, rb_tree_t *rts, int af)
+rt_headclear(rb_tree_t *rts, int af)
 {
 	struct rt *rt, *rtn;
 
 	if (rts == NULL)
 		return;
-	assert(ctx != NULL);
-#ifdef RT_FREE_ROUTE_TABLE
-	assert(&ctx->froutes != rts);
-#endif
 
 	RB_TREE_FOREACH_SAFE(rt, rts, rtn) {
 		if (af != AF_UNSPEC &&
@@ -314,16 +312,6 @@ rt_headclear0(struct dhcpcd_ctx *ctx, rb_tree_t *rts, int af)
 	}
 }
 
-void
-rt_headclear(rb_tree_t *rts, int af)
-{
-	struct rt *rt;
-
-	if (rts == NULL || (rt = RB_TREE_MIN(rts)) == NULL)
-		return;
-	rt_headclear0(rt->rt_ifp->ctx, rts, af);
-}
-
 static void
 rt_headfree(rb_tree_t *rts)
 {
@@ -341,6 +329,8 @@ rt_dispose(struct dhcpcd_ctx *ctx)
 
 	assert(ctx != NULL);
 	rt_headfree(&ctx->routes);
+	rt_headfree(&ctx->kroutes);
+	ctx->kroutes_valid = 0;
 #ifdef RT_FREE_ROUTE_TABLE
 	rt_headfree(&ctx->froutes);
 #ifdef RT_FREE_ROUTE_TABLE_STATS
@@ -461,6 +451,113 @@ rt_freeif(struct interface *ifp)
 			rt_free(rt);
 		}
 	}
+	RB_TREE_FOREACH_SAFE(rt, &ctx->kroutes, rtn) {
+		if (rt->rt_ifp == ifp) {
+			rb_tree_remove_node(&ctx->kroutes, rt);
+			rt_free(rt);
+		}
+	}
+}
+
+static unsigned int
+rt_kroutes_af(int af)
+{
+
+	switch (af) {
+	case AF_INET:
+		return 0x1;
+	case AF_INET6:
+		return 0x2;
+	default:
+		return 0x1 | 0x2;
+	}
+}
+
+#define	RT_DIRTY_INET	0x1
+#define	RT_DIRTY_INET6	0x2
+#define	RT_DIRTY_UNSPEC	0x4
+
+static unsigned int
+rt_dirty_af(int af)
+{
+
+	switch (af) {
+	case AF_INET:
+		return RT_DIRTY_INET;
+	case AF_INET6:
+		return RT_DIRTY_INET6;
+	default:
+		/* Building AF_UNSPEC builds every family. */
+		return RT_DIRTY_INET | RT_DIRTY_INET6 | RT_DIRTY_UNSPEC;
+	}
+}
+
+/*
+ * The kernel does not always announce routes it removes itself,
+ * such as the subnet route when an address is deleted or routes
+ * flushed when the link goes down.
+ * Call this when that may have happened so the next rt_build
+ * reloads the kernel routes for the family.
+ */
+void
+rt_kroutes_invalidate(struct dhcpcd_ctx *ctx, int af)
+{
+
+	ctx->kroutes_valid &= ~rt_kroutes_af(af);
+}
+
+/* Update our mirror of the kernel routing table. */
+static void
+rt_kroutes_update(struct dhcpcd_ctx *ctx, int cmd, const struct rt *rt)
+{
+	struct rt *krt;
+
+	if (!(ctx->kroutes_valid & rt_kroutes_af(rt->rt_dest.sa_family)))
+		return;
+
+	krt = rb_tree_find_node(&ctx->kroutes, rt);
+	switch (cmd) {
+	case RTM_ADD:		/* FALLTHROUGH */
+	case RTM_CHANGE:
+		if (krt != NULL) {
+			/* Same key, so the tree order is preserved. */
+			rb_node_t node = krt->rt_tree;
+
+			memcpy(krt, rt, sizeof(*krt));
+			krt->rt_tree = node;
+			break;
+		}
+		if ((krt = rt_new0(ctx)) == NULL) {
+			rt_kroutes_invalidate(ctx, rt->rt_dest.sa_family);
+			break;
+		}
+		memcpy(krt, rt, sizeof(*krt));
+		rb_tree_insert_node(&ctx->kroutes, krt);
+		break;
+	case RTM_DELETE:
+		/* Only remove the route if it is the one deleted
+		 * as many routes can share the same destination. */
+		if (krt != NULL && krt->rt_ifp == rt->rt_ifp &&
+#ifdef HAVE_ROUTE_METRIC
+		    krt->rt_metric == rt->rt_metric &&
+#endif
+		    sa_cmp(&krt->rt_gateway, &rt->rt_gateway) == 0)
+		{
+			rb_tree_remove_node(&ctx->kroutes, krt);
+			rt_free(krt);
+		}
+		break;
+	}
+}
+
+static int
+rt_ifroute(unsigned char cmd, const struct rt *rt)
+{
+
+	if (if_route(cmd, rt) == -1)
+		return -1;
+	rt_kroutes_update(rt->rt_ifp->ctx, cmd, rt);
+	return 0;
 }
 
 /* If something other than dhcpcd removes a route,
@@ -476,6 +573,7 @@ rt_recvrt(int cmd, const struct rt *rt, pid_t pid)
 	assert(rt->rt_ifp->ctx != NULL);
 
 	ctx = rt->rt_ifp->ctx;
+	rt_kroutes_update(ctx, cmd, rt);
 
 	switch(cmd) {
 	case RTM_DELETE:
@@ -498,13 +596,9 @@ rt_recvrt(int cmd, const struct rt *rt, pid_t pid)
 }
 
 static bool
-rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
+rt_wantgateway(const struct rt *rt)
 {
-	struct dhcpcd_ctx *ctx;
-	bool change, kroute, result;
-
-	assert(nrt != NULL);
-	ctx = nrt->rt_ifp->ctx;
+	struct dhcpcd_ctx *ctx = rt->rt_ifp->ctx;
 
 	/*
 	 * Don't install a gateway if not asked to.
@@ -514,18 +608,37 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 	 * beyond their own, a longer term solution would be to remove this
 	 * and get the VPN to inject the default route into dhcpcd somehow.
 	 */
-	if (((nrt->rt_ifp->active &&
-	    !(nrt->rt_ifp->options->options & DHCPCD_GATEWAY)) ||
-	    (!nrt->rt_ifp->active && !(ctx->options & DHCPCD_GATEWAY))) &&
-	    sa_is_unspecified(&nrt->rt_dest) &&
-	    sa_is_unspecified(&nrt->rt_netmask))
+	if (((rt->rt_ifp->active &&
+	    !(rt->rt_ifp->options->options & DHCPCD_GATEWAY)) ||
+	    (!rt->rt_ifp->active && !(ctx->options & DHCPCD_GATEWAY))) &&
+	    sa_is_unspecified(&rt->rt_dest) &&
+	    sa_is_unspecified(&rt->rt_netmask))
+		return false;
+	return true;
+}
+
+static bool
+rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
+{
+	struct rt kort;
+	bool change, result;
+
+	assert(nrt != NULL);
+
+	if (!rt_wantgateway(nrt))
 		return false;
 
 	rt_desc(ort == NULL ? "adding" : "changing", nrt);
 
-	change = kroute = result = false;
+	change = result = false;
 	if (ort == NULL) {
 		ort = rb_tree_find_node(kroutes, nrt);
+		/* Work from a copy as changing the kernel routes
+		 * will update the mirror we found it in. */
+		if (ort != NULL) {
+			kort = *ort;
+			ort = &kort;
+		}
 		if (ort != NULL &&
 		    ((ort->rt_flags & RTF_REJECT &&
 		      nrt->rt_flags & RTF_REJECT) ||
@@ -538,7 +651,6 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 			if (ort->rt_mtu == nrt->rt_mtu)
 				return true;
 			change = true;
-			kroute = true;
 		}
 	} else if (ort->rt_dflags & RTDF_FAKE &&
 	    !(nrt->rt_dflags & RTDF_FAKE) &&
@@ -565,7 +677,7 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 #endif
 
 	if (change) {
-		if (if_route(RTM_CHANGE, nrt) != -1) {
+		if (rt_ifroute(RTM_CHANGE, nrt) != -1) {
 			result = true;
 			goto out;
 		}
@@ -576,9 +688,10 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 #ifdef HAVE_ROUTE_METRIC
 	/* With route metrics, we can safely add the new route before
 	 * deleting the old route. */
-	if (if_route(RTM_ADD, nrt) != -1) {
+	if (rt_ifroute(RTM_ADD, nrt) != -1) {
 		if (ort != NULL) {
-			if (if_route(RTM_DELETE, ort) == -1 && errno != ESRCH)
+			if (rt_ifroute(RTM_DELETE, ort) == -1 &&
+			    errno != ESRCH)
 				logerr("if_route (DEL)");
 		}
 		result = true;
@@ -597,10 +710,8 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 	errno = 0;
 #endif
 	if (ort != NULL) {
-		if (if_route(RTM_DELETE, ort) == -1 && errno != ESRCH)
+		if (rt_ifroute(RTM_DELETE, ort) == -1 && errno != ESRCH)
 			logerr("if_route (DEL)");
-		else
-			kroute = false;
 	}
 #ifdef ROUTE_PER_GATEWAY
 	/* The OS allows many routes to the same dest with different gateways.
@@ -608,7 +719,7 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 	 * deleting the route until there is an error. */
 	if (ort != NULL && errno == 0) {
 		for (;;) {
-			if (if_route(RTM_DELETE, ort) == -1)
+			if (rt_ifroute(RTM_DELETE, ort) == -1)
 				break;
 		}
 	}
@@ -616,7 +727,7 @@ rt_add(rb_tree_t *kroutes, struct rt *nrt, struct rt *ort)
 
 	/* Shouldn't need to check for EEXIST, but some kernels don't
 	 * dump the subnet route just after we added the address. */
-	if (if_route(RTM_ADD, nrt) != -1 || errno == EEXIST) {
+	if (rt_ifroute(RTM_ADD, nrt) != -1 || errno == EEXIST) {
 		result = true;
 		goto out;
 	}
@@ -627,23 +738,66 @@ logerr:
 	logerr("if_route (ADD)");
 
 out:
-	if (kroute) {
-		rb_tree_remove_node(kroutes, ort);
-		rt_free(ort);
-	}
 	return result;
 }
 
+static void
+rt_txadded(void *arg, void *obj, int error)
+{
+	rb_tree_t *added = arg;
+	struct rt *rt = obj;
+
+	if (error == 0) {
+		rt_kroutes_update(rt->rt_ifp->ctx, RTM_ADD, rt);
+		return;
+	}
+#ifndef HAVE_ROUTE_METRIC
+	/* Shouldn't need to check for EEXIST, but some kernels don't
+	 * dump the subnet route just after we added the address. */
+	if (error == EEXIST)
+		return;
+#endif
+
+	errno = error;
+	logerr("if_route (ADD)");
+	rb_tree_remove_node(added, rt);
+	rt_free(rt);
+}
+
+/*
+ * A route the kernel does not have can just be added, so queue it
+ * to be sent with the rest of the changes rt_dobuild makes.
+ * Anything else is left to rt_doroute.
+ */
 static bool
-rt_delete(struct rt *rt)
+rt_txadd(rb_tree_t *kroutes, rb_tree_t *routes, rb_tree_t *added,
+    struct rt *rt)
 {
-	int retval;
 
-	rt_desc("deleting", rt);
-	retval = if_route(RTM_DELETE, rt) == -1 ? false : true;
-	if (!retval && errno != ENOENT && errno != ESRCH)
-		logerr(__func__);
-	return retval;
+	if (rt->rt_dflags & RTDF_FAKE || !rt_wantgateway(rt) ||
+	    rb_tree_find_node(kroutes, rt) != NULL)
+		return false;
+	if (if_txroute(RTM_ADD, rt, rt_txadded, added) == -1)
+		return false;
+
+	rt_desc("adding", rt);
+	rb_tree_remove_node(routes, rt);
+	rb_tree_insert_node(added, rt);
+	return true;
+}
+
+static void
+rt_txdeleted(__unused void *arg, void *obj, int error)
+{
+	struct rt *rt = obj;
+
+	if (error == 0)
+		rt_kroutes_update(rt->rt_ifp->ctx, RTM_DELETE, rt);
+	else if (error != ENOENT && error != ESRCH) {
+		errno = error;
+		logerr("rt_delete");
+	}
+	rt_free(rt);
 }
 
 static bool
@@ -678,8 +832,6 @@ rt_doroute(rb_tree_t *kroutes, struct rt *rt)
 			if (!rt_add(kroutes, rt, or))
 				return false;
 		}
-		rb_tree_remove_node(&ctx->routes, or);
-		rt_free(or);
 	} else {
 		if (rt->rt_dflags & RTDF_FAKE) {
 			or = rb_tree_find_node(kroutes, rt);
@@ -696,19 +848,31 @@ rt_doroute(rb_tree_t *kroutes, struct rt *rt)
 	return true;
 }
 
-void
-rt_build(struct dhcpcd_ctx *ctx, int af)
+static void
+rt_dobuild(struct dhcpcd_ctx *ctx, int af)
 {
-	rb_tree_t routes, added, kroutes;
-	struct rt *rt, *rtn;
+	rb_tree_t routes, added;
+	struct rt *rt, *rtn, *or;
+	rb_node_t node;
 	unsigned long long o;
+	unsigned int kaf;
 
 	rb_tree_init(&routes, &rt_compare_proto_ops);
 	rb_tree_init(&added, &rt_compare_os_ops);
-	rb_tree_init(&kroutes, &rt_compare_os_ops);
-	if_initrt(ctx, &kroutes, af);
+
+	/* Only dump the kernel routes if our mirror of them is not current.
+	 * Otherwise it's kept up to date by rt_recvrt and our own changes. */
+	kaf = rt_kroutes_af(af);
+	if ((ctx->kroutes_valid & kaf) != kaf) {
+		rt_headclear(&ctx->kroutes, af);
+		if (if_initrt(ctx, &ctx->kroutes, af) == 0)
+			ctx->kroutes_valid |= kaf;
+		else
+			logerr("%s: if_initrt", __func__);
+	}
 	ctx->rt_order = 0;
 	ctx->options |= DHCPCD_RTBUILD;
+	ctx->rt_dirty &= ~rt_dirty_af(af);
 
 #ifdef INET
 	if (!inet_getroutes(ctx, &routes))
@@ -743,13 +907,27 @@ rt_build(struct dhcpcd_ctx *ctx, int af)
 		/* Is this route already in our table? */
 		if (rb_tree_find_node(&added, rt) != NULL)
 			continue;
-		if (rt_doroute(&kroutes, rt)) {
-			rb_tree_remove_node(&routes, rt);
-			if (rb_tree_insert_node(&added, rt) != rt) {
-				errno = EEXIST;
-				logerr(__func__);
-				rt_free(rt);
-			}
+		or = rb_tree_find_node(&ctx->routes, rt);
+		if (or != NULL && or->rt_dflags & RTDF_BUILT)
+			continue;
+		if (or == NULL &&
+		    rt_txadd(&ctx->kroutes, &routes, &added, rt))
+			continue;
+		if (!rt_doroute(&ctx->kroutes, rt))
+			continue;
+		rb_tree_remove_node(&routes, rt);
+		if (or != NULL) {
+			/* Update the route we already manage in place.
+			 * It has the same key, so the tree order is kept. */
+			node = or->rt_tree;
+			memcpy(or, rt, sizeof(*or));
+			or->rt_tree = node;
+			or->rt_dflags |= RTDF_BUILT;
+			rt_free(rt);
+		} else if (rb_tree_insert_node(&added, rt) != rt) {
+			errno = EEXIST;
+			logerr(__func__);
+			rt_free(rt);
 		}
 	}
 
@@ -765,20 +943,34 @@ rt_build(struct dhcpcd_ctx *ctx, int af)
 		    (rt->rt_gateway.sa_family != af &&
 		    rt->rt_gateway.sa_family != AF_UNSPEC))
 			continue;
+		if (rt->rt_dflags & RTDF_BUILT) {
+			rt->rt_dflags &= ~(unsigned int)RTDF_BUILT;
+			continue;
+		}
 		rb_tree_remove_node(&ctx->routes, rt);
-		if (rb_tree_find_node(&added, rt) == NULL) {
-			o = rt->rt_ifp->options ?
-			    rt->rt_ifp->options->options :
-			    ctx->options;
-			if ((o &
-				(DHCPCD_EXITING | DHCPCD_PERSISTENT)) !=
-				(DHCPCD_EXITING | DHCPCD_PERSISTENT))
-				rt_delete(rt);
+		o = rt->rt_ifp->options ?
+		    rt->rt_ifp->options->options :
+		    ctx->options;
+		if ((o &
+			(DHCPCD_EXITING | DHCPCD_PERSISTENT)) !=
+			(DHCPCD_EXITING | DHCPCD_PERSISTENT))
+		{
+			rt_desc("deleting", rt);
+			/* rt_txdeleted frees it once the kernel replies. */
+			if (if_txroute(RTM_DELETE, rt,
+			    rt_txdeleted, NULL) == 0)
+				continue;
+			logerr("if_txroute");
 		}
 		rt_free(rt);
 	}
 
-	/* XXX This needs to be optimised. */
+	/* Send the adds and deletes together, adds first so we
+	 * don't lose connectivity when changing gateway.
+	 * Failed adds are removed from added. */
+	if_txcommit(ctx);
+
+	/* Add the routes we didn't manage before. */
 	while ((rt = RB_TREE_MIN(&added)) != NULL) {
 		rb_tree_remove_node(&added, rt);
 		if (rb_tree_insert_node(&ctx->routes, rt) != rt) {
@@ -790,5 +982,71 @@ rt_build(struct dhcpcd_ctx *ctx, int af)
 
 getfail:
 	rt_headclear(&routes, AF_UNSPEC);
-	rt_headclear(&kroutes, AF_UNSPEC);
+}
+
+static void rt_build_dirty(void *);
+
+/* Build any routes deferred while held. */
+void
+rt_build_flush(struct dhcpcd_ctx *ctx)
+{
+
+	eloop_timeout_delete(ctx->eloop, rt_build_dirty, ctx);
+	if (ctx->rt_dirty & RT_DIRTY_UNSPEC) {
+		rt_dobuild(ctx, AF_UNSPEC);
+		return;
+	}
+	if (ctx->rt_dirty & RT_DIRTY_INET)
+		rt_dobuild(ctx, AF_INET);
+	if (ctx->rt_dirty & RT_DIRTY_INET6)
+		rt_dobuild(ctx, AF_INET6);
+}
+
+static void
+rt_build_dirty(void *arg)
+{
+
+	rt_build_flush(arg);
+}
+
+/*
+ * A single route message can change addresses which in turn
+ * rebuilds the routing table.
+ * When reading a burst of them, hold route building and just mark
+ * the family as dirty so it's rebuilt once when the burst is done.
+ */
+void
+rt_build_hold(struct dhcpcd_ctx *ctx)
+{
+
+	ctx->rt_hold++;
+}
+
+void
+rt_build_release(struct dhcpcd_ctx *ctx)
+{
+
+	assert(ctx->rt_hold != 0);
+	ctx->rt_hold--;
+}
+
+void
+rt_build(struct dhcpcd_ctx *ctx, int af)
+{
+
+	if (ctx->rt_hold == 0) {
+		rt_dobuild(ctx, af);
+		return;
+	}
+
+	/* Let ipv6_handleifa know a build is pending. */
+	ctx->options |= DHCPCD_RTBUILD;
+	if (ctx->rt_dirty == 0 &&
+	    eloop_timeout_add_sec(ctx->eloop, 0, rt_build_dirty, ctx) == -1)
+	{
+		logerr(__func__);
+		rt_dobuild(ctx, af);
+		return;
+	}
+	ctx->rt_dirty |= rt_dirty_af(af);
 }
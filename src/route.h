@@ -118,6 +118,7 @@ struct rt {
 #define	RTDF_DHCP		0x10		/* DHCP route */
 #define	RTDF_STATIC		0x20		/* Configured in dhcpcd */
 #define	RTDF_GATELINK		0x40		/* Gateway is on link */
+#define	RTDF_BUILT		0x80		/* Kept by the current rt_build */
 	size_t			rt_order;
 	rb_node_t		rt_tree;
 };
@@ -130,7 +131,6 @@ void rt_dispose(struct dhcpcd_ctx *);
 void rt_free(struct rt *);
 void rt_freeif(struct interface *);
 bool rt_is_default(const struct rt *);
-void rt_headclear0(struct dhcpcd_ctx *, rb_tree_t *, int);
 void rt_headclear(rb_tree_t *, int);
 void rt_headfreeif(rb_tree_t *);
 struct rt * rt_new0(struct dhcpcd_ctx *);
@@ -140,6 +140,10 @@ struct rt * rt_proto_add_ctx(rb_tree_t *, struct rt *, struct dhcpcd_ctx *);
 struct rt * rt_proto_add(rb_tree_t *, struct rt *);
 int rt_cmp_dest(const struct rt *, const struct rt *);
 void rt_recvrt(int, const struct rt *, pid_t);
+void rt_kroutes_invalidate(struct dhcpcd_ctx *, int);
 void rt_build(struct dhcpcd_ctx *, int);
+void rt_build_hold(struct dhcpcd_ctx *);
+void rt_build_release(struct dhcpcd_ctx *);
+void rt_build_flush(struct dhcpcd_ctx *);
 
 #endif
@@ -176,6 +176,152 @@ efprintf(FILE *fp, const char *fmt, ...)
 	return r;
 }
 
+#if defined(INET) || defined(DHCP6)
+/* Write the cached fragment if it was made from key.
+ * Returns 1 if written, 0 if it needs making. */
+static int
+script_envfrag_put(FILE *fp, const struct interface *ifp, unsigned int n,
+    const void *key, size_t keylen)
+{
+#ifdef HAVE_OPEN_MEMSTREAM
+	const struct env_frag *ef;
+
+	if (ifp->env_frags == NULL)
+		return 0;
+	ef = &ifp->env_frags[n];
+	if (ef->ef_buf == NULL ||
+	    ef->ef_ifo != ifp->options ||
+	    ef->ef_cfgen != ifp->ctx->cf_gen ||
+	    ef->ef_keylen != keylen ||
+	    memcmp(ef->ef_buf, key, keylen) != 0)
+		return 0;
+	if (fwrite(ef->ef_buf + keylen, 1, ef->ef_envlen, fp) !=
+	    ef->ef_envlen)
+		return -1;
+	return 1;
+#else
+	UNUSED(fp);
+	UNUSED(ifp);
+	UNUSED(n);
+	UNUSED(key);
+	UNUSED(keylen);
+	return 0;
+#endif
+}
+
+/* Keep what was written to fp from pos as the fragment for key.
+ * Failure just means it will be made again next time. */
+static void
+script_envfrag_save(FILE *fp, const struct interface *ifp, unsigned int n,
+    const void *key, size_t keylen, long pos)
+{
+#ifdef HAVE_OPEN_MEMSTREAM
+	struct interface *ifw = UNCONST(ifp);
+	struct env_frag *ef;
+	size_t envlen, size;
+	long end;
+
+	/* Nowhere to keep it for a lease read from stdin. */
+	if (ifp->name[0] == '\0')
+		return;
+	if (pos == -1 || fflush(fp) == EOF || (end = ftell(fp)) == -1)
+		return;
+	envlen = (size_t)(end - pos);
+
+	if (ifw->env_frags == NULL) {
+		ifw->env_frags = calloc(ENV_FRAG_MAX, sizeof(*ef));
+		if (ifw->env_frags == NULL)
+			return;
+	}
+	ef = &ifw->env_frags[n];
+	size = keylen + envlen;
+	if (size > ef->ef_bufsize) {
+		uint8_t *nbuf;
+
+		nbuf = realloc(ef->ef_buf, size);
+		if (nbuf == NULL) {
+			free(ef->ef_buf);
+			ef->ef_buf = NULL;
+			ef->ef_bufsize = 0;
+			return;
+		}
+		ef->ef_buf = nbuf;
+		ef->ef_bufsize = size;
+	}
+	memcpy(ef->ef_buf, key, keylen);
+	memcpy(ef->ef_buf + keylen, ifp->ctx->script_buf + pos, envlen);
+	ef->ef_keylen = keylen;
+	ef->ef_envlen = envlen;
+	ef->ef_ifo = ifp->options;
+	ef->ef_cfgen = ifp->ctx->cf_gen;
+#else
+	UNUSED(fp);
+	UNUSED(ifp);
+	UNUSED(n);
+	UNUSED(key);
+	UNUSED(keylen);
+	UNUSED(pos);
+#endif
+}
+#endif
+
+#ifdef INET
+static int
+script_dhcpenv(FILE *fp, const char *prefix, const struct interface *ifp,
+    unsigned int n, const struct bootp *bootp, size_t bootp_len)
+{
+	long pos;
+	int r;
+
+	if ((r = script_envfrag_put(fp, ifp, n, bootp, bootp_len)) != 0)
+		return r;
+
+	pos = ftell(fp);
+	if (dhcp_env(fp, prefix, ifp, bootp, bootp_len) == -1)
+		return -1;
+	if (append_config(fp, prefix,
+	    (const char *const *)ifp->options->config) == -1)
+		return -1;
+	script_envfrag_save(fp, ifp, n, bootp, bootp_len, pos);
+	return 1;
+}
+#endif
+
+#ifdef DHCP6
+static int
+script_dhcp6env(FILE *fp, const char *prefix, const struct interface *ifp,
+    unsigned int n, const struct dhcp6_message *m, size_t len)
+{
+	long pos;
+	int r;
+
+	if ((r = script_envfrag_put(fp, ifp, n, m, len)) == 0) {
+		pos = ftell(fp);
+		if (dhcp6_env(fp, prefix, ifp, m, len) == -1)
+			return -1;
+		script_envfrag_save(fp, ifp, n, m, len, pos);
+	} else if (r == -1)
+		return -1;
+
+	if (dhcp6_env_delegated(fp, prefix, ifp) == -1)
+		return -1;
+	return 1;
+}
+#endif
+
+void
+script_freeenv(struct interface *ifp)
+{
+	size_t i;
+
+	if (ifp->env_frags == NULL)
+		return;
+	for (i = 0; i < ENV_FRAG_MAX; i++)
+		free(ifp->env_frags[i].ef_buf);
+	free(ifp->env_frags);
+	ifp->env_frags = NULL;
+}
+
 char **
 script_buftoenv(struct dhcpcd_ctx *ctx, char *buf, size_t len)
 {
@@ -477,17 +623,14 @@ make_env(struct dhcpcd_ctx *ctx, const struct interface *ifp,
 	}
 #ifdef INET
 	if (protocol == PROTO_DHCP && state && state->old) {
-		if (dhcp_env(fp, "old", ifp,
+		if (script_dhcpenv(fp, "old", ifp, ENV_FRAG_DHCP_OLD,
 		    state->old, state->old_len) == -1)
 			goto eexit;
-		if (append_config(fp, "old",
-		    (const char *const *)ifo->config) == -1)
-			goto eexit;
 	}
 #endif
 #ifdef DHCP6
 	if (protocol == PROTO_DHCP6 && d6_state && d6_state->old) {
-		if (dhcp6_env(fp, "old", ifp,
+		if (script_dhcp6env(fp, "old", ifp, ENV_FRAG_DHCP6_OLD,
 		    d6_state->old, d6_state->old_len) == -1)
 			goto eexit;
 	}
@@ -502,12 +645,9 @@ dumplease:
 	}
 #endif
 	if (protocol == PROTO_DHCP && state && state->new) {
-		if (dhcp_env(fp, "new", ifp,
+		if (script_dhcpenv(fp, "new", ifp, ENV_FRAG_DHCP_NEW,
 		    state->new, state->new_len) == -1)
 			goto eexit;
-		if (append_config(fp, "new",
-		    (const char *const *)ifo->config) == -1)
-			goto eexit;
 	}
 #endif
 #ifdef INET6
@@ -517,7 +657,7 @@ dumplease:
 	}
 #ifdef DHCP6
 	if (protocol == PROTO_DHCP6 && D6_STATE_RUNNING(ifp)) {
-		if (dhcp6_env(fp, "new", ifp,
+		if (script_dhcp6env(fp, "new", ifp, ENV_FRAG_DHCP6_NEW,
 		    d6_state->new, d6_state->new_len) == -1)
 			goto eexit;
 	}
@@ -681,34 +821,194 @@ send_interface(struct fd_list *fd, const struct interface *ifp, int af)
 	return retval;
 }
 
+struct script_job {
+	TAILQ_ENTRY(script_job) next;
+	char ifname[IF_NAMESIZE];
+	char *env;
+	size_t envlen;
+	pid_t pid;
+};
+
+static void
+script_job_free(struct dhcpcd_ctx *ctx, struct script_job *job)
+{
+
+	TAILQ_REMOVE(&ctx->script_jobs, job, next);
+	if (job->pid != 0)
+		ctx->script_jobs_running--;
+	free(job->env);
+	free(job);
+}
+
+static void
+script_status(const char *script, int status)
+{
+
+	if (WIFEXITED(status)) {
+		if (WEXITSTATUS(status))
+			logerrx("%s: %s: WEXITSTATUS %d",
+			    __func__, script, WEXITSTATUS(status));
+	} else if (WIFSIGNALED(status))
+		logerrx("%s: %s: %s",
+		    __func__, script, strsignal(WTERMSIG(status)));
+}
+
 static int
-script_run(struct dhcpcd_ctx *ctx, char **argv)
+script_job_start(struct dhcpcd_ctx *ctx, struct script_job *job)
 {
+	char *argv[] = { ctx->script, NULL };
 	pid_t pid;
-	int status = 0;
 
+	if (script_buftoenv(ctx, job->env, job->envlen) == NULL)
+		return -1;
 	pid = script_exec(argv, ctx->script_env);
-	if (pid == -1)
-		logerr("%s: %s", __func__, argv[0]);
-	else if (pid != 0) {
-		/* Wait for the script to finish */
-		while (waitpid(pid, &status, 0) == -1) {
-			if (errno != EINTR) {
-				logerr("%s: waitpid", __func__);
-				status = 0;
+	if (pid == -1 || pid == 0)
+		return -1;
+
+	/* posix_spawn has copied the environment, so we can free it. */
+	free(job->env);
+	job->env = NULL;
+	job->pid = pid;
+	ctx->script_jobs_running++;
+	return 0;
+}
+
+/*
+ * Start as many queued scripts as we are allowed to.
+ * Scripts for the same interface are run in the order they were queued
+ * and only one at a time, so a script will never see the state from a
+ * reason which is newer than the one it was run for.
+ */
+static void
+script_runqueue(struct dhcpcd_ctx *ctx)
+{
+	struct script_job *job, *jobn, *j;
+
+	TAILQ_FOREACH_SAFE(job, &ctx->script_jobs, next, jobn) {
+		if (ctx->script_jobs_running >= SCRIPT_JOBS_MAX)
+			break;
+		if (job->pid != 0)
+			continue;
+
+		/* Don't start if a prior script for this interface
+		 * is queued or running. */
+		TAILQ_FOREACH(j, &ctx->script_jobs, next) {
+			if (j == job || strcmp(j->ifname, job->ifname) == 0)
+				break;
+		}
+		if (j != job)
+			continue;
+
+		if (script_job_start(ctx, job) == -1) {
+			logerr("%s: %s", __func__, ctx->script);
+			script_job_free(ctx, job);
+		}
+	}
+}
+
+static const char *
+script_envifname(const char *env, size_t len)
+{
+	const char *ep = env + len;
+
+	for (; env < ep; env += strlen(env) + 1) {
+		if (strncmp(env, "interface=", strlen("interface=")) == 0)
+			return env + strlen("interface=");
+	}
+	return "";
+}
+
+int
+script_queue(struct dhcpcd_ctx *ctx, const void *env, size_t len)
+{
+	struct script_job *job;
+
+	if (len == 0)
+		return 0;
+	if (((const char *)env)[len - 1] != '\0') {
+		errno = EINVAL;
+		return -1;
+	}
+
+	job = calloc(1, sizeof(*job));
+	if (job == NULL)
+		return -1;
+	job->env = malloc(len);
+	if (job->env == NULL) {
+		free(job);
+		return -1;
+	}
+	memcpy(job->env, env, len);
+	job->envlen = len;
+	strlcpy(job->ifname, script_envifname(job->env, len),
+	    sizeof(job->ifname));
+	TAILQ_INSERT_TAIL(&ctx->script_jobs, job, next);
+
+#ifdef USE_SIGNALS
+	script_runqueue(ctx);
+#else
+	/* Without SIGCHLD we have no way of knowing when a script
+	 * has finished, so wait for it here. */
+	script_wait(ctx);
+#endif
+	return 0;
+}
+
+bool
+script_reap(struct dhcpcd_ctx *ctx, pid_t pid, int status)
+{
+	struct script_job *job;
+
+	TAILQ_FOREACH(job, &ctx->script_jobs, next) {
+		if (job->pid == pid)
+			break;
+	}
+	if (job == NULL)
+		return false;
+
+	script_status(ctx->script, status);
+	script_job_free(ctx, job);
+	script_runqueue(ctx);
+	return true;
+}
+
+void
+script_wait(struct dhcpcd_ctx *ctx)
+{
+	struct script_job *job;
+	int status;
+
+	script_runqueue(ctx);
+	while (ctx->script_jobs_running != 0) {
+		/* Only wait on our scripts so that we don't reap
+		 * any privsep processes. */
+		TAILQ_FOREACH(job, &ctx->script_jobs, next) {
+			if (job->pid != 0)
 				break;
-			}
 		}
-		if (WIFEXITED(status)) {
-			if (WEXITSTATUS(status))
-				logerrx("%s: %s: WEXITSTATUS %d",
-				    __func__, argv[0], WEXITSTATUS(status));
-		} else if (WIFSIGNALED(status))
-			logerrx("%s: %s: %s",
-			    __func__, argv[0], strsignal(WTERMSIG(status)));
+		assert(job != NULL);
+		if (waitpid(job->pid, &status, 0) == -1) {
+			if (errno == EINTR)
+				continue;
+			logerr("%s: waitpid", __func__);
+			status = 0;
+		}
+		script_reap(ctx, job->pid, status);
 	}
 
-	return WEXITSTATUS(status);
+	/* Discard anything we failed to run. */
+	while ((job = TAILQ_FIRST(&ctx->script_jobs)) != NULL)
+		script_job_free(ctx, job);
+}
+
+/* Scripts queued or running belong to the process we forked from. */
+void
+script_forked(struct dhcpcd_ctx *ctx)
+{
+	struct script_job *job;
+
+	while ((job = TAILQ_FIRST(&ctx->script_jobs)) != NULL)
+		script_job_free(ctx, job);
 }
 
 int
@@ -736,11 +1036,13 @@ int
 script_runreason(const struct interface *ifp, const char *reason)
 {
 	struct dhcpcd_ctx *ctx = ifp->ctx;
-	char *argv[2];
 	int status = 0;
-	struct fd_list *fd;
 	long buflen;
 
+	/* Every reason but a dump is a change pollers should see. */
+	if (strncmp(reason, "DUMP", 4) != 0)
+		control_ifchanged(UNCONST(ifp));
+
 	if (ctx->script == NULL &&
 	    TAILQ_FIRST(&ifp->ctx->control_fds) == NULL)
 		return 0;
@@ -757,9 +1059,11 @@ script_runreason(const struct interface *ifp, const char *reason)
 	if (ctx->script == NULL)
 		goto send_listeners;
 
-	argv[0] = ctx->script;
-	argv[1] = NULL;
-	logdebugx("%s: executing: %s %s", ifp->name, argv[0], reason);
+	/* Ensure routes are current for the hook. */
+	if (ctx->rt_dirty != 0)
+		rt_build_flush(ctx);
+
+	logdebugx("%s: executing: %s %s", ifp->name, ctx->script, reason);
 
 #ifdef PRIVSEP
 	if (ctx->options & DHCPCD_PRIVSEP) {
@@ -770,19 +1074,13 @@ script_runreason(const struct interface *ifp, const char *reason)
 	}
 #endif
 
-	script_run(ctx, argv);
+	if (script_queue(ctx, ctx->script_buf, (size_t)buflen) == -1)
+		logerr("%s: script_queue", __func__);
 
 send_listeners:
 	/* Send to our listeners */
-	status = 0;
-	TAILQ_FOREACH(fd, &ctx->control_fds, next) {
-		if (!(fd->flags & FD_LISTEN))
-			continue;
-		if (control_queue(fd, ctx->script_buf, ctx->script_buflen)== -1)
-			logerr("%s: control_queue", __func__);
-		else
-			status = 1;
-	}
-
-	return status;
+	status = control_broadcast(ctx, ctx->script_buf, (size_t)buflen);
+	if (status == -1)
+		logerr("%s: control_broadcast", __func__);
+	return status > 0 ? 1 : 0;
 }
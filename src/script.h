@@ -31,6 +31,23 @@
 
 #include "control.h"
 
+/* Lease environments are cached per interface and reused while the
+ * lease and the interface options are unchanged. */
+#define	ENV_FRAG_DHCP_OLD	0
+#define	ENV_FRAG_DHCP_NEW	1
+#define	ENV_FRAG_DHCP6_OLD	2
+#define	ENV_FRAG_DHCP6_NEW	3
+#define	ENV_FRAG_MAX		4
+
+struct env_frag {
+	const struct if_options *ef_ifo;
+	unsigned int ef_cfgen;		/* ctx->cf_gen when made */
+	uint8_t *ef_buf;		/* key then env */
+	size_t ef_bufsize;
+	size_t ef_keylen;
+	size_t ef_envlen;
+};
+
 __printflike(2, 3) int efprintf(FILE *, const char *, ...);
 void if_printoptions(void);
 char ** script_buftoenv(struct dhcpcd_ctx *, char *, size_t);
@@ -38,4 +55,9 @@ pid_t script_exec(char *const *, char *const *);
 int send_interface(struct fd_list *, const struct interface *, int);
 int script_dump(const char *, size_t);
 int script_runreason(const struct interface *, const char *);
+int script_queue(struct dhcpcd_ctx *, const void *, size_t);
+bool script_reap(struct dhcpcd_ctx *, pid_t, int);
+void script_wait(struct dhcpcd_ctx *);
+void script_forked(struct dhcpcd_ctx *);
+void script_freeenv(struct interface *);
 #endif
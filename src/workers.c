@@ -0,0 +1,1205 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - DHCP client daemon
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <ifaddrs.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "common.h"
+#include "dhcpcd.h"
+#include "control.h"
+#include "duid.h"
+#include "eloop.h"
+#include "if.h"
+#include "if-options.h"
+#include "ipv6.h"
+#include "logerr.h"
+#include "route.h"
+#include "workers.h"
+
+/* Messages on the command socket between the manager and a worker. */
+#define	WK_CTL			1	/* control request for the worker */
+#define	WK_DONE			2	/* request answered */
+#define	WK_DAEMONISED		3	/* worker would have forked */
+
+#define	WK_UNPRIV		0x01U	/* WK_CTL from an unprivileged user */
+#define	WK_CLOSE		0x01U	/* WK_DONE, close the client */
+#define	WK_IDLE			0x01U	/* WK_DAEMONISED, no interfaces */
+
+struct wk_msghdr {
+	uint16_t wh_cmd;
+	uint16_t wh_flags;
+};
+
+/* Replies and events are read in pieces and put back together. */
+struct wk_buf {
+	uint8_t *wb_data;
+	size_t wb_len;
+	size_t wb_size;
+};
+
+/* How the replies from each worker are merged into one. */
+#define	WR_ARGS			0	/* concatenated */
+#define	WR_DUMP			1	/* leading interface counts summed */
+#define	WR_STATE		2	/* binary state protocol */
+
+struct wk_request {
+	TAILQ_ENTRY(wk_request) wr_next;
+	struct fd_list *wr_fd;		/* NULL once the client has gone */
+	unsigned int wr_kind;
+	uint16_t wr_flags;
+	bool wr_sent;
+	bool wr_close;
+	bool wr_resync;			/* asked again for full state */
+	size_t wr_len;
+	char wr_data[];
+};
+TAILQ_HEAD(wk_request_head, wk_request);
+
+struct wk_process {
+	struct dhcpcd_ctx *wp_ctx;
+	unsigned int wp_index;
+	pid_t wp_pid;
+	int wp_fd;			/* commands */
+	int wp_data_fd;			/* replies to control requests */
+	int wp_listen_fd;		/* events for listeners */
+	struct wk_buf wp_reply;
+	struct wk_buf wp_events;
+	bool wp_busy;			/* answering the current request */
+	bool wp_daemonised;
+	bool wp_idle;			/* daemonised without interfaces */
+};
+
+struct wk_manager {
+	struct wk_process *wm_processes;
+	unsigned int wm_nprocesses;
+	unsigned int wm_nrunning;
+	struct wk_request_head wm_requests;	/* first is being answered */
+	bool wm_stopping;
+	int wm_exit_code;
+};
+
+struct wk_worker {
+	unsigned int ww_index;
+	unsigned int ww_nworkers;
+	int ww_fd;
+	int ww_data_fd;
+};
+
+static void workers_dispatch(struct dhcpcd_ctx *);
+
+/* FNV-1a, so an interface goes to the same worker each time. */
+static unsigned int
+workers_shard(const char *ifname, unsigned int n)
+{
+	uint32_t h = 2166136261U;
+
+	for (; *ifname != '\0'; ifname++) {
+		h ^= (uint8_t)*ifname;
+		h *= 16777619U;
+	}
+	return h % n;
+}
+
+bool
+workers_ownsif(const struct dhcpcd_ctx *ctx, const char *ifname)
+{
+	const struct wk_worker *ww = ctx->wk_worker;
+
+	if (ww == NULL)
+		return true;
+	return workers_shard(ifname, ww->ww_nworkers) == ww->ww_index;
+}
+
+static ssize_t
+workers_send(int fd, uint16_t cmd, uint16_t flags,
+    const void *data, size_t len)
+{
+	struct wk_msghdr wh = { .wh_cmd = cmd, .wh_flags = flags };
+	struct iovec iov[] = {
+		{ .iov_base = &wh, .iov_len = sizeof(wh) },
+		{ .iov_base = UNCONST(data), .iov_len = len },
+	};
+
+	return writev(fd, iov, len == 0 ? 1 : 2);
+}
+
+static int
+workers_bufgrow(struct wk_buf *wb, size_t len)
+{
+	uint8_t *nd;
+	size_t size;
+
+	if (wb->wb_size - wb->wb_len >= len)
+		return 0;
+	size = wb->wb_size == 0 ? BUFSIZ : wb->wb_size;
+	while (size - wb->wb_len < len)
+		size *= 2;
+	nd = realloc(wb->wb_data, size);
+	if (nd == NULL)
+		return -1;
+	wb->wb_data = nd;
+	wb->wb_size = size;
+	return 0;
+}
+
+static int
+workers_bufappend(struct wk_buf *wb, const void *data, size_t len)
+{
+
+	if (workers_bufgrow(wb, len) == -1)
+		return -1;
+	memcpy(wb->wb_data + wb->wb_len, data, len);
+	wb->wb_len += len;
+	return 0;
+}
+
+/* Returns 1 at the end of the stream, 0 once drained, otherwise -1. */
+static int
+workers_bufread(struct wk_buf *wb, int fd)
+{
+	ssize_t len;
+
+	for (;;) {
+		if (workers_bufgrow(wb, BUFSIZ) == -1)
+			return -1;
+		len = read(fd, wb->wb_data + wb->wb_len,
+		    wb->wb_size - wb->wb_len);
+		if (len == 0)
+			return 1;
+		if (len == -1)
+			return errno == EAGAIN ? 0 : -1;
+		wb->wb_len += (size_t)len;
+	}
+}
+
+static void
+workers_kill(struct wk_manager *wm, int sig)
+{
+	struct wk_process *wp;
+	unsigned int i;
+
+	for (i = 0; i < wm->wm_nprocesses; i++) {
+		wp = &wm->wm_processes[i];
+		if (wp->wp_pid != 0 && kill(wp->wp_pid, sig) == -1)
+			logerr("%s: worker %u", __func__, wp->wp_index);
+	}
+}
+
+/*
+ * Merging the replies.
+ * Workers which were not asked or had nothing to say are skipped.
+ */
+
+static int
+workers_mergeargs(struct wk_manager *wm, struct wk_buf *out)
+{
+	struct wk_buf *wb;
+	unsigned int i;
+
+	for (i = 0; i < wm->wm_nprocesses; i++) {
+		wb = &wm->wm_processes[i].wp_reply;
+		if (wb->wb_len != 0 &&
+		    workers_bufappend(out, wb->wb_data, wb->wb_len) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static int
+workers_mergedump(struct wk_manager *wm, struct wk_buf *out)
+{
+	struct wk_buf *wb;
+	unsigned int i;
+	size_t n, nifaces = 0;
+
+	if (workers_bufappend(out, &nifaces, sizeof(nifaces)) == -1)
+		return -1;
+	for (i = 0; i < wm->wm_nprocesses; i++) {
+		wb = &wm->wm_processes[i].wp_reply;
+		if (wb->wb_len == 0)
+			continue;
+		if (wb->wb_len < sizeof(n)) {
+			errno = EINVAL;
+			return -1;
+		}
+		memcpy(&n, wb->wb_data, sizeof(n));
+		nifaces += n;
+		if (workers_bufappend(out, wb->wb_data + sizeof(n),
+		    wb->wb_len - sizeof(n)) == -1)
+			return -1;
+	}
+	memcpy(out->wb_data, &nifaces, sizeof(nifaces));
+	return 0;
+}
+
+/*
+ * Each reply is framed with its length.
+ * The oldest generation is handed out so the next delta misses
+ * nothing, at the cost of some records being sent twice.
+ * Returns 1 if only some workers had to resync.
+ */
+static int
+workers_mergestate(struct wk_manager *wm, struct wk_buf *out)
+{
+	struct wk_buf *wb;
+	struct ctl_reply cp, wcp;
+	unsigned int i, n = 0, nresync = 0;
+	size_t len;
+
+	memset(&cp, 0, sizeof(cp));
+	if (workers_bufappend(out, &cp, sizeof(cp)) == -1)
+		return -1;
+	for (i = 0; i < wm->wm_nprocesses; i++) {
+		wb = &wm->wm_processes[i].wp_reply;
+		if (wb->wb_len == 0)
+			continue;
+		if (wb->wb_len < sizeof(len) + sizeof(wcp))
+			goto einval;
+		memcpy(&len, wb->wb_data, sizeof(len));
+		if (len != wb->wb_len - sizeof(len))
+			goto einval;
+		memcpy(&wcp, wb->wb_data + sizeof(len), sizeof(wcp));
+		if (n++ == 0)
+			cp = wcp;
+		else {
+			if (wcp.cp_gen < cp.cp_gen)
+				cp.cp_gen = wcp.cp_gen;
+			if (cp.cp_status == 0)
+				cp.cp_status = wcp.cp_status;
+			cp.cp_nrecords += wcp.cp_nrecords;
+			cp.cp_flags |= wcp.cp_flags;
+		}
+		if (wcp.cp_flags & CTL_RESYNC)
+			nresync++;
+		if (workers_bufappend(out,
+		    wb->wb_data + sizeof(len) + sizeof(wcp),
+		    len - sizeof(wcp)) == -1)
+			return -1;
+	}
+	if (n == 0)
+		goto einval;
+
+	if (cp.cp_status != 0) {
+		cp.cp_nrecords = 0;
+		out->wb_len = sizeof(cp);
+	}
+	memcpy(out->wb_data, &cp, sizeof(cp));
+	return nresync != 0 && nresync != n ? 1 : 0;
+
+einval:
+	errno = EINVAL;
+	return -1;
+}
+
+static void
+workers_reply(struct dhcpcd_ctx *ctx, struct wk_request *wr)
+{
+	struct wk_manager *wm = ctx->wk_manager;
+	struct fd_list *fd = wr->wr_fd;
+	struct wk_buf out = { .wb_data = NULL };
+	struct ctl_req req;
+	int err;
+
+	if (fd == NULL || wr->wr_close) {
+		err = -1;
+		goto done;
+	}
+
+	switch (wr->wr_kind) {
+	case WR_STATE:
+		err = workers_mergestate(wm, &out);
+		if (err == 1 && !wr->wr_resync) {
+			/* A delta cannot be merged with full state,
+			 * so ask every worker for full state. */
+			memcpy(&req, wr->wr_data, sizeof(req));
+			req.cr_gen = 0;
+			memcpy(wr->wr_data, &req, sizeof(req));
+			wr->wr_resync = true;
+			wr->wr_sent = false;
+			free(out.wb_data);
+			return;
+		}
+		if (err != -1)
+			err = control_queue(fd, out.wb_data, out.wb_len);
+		break;
+	case WR_DUMP:
+		err = workers_mergedump(wm, &out);
+		break;
+	default:
+		err = workers_mergeargs(wm, &out);
+		break;
+	}
+
+	/* Other replies are framed by the workers already. */
+	if (wr->wr_kind != WR_STATE && err == 0 && out.wb_len != 0) {
+		fd->flags &= ~FD_SENDLEN;
+		err = control_queue(fd, out.wb_data, out.wb_len);
+		fd->flags |= FD_SENDLEN;
+	}
+	if (err == -1)
+		logerr(__func__);
+
+done:
+	free(out.wb_data);
+	TAILQ_REMOVE(&wm->wm_requests, wr, wr_next);
+	free(wr);
+	if (err == -1 && fd != NULL)
+		control_free(fd);
+}
+
+/* Reply once every worker asked has answered. */
+static void
+workers_reqcheck(struct dhcpcd_ctx *ctx)
+{
+	struct wk_manager *wm = ctx->wk_manager;
+	struct wk_request *wr;
+	unsigned int i;
+
+	wr = TAILQ_FIRST(&wm->wm_requests);
+	if (wr == NULL || !wr->wr_sent)
+		return;
+	for (i = 0; i < wm->wm_nprocesses; i++) {
+		if (wm->wm_processes[i].wp_busy)
+			return;
+	}
+	workers_reply(ctx, wr);
+	workers_dispatch(ctx);
+}
+
+static void
+workers_dispatch(struct dhcpcd_ctx *ctx)
+{
+	struct wk_manager *wm = ctx->wk_manager;
+	struct wk_request *wr;
+	struct wk_process *wp;
+	struct ctl_req req;
+	unsigned int i, only;
+
+	while ((wr = TAILQ_FIRST(&wm->wm_requests)) != NULL) {
+		if (wr->wr_sent)
+			return;
+		if (wr->wr_fd == NULL) {
+			TAILQ_REMOVE(&wm->wm_requests, wr, wr_next);
+			free(wr);
+			continue;
+		}
+
+		/* State for one interface comes from its worker. */
+		only = wm->wm_nprocesses;
+		if (wr->wr_kind == WR_STATE) {
+			memcpy(&req, wr->wr_data, sizeof(req));
+			req.cr_ifname[sizeof(req.cr_ifname) - 1] = '\0';
+			if (req.cr_type == CTL_REQ_STATE &&
+			    req.cr_ifname[0] != '\0')
+				only = workers_shard(req.cr_ifname,
+				    wm->wm_nprocesses);
+		}
+
+		for (i = 0; i < wm->wm_nprocesses; i++) {
+			wp = &wm->wm_processes[i];
+			wp->wp_reply.wb_len = 0;
+			if (wp->wp_fd == -1 ||
+			    (only != wm->wm_nprocesses && i != only))
+				continue;
+			if (workers_send(wp->wp_fd, WK_CTL, wr->wr_flags,
+			    wr->wr_data, wr->wr_len) == -1)
+			{
+				logerr("%s: worker %u", __func__, i);
+				continue;
+			}
+			wp->wp_busy = true;
+			wr->wr_sent = true;
+		}
+		if (wr->wr_sent)
+			return;
+
+		/* No worker can answer it. */
+		wr->wr_close = true;
+		workers_reply(ctx, wr);
+	}
+}
+
+static void
+workers_closeprocess(struct wk_process *wp)
+{
+	struct dhcpcd_ctx *ctx = wp->wp_ctx;
+	int *fds[] = { &wp->wp_fd, &wp->wp_data_fd, &wp->wp_listen_fd };
+	struct wk_request *wr;
+	size_t i;
+
+	for (i = 0; i < __arraycount(fds); i++) {
+		if (*fds[i] == -1)
+			continue;
+		eloop_event_delete(ctx->eloop, *fds[i]);
+		close(*fds[i]);
+		*fds[i] = -1;
+	}
+	wp->wp_events.wb_len = 0;
+
+	if (wp->wp_busy) {
+		/* The reply is missing a part. */
+		wp->wp_busy = false;
+		wr = TAILQ_FIRST(&ctx->wk_manager->wm_requests);
+		if (wr != NULL)
+			wr->wr_close = true;
+		workers_reqcheck(ctx);
+	}
+}
+
+static void
+workers_checkdaemonised(struct dhcpcd_ctx *ctx)
+{
+	struct wk_manager *wm = ctx->wk_manager;
+	struct wk_process *wp;
+	unsigned int i, nconfigured = 0, nwaiting = 0;
+
+	if (ctx->options & DHCPCD_DAEMONISED)
+		return;
+
+	for (i = 0; i < wm->wm_nprocesses; i++) {
+		wp = &wm->wm_processes[i];
+		if (wp->wp_daemonised) {
+			if (!wp->wp_idle)
+				nconfigured++;
+		} else if (wp->wp_pid != 0)
+			nwaiting++;
+	}
+	/* Without a wait option dhcpcd forks once any interface is
+	 * configured, otherwise every worker must be happy. */
+	if (nwaiting != 0 &&
+	    (ctx->options & DHCPCD_WAITOPTS || nconfigured == 0))
+		return;
+
+	ctx->options |= DHCPCD_NOWAITIP;
+	dhcpcd_daemonise(ctx);
+}
+
+static void
+workers_recvmsg(void *arg, unsigned short events)
+{
+	struct wk_process *wp = arg;
+	struct dhcpcd_ctx *ctx = wp->wp_ctx;
+	struct wk_request *wr;
+	struct wk_msghdr wh;
+	ssize_t len;
+
+	if (!(events & (ELE_READ | ELE_HANGUP)))
+		logerrx("%s: unexpected event 0x%04x", __func__, events);
+
+	len = recv(wp->wp_fd, &wh, sizeof(wh), 0);
+	if (len == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+			return;
+		logerr("%s: worker %u", __func__, wp->wp_index);
+	}
+	if (len == -1 || len == 0) {
+		/* Exiting, it's reaped on SIGCHLD. */
+		workers_closeprocess(wp);
+		return;
+	}
+	if ((size_t)len != sizeof(wh)) {
+		logerrx("%s: worker %u: truncated message",
+		    __func__, wp->wp_index);
+		return;
+	}
+
+	switch (wh.wh_cmd) {
+	case WK_DONE:
+		/* The reply is written first, so take the rest now. */
+		if (workers_bufread(&wp->wp_reply, wp->wp_data_fd) == -1)
+			logerr("%s: worker %u", __func__, wp->wp_index);
+		if (wh.wh_flags & WK_CLOSE &&
+		    (wr = TAILQ_FIRST(&ctx->wk_manager->wm_requests)) != NULL)
+			wr->wr_close = true;
+		wp->wp_busy = false;
+		workers_reqcheck(ctx);
+		break;
+	case WK_DAEMONISED:
+		wp->wp_daemonised = true;
+		wp->wp_idle = wh.wh_flags & WK_IDLE;
+		workers_checkdaemonised(ctx);
+		break;
+	default:
+		logerrx("%s: worker %u: unknown command %d",
+		    __func__, wp->wp_index, wh.wh_cmd);
+		break;
+	}
+}
+
+static void
+workers_recvreply(void *arg, unsigned short events)
+{
+	struct wk_process *wp = arg;
+
+	if (!(events & (ELE_READ | ELE_HANGUP)))
+		logerrx("%s: unexpected event 0x%04x", __func__, events);
+
+	switch (workers_bufread(&wp->wp_reply, wp->wp_data_fd)) {
+	case -1:
+		logerr("%s: worker %u", __func__, wp->wp_index);
+		/* FALLTHROUGH */
+	case 1:
+		workers_closeprocess(wp);
+		break;
+	}
+}
+
+static void
+workers_recvevents(void *arg, unsigned short events)
+{
+	struct wk_process *wp = arg;
+	struct wk_buf *wb = &wp->wp_events;
+	size_t len, off = 0;
+	int err;
+
+	if (!(events & (ELE_READ | ELE_HANGUP)))
+		logerrx("%s: unexpected event 0x%04x", __func__, events);
+
+	err = workers_bufread(wb, wp->wp_listen_fd);
+	if (err == -1)
+		logerr("%s: worker %u", __func__, wp->wp_index);
+
+	/* Pass on each whole event to our listeners. */
+	while (wb->wb_len - off >= sizeof(len)) {
+		memcpy(&len, wb->wb_data + off, sizeof(len));
+		if (wb->wb_len - off - sizeof(len) < len)
+			break;
+		off += sizeof(len);
+		if (len != 0 && control_broadcast(wp->wp_ctx,
+		    wb->wb_data + off, len) == -1)
+			logerr("%s: control_broadcast", __func__);
+		off += len;
+	}
+	if (off != 0) {
+		memmove(wb->wb_data, wb->wb_data + off, wb->wb_len - off);
+		wb->wb_len -= off;
+	}
+
+	if (err != 0)
+		workers_closeprocess(wp);
+}
+
+static void
+workers_reap(struct dhcpcd_ctx *ctx)
+{
+	struct wk_manager *wm = ctx->wk_manager;
+	struct wk_process *wp;
+	unsigned int i;
+	pid_t pid;
+	int status;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (i = 0; i < wm->wm_nprocesses; i++) {
+			if (wm->wm_processes[i].wp_pid == pid)
+				break;
+		}
+		if (i == wm->wm_nprocesses)
+			continue;
+		wp = &wm->wm_processes[i];
+		wp->wp_pid = 0;
+		wm->wm_nrunning--;
+		workers_closeprocess(wp);
+
+		if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS)
+			continue;
+		wm->wm_exit_code = EXIT_FAILURE;
+		if (wm->wm_stopping)
+			continue;
+		if (WIFSIGNALED(status))
+			logerrx("worker %u: killed by signal %d",
+			    wp->wp_index, WTERMSIG(status));
+		else
+			logerrx("worker %u: exited with status %d",
+			    wp->wp_index, WEXITSTATUS(status));
+		/* Interfaces on that worker are now unmanaged. */
+		wm->wm_stopping = true;
+		workers_kill(wm, SIGTERM);
+	}
+
+	if (wm->wm_nrunning == 0)
+		eloop_exit(ctx->eloop, wm->wm_exit_code);
+	else
+		workers_checkdaemonised(ctx);
+}
+
+void
+workers_signal(struct dhcpcd_ctx *ctx, int sig)
+{
+	struct wk_manager *wm = ctx->wk_manager;
+
+	switch (sig) {
+	case SIGCHLD:
+		workers_reap(ctx);
+		return;
+	case SIGINT:
+	case SIGTERM:
+	case SIGALRM:
+		wm->wm_stopping = true;
+		break;
+	case SIGUSR2:
+		if (logopen(ctx->logfile) == -1)
+			logerr("logopen");
+		break;
+	}
+
+	logdebugx("passing signal %d to workers", sig);
+	workers_kill(wm, sig);
+}
+
+/*
+ * Work out how the replies to a request are merged.
+ * Argument vectors are parsed as dhcpcd_handleargs() would,
+ * so this works on a copy.
+ */
+static unsigned int
+workers_reqkind(const char *data, size_t len)
+{
+	char *buf, *p, *e, *argv[255];
+	int argc = 0, opt, oi;
+	unsigned int kind = WR_ARGS;
+
+	if (len >= sizeof(struct ctl_req) &&
+	    memcmp(data, CTL_MAGIC, CTL_MAGIC_LEN) == 0)
+		return WR_STATE;
+
+	buf = malloc(len + 1);
+	if (buf == NULL)
+		return kind;
+	memcpy(buf, data, len);
+	buf[len] = '\0';
+	for (p = buf, e = buf + len;
+	    p < e && argc < (int)__arraycount(argv) - 1;
+	    p += strlen(p) + 1)
+	{
+		if (*p == '\0')
+			continue;
+		argv[argc++] = p;
+		oi = (int)strlen(p);
+		if (p[oi - 1] == '\n') {
+			p[oi - 1] = '\0';
+			break;
+		}
+	}
+	argv[argc] = NULL;
+
+	if (argc != 0 && strcmp(argv[0], "--getinterfaces") == 0)
+		kind = WR_DUMP;
+	else if (argc != 0) {
+		optind = 0;
+		opterr = 0;
+		while ((opt = getopt_long(argc, argv,
+		    IF_OPTS, cf_options, &oi)) != -1)
+		{
+			if (opt == 'U')
+				kind = WR_DUMP;
+		}
+		opterr = 1;
+	}
+	free(buf);
+	return kind;
+}
+
+static int
+workers_enqueue(struct fd_list *fd, const char *data, size_t len)
+{
+	struct wk_manager *wm = fd->ctx->wk_manager;
+	struct wk_request *wr;
+
+	wr = malloc(sizeof(*wr) + len);
+	if (wr == NULL)
+		return -1;
+	wr->wr_fd = fd;
+	wr->wr_kind = workers_reqkind(data, len);
+	wr->wr_flags = fd->flags & FD_UNPRIV ? WK_UNPRIV : 0;
+	wr->wr_sent = wr->wr_close = wr->wr_resync = false;
+	wr->wr_len = len;
+	memcpy(wr->wr_data, data, len);
+	TAILQ_INSERT_TAIL(&wm->wm_requests, wr, wr_next);
+	return 0;
+}
+
+int
+workers_ctlrequest(struct fd_list *fd, char *data, size_t len)
+{
+
+	/* Make any change here in dhcpcd.c as well. */
+	if (strncmp(data, "--version",
+	    MIN(strlen("--version"), len)) == 0) {
+		return control_queue(fd, UNCONST(VERSION),
+		    strlen(VERSION) + 1);
+	} else if (strncmp(data, "--getconfigfile",
+	    MIN(strlen("--getconfigfile"), len)) == 0) {
+		return control_queue(fd, UNCONST(fd->ctx->cffile),
+		    strlen(fd->ctx->cffile) + 1);
+	} else if (strncmp(data, "--listen",
+	    MIN(strlen("--listen"), len)) == 0) {
+		fd->flags |= FD_LISTEN;
+		return 0;
+	}
+
+	/* Pipelined state requests may be for different workers. */
+	while (len >= sizeof(struct ctl_req) &&
+	    memcmp(data, CTL_MAGIC, CTL_MAGIC_LEN) == 0)
+	{
+		if (workers_enqueue(fd, data, sizeof(struct ctl_req)) == -1)
+			return -1;
+		data += sizeof(struct ctl_req);
+		len -= sizeof(struct ctl_req);
+	}
+	if (len != 0 && workers_enqueue(fd, data, len) == -1)
+		return -1;
+
+	workers_dispatch(fd->ctx);
+	return 0;
+}
+
+/* Seed what the workers would otherwise race each other to write. */
+static void
+workers_seed(struct dhcpcd_ctx *ctx)
+{
+	struct ifaddrs *ifaddrs;
+	struct if_head *ifs;
+	struct interface *ifp;
+
+#ifdef INET6
+	if (ctx->options & DHCPCD_IPV6 && ctx->secret_len == 0 &&
+	    ipv6_readsecret(ctx) == -1)
+		logerr("%s: ipv6_readsecret", __func__);
+#endif
+
+	if (!(ctx->options & (DHCPCD_DUID | DHCPCD_IPV6)) ||
+	    ctx->options & DHCPCD_ANONYMOUS ||
+	    duid_init(ctx, NULL) != 0)
+		return;
+
+	/* No machine UUID, so use the first interface as dhcpcd would. */
+	if (if_opensockets(ctx) == -1) {
+		logerr("%s: if_opensockets", __func__);
+		goto out;
+	}
+	ifs = if_discover(ctx, &ifaddrs, ctx->ifc, ctx->ifv);
+	if (ifs == NULL) {
+		logerr("%s: if_discover", __func__);
+		goto out;
+	}
+	TAILQ_FOREACH(ifp, ifs, next) {
+		if (ifp->active && ifp->hwlen != 0)
+			break;
+	}
+	if (ifp != NULL)
+		duid_init(ctx, ifp);
+	while ((ifp = TAILQ_FIRST(ifs)) != NULL) {
+		TAILQ_REMOVE(ifs, ifp, next);
+		if_free(ifp);
+	}
+	free(ifs);
+	freeifaddrs(ifaddrs);
+
+out:
+	/* Each worker opens its own. */
+	if (ctx->link_fd != -1) {
+		close(ctx->link_fd);
+		ctx->link_fd = -1;
+	}
+	if_closesockets(ctx);
+	ctx->pf_inet_fd = -1;
+#ifdef PF_LINK
+	ctx->pf_link_fd = -1;
+#endif
+	ctx->priv = NULL;
+}
+
+static void
+workers_freemanager(struct wk_manager *wm)
+{
+	struct wk_request *wr;
+	unsigned int i;
+
+	while ((wr = TAILQ_FIRST(&wm->wm_requests)) != NULL) {
+		TAILQ_REMOVE(&wm->wm_requests, wr, wr_next);
+		free(wr);
+	}
+	for (i = 0; i < wm->wm_nprocesses; i++) {
+		free(wm->wm_processes[i].wp_reply.wb_data);
+		free(wm->wm_processes[i].wp_events.wb_data);
+	}
+	free(wm->wm_processes);
+	free(wm);
+}
+
+/*
+ * Worker side.
+ */
+
+static void
+workers_senddone(struct dhcpcd_ctx *ctx, uint16_t flags)
+{
+
+	if (workers_send(ctx->wk_worker->ww_fd, WK_DONE, flags,
+	    NULL, 0) == -1)
+		logerr(__func__);
+}
+
+void
+workers_ctldone(struct fd_list *fd)
+{
+	struct dhcpcd_ctx *ctx = fd->ctx;
+
+	ctx->wk_client = NULL;
+	control_free(fd);
+	workers_senddone(ctx, 0);
+}
+
+void
+workers_ctlfree(struct fd_list *fd)
+{
+	struct dhcpcd_ctx *ctx = fd->ctx;
+	struct wk_request *wr, *wrn;
+
+	if (ctx->wk_client == fd) {
+		/* Freed before the reply was sent. */
+		ctx->wk_client = NULL;
+		workers_senddone(ctx, WK_CLOSE);
+		return;
+	}
+
+	if (ctx->wk_manager == NULL)
+		return;
+	TAILQ_FOREACH_SAFE(wr, &ctx->wk_manager->wm_requests, wr_next, wrn) {
+		if (wr->wr_fd != fd)
+			continue;
+		if (wr->wr_sent)
+			wr->wr_fd = NULL;
+		else {
+			TAILQ_REMOVE(&ctx->wk_manager->wm_requests,
+			    wr, wr_next);
+			free(wr);
+		}
+	}
+}
+
+void
+workers_daemonised(struct dhcpcd_ctx *ctx)
+{
+	struct interface *ifp;
+	uint16_t flags = WK_IDLE;
+
+	if (ctx->ifaces != NULL) {
+		TAILQ_FOREACH(ifp, ctx->ifaces, next) {
+			if (ifp->active) {
+				flags = 0;
+				break;
+			}
+		}
+	}
+	if (workers_send(ctx->wk_worker->ww_fd, WK_DAEMONISED, flags,
+	    NULL, 0) == -1)
+		logerr(__func__);
+	ctx->options |= DHCPCD_DAEMONISED;
+	/* stderr goes away once the manager forks. */
+	logsetopts(loggetopts() & ~LOGERR_ERR);
+}
+
+static void
+workers_recvctl(void *arg, unsigned short events)
+{
+	struct dhcpcd_ctx *ctx = arg;
+	struct wk_worker *ww = ctx->wk_worker;
+	struct wk_msghdr wh;
+	char buf[1024];
+	struct iovec iov[] = {
+		{ .iov_base = &wh, .iov_len = sizeof(wh) },
+		{ .iov_base = buf, .iov_len = sizeof(buf) },
+	};
+	struct msghdr msg = {
+	    .msg_iov = iov, .msg_iovlen = __arraycount(iov),
+	};
+	struct fd_list *fd;
+	ssize_t len;
+	int dfd;
+
+	if (!(events & (ELE_READ | ELE_HANGUP)))
+		logerrx("%s: unexpected event 0x%04x", __func__, events);
+
+	len = recvmsg(ww->ww_fd, &msg, 0);
+	if (len == -1) {
+		if (errno != EAGAIN && errno != EINTR)
+			logerr(__func__);
+		return;
+	}
+	if (len == 0) {
+		/* No one can control us now. */
+		logerrx("%s: manager has gone", __func__);
+		eloop_exit(ctx->eloop, EXIT_FAILURE);
+		return;
+	}
+	if ((size_t)len < sizeof(wh) || msg.msg_flags & MSG_TRUNC) {
+		logerrx("%s: truncated message", __func__);
+		return;
+	}
+	if (wh.wh_cmd != WK_CTL) {
+		logerrx("%s: unknown command %d", __func__, wh.wh_cmd);
+		return;
+	}
+
+	/* The manager sends one request at a time. */
+	if (ctx->wk_client != NULL)
+		control_free(ctx->wk_client);
+
+	/* control_free() closes the fd, so hand it a copy. */
+	dfd = fcntl(ww->ww_data_fd, F_DUPFD_CLOEXEC, 0);
+	if (dfd == -1) {
+		logerr("%s: fcntl", __func__);
+		workers_senddone(ctx, WK_CLOSE);
+		return;
+	}
+	fd = control_new(ctx, dfd,
+	    FD_SENDLEN | (wh.wh_flags & WK_UNPRIV ? FD_UNPRIV : 0));
+	if (fd == NULL) {
+		logerr("%s: control_new", __func__);
+		close(dfd);
+		workers_senddone(ctx, WK_CLOSE);
+		return;
+	}
+
+	ctx->wk_client = fd;
+	control_recvdata(fd, buf, (size_t)len - sizeof(wh));
+	if (ctx->wk_client == fd && TAILQ_FIRST(&fd->queue) == NULL)
+		workers_ctldone(fd);
+}
+
+static pid_t
+workers_fork(struct dhcpcd_ctx *ctx, struct wk_process *wp)
+{
+	struct wk_worker *ww;
+	int fd[2], data_fd[2], listen_fd[2];
+	pid_t pid;
+
+	ww = calloc(1, sizeof(*ww));
+	if (ww == NULL)
+		return -1;
+	if (xsocketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CXNB, 0, fd) == -1)
+		goto err_ww;
+	if (xsocketpair(AF_UNIX, SOCK_STREAM | SOCK_CXNB, 0, data_fd) == -1)
+		goto err_fd;
+	if (xsocketpair(AF_UNIX, SOCK_STREAM | SOCK_CXNB, 0,
+	    listen_fd) == -1)
+		goto err_data_fd;
+
+	switch (pid = fork()) {
+	case -1:
+		logerr("fork");
+		goto err_listen_fd;
+	case 0:
+		break;
+	default:
+		free(ww);
+		close(fd[1]);
+		close(data_fd[1]);
+		close(listen_fd[1]);
+		wp->wp_pid = pid;
+		wp->wp_fd = fd[0];
+		wp->wp_data_fd = data_fd[0];
+		wp->wp_listen_fd = listen_fd[0];
+		ctx->wk_manager->wm_nrunning++;
+		if (eloop_event_add(ctx->eloop, wp->wp_fd, ELE_READ,
+		    workers_recvmsg, wp) == -1 ||
+		    eloop_event_add(ctx->eloop, wp->wp_data_fd, ELE_READ,
+		    workers_recvreply, wp) == -1 ||
+		    eloop_event_add(ctx->eloop, wp->wp_listen_fd, ELE_READ,
+		    workers_recvevents, wp) == -1)
+		{
+			logerr("%s: eloop_event_add", __func__);
+			return -1;
+		}
+		return pid;
+	}
+
+	/* Take nothing of the manager with us. */
+	close(fd[0]);
+	close(data_fd[0]);
+	close(listen_fd[0]);
+	ww->ww_index = wp->wp_index;
+	ww->ww_nworkers = ctx->workers;
+	ww->ww_fd = fd[1];
+	ww->ww_data_fd = data_fd[1];
+	ctx->wk_worker = ww;
+
+	eloop_clear(ctx->eloop, -1);
+	ctx->control_fd = ctx->control_unpriv_fd = -1;
+	ctx->fork_fd = -1;
+	workers_freemanager(ctx->wk_manager);
+	ctx->wk_manager = NULL;
+	if (eloop_forked(ctx->eloop) == -1) {
+		logerr("%s: eloop_forked", __func__);
+		return -1;
+	}
+	pidfile_clean();
+
+	/* Signals are for the manager to pass on. */
+	if (setpgid(0, 0) == -1)
+		logerr("%s: setpgid", __func__);
+	setproctitle("[worker %u]", ww->ww_index);
+
+	if (eloop_event_add(ctx->eloop, ww->ww_fd, ELE_READ,
+	    workers_recvctl, ctx) == -1)
+	{
+		logerr("%s: eloop_event_add", __func__);
+		return -1;
+	}
+	if (control_new(ctx, listen_fd[1], FD_SENDLEN | FD_LISTEN) == NULL) {
+		logerr("%s: control_new", __func__);
+		return -1;
+	}
+	logdebugx("worker %u started", ww->ww_index);
+	return 0;
+
+err_listen_fd:
+	close(listen_fd[0]);
+	close(listen_fd[1]);
+err_data_fd:
+	close(data_fd[0]);
+	close(data_fd[1]);
+err_fd:
+	close(fd[0]);
+	close(fd[1]);
+err_ww:
+	free(ww);
+	return -1;
+}
+
+int
+workers_start(struct dhcpcd_ctx *ctx)
+{
+	struct wk_manager *wm;
+	struct wk_process *wp;
+	unsigned int i;
+
+	if (ctx->workers < 2 ||
+	    !(ctx->options & DHCPCD_MANAGER) ||
+	    ctx->options & DHCPCD_TEST)
+		return 0;
+
+	/* Rather than run workers which would get things wrong,
+	 * say why and look after every interface in this process. */
+	if (IN_PRIVSEP(ctx)) {
+		logwarnx("workers are not supported with privilege separation");
+		return 0;
+	}
+	if (ctx->lease_log) {
+		/* Each worker would compact away the leases of the others. */
+		logwarnx("workers are not supported with lease_log");
+		return 0;
+	}
+#ifndef HAVE_ROUTE_METRIC
+	/* There is no single route owner, so a route to the same
+	 * destination from two workers would replace the other. */
+	logwarnx("workers are not supported without route metrics");
+	return 0;
+#endif
+
+	workers_seed(ctx);
+
+	wm = calloc(1, sizeof(*wm));
+	if (wm == NULL)
+		return -1;
+	wm->wm_processes = calloc(ctx->workers, sizeof(*wm->wm_processes));
+	if (wm->wm_processes == NULL) {
+		free(wm);
+		return -1;
+	}
+	wm->wm_nprocesses = ctx->workers;
+	wm->wm_exit_code = EXIT_SUCCESS;
+	TAILQ_INIT(&wm->wm_requests);
+	for (i = 0; i < wm->wm_nprocesses; i++) {
+		wp = &wm->wm_processes[i];
+		wp->wp_ctx = ctx;
+		wp->wp_index = i;
+		wp->wp_fd = wp->wp_data_fd = wp->wp_listen_fd = -1;
+	}
+	ctx->wk_manager = wm;
+
+	for (i = 0; i < wm->wm_nprocesses; i++) {
+		switch (workers_fork(ctx, &wm->wm_processes[i])) {
+		case -1:
+			/* A worker which failed to start just exits. */
+			if (!IN_WORKER(ctx))
+				workers_free(ctx);
+			return -1;
+		case 0:
+			return 0;
+		}
+	}
+
+	loginfox("sharing interfaces over %u workers", wm->wm_nprocesses);
+	return (int)wm->wm_nprocesses;
+}
+
+void
+workers_free(struct dhcpcd_ctx *ctx)
+{
+	struct wk_manager *wm = ctx->wk_manager;
+	struct wk_worker *ww = ctx->wk_worker;
+	struct wk_process *wp;
+	unsigned int i;
+
+	if (ww != NULL) {
+		ctx->wk_client = NULL;
+		close(ww->ww_fd);
+		close(ww->ww_data_fd);
+		free(ww);
+		ctx->wk_worker = NULL;
+	}
+
+	if (wm == NULL)
+		return;
+	workers_kill(wm, SIGTERM);
+	for (i = 0; i < wm->wm_nprocesses; i++) {
+		wp = &wm->wm_processes[i];
+		if (wp->wp_fd != -1)
+			close(wp->wp_fd);
+		if (wp->wp_data_fd != -1)
+			close(wp->wp_data_fd);
+		if (wp->wp_listen_fd != -1)
+			close(wp->wp_listen_fd);
+	}
+	workers_freemanager(wm);
+	ctx->wk_manager = NULL;
+}
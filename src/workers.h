@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * dhcpcd - DHCP client daemon
+ * Copyright (c) 2006-2021 Roy Marples <roy@marples.name>
+ * All rights reserved
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stdbool.h>
+
+/*
+ * Experimental, only built with configure --enable-workers.
+ * Interfaces can be shared over a number of worker processes, each
+ * running its own eloop, kernel and packet sockets, scripts and leases
+ * for the interfaces whose name hashes to it.
+ * The manager process keeps the pidfile, the control sockets and the
+ * launcher and seeds the DUID and secret before forking the workers.
+ *
+ * Control requests are passed to the worker owning the interface
+ * named, otherwise to every worker, one request at a time.
+ * The replies are merged by the manager, so clients cannot tell
+ * they are talking to more than one process.
+ * Signals sent to the manager are passed on to every worker.
+ *
+ * There is no single route owner. Each worker adds and removes the
+ * routes of its own interfaces, which only works where routes are
+ * kept apart by the interface metric.
+ * Every worker still reads all routing socket messages and Router
+ * Advertisements and drops those for interfaces it does not own.
+ * Workers are not started with privilege separation or lease_log.
+ */
+
+/* Upper bound so a typo cannot fork the machine to death. */
+#define	WORKERS_MAX		64
+
+#ifdef WORKERS
+#define	IN_WORKER(ctx)		((ctx)->wk_worker != NULL)
+#define	IN_WORKERS_MANAGER(ctx)	((ctx)->wk_manager != NULL)
+#else
+#define	IN_WORKER(ctx)		false
+#define	IN_WORKERS_MANAGER(ctx)	false
+#endif
+
+struct dhcpcd_ctx;
+struct fd_list;
+
+int workers_start(struct dhcpcd_ctx *);
+void workers_free(struct dhcpcd_ctx *);
+bool workers_ownsif(const struct dhcpcd_ctx *, const char *);
+void workers_signal(struct dhcpcd_ctx *, int);
+void workers_daemonised(struct dhcpcd_ctx *);
+int workers_ctlrequest(struct fd_list *, char *, size_t);
+void workers_ctldone(struct fd_list *);
+void workers_ctlfree(struct fd_list *);
+#endif
@@ -28,6 +28,7 @@
 #include <sys/resource.h>
 
 #include <err.h>
+#include <stdbool.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -52,11 +53,38 @@ struct pipe {
 	int fd[2];
 };
 
+struct timer {
+	bool pending;
+};
+
 static size_t good, bad, writes, fired;
-static size_t npipes = 100, nwrites = 100, nactive = 1;
+static size_t npipes = 100, nwrites = 100, nactive = 1, nmods;
 static struct pipe *pipes;
+static size_t ntimers, nrearms = 10000, rearms, pending;
+static struct timer *timers;
+static size_t nwakers, nspread = 1000, nslack;
 static struct eloop *e;
 
+static void timer_cb(void *);
+static void read_cb(void *, unsigned short);
+
+static void
+modify(struct pipe *p)
+{
+	struct pipe *q;
+	size_t i;
+
+	for (i = 0; i < nmods; i++) {
+		if (eloop_event_add(e, p->fd[0], ELE_READ, read_cb, p) == -1)
+			err(EXIT_FAILURE, "eloop_event_add");
+	}
+	q = &pipes[(size_t)random() % npipes];
+	if (eloop_event_delete(e, q->fd[0]) == -1)
+		err(EXIT_FAILURE, "eloop_event_delete");
+	if (eloop_event_add(e, q->fd[0], ELE_READ, read_cb, q) == -1)
+		err(EXIT_FAILURE, "eloop_event_add");
+}
+
 static void
 read_cb(void *arg, unsigned short events)
 {
@@ -72,6 +100,11 @@ read_cb(void *arg, unsigned short events)
 	} else
 		good++;
 
+	/* Simulate the churn from control sockets toggling ELE_WRITE
+	 * and ARP and BPF sockets coming and going. */
+	if (nmods != 0)
+		modify(p);
+
 	if (writes != 0) {
 		writes--;
 		if (write(p->fd[1], "e", 1) != 1) {
@@ -88,6 +121,112 @@ read_cb(void *arg, unsigned short events)
 	}
 }
 
+static void
+timer_add(struct timer *t)
+{
+	struct timespec ts = {
+	    .tv_sec = 0,
+	    .tv_nsec = (long)(random() % NSEC_PER_MSEC),
+	};
+
+	if (!t->pending) {
+		t->pending = true;
+		pending++;
+	}
+	if (eloop_timeout_add_tv(e, &ts, timer_cb, t) == -1)
+		err(EXIT_FAILURE, "eloop_timeout_add_tv");
+}
+
+static void
+timer_cb(void *arg)
+{
+	struct timer *t = arg;
+
+	t->pending = false;
+	pending--;
+	fired++;
+
+	if (rearms != 0) {
+		rearms--;
+		/* Re-arm ourself and replace another timer.
+		 * This simulates the churn from many interfaces
+		 * each restarting their DHCP, RS, ARP, etc timers. */
+		timer_add(t);
+		timer_add(&timers[(size_t)random() % ntimers]);
+	}
+
+	if (pending == 0)
+		eloop_exit(e, EXIT_SUCCESS);
+}
+
+static int
+runtimers(struct timespec *t)
+{
+	size_t i;
+	struct timespec ts, te;
+	int result;
+
+	rearms = nrearms;
+	fired = 0;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	for (i = 0; i < ntimers; i++)
+		timer_add(&timers[i]);
+	eloop_enter(e);
+	result = eloop_start(e, NULL);
+	if (clock_gettime(CLOCK_MONOTONIC, &te) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+
+	timespecsub(&te, &ts, t);
+	return result;
+}
+
+#ifdef ELOOP_STATS
+static void
+wake_cb(void *arg)
+{
+	struct timer *t = arg;
+
+	t->pending = false;
+	fired++;
+	if (--pending == 0)
+		eloop_exit(e, EXIT_SUCCESS);
+}
+
+static int
+runwakeups(struct timespec *t, unsigned long long *wakeups)
+{
+	size_t i;
+	struct timespec ts, te;
+	struct eloop_stats st;
+	int result;
+
+	fired = 0;
+	pending = nwakers;
+	eloop_stats_reset(e);
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	for (i = 0; i < nwakers; i++) {
+		timers[i].pending = true;
+		if (eloop_timeout_add_msec_slack(e,
+		    (unsigned long)random() % nspread, (unsigned int)nslack,
+		    wake_cb, &timers[i]) == -1)
+			err(EXIT_FAILURE, "eloop_timeout_add_msec_slack");
+	}
+	eloop_enter(e);
+	result = eloop_start(e, NULL);
+	if (clock_gettime(CLOCK_MONOTONIC, &te) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+
+	eloop_stats(e, &st, NULL, NULL);
+	*wakeups = st.wakeups;
+	timespecsub(&te, &ts, t);
+	return result;
+}
+#endif
+
 static int
 runone(struct timespec *t)
 {
@@ -108,6 +247,7 @@ runone(struct timespec *t)
 
 	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
 		err(EXIT_FAILURE, "clock_gettime");
+	eloop_enter(e);
 	result = eloop_start(e, NULL);
 	if (clock_gettime(CLOCK_MONOTONIC, &te) == -1)
 		err(EXIT_FAILURE, "clock_gettime");
@@ -124,20 +264,38 @@ main(int argc, char **argv)
 	struct pipe *p;
 	struct timespec ts, te, t;
 
-	while ((c = getopt(argc, argv, "a:n:r:w:")) != -1) {
+	while ((c = getopt(argc, argv, "a:d:m:n:r:s:t:T:w:W:")) != -1) {
 		switch (c) {
 		case 'a':
 			nactive = (size_t)atoi(optarg);
 			break;
+		case 'd':
+			nspread = (size_t)atoi(optarg);
+			break;
+		case 'm':
+			nmods = (size_t)atoi(optarg);
+			break;
 		case 'n':
 			npipes = (size_t)atoi(optarg);
 			break;
 		case 'r':
 			nruns = (size_t)atoi(optarg);
 			break;
+		case 's':
+			nslack = (size_t)atoi(optarg);
+			break;
+		case 't':
+			ntimers = (size_t)atoi(optarg);
+			break;
+		case 'T':
+			nrearms = (size_t)atoi(optarg);
+			break;
 		case 'w':
 			nwrites = (size_t)atoi(optarg);
 			break;
+		case 'W':
+			nwakers = (size_t)atoi(optarg);
+			break;
 		default:
 			errx(EXIT_FAILURE, "illegal argument `%c'", c);
 		}
@@ -163,12 +321,49 @@ main(int argc, char **argv)
 			err(EXIT_FAILURE, "eloop_event_add");
 	}
 
-	printf("active = %zu, pipes = %zu, runs = %zu, writes = %zu\n",
-	    nactive, npipes, nruns, nwrites);
+	if (nwakers != 0) {
+#ifndef ELOOP_STATS
+		errx(EXIT_FAILURE, "counting wakeups needs ELOOP_STATS");
+#endif
+		if (nspread == 0)
+			nspread = 1;
+		timers = calloc(nwakers, sizeof(*timers));
+		if (timers == NULL)
+			err(EXIT_FAILURE, "malloc");
+		printf("timers = %zu, spread = %zums, slack = %zums, "
+		    "runs = %zu\n",
+		    nwakers, nspread, nslack, nruns);
+	} else if (ntimers != 0) {
+		timers = calloc(ntimers, sizeof(*timers));
+		if (timers == NULL)
+			err(EXIT_FAILURE, "malloc");
+		printf("timers = %zu, rearms = %zu, runs = %zu\n",
+		    ntimers, nrearms, nruns);
+	} else
+		printf("active = %zu, pipes = %zu, runs = %zu, writes = %zu, "
+		    "modifies = %zu\n",
+		    nactive, npipes, nruns, nwrites, nmods);
 
 	exit_code = EXIT_SUCCESS;
 	for (i = 0; i < nruns; i++) {
-		result = runone(&t);
+#ifdef ELOOP_STATS
+		if (nwakers != 0) {
+			unsigned long long wakeups;
+
+			result = runwakeups(&t, &wakeups);
+			if (result != EXIT_SUCCESS)
+				exit_code = result;
+			printf("run %zu took %lld.%.9ld seconds, "
+			    "%llu wakeups, result %d\n",
+			    i + 1, (long long)t.tv_sec, t.tv_nsec,
+			    wakeups, result);
+			continue;
+		}
+#endif
+		if (ntimers != 0)
+			result = runtimers(&t);
+		else
+			result = runone(&t);
 		if (result != EXIT_SUCCESS)
 			exit_code = result;
 		printf("run %zu took %lld.%.9ld seconds, result %d\n",
@@ -177,6 +372,7 @@ main(int argc, char **argv)
 
 	eloop_free(e);
 	free(pipes);
+	free(timers);
 
 	if (clock_gettime(CLOCK_MONOTONIC, &te) == -1)
 		err(EXIT_FAILURE, "clock_gettime");